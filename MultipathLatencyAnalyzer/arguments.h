@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace multipath {
+
+// The options parsed from the command line, all of them take a value: -name:value
+// - an option is matched by its exact name, so an option can be a prefix of another (-echo and -echobatch)
+inline constexpr std::array<std::wstring_view, 33> c_argumentNames{
+    L"-listen", L"-target", L"-protocol", L"-port", L"-bitrate", L"-grouping", L"-batchsend", L"-timestamping",
+    L"-verifypayload", L"-echo", L"-mode", L"-pacing", L"-catchup", L"-catchuplimit", L"-scheduler",
+    L"-duplicatethreshold", L"-duplicateholdoff", L"-iopool", L"-duration", L"-losstimeout", L"-report",
+    L"-histogramdigits", L"-clock", L"-prepostrecvs", L"-threads", L"-echobatch", L"-downlink", L"-secondary",
+    L"-paths", L"-combine", L"-output", L"-format", L"-loglevel"};
+
+// Returns whether the argument is the option `name`, with or without a value
+inline bool IsArgument(const std::wstring_view arg, const std::wstring_view name) noexcept
+{
+    return arg.starts_with(name) && (arg.size() == name.size() || arg[name.size()] == L':');
+}
+
+inline std::wstring_view ParseArgumentValue(const std::wstring_view str)
+{
+    const auto delim = str.find(L':');
+    if (delim == std::wstring_view::npos)
+    {
+        return {};
+    }
+
+    return str.substr(delim + 1);
+}
+
+// Removes the option `name` from the arguments and returns its value, if it is present
+inline std::optional<std::wstring_view> ParseArgument(const std::wstring_view name, std::vector<const wchar_t*>& args)
+{
+    auto foundParameter = std::ranges::find_if(args, [&](const std::wstring_view arg) { return IsArgument(arg, name); });
+    if (foundParameter != args.end())
+    {
+        auto value = ParseArgumentValue(*foundParameter);
+        if (value.empty())
+        {
+            throw std::invalid_argument("Found parameter without value");
+        }
+
+        args.erase(foundParameter);
+        return value;
+    }
+    return {};
+}
+
+} // namespace multipath
@@ -0,0 +1,37 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+# Sweeps the echo batch size of the server (-echobatch) over loopback, at a bitrate high enough to queue datagrams
+# on the server. For each batch size, prints the datagrams received by the client and the latency percentiles
+# (p50 / p90 / p99 / p99.9 / p99.99), which include the echo delay of the server.
+
+param(
+    [string]$Binary = ".\MultipathLatencyAnalyzer.exe",
+    [string]$Bitrate = "1000",
+    [int]$Grouping = 64,
+    [int]$Duration = 30,
+    [int]$Threads = 1,
+    [int[]]$BatchSizes = @(1, 4, 16, 64, 256),
+    [int]$Port = 8888
+)
+
+foreach ($batchSize in $BatchSizes)
+{
+    $server = Start-Process -FilePath $Binary -PassThru -NoNewWindow -ArgumentList "-listen:127.0.0.1", "-port:$Port", `
+        "-prepostrecvs:256", "-threads:$Threads", "-echobatch:$batchSize"
+    try
+    {
+        # Give the server some time to start listening
+        Start-Sleep -Seconds 2
+
+        Write-Output "--- -echobatch:$batchSize ---"
+        $output = & $Binary -target:127.0.0.1 -port:$Port -bitrate:$Bitrate -grouping:$Grouping -duration:$Duration `
+            -secondary:0 -prepostrecvs:256 -batchsend:1
+        $output | Select-String -Pattern "Received datagrams on primary", "Latency percentiles .* on primary"
+        Write-Output ""
+    }
+    finally
+    {
+        Stop-Process -Id $server.Id
+    }
+}
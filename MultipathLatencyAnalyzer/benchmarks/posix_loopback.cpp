@@ -0,0 +1,314 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Measures the round trip of datagrams echoed over the loopback interface with the portable I/O backend
+// - the echo server of the tool (StreamServer) and a client run in the same process, each with its own socket and
+//   completion thread
+// - the datagrams carry the same header as the ones of MultipathLatencyAnalyzer
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "crc32c.h"
+#include "datagram_header.h"
+#include "latency_histogram.h"
+#include "posix_io.h"
+#include "posix_socket_utils.h"
+#include "stream_server.h"
+
+using namespace multipath;
+
+namespace {
+constexpr size_t c_bufferSize = 1024; // same as MeasuredSocket::c_bufferSize
+constexpr int c_defaultSocketReceiveBufferSize = 1048576; // 1MB
+
+long long SnapNanoSec() noexcept
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Sends the datagrams at a fixed rate and measures their round trip
+class LoopbackClient
+{
+public:
+    // With verifyPayload, the datagrams carry the CRC of their payload, verified by the server and once echoed
+    LoopbackClient(ctl::ctPosixIoBackend backend, size_t receiveCount, const sockaddr_in& serverAddress, bool verifyPayload) :
+        m_socket(CreateDatagramSocket()), m_receiveContexts(receiveCount), m_sendSlots(c_sendSlotCount), m_verifyPayload(verifyPayload)
+    {
+        SetSocketReceiveBufferSize(m_socket.get(), c_defaultSocketReceiveBufferSize);
+        if (connect(m_socket.get(), reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)) != 0)
+        {
+            ThrowLastError("connect failed");
+        }
+        m_io = std::make_unique<ctl::ctPosixIo>(m_socket.get(), c_sendSlotCount + receiveCount, backend);
+    }
+
+    // Sends count datagrams at the given rate, then waits a second for the last echoes
+    void Run(long long count, long long rate)
+    {
+        for (auto& receiveContext : m_receiveContexts)
+        {
+            InitiateReceive(receiveContext);
+        }
+
+        const auto start = SnapNanoSec();
+        for (long long sequenceNumber = 0; sequenceNumber < count; ++sequenceNumber)
+        {
+            const auto sendTime = start + sequenceNumber * 1'000'000'000 / rate;
+            if (const auto now = SnapNanoSec(); now < sendTime)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(sendTime - now));
+            }
+            SendDatagram(sequenceNumber);
+        }
+        m_sendDuration = SnapNanoSec() - start;
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        m_statistics = m_io->statistics();
+        m_io->stop();
+    }
+
+    // The automatic backend is resolved by the kernel support
+    [[nodiscard]] ctl::ctPosixIoBackend Backend() const noexcept
+    {
+        return m_io->backend();
+    }
+
+    void PrintStatistics(long long count) const
+    {
+        const auto received = m_roundTrips.Count();
+        std::cout << "Sent " << count << " datagrams in " << m_sendDuration / 1'000'000 << " ms ("
+                  << (m_sendDuration > 0 ? count * 1'000'000'000 / m_sendDuration : 0) << " datagrams per second), "
+                  << m_sendErrors << " send errors\n";
+        std::cout << "Received: " << received << " ("
+                  << (count > 0 ? 100. * static_cast<double>(count - received) / static_cast<double>(count) : 0.)
+                  << "% lost)\n";
+        std::cout << "Round trip in microseconds (min / p50 / p99 / p99.9 / max): " << m_roundTrips.Min() / 1'000. << " / "
+                  << m_roundTrips.ValueAtPercentile(50.) / 1'000. << " / " << m_roundTrips.ValueAtPercentile(99.) / 1'000.
+                  << " / " << m_roundTrips.ValueAtPercentile(99.9) / 1'000. << " / " << m_roundTrips.Max() / 1'000. << '\n';
+        if (m_verifyPayload)
+        {
+            std::cout << "Corrupt payloads received by the client: " << m_corruptPayloads << " (CRC32C "
+                      << (IsCrc32cAccelerated() ? "hardware" : "table") << ")\n";
+        }
+        std::cout << "Client requests: peak in use " << m_statistics.peak_in_use << " of " << m_statistics.capacity
+                  << ", allocated on the heap " << m_statistics.exhausted_count << '\n';
+    }
+
+private:
+    // A send buffer is reused once its send completes, sent datagrams are echoed long before the slots wrap around
+    static constexpr size_t c_sendSlotCount = 1024;
+
+    struct SendSlot
+    {
+        std::array<char, c_bufferSize> m_buffer{};
+        iovec m_iov{};
+        std::atomic<bool> m_inFlight{false};
+    };
+
+    struct ReceiveContext
+    {
+        std::array<char, c_bufferSize> m_buffer{};
+        iovec m_iov{};
+    };
+
+    void SendDatagram(long long sequenceNumber)
+    {
+        auto& slot = m_sendSlots[static_cast<size_t>(sequenceNumber) % c_sendSlotCount];
+        while (slot.m_inFlight.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        slot.m_inFlight.store(true, std::memory_order_relaxed);
+
+        DatagramHeader header;
+        header.m_payloadLength = static_cast<uint32_t>(slot.m_buffer.size() - c_datagramHeaderLength);
+        header.m_sequenceNumber = sequenceNumber;
+        header.m_echoTimestamp = -1;
+        if (m_verifyPayload)
+        {
+            header.m_flags |= c_datagramPayloadCrcFlag;
+            header.m_payloadCrc = ComputeCrc32c(slot.m_buffer.data() + c_datagramHeaderLength, header.m_payloadLength);
+        }
+        WriteDatagramHeader(slot.m_buffer.data(), header);
+
+        auto* request = m_io->new_request([this, &slot](ctl::ctPosixIoRequest* completed) noexcept {
+            m_sendErrors += completed->result < 0 ? 1 : 0;
+            slot.m_inFlight.store(false, std::memory_order_release);
+        });
+        slot.m_iov = {slot.m_buffer.data(), slot.m_buffer.size()};
+        request->message.msg_iov = &slot.m_iov;
+        request->message.msg_iovlen = 1;
+        // refresh the timestamp at the last possible moment
+        StampDatagramSend(slot.m_buffer.data(), SnapNanoSec());
+        if (m_io->start_send(request) != 0)
+        {
+            m_io->cancel_request(request);
+            m_sendErrors += 1;
+            slot.m_inFlight.store(false, std::memory_order_release);
+        }
+    }
+
+    void InitiateReceive(ReceiveContext& receiveContext)
+    {
+        auto* request = m_io->new_request([this, &receiveContext](ctl::ctPosixIoRequest* completed) noexcept {
+            const auto receiveTimestamp = SnapNanoSec();
+            if (completed->result == -ECANCELED)
+            {
+                return;
+            }
+            DatagramHeader header;
+            if (completed->result > 0 &&
+                ParseDatagramHeader(receiveContext.m_buffer.data(), static_cast<size_t>(completed->result), header))
+            {
+                if (VerifyDatagramPayload(receiveContext.m_buffer.data(), header))
+                {
+                    m_roundTrips.Add(receiveTimestamp - header.m_sendTimestamp);
+                }
+                else
+                {
+                    m_corruptPayloads += 1;
+                }
+            }
+            InitiateReceive(receiveContext);
+        });
+        receiveContext.m_iov = {receiveContext.m_buffer.data(), receiveContext.m_buffer.size()};
+        request->message.msg_iov = &receiveContext.m_iov;
+        request->message.msg_iovlen = 1;
+        if (const auto error = m_io->start_receive(request))
+        {
+            m_io->cancel_request(request);
+            if (error != ECANCELED)
+            {
+                std::cerr << "Failed to start a receive: " << std::strerror(error) << '\n';
+            }
+        }
+    }
+
+    UniqueFd m_socket;
+    std::unique_ptr<ctl::ctPosixIo> m_io;
+    std::vector<ReceiveContext> m_receiveContexts;
+    std::vector<SendSlot> m_sendSlots;
+
+    // Only updated by the completion thread, read once it is stopped
+    LatencyHistogram m_roundTrips;
+    long long m_corruptPayloads = 0;
+    std::atomic<long long> m_sendErrors{0};
+    long long m_sendDuration = 0;
+    ctl::ctPosixIoStatistics m_statistics{};
+    bool m_verifyPayload = false;
+};
+
+void PrintUsage()
+{
+    std::cout << "posix_loopback measures the round trip of datagrams echoed over loopback with the portable I/O backend\n"
+                 "\n"
+                 "posix_loopback [-backend:<auto,io_uring,epoll>] [-port:#] [-datagrams:#] [-rate:#] [-prepostrecvs:#] [-verifypayload:<0,1>]\n"
+                 "\n"
+                 "-backend:<auto,io_uring,epoll>  the completion backend of the client, io_uring when available by default\n"
+                 "                                 (the server always takes the default, like posix_server)\n"
+                 "-port:#                          the loopback port of the server (default: 8888)\n"
+                 "-datagrams:#                     the number of datagrams sent (default: 1000000)\n"
+                 "-rate:#                          the datagrams sent per second (default: 100000)\n"
+                 "-prepostrecvs:#                  the receives kept posted on each socket (default: 16)\n"
+                 "-verifypayload:<0,1>             verify the CRC32C of the payloads on both sides (default: 0)\n";
+}
+
+bool ParseNumber(std::string_view value, long long& number)
+{
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return error == std::errc{} && end == value.data() + value.size() && number > 0;
+}
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    auto backend = ctl::ctPosixIoBackend::automatic;
+    long long port = 8888;
+    long long datagrams = 1'000'000;
+    long long rate = 100'000;
+    long long receiveCount = 16;
+    bool verifyPayload = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view argument{argv[i]};
+        const auto separator = argument.find(':');
+        const auto name = argument.substr(0, separator);
+        const auto value = separator == std::string_view::npos ? std::string_view{} : argument.substr(separator + 1);
+
+        bool valid = true;
+        if (name == "-backend")
+        {
+            valid = value == "auto" || value == "io_uring" || value == "epoll";
+            backend = value == "io_uring" ? ctl::ctPosixIoBackend::io_uring
+                      : value == "epoll"  ? ctl::ctPosixIoBackend::epoll
+                                          : ctl::ctPosixIoBackend::automatic;
+        }
+        else if (name == "-port")
+        {
+            valid = ParseNumber(value, port) && port <= 65535;
+        }
+        else if (name == "-datagrams")
+        {
+            valid = ParseNumber(value, datagrams);
+        }
+        else if (name == "-rate")
+        {
+            valid = ParseNumber(value, rate);
+        }
+        else if (name == "-prepostrecvs")
+        {
+            valid = ParseNumber(value, receiveCount);
+        }
+        else if (name == "-verifypayload")
+        {
+            valid = value == "0" || value == "1";
+            verifyPayload = value == "1";
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    sockaddr_in serverAddress{};
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    serverAddress.sin_port = htons(static_cast<uint16_t>(port));
+
+    StreamServer server{SocketAddress{reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)}};
+    server.Start(static_cast<unsigned long>(receiveCount));
+    LoopbackClient client{backend, static_cast<size_t>(receiveCount), serverAddress, verifyPayload};
+    std::cout << "Backend: " << ctl::ctPosixIoBackendName(client.Backend()) << '\n';
+
+    client.Run(datagrams, rate);
+    server.Stop();
+    client.PrintStatistics(datagrams);
+    server.PrintStatistics();
+    return 0;
+}
+catch (const std::exception& ex)
+{
+    std::cerr << "Error: " << ex.what() << '\n';
+    return 1;
+}
@@ -0,0 +1,34 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+# Compares the cost of the per-datagram send path and of the batched send path (-batchsend:1) over loopback.
+# For each mode, prints the number of send calls (one system call each) and the process CPU time per datagram
+# reported by the client.
+
+param(
+    [string]$Binary = ".\MultipathLatencyAnalyzer.exe",
+    [string]$Bitrate = "4k",
+    [int]$Grouping = 30,
+    [int]$Duration = 30,
+    [int]$Port = 8888
+)
+
+$server = Start-Process -FilePath $Binary -ArgumentList "-listen:127.0.0.1", "-port:$Port", "-prepostrecvs:32" -PassThru -NoNewWindow
+try
+{
+    # Give the server some time to start listening
+    Start-Sleep -Seconds 2
+
+    foreach ($batchSend in 0, 1)
+    {
+        Write-Output "--- -batchsend:$batchSend ---"
+        $output = & $Binary -target:127.0.0.1 -port:$Port -bitrate:$Bitrate -grouping:$Grouping -duration:$Duration `
+            -secondary:0 -prepostrecvs:32 -batchsend:$batchSend
+        $output | Select-String -Pattern "were sent in", "Send calls on primary", "CPU time per datagram"
+        Write-Output ""
+    }
+}
+finally
+{
+    Stop-Process -Id $server.Id
+}
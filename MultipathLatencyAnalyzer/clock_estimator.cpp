@@ -0,0 +1,139 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "clock_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace multipath {
+
+void ClockEstimator::AddSample(
+    long long sendTimestamp, long long reflectorReceiveTimestamp, long long echoTimestamp, long long receiveTimestamp)
+{
+    if (sendTimestamp < 0 || reflectorReceiveTimestamp < 0 || echoTimestamp < reflectorReceiveTimestamp ||
+        receiveTimestamp < sendTimestamp)
+    {
+        return;
+    }
+
+    // The middles of the two intervals, like the offset computed by NTP: ((T2 - T1) + (T3 - T4)) / 2
+    const auto reflectorDelay = echoTimestamp - reflectorReceiveTimestamp;
+    const auto roundTrip = (std::max)(receiveTimestamp - sendTimestamp - reflectorDelay, 0LL);
+    const auto middle = sendTimestamp + (receiveTimestamp - sendTimestamp) / 2;
+    const Sample sample{roundTrip, middle, reflectorReceiveTimestamp + reflectorDelay / 2 - middle};
+
+    Insert(sendTimestamp / m_window, sample);
+    while (m_windows.size() > c_maxWindows)
+    {
+        Coarsen();
+    }
+}
+
+void ClockEstimator::Insert(long long index, const Sample& sample)
+{
+    if (m_windows.empty())
+    {
+        m_reference = sample.m_time;
+    }
+
+    const auto [window, inserted] = m_windows.try_emplace(index, sample);
+    if (inserted)
+    {
+        Accumulate(sample, 1.);
+    }
+    else if (sample.m_roundTrip < window->second.m_roundTrip)
+    {
+        Accumulate(window->second, -1.);
+        window->second = sample;
+        Accumulate(sample, 1.);
+    }
+}
+
+void ClockEstimator::Accumulate(const Sample& sample, double sign) noexcept
+{
+    const auto x = static_cast<double>(sample.m_time - m_reference);
+    const auto y = static_cast<double>(sample.m_offset);
+    m_sumX += sign * x;
+    m_sumY += sign * y;
+    m_sumXX += sign * x * x;
+    m_sumXY += sign * x * y;
+}
+
+void ClockEstimator::Coarsen()
+{
+    std::map<long long, Sample> windows;
+    for (const auto& [index, sample] : m_windows)
+    {
+        const auto [window, inserted] = windows.try_emplace(index / 2, sample);
+        if (!inserted && sample.m_roundTrip < window->second.m_roundTrip)
+        {
+            window->second = sample;
+        }
+    }
+    m_windows = std::move(windows);
+    m_window *= 2;
+
+    // The sums are computed again, which also drops the rounding errors of the samples replaced
+    m_sumX = m_sumY = m_sumXX = m_sumXY = 0.;
+    for (const auto& [index, sample] : m_windows)
+    {
+        Accumulate(sample, 1.);
+    }
+}
+
+void ClockEstimator::AddSamples(const LatencyMeasure& measure, size_t pathCount)
+{
+    for (size_t i = 0; i < pathCount; ++i)
+    {
+        const auto& timestamps = measure.m_paths[i];
+        const auto reflectorReceive = timestamps.m_reflectorReceive >= 0 ? timestamps.m_reflectorReceive : timestamps.m_echo;
+        AddSample(timestamps.m_send, reflectorReceive, timestamps.m_echo, timestamps.m_receive);
+    }
+}
+
+void ClockEstimator::Merge(const ClockEstimator& other)
+{
+    // The windows of both are the initial window doubled a number of times, the shorter ones are merged into the longer
+    while (m_window < other.m_window)
+    {
+        Coarsen();
+    }
+    const auto ratio = m_window / other.m_window;
+    for (const auto& [index, sample] : other.m_windows)
+    {
+        Insert(index / ratio, sample);
+    }
+    while (m_windows.size() > c_maxWindows)
+    {
+        Coarsen();
+    }
+}
+
+std::optional<ClockModel> ClockEstimator::Estimate() const
+{
+    if (m_windows.empty())
+    {
+        return std::nullopt;
+    }
+
+    ClockModel model;
+    model.m_reference = m_reference;
+
+    // With a single window, or all the samples at the same time, only the offset can be estimated
+    const auto count = static_cast<double>(m_windows.size());
+    const auto denominator = count * m_sumXX - m_sumX * m_sumX;
+    model.m_skew = denominator > 0. ? (count * m_sumXY - m_sumX * m_sumY) / denominator : 0.;
+    model.m_offset = (m_sumY - model.m_skew * m_sumX) / count;
+
+    for (const auto& [index, sample] : m_windows)
+    {
+        const auto x = static_cast<double>(sample.m_time - model.m_reference);
+        const auto deviation = std::abs(static_cast<double>(sample.m_offset) - (model.m_offset + model.m_skew * x));
+        model.m_deviation = deviation > model.m_deviation ? deviation : model.m_deviation;
+    }
+    return model;
+}
+
+} // namespace multipath
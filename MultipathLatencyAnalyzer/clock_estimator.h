@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <map>
+#include <optional>
+
+#include "latencyStatistics.h"
+
+namespace multipath {
+
+// Splits the round trip of each datagram in one-way delays by estimating the offset and the skew of the server clock
+// - in each window of the run, the datagram with the lowest round trip is the one least delayed by queuing, for which
+//   the delays in both directions are assumed equal, like NTP does: its echo happened at the middle of its round trip
+// - a line fitted by least squares through the offsets of these datagrams gives the offset and the skew over the run
+// - the datagrams are taken on all the paths, the echo timestamps all come from the same server clock
+// - at most c_maxWindows are kept: past it, the windows are merged by pairs and their length doubles, the memory used
+//   does not grow with the run. The sums of the fit are updated as the windows change, an estimate only scans the
+//   windows for the largest deviation.
+// The one-way delays are only correct up to the asymmetry of the minimum delays, which cannot be measured without a
+// common clock.
+class ClockEstimator
+{
+public:
+    static constexpr long long c_defaultWindow = 1'000'000'000; // 1 second
+    // About 17 minutes of the default windows before they are merged
+    static constexpr size_t c_maxWindows = 1024;
+
+    explicit ClockEstimator(long long windowInNanoSec = c_defaultWindow) noexcept : m_window(windowInNanoSec)
+    {
+    }
+
+    // The send and receive timestamps from the client clock, the echo timestamp from the server clock
+    void AddSample(long long sendTimestamp, long long echoTimestamp, long long receiveTimestamp)
+    {
+        AddSample(sendTimestamp, echoTimestamp, echoTimestamp, receiveTimestamp);
+    }
+
+    // With a STAMP reflector, which timestamps separately the receive and the send of the echo: the time between
+    // them is not part of the round trip
+    void AddSample(long long sendTimestamp, long long reflectorReceiveTimestamp, long long echoTimestamp, long long receiveTimestamp);
+
+    // The datagrams echoed on each path
+    void AddSamples(const LatencyMeasure& measure, size_t pathCount);
+
+    // Accumulates the samples of another part of the same run, created with the same window
+    void Merge(const ClockEstimator& other);
+
+    // Empty until a datagram is echoed
+    [[nodiscard]] std::optional<ClockModel> Estimate() const;
+
+    [[nodiscard]] size_t WindowCount() const noexcept
+    {
+        return m_windows.size();
+    }
+
+private:
+    struct Sample
+    {
+        long long m_roundTrip;
+        // The middle of the round trip, in client time
+        long long m_time;
+        // The middle of the echo in server time minus the middle of the round trip
+        long long m_offset;
+    };
+
+    // Keeps the sample if it has the lowest round trip of its window
+    void Insert(long long index, const Sample& sample);
+    // Adds the sample to the sums of the fit, or removes it with a sign of -1
+    void Accumulate(const Sample& sample, double sign) noexcept;
+    // Merges the windows by pairs, the length of a window doubles
+    void Coarsen();
+
+    long long m_window;
+    // The sample with the lowest round trip of each window, by index of the window
+    std::map<long long, Sample> m_windows;
+
+    // The sums of the least squares fit over the windows, the times relative to the first sample to keep them precise
+    long long m_reference = 0;
+    double m_sumX = 0.;
+    double m_sumY = 0.;
+    double m_sumXX = 0.;
+    double m_sumXY = 0.;
+};
+
+} // namespace multipath
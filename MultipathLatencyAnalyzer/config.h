@@ -1,12 +1,27 @@
 #pragma once
 
+#include "datagram_header.h"
+#include "latency_dump.h"
+#include "path_scheduler.h"
 #include "sockaddr.h"
+#include "threadpool_timer.h"
 
 #include <filesystem>
+#include <vector>
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
 namespace multipath {
+// A path in addition to the primary and secondary interfaces, sending from a given interface or source address
+struct PathConfiguration
+{
+    // the index of the interface to send from, 0 when the path is bound to a source address
+    int m_interfaceIndex = 0;
+
+    // the local address to send from, AF_UNSPEC when the path is bound to an interface
+    ctl::ctSockaddr m_sourceAddress{};
+};
+
 struct Configuration
 {
     // these values make debugging much easier
@@ -24,33 +39,110 @@ struct Configuration
 
     static constexpr unsigned long c_defaultDuration = 60; // 1 minute
 
+    static constexpr unsigned long c_defaultLossTimeout = 5000; // 5 seconds
+
+    static constexpr int c_defaultHistogramDigits = 3;
+
     static constexpr DWORD c_defaultSocketReceiveBufferSize = 1048576;
 
+    static constexpr size_t c_defaultIoPoolCapacity = 256;
+
+    static constexpr unsigned long c_defaultDuplicateThreshold = 20; // 20 ms
+    static constexpr unsigned long c_defaultDuplicateHoldoff = 1000; // 1 second
+
     // the address on which to listen (server only)
     ctl::ctSockaddr m_listenAddress{};
 
     // the target address to connect to (client only)
     ctl::ctSockaddr m_targetAddress{};
 
-    // the port to use for connections
+    // the port to use for connections, the STAMP port by default with STAMP
     unsigned short m_port = c_defaultPort;
 
+    // the datagrams exchanged: the native header, or STAMP test packets to measure against a standard reflector
+    // (client), or to reflect the ones of standard senders along the native datagrams (server)
+    DatagramProtocol m_protocol = DatagramProtocol::Native;
+
+    // the clock of the datagram timestamps
+    ClockSource m_clock = ClockSource::Qpc;
+
     // the rate at which to send data (client only)
     unsigned long m_bitrate = c_defaultBitrate;
 
     // the number of datagrams to send per tick (client only)
     unsigned long m_grouping = c_defaultGrouping;
 
+    // send the datagrams of a tick with a single send call (client only)
+    bool m_batchSend = false;
+
+    // pace the ticks with a dedicated high precision thread instead of a threadpool timer (client only)
+    bool m_precisePacing = false;
+
+    // what the threadpool timer does with the ticks it missed, and its burst size or spreading period (client only)
+    TimerCatchUpSettings m_catchUp{};
+
+    // record the kernel timestamps of the datagrams sent and received, along the application timestamps (client only)
+    bool m_timestamping = false;
+
+    // carry the CRC32C of the payload in each datagram, verified by the server and when echoed (client only)
+    bool m_verifyPayload = false;
+
+    // ask the server to echo the header of the datagrams only, with the time and the length it received them (client only)
+    bool m_headerEcho = false;
+
+    // measure the downlink only: the server streams the datagrams, the client receives them and requests the stream
+    // (client only)
+    bool m_downlink = false;
+
+    // stream datagrams to the clients which request it, in addition to echoing (server only)
+    bool m_downlinkStreams = false;
+
     // the number of receives to keep posted on the socket
     unsigned long m_prePostRecvs = c_defaultPrePostRecvs;
 
-    // the duration to run the application, in seconds (client only)
+    // the number of dedicated threads echoing the datagrams, or 0 to use the system threadpool (server only)
+    unsigned long m_serverThreads = 0;
+
+    // the maximum number of datagrams echoed together by each thread, 1 to echo them one by one (server only)
+    unsigned long m_echoBatchSize = 1;
+
+    // the number of I/O requests preallocated for each socket (client only)
+    size_t m_ioPoolCapacity = c_defaultIoPoolCapacity;
+
+    // the duration to run the application, in seconds, or 0 to run until stopped (client only)
     unsigned long m_duration = c_defaultDuration;
 
-    // the file to output the results to (as csv)
+    // the time after which a datagram not received is considered lost, in milliseconds (client only)
+    unsigned long m_lossTimeout = c_defaultLossTimeout;
+
+    // the interval at which to print the statistics during the run, in milliseconds, or 0 to disable (client only)
+    unsigned long m_reportInterval = 0;
+
+    // the number of significant digits kept by the latency histograms (client only)
+    int m_histogramDigits = c_defaultHistogramDigits;
+
+    // the file to output the results to (client only)
     std::filesystem::path m_outputFile{};
 
+    // the format of the output file (client only)
+    LatencyDumpFormat m_outputFormat = LatencyDumpFormat::Csv;
+
     // behavior for the secondary WLAN interface
     bool m_useSecondaryWlanInterface = true;
+
+    // the paths measured after the primary and secondary interfaces, paths 2 and up (client only)
+    std::vector<PathConfiguration> m_additionalPaths{};
+
+    // the sets of paths whose effective latency is reported, all the paths together if empty (client only)
+    std::vector<PathSet> m_combinations{};
+
+    // how the paths each datagram is sent on are chosen (client only)
+    SchedulingPolicy m_schedulingPolicy = SchedulingPolicy::DuplicateAll;
+
+    // the latency above which the datagrams are duplicated with the onlatency policy, in milliseconds (client only)
+    unsigned long m_duplicateThreshold = c_defaultDuplicateThreshold;
+
+    // the time during which the datagrams are duplicated after a loss with the onloss policy, in milliseconds (client only)
+    unsigned long m_duplicateHoldoff = c_defaultDuplicateHoldoff;
 };
 } // namespace multipath
\ No newline at end of file
@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace multipath {
+namespace {
+    // The reflected Castagnoli polynomial
+    constexpr uint32_t c_polynomial = 0x82F63B78;
+
+    constexpr std::array<uint32_t, 256> c_table = []() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < table.size(); ++i)
+        {
+            auto crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) != 0 ? c_polynomial : 0);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint32_t ComputeWithTable(const unsigned char* data, size_t length, uint32_t crc) noexcept
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            crc = c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    bool HasCrcInstructions() noexcept
+    {
+#if defined(_MSC_VER)
+        int registers[4]{};
+        __cpuid(registers, 1);
+        return (registers[2] & (1 << 20)) != 0; // ECX bit 20: SSE 4.2
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+#if defined(__GNUC__)
+    __attribute__((target("sse4.2")))
+#endif
+    uint32_t ComputeWithInstructions(const unsigned char* data, size_t length, uint32_t crc) noexcept
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for (; length >= 8; data += 8, length -= 8)
+        {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc64 = _mm_crc32_u64(crc64, value);
+        }
+        crc = static_cast<uint32_t>(crc64);
+#endif
+        for (; length >= 4; data += 4, length -= 4)
+        {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc = _mm_crc32_u32(crc, value);
+        }
+        for (; length > 0; ++data, --length)
+        {
+            crc = _mm_crc32_u8(crc, *data);
+        }
+        return crc;
+    }
+#elif defined(_M_ARM64) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+    bool HasCrcInstructions() noexcept
+    {
+        // Optional in ARMv8.0 but required by Windows on ARM, and built in when the compiler targets it
+        return true;
+    }
+
+    uint32_t ComputeWithInstructions(const unsigned char* data, size_t length, uint32_t crc) noexcept
+    {
+        for (; length >= 8; data += 8, length -= 8)
+        {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc = __crc32cd(crc, value);
+        }
+        for (; length > 0; ++data, --length)
+        {
+            crc = __crc32cb(crc, *data);
+        }
+        return crc;
+    }
+#else
+    bool HasCrcInstructions() noexcept
+    {
+        return false;
+    }
+
+    uint32_t ComputeWithInstructions(const unsigned char* data, size_t length, uint32_t crc) noexcept
+    {
+        return ComputeWithTable(data, length, crc);
+    }
+#endif
+} // namespace
+
+bool IsCrc32cAccelerated() noexcept
+{
+    static const bool accelerated = HasCrcInstructions();
+    return accelerated;
+}
+
+uint32_t ComputeCrc32c(const void* data, size_t length, uint32_t crc) noexcept
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    crc = IsCrc32cAccelerated() ? ComputeWithInstructions(bytes, length, crc) : ComputeWithTable(bytes, length, crc);
+    return ~crc;
+}
+
+} // namespace multipath
@@ -0,0 +1,20 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace multipath {
+
+// CRC32C (Castagnoli polynomial, as in iSCSI and SCTP), free of OS dependencies
+// - computed with the CRC instructions of the processor when it has them: SSE 4.2 on x86 and x64, the CRC32 extension
+//   on ARM64, around 60 ns per KB. Otherwise, falls back to a lookup table, around 2 us per KB
+// - crc is the CRC of the preceding bytes, to compute the CRC of a buffer in several parts
+uint32_t ComputeCrc32c(const void* data, size_t length, uint32_t crc = 0) noexcept;
+
+// Whether ComputeCrc32c uses the CRC instructions of the processor
+bool IsCrc32cAccelerated() noexcept;
+
+} // namespace multipath
@@ -3,34 +3,23 @@
 
 #pragma once
 
+#include "datagram_header.h"
+#include "stamp_packet.h"
 #include "time_utils.h"
 
+#include <algorithm>
 #include <array>
 #include <span>
+#include <vector>
 #include <WinSock2.h>
 
 namespace multipath {
 
-constexpr unsigned long c_datagramSequenceNumberLength = 8;
-constexpr unsigned long c_datagramTimestampLength = 8;
-constexpr unsigned long c_datagramHeaderLength = c_datagramSequenceNumberLength + 2 * c_datagramTimestampLength;
-
-struct DatagramHeader
-{
-    long long m_sequenceNumber;
-    long long m_sendTimestamp; // Microsec
-    long long m_echoTimestamp; // Microsec
-};
-
-static_assert(sizeof(DatagramHeader) == c_datagramHeaderLength);
-
 class DatagramSendRequest
 {
 private:
-    static constexpr int c_datagramSequenceNumberOffset = 0;
-    static constexpr int c_datagramSendTimestampOffset = 1;
-    static constexpr int c_datagramEchoTimestampOffset = 2;
-    static constexpr int c_datagramPayloadOffset = 3;
+    static constexpr int c_datagramHeaderOffset = 0;
+    static constexpr int c_datagramPayloadOffset = 1;
 
 public:
     ~DatagramSendRequest() = default;
@@ -41,31 +30,47 @@ public:
     DatagramSendRequest(DatagramSendRequest&&) = delete;
     DatagramSendRequest& operator=(DatagramSendRequest&&) = delete;
 
-    static constexpr size_t c_bufferArraySize = 4;
+    static constexpr size_t c_bufferArraySize = 2;
     using BufferArray = std::array<WSABUF, c_bufferArraySize>;
 
-    DatagramSendRequest(long long sequenceNumber, std::span<const char> sendBuffer) : m_sequenceNumber(sequenceNumber)
+    // The header has no extensions, the payload is the end of the send buffer
+    // - with STAMP, a sender packet with the sequence number of the header is written instead, padded with the
+    //   rest of the header buffer and the payload to the same length
+    DatagramSendRequest(
+        const DatagramHeader& header, std::span<const char> sendBuffer, DatagramProtocol protocol = DatagramProtocol::Native) :
+        m_protocol(protocol)
     {
         static_assert(c_bufferArraySize == c_datagramPayloadOffset + 1);
-
-        // buffer layout: sequence number, send timestamp, echo timestamp, then buffer data
-        m_wsabufs[c_datagramSequenceNumberOffset].buf = reinterpret_cast<char*>(&m_sequenceNumber);
-        m_wsabufs[c_datagramSequenceNumberOffset].len = c_datagramSequenceNumberLength;
-
-        m_wsabufs[c_datagramSendTimestampOffset].buf = reinterpret_cast<char*>(&m_sendTimestamp);
-        m_wsabufs[c_datagramSendTimestampOffset].len = c_datagramTimestampLength;
-
-        m_wsabufs[c_datagramEchoTimestampOffset].buf = reinterpret_cast<char*>(&m_echoTimestamp);
-        m_wsabufs[c_datagramEchoTimestampOffset].len = c_datagramTimestampLength;
-
-        m_wsabufs[c_datagramPayloadOffset].buf = const_cast<char*>(sendBuffer.data());
-        m_wsabufs[c_datagramPayloadOffset].len = static_cast<ULONG>(sendBuffer.size() - c_datagramHeaderLength);
+        static_assert(c_stampPacketLength <= c_datagramHeaderLength);
+
+        // buffer layout: header, then buffer data
+        if (m_protocol == DatagramProtocol::Stamp)
+        {
+            WriteStampSenderPacket(m_header.data(), static_cast<uint32_t>(header.m_sequenceNumber));
+        }
+        else
+        {
+            WriteDatagramHeader(m_header.data(), header);
+        }
+        m_wsabufs[c_datagramHeaderOffset].buf = m_header.data();
+        m_wsabufs[c_datagramHeaderOffset].len = static_cast<ULONG>(m_header.size());
+
+        m_wsabufs[c_datagramPayloadOffset].buf = const_cast<char*>(sendBuffer.data() + c_datagramHeaderLength);
+        m_wsabufs[c_datagramPayloadOffset].len = header.m_payloadLength;
     }
 
     BufferArray& GetBuffers() noexcept
     {
         // refresh QPC value at last possible moment
-        m_sendTimestamp = SnapQpcInMicroSec();
+        m_sendTimestamp = SnapTimestampInNanoSec();
+        if (m_protocol == DatagramProtocol::Stamp)
+        {
+            SetStampSenderTimestamp(m_header.data(), ConvertTimestampToNtp(m_sendTimestamp));
+        }
+        else
+        {
+            StampDatagramSend(m_header.data(), m_sendTimestamp);
+        }
         return m_wsabufs;
     }
 
@@ -76,24 +81,109 @@ public:
 
 private:
     BufferArray m_wsabufs{};
-    long long m_sequenceNumber = 0;
+    std::array<char, c_datagramHeaderLength> m_header{};
     long long m_sendTimestamp = 0;
-    long long m_echoTimestamp = 0;
+    DatagramProtocol m_protocol = DatagramProtocol::Native;
 };
 
-inline bool ValidateBufferLength(size_t completedBytes) noexcept
+// A group of consecutive datagrams submitted with a single send call
+// - the datagrams are laid out back to back in one contiguous buffer, the network stack splits them again
+//   using UDP send offload (UDP_SEND_MSG_SIZE)
+// - a batch is allocated once for up to `maxCount` datagrams and reused for each send
+class DatagramSendBatch
 {
-    if (completedBytes < c_datagramHeaderLength)
+public:
+    ~DatagramSendBatch() = default;
+
+    DatagramSendBatch() = delete;
+    DatagramSendBatch(const DatagramSendBatch&) = delete;
+    DatagramSendBatch& operator=(const DatagramSendBatch&) = delete;
+    DatagramSendBatch(DatagramSendBatch&&) = delete;
+    DatagramSendBatch& operator=(DatagramSendBatch&&) = delete;
+
+    DatagramSendBatch(long long maxCount, std::span<const char> sendBuffer, DatagramProtocol protocol = DatagramProtocol::Native) :
+        m_datagramSize(sendBuffer.size()), m_maxCount(maxCount), m_protocol(protocol)
     {
-        fprintf(stderr, "ValidateBufferLength rejecting the datagram: the size (%zu) is less than DatagramHeaderLength (%lu)", completedBytes, c_datagramHeaderLength);
-        return false;
+        m_buffer.resize(static_cast<size_t>(maxCount) * m_datagramSize);
+        for (long long i = 0; i < maxCount; ++i)
+        {
+            auto* datagram = m_buffer.data() + static_cast<size_t>(i) * m_datagramSize;
+            std::copy(sendBuffer.begin() + c_datagramHeaderLength, sendBuffer.end(), datagram + c_datagramHeaderLength);
+        }
     }
-    return true;
-}
 
-inline DatagramHeader& ParseDatagramHeader(char* buffer) noexcept
-{
-    return *reinterpret_cast<DatagramHeader*>(buffer);
-}
+    // The datagrams are numbered from the sequence number of the given header, which has no extensions
+    void Prepare(DatagramHeader header, long long count) noexcept
+    {
+        m_count = count < m_maxCount ? count : m_maxCount;
+        m_firstSequenceNumber = header.m_sequenceNumber;
+        for (long long i = 0; i < m_count; ++i)
+        {
+            if (m_protocol == DatagramProtocol::Stamp)
+            {
+                // The end of the header buffer is padding, it stays zeroed
+                WriteStampSenderPacket(GetDatagram(i), static_cast<uint32_t>(header.m_sequenceNumber));
+            }
+            else
+            {
+                WriteDatagramHeader(GetDatagram(i), header);
+            }
+            header.m_sequenceNumber += 1;
+        }
+
+        m_wsabuf.buf = m_buffer.data();
+        m_wsabuf.len = static_cast<ULONG>(static_cast<size_t>(m_count) * m_datagramSize);
+    }
+
+    WSABUF& GetBuffer() noexcept
+    {
+        // refresh QPC values at last possible moment, each datagram gets its own timestamp
+        for (long long i = 0; i < m_count; ++i)
+        {
+            if (m_protocol == DatagramProtocol::Stamp)
+            {
+                SetStampSenderTimestamp(GetDatagram(i), ConvertTimestampToNtp(SnapTimestampInNanoSec()));
+            }
+            else
+            {
+                StampDatagramSend(GetDatagram(i), SnapTimestampInNanoSec());
+            }
+        }
+        return m_wsabuf;
+    }
+
+    [[nodiscard]] long long GetCount() const noexcept
+    {
+        return m_count;
+    }
+
+    // With STAMP, only the sequence number and the send timestamp are set
+    [[nodiscard]] DatagramHeader GetHeader(long long index) const noexcept
+    {
+        const auto* datagram = m_buffer.data() + static_cast<size_t>(index) * m_datagramSize;
+        if (m_protocol == DatagramProtocol::Stamp)
+        {
+            DatagramHeader header;
+            header.m_sequenceNumber = m_firstSequenceNumber + index;
+            header.m_sendTimestamp = ConvertNtpToTimestamp(details::Load64(datagram + details::c_stampTimestampOffset));
+            return header;
+        }
+        return DecodeDatagramHeader(datagram);
+    }
+
+private:
+    char* GetDatagram(long long index) noexcept
+    {
+        return m_buffer.data() + static_cast<size_t>(index) * m_datagramSize;
+    }
+
+    std::vector<char> m_buffer{};
+    WSABUF m_wsabuf{};
+    size_t m_datagramSize = 0;
+    long long m_maxCount = 0;
+    long long m_count = 0;
+    long long m_firstSequenceNumber = 0;
+    DatagramProtocol m_protocol = DatagramProtocol::Native;
+};
 
 } // namespace multipath
\ No newline at end of file
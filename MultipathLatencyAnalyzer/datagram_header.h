@@ -0,0 +1,482 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "crc32c.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace multipath {
+
+// The header of the measured datagrams, free of OS dependencies to be shared with the POSIX I/O backend
+//
+// Layout of version 1, in network byte order:
+//  0  magic (4)            "MPLA"
+//  4  version (1)
+//  5  flags (1)            the unknown flags are ignored by the receivers
+//  6  header length (2)    in bytes, including the extensions, a multiple of 8
+//  8  flow id (4)          chosen by the client for each run
+// 12  path id (2)          the path of the client the datagram is sent on
+// 14  header checksum (2)  ones' complement of the ones' complement sum of the header (RFC 1071)
+// 16  payload length (4)   in bytes, following the header
+// 20  payload CRC (4)      CRC32C of the payload with c_datagramPayloadCrcFlag, 0 otherwise
+// 24  sequence number (8)
+// 32  send timestamp (8)   nanoseconds, client clock
+// 40  echo timestamp (8)   nanoseconds, server clock
+// 48  extensions           type (1), length of the value (1), value; the type 0 is a single padding byte
+//
+// Echo report extension, in the header echoes of c_datagramHeaderEchoFlag:
+//  0  bytes received (4)      the length of the datagram received by the server
+//  4  receive timestamp (8)   nanoseconds, server clock
+// 12  transmit timestamp (8)  nanoseconds, server clock, the echo timestamp of the header
+//
+// Stream request extension, in the datagrams of c_datagramStreamRequestFlag:
+//  0  bitrate (8)             bits per second, on each path of the flow
+//  8  end sequence number (8) the stream stops before it, 0 to stream until the requests stop
+// 16  datagram size (4)       in bytes, including the header
+// 20  grouping (4)            the datagrams sent back to back at each tick
+// 24  cookie (8)              the last stream cookie echoed by the server on this path, 0 before
+//
+// Stream cookie extension, in the header echoes of the stream requests, following the echo report:
+//  0  cookie (8)              the cookie the server expects in the requests of this address, flow and path
+//
+// Version 0 is the unversioned layout of the previous releases: the sequence number and the send and echo timestamps
+// in microseconds, in host byte order. The server echoes both, the clients of both versions can share it.
+constexpr uint32_t c_datagramMagic = 0x4D504C41; // "MPLA"
+constexpr uint8_t c_datagramVersion = 1;
+constexpr size_t c_datagramHeaderLength = 48; // Without extensions
+constexpr size_t c_legacyDatagramHeaderLength = 24;
+
+// The payload CRC is set: the payload can be verified by the server and by the client once echoed
+constexpr uint8_t c_datagramPayloadCrcFlag = 0x01;
+// The server echoes the header only, followed by an echo report, instead of the whole datagram: the echoes have the
+// same small size whatever the size of the datagrams sent
+constexpr uint8_t c_datagramHeaderEchoFlag = 0x02;
+// The datagram asks the server to stream datagrams to its sender, on its flow and path, as described by its stream
+// request extension. The client renews it until the end of the stream: each request is echoed as a header echo, its
+// round trip gives the offset of the server clock. The server only streams to the requests carrying the cookie it
+// echoed to their address: a sender whose address is spoofed cannot start a stream.
+constexpr uint8_t c_datagramStreamRequestFlag = 0x04;
+
+enum class DatagramExtension : uint8_t
+{
+    Padding = 0,
+    EchoReport = 1,
+    StreamRequest = 2,
+    StreamCookie = 3
+};
+
+constexpr size_t c_echoReportLength = 20;
+// The header, the echo report and its padding to a multiple of 8, without payload
+constexpr size_t c_headerEchoLength = 72;
+
+struct EchoReport
+{
+    uint32_t m_bytesReceived = 0;
+    long long m_receiveTimestamp = 0; // Nanosec
+    long long m_transmitTimestamp = 0; // Nanosec
+};
+
+constexpr size_t c_streamRequestLength = 32;
+// The header, the stream request and its padding to a multiple of 8, without payload
+constexpr size_t c_streamRequestDatagramLength = 88;
+
+constexpr size_t c_streamCookieLength = 8;
+// The header echo of a stream request, followed by the stream cookie
+constexpr size_t c_streamRequestEchoLength = 80;
+
+struct StreamRequest
+{
+    unsigned long long m_bitrate = 0;
+    long long m_endSequenceNumber = 0;
+    uint32_t m_datagramSize = 0;
+    uint32_t m_grouping = 1;
+    uint64_t m_cookie = 0;
+};
+
+struct DatagramHeader
+{
+    uint8_t m_version = c_datagramVersion;
+    uint8_t m_flags = 0;
+    uint16_t m_headerLength = c_datagramHeaderLength;
+    uint32_t m_flowId = 0;
+    uint16_t m_pathId = 0;
+    uint32_t m_payloadLength = 0;
+    uint32_t m_payloadCrc = 0;
+    long long m_sequenceNumber = 0;
+    long long m_sendTimestamp = 0; // Nanosec
+    long long m_echoTimestamp = 0; // Nanosec
+};
+
+// The datagrams exchanged by the clients and the servers
+enum class DatagramProtocol
+{
+    // This header
+    Native,
+    // The test packets of STAMP (RFC 8762), see stamp_packet.h
+    Stamp
+};
+
+// How a server handles a received datagram
+enum class DatagramFormat
+{
+    Invalid,    // dropped
+    Legacy,     // version 0
+    Current,
+    HeaderEcho, // of the current version with c_datagramHeaderEchoFlag, once turned into its echo
+    Stamp       // a STAMP sender packet, when the server reflects them instead of the legacy datagrams
+};
+
+namespace details {
+    constexpr size_t c_magicOffset = 0;
+    constexpr size_t c_versionOffset = 4;
+    constexpr size_t c_flagsOffset = 5;
+    constexpr size_t c_headerLengthOffset = 6;
+    constexpr size_t c_flowIdOffset = 8;
+    constexpr size_t c_pathIdOffset = 12;
+    constexpr size_t c_checksumOffset = 14;
+    constexpr size_t c_payloadLengthOffset = 16;
+    constexpr size_t c_payloadCrcOffset = 20;
+    constexpr size_t c_sequenceNumberOffset = 24;
+    constexpr size_t c_sendTimestampOffset = 32;
+    constexpr size_t c_echoTimestampOffset = 40;
+    constexpr size_t c_legacyEchoTimestampOffset = 16;
+
+    // The echo report is the first extension of a header echo, its timestamps on 16-bit words of the checksum
+    constexpr size_t c_echoReportOffset = c_datagramHeaderLength;
+    constexpr size_t c_reportBytesReceivedOffset = c_echoReportOffset + 2;
+    constexpr size_t c_reportReceiveTimestampOffset = c_echoReportOffset + 6;
+    constexpr size_t c_reportTransmitTimestampOffset = c_echoReportOffset + 14;
+
+    // The fields are assembled byte by byte: the compilers turn it into a load or store and a byte swap
+    inline uint16_t Load16(const char* buffer) noexcept
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(buffer);
+        return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+    }
+
+    inline uint32_t Load32(const char* buffer) noexcept
+    {
+        return static_cast<uint32_t>(Load16(buffer)) << 16 | Load16(buffer + 2);
+    }
+
+    inline uint64_t Load64(const char* buffer) noexcept
+    {
+        return static_cast<uint64_t>(Load32(buffer)) << 32 | Load32(buffer + 4);
+    }
+
+    inline void Store16(char* buffer, uint16_t value) noexcept
+    {
+        auto* bytes = reinterpret_cast<unsigned char*>(buffer);
+        bytes[0] = static_cast<unsigned char>(value >> 8);
+        bytes[1] = static_cast<unsigned char>(value);
+    }
+
+    inline void Store32(char* buffer, uint32_t value) noexcept
+    {
+        Store16(buffer, static_cast<uint16_t>(value >> 16));
+        Store16(buffer + 2, static_cast<uint16_t>(value));
+    }
+
+    inline void Store64(char* buffer, uint64_t value) noexcept
+    {
+        Store32(buffer, static_cast<uint32_t>(value >> 32));
+        Store32(buffer + 4, static_cast<uint32_t>(value));
+    }
+
+    // The 16-bit words of the buffer added without folding the carries, length must be even
+    inline uint64_t SumWords(const char* buffer, size_t length) noexcept
+    {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < length; i += 2)
+        {
+            sum += Load16(buffer + i);
+        }
+        return sum;
+    }
+
+    inline uint16_t FoldSum(uint64_t sum) noexcept
+    {
+        while (sum >> 16)
+        {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        return static_cast<uint16_t>(sum);
+    }
+
+    // Updates a timestamp and the checksum of the header, without summing the whole header again (RFC 1624)
+    inline void StoreTimestamp(char* buffer, size_t offset, long long timestamp) noexcept
+    {
+        uint64_t sum = static_cast<uint16_t>(~Load16(buffer + c_checksumOffset));
+        for (size_t i = 0; i < 8; i += 2)
+        {
+            sum += static_cast<uint16_t>(~Load16(buffer + offset + i));
+        }
+        Store64(buffer + offset, static_cast<uint64_t>(timestamp));
+        sum += SumWords(buffer + offset, 8);
+        Store16(buffer + c_checksumOffset, static_cast<uint16_t>(~FoldSum(sum)));
+    }
+} // namespace details
+
+// Writes the header of a datagram followed by header.m_payloadLength bytes
+// - the extensions, if any, must be written in the buffer beforehand: the checksum covers them
+inline void WriteDatagramHeader(char* buffer, const DatagramHeader& header) noexcept
+{
+    using namespace details;
+    Store32(buffer + c_magicOffset, c_datagramMagic);
+    buffer[c_versionOffset] = static_cast<char>(header.m_version);
+    buffer[c_flagsOffset] = static_cast<char>(header.m_flags);
+    Store16(buffer + c_headerLengthOffset, header.m_headerLength);
+    Store32(buffer + c_flowIdOffset, header.m_flowId);
+    Store16(buffer + c_pathIdOffset, header.m_pathId);
+    Store16(buffer + c_checksumOffset, 0);
+    Store32(buffer + c_payloadLengthOffset, header.m_payloadLength);
+    Store32(buffer + c_payloadCrcOffset, header.m_payloadCrc);
+    Store64(buffer + c_sequenceNumberOffset, static_cast<uint64_t>(header.m_sequenceNumber));
+    Store64(buffer + c_sendTimestampOffset, static_cast<uint64_t>(header.m_sendTimestamp));
+    Store64(buffer + c_echoTimestampOffset, static_cast<uint64_t>(header.m_echoTimestamp));
+    Store16(buffer + c_checksumOffset, static_cast<uint16_t>(~FoldSum(SumWords(buffer, header.m_headerLength))));
+}
+
+// Decodes the fields of a header, without checking them
+inline DatagramHeader DecodeDatagramHeader(const char* buffer) noexcept
+{
+    using namespace details;
+    DatagramHeader header;
+    header.m_version = static_cast<uint8_t>(buffer[c_versionOffset]);
+    header.m_flags = static_cast<uint8_t>(buffer[c_flagsOffset]);
+    header.m_headerLength = Load16(buffer + c_headerLengthOffset);
+    header.m_flowId = Load32(buffer + c_flowIdOffset);
+    header.m_pathId = Load16(buffer + c_pathIdOffset);
+    header.m_payloadLength = Load32(buffer + c_payloadLengthOffset);
+    header.m_payloadCrc = Load32(buffer + c_payloadCrcOffset);
+    header.m_sequenceNumber = static_cast<long long>(Load64(buffer + c_sequenceNumberOffset));
+    header.m_sendTimestamp = static_cast<long long>(Load64(buffer + c_sendTimestampOffset));
+    header.m_echoTimestamp = static_cast<long long>(Load64(buffer + c_echoTimestampOffset));
+    return header;
+}
+
+// Decodes the header of a datagram of completedBytes bytes, returns false if it is not a valid datagram of the
+// current version: the magic, the version, the lengths and the checksum are checked together, without branching on
+// the content of the datagram
+// - the buffer must hold at least c_datagramHeaderLength bytes, even when fewer were received
+inline bool ParseDatagramHeader(const char* buffer, size_t completedBytes, DatagramHeader& header) noexcept
+{
+    using namespace details;
+    header = DecodeDatagramHeader(buffer);
+
+    // The checksum is only computed over the bytes received, a truncated header fails the length checks
+    const size_t headerLength = header.m_headerLength;
+    const auto checkedLength = (std::min)(headerLength, completedBytes) & ~size_t{1};
+    const auto sum = FoldSum(SumWords(buffer, checkedLength));
+
+    const bool valid = (Load32(buffer + c_magicOffset) == c_datagramMagic) & (header.m_version == c_datagramVersion) &
+                       (headerLength >= c_datagramHeaderLength) & (headerLength % 8 == 0) &
+                       (headerLength + header.m_payloadLength == completedBytes) & (sum == 0xFFFF);
+    return valid;
+}
+
+// Classifies a datagram received by a server and decodes its header when it is of the current version
+// - a datagram starting with the magic is never taken for a legacy one: it is corrupt, or of a later version
+inline DatagramFormat ClassifyDatagram(const char* buffer, size_t completedBytes, DatagramHeader& header) noexcept
+{
+    if (ParseDatagramHeader(buffer, completedBytes, header))
+    {
+        return DatagramFormat::Current;
+    }
+    if (completedBytes >= c_legacyDatagramHeaderLength && details::Load32(buffer) != c_datagramMagic)
+    {
+        return DatagramFormat::Legacy;
+    }
+    return DatagramFormat::Invalid;
+}
+
+// Returns false if the payload of a parsed datagram does not match its CRC, true if it has no CRC
+inline bool VerifyDatagramPayload(const char* buffer, const DatagramHeader& header) noexcept
+{
+    if ((header.m_flags & c_datagramPayloadCrcFlag) == 0)
+    {
+        return true;
+    }
+    return ComputeCrc32c(buffer + header.m_headerLength, header.m_payloadLength) == header.m_payloadCrc;
+}
+
+inline void StampDatagramSend(char* buffer, long long timestampInNanoSec) noexcept
+{
+    details::StoreTimestamp(buffer, details::c_sendTimestampOffset, timestampInNanoSec);
+}
+
+// Turns a datagram parsed with c_datagramHeaderEchoFlag into its echo, in place: its header without extensions, followed
+// by an echo report, without payload. Returns the length of the echo, c_headerEchoLength.
+// - the buffer must hold at least c_headerEchoLength bytes, even when fewer were received
+// - the echo has no payload CRC, the payload is verified by the server only
+// - the transmit timestamp of the report is set along the echo timestamp, by StampDatagramEcho
+inline size_t TruncateDatagramEcho(char* buffer, DatagramHeader header, size_t bytesReceived, long long receiveTimestamp) noexcept
+{
+    using namespace details;
+    static_assert(c_reportTransmitTimestampOffset + 8 <= c_headerEchoLength && c_headerEchoLength % 8 == 0);
+
+    std::memset(buffer + c_echoReportOffset, 0, c_headerEchoLength - c_echoReportOffset);
+    buffer[c_echoReportOffset] = static_cast<char>(DatagramExtension::EchoReport);
+    buffer[c_echoReportOffset + 1] = static_cast<char>(c_echoReportLength);
+    Store32(buffer + c_reportBytesReceivedOffset, static_cast<uint32_t>(bytesReceived));
+    Store64(buffer + c_reportReceiveTimestampOffset, static_cast<uint64_t>(receiveTimestamp));
+
+    header.m_flags &= static_cast<uint8_t>(~c_datagramPayloadCrcFlag);
+    header.m_headerLength = c_headerEchoLength;
+    header.m_payloadLength = 0;
+    header.m_payloadCrc = 0;
+    WriteDatagramHeader(buffer, header);
+    return c_headerEchoLength;
+}
+
+// Turns a stream request into its header echo, like TruncateDatagramEcho, followed by the stream cookie of its
+// sender. Returns the length of the echo, c_streamRequestEchoLength.
+inline size_t TruncateStreamRequestEcho(
+    char* buffer, DatagramHeader header, size_t bytesReceived, long long receiveTimestamp, uint64_t cookie) noexcept
+{
+    using namespace details;
+    constexpr size_t offset = c_echoReportOffset + 2 + c_echoReportLength;
+    static_assert(offset + 2 + c_streamCookieLength == c_streamRequestEchoLength);
+
+    TruncateDatagramEcho(buffer, header, bytesReceived, receiveTimestamp);
+    buffer[offset] = static_cast<char>(DatagramExtension::StreamCookie);
+    buffer[offset + 1] = static_cast<char>(c_streamCookieLength);
+    Store64(buffer + offset + 2, cookie);
+
+    header.m_flags &= static_cast<uint8_t>(~c_datagramPayloadCrcFlag);
+    header.m_headerLength = c_streamRequestEchoLength;
+    header.m_payloadLength = 0;
+    header.m_payloadCrc = 0;
+    WriteDatagramHeader(buffer, header);
+    return c_streamRequestEchoLength;
+}
+
+// Writes a stream request in buffer, which must hold c_streamRequestDatagramLength bytes, and returns its length
+// - the header has no payload: with c_datagramPayloadCrcFlag, the CRC is the one of no bytes, and the streamed
+//   datagrams carry the CRC of their payload
+inline size_t WriteStreamRequest(char* buffer, DatagramHeader header, const StreamRequest& request) noexcept
+{
+    using namespace details;
+    constexpr size_t offset = c_datagramHeaderLength;
+    static_assert(offset + 2 + c_streamRequestLength <= c_streamRequestDatagramLength && c_streamRequestDatagramLength % 8 == 0);
+
+    std::memset(buffer + offset, 0, c_streamRequestDatagramLength - offset);
+    buffer[offset] = static_cast<char>(DatagramExtension::StreamRequest);
+    buffer[offset + 1] = static_cast<char>(c_streamRequestLength);
+    Store64(buffer + offset + 2, request.m_bitrate);
+    Store64(buffer + offset + 10, static_cast<uint64_t>(request.m_endSequenceNumber));
+    Store32(buffer + offset + 18, request.m_datagramSize);
+    Store32(buffer + offset + 22, request.m_grouping);
+    Store64(buffer + offset + 26, request.m_cookie);
+
+    header.m_flags |= c_datagramStreamRequestFlag;
+    header.m_headerLength = c_streamRequestDatagramLength;
+    header.m_payloadLength = 0;
+    header.m_payloadCrc = 0;
+    WriteDatagramHeader(buffer, header);
+    return c_streamRequestDatagramLength;
+}
+
+// Stamps a datagram accepted by ClassifyDatagram with the echo time, in the unit of its version
+inline void StampDatagramEcho(char* buffer, DatagramFormat format, long long timestampInNanoSec) noexcept
+{
+    if (format == DatagramFormat::Legacy)
+    {
+        const long long timestampInMicroSec = timestampInNanoSec / 1'000;
+        std::memcpy(buffer + details::c_legacyEchoTimestampOffset, &timestampInMicroSec, sizeof(timestampInMicroSec));
+        return;
+    }
+    if (format == DatagramFormat::HeaderEcho)
+    {
+        details::StoreTimestamp(buffer, details::c_reportTransmitTimestampOffset, timestampInNanoSec);
+    }
+    details::StoreTimestamp(buffer, details::c_echoTimestampOffset, timestampInNanoSec);
+}
+
+// Returns the value of the first extension of the given type in a parsed datagram, empty if there is none
+inline std::span<const char> FindDatagramExtension(const char* buffer, const DatagramHeader& header, DatagramExtension type) noexcept
+{
+    size_t offset = c_datagramHeaderLength;
+    while (offset < header.m_headerLength)
+    {
+        const auto extension = static_cast<DatagramExtension>(buffer[offset]);
+        if (extension == DatagramExtension::Padding)
+        {
+            offset += 1;
+            continue;
+        }
+
+        // A truncated extension ends the list
+        const auto valueOffset = offset + 2;
+        if (valueOffset > header.m_headerLength)
+        {
+            break;
+        }
+        const size_t valueLength = static_cast<uint8_t>(buffer[offset + 1]);
+        if (valueOffset + valueLength > header.m_headerLength)
+        {
+            break;
+        }
+        if (extension == type)
+        {
+            return {buffer + valueOffset, valueLength};
+        }
+        offset = valueOffset + valueLength;
+    }
+    return {};
+}
+
+// Decodes the stream request of a parsed datagram, returns false if it has none
+inline bool ParseStreamRequest(const char* buffer, const DatagramHeader& header, StreamRequest& request) noexcept
+{
+    using namespace details;
+    const auto value = FindDatagramExtension(buffer, header, DatagramExtension::StreamRequest);
+    if (value.size() < c_streamRequestLength)
+    {
+        return false;
+    }
+
+    request.m_bitrate = Load64(value.data());
+    request.m_endSequenceNumber = static_cast<long long>(Load64(value.data() + 8));
+    request.m_datagramSize = Load32(value.data() + 16);
+    request.m_grouping = Load32(value.data() + 20);
+    request.m_cookie = Load64(value.data() + 24);
+    return true;
+}
+
+// Decodes the echo report of a parsed header echo, returns false if it has none
+inline bool ParseEchoReport(const char* buffer, const DatagramHeader& header, EchoReport& report) noexcept
+{
+    using namespace details;
+    const auto value = FindDatagramExtension(buffer, header, DatagramExtension::EchoReport);
+    if (value.size() < c_echoReportLength)
+    {
+        return false;
+    }
+
+    report.m_bytesReceived = Load32(value.data());
+    report.m_receiveTimestamp = static_cast<long long>(Load64(value.data() + 4));
+    report.m_transmitTimestamp = static_cast<long long>(Load64(value.data() + 12));
+    return true;
+}
+
+// Decodes the stream cookie of a parsed stream request echo, returns false if it has none
+inline bool ParseStreamCookie(const char* buffer, const DatagramHeader& header, uint64_t& cookie) noexcept
+{
+    const auto value = FindDatagramExtension(buffer, header, DatagramExtension::StreamCookie);
+    if (value.size() < c_streamCookieLength)
+    {
+        return false;
+    }
+
+    cookie = details::Load64(value.data());
+    return true;
+}
+
+} // namespace multipath
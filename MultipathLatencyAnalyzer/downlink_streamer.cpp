@@ -0,0 +1,393 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "downlink_streamer.h"
+#include "logs.h"
+#include "time_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace multipath {
+
+namespace {
+uint64_t RotateLeft(uint64_t value, int bits) noexcept
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) noexcept
+{
+    v0 += v1;
+    v1 = RotateLeft(v1, 13);
+    v1 ^= v0;
+    v0 = RotateLeft(v0, 32);
+    v2 += v3;
+    v3 = RotateLeft(v3, 16);
+    v3 ^= v2;
+    v0 += v3;
+    v3 = RotateLeft(v3, 21);
+    v3 ^= v0;
+    v2 += v1;
+    v1 = RotateLeft(v1, 17);
+    v1 ^= v2;
+    v2 = RotateLeft(v2, 32);
+}
+
+// SipHash-2-4, a keyed hash of short inputs: the cookies cannot be computed without the key
+uint64_t SipHash24(const std::array<uint64_t, 2>& key, const uint8_t* data, size_t length) noexcept
+{
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6d;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261;
+    uint64_t v3 = key[1] ^ 0x7465646279746573;
+
+    const auto compress = [&](uint64_t word) noexcept {
+        v3 ^= word;
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 ^= word;
+    };
+
+    const size_t wordsEnd = length - length % 8;
+    for (size_t i = 0; i < wordsEnd; i += 8)
+    {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; ++j)
+        {
+            word |= static_cast<uint64_t>(data[i + j]) << (8 * j);
+        }
+        compress(word);
+    }
+    uint64_t last = static_cast<uint64_t>(length) << 56;
+    for (size_t j = 0; j < length % 8; ++j)
+    {
+        last |= static_cast<uint64_t>(data[wordsEnd + j]) << (8 * j);
+    }
+    compress(last);
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+    {
+        SipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+} // namespace
+
+DownlinkStreamer::DownlinkStreamer(SOCKET socket) : m_socket(socket)
+{
+    std::random_device random;
+    for (auto& word : m_cookieKey)
+    {
+        word = (static_cast<uint64_t>(random()) << 32) | random();
+    }
+    m_dueDatagrams.reserve(c_maxSessionCount);
+
+    // A high resolution timer is available from Windows 10 1803, fall back to a regular timer otherwise
+    m_waitableTimer.reset(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+    if (!m_waitableTimer)
+    {
+        m_waitableTimer.reset(CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS));
+        THROW_LAST_ERROR_IF_MSG(!m_waitableTimer, "CreateWaitableTimerExW failed");
+    }
+}
+
+DownlinkStreamer::~DownlinkStreamer() noexcept
+{
+    Stop();
+}
+
+void DownlinkStreamer::Start()
+{
+    m_thread = std::thread([this]() noexcept { Run(); });
+}
+
+void DownlinkStreamer::Stop() noexcept
+{
+    m_stopping = true;
+    m_sessionStarted.SetEvent();
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+DownlinkStreamer::RequestResult DownlinkStreamer::Request(
+    const ctl::ctSockaddr& remoteAddress, int remoteAddressLength, const DatagramHeader& header, const StreamRequest& request) noexcept
+{
+    const auto now = SnapTimestampInNanoSec();
+    const std::scoped_lock lock(m_lock);
+
+    // The cookie proves that the sender receives at its address, before anything is streamed to it
+    if (request.m_cookie != Cookie(remoteAddress, header))
+    {
+        m_challengedRequests += 1;
+        return RequestResult::Challenged;
+    }
+
+    auto session = std::ranges::find_if(m_sessions, [&](const auto& s) {
+        return s->m_flowId == header.m_flowId && s->m_pathId == header.m_pathId && s->m_remoteAddress == remoteAddress;
+    });
+    if (session != m_sessions.end())
+    {
+        // The parameters of a session do not change, the requests renew it and can end it earlier
+        (*session)->m_lastRequest = now;
+        (*session)->m_endSequenceNumber =
+            request.m_endSequenceNumber > 0 ? request.m_endSequenceNumber : (std::numeric_limits<long long>::max)();
+        return RequestResult::Accepted;
+    }
+
+    unsigned long long totalBitrate = 0;
+    for (const auto& s : m_sessions)
+    {
+        totalBitrate += s->m_bitrate;
+    }
+    if (request.m_bitrate == 0 || request.m_bitrate > c_maxSessionBitrate || totalBitrate + request.m_bitrate > c_maxTotalBitrate ||
+        request.m_grouping == 0 || request.m_grouping > c_maxGrouping || request.m_datagramSize < c_datagramHeaderLength ||
+        request.m_datagramSize > c_maxDatagramSize || request.m_bitrate / (request.m_datagramSize * 8ull) > c_maxSessionDatagramRate ||
+        m_sessions.size() >= c_maxSessionCount)
+    {
+        m_refusedRequests += 1;
+        return RequestResult::Refused;
+    }
+
+    try
+    {
+        auto newSession = std::make_unique<Session>();
+        newSession->m_remoteAddress = remoteAddress;
+        newSession->m_remoteAddressLength = remoteAddressLength;
+        newSession->m_flowId = header.m_flowId;
+        newSession->m_pathId = header.m_pathId;
+        newSession->m_grouping = request.m_grouping;
+        newSession->m_bitrate = request.m_bitrate;
+        newSession->m_tickInterval =
+            static_cast<double>(request.m_datagramSize) * request.m_grouping * 8. * 1'000'000'000. / static_cast<double>(request.m_bitrate);
+        newSession->m_endSequenceNumber =
+            request.m_endSequenceNumber > 0 ? request.m_endSequenceNumber : (std::numeric_limits<long long>::max)();
+        newSession->m_lastRequest = now;
+
+        // A path joining a flow already streamed takes the schedule of the flow, from its next group
+        newSession->m_start = now;
+        const auto flow = std::ranges::find_if(m_sessions, [&](const auto& s) { return s->m_flowId == header.m_flowId; });
+        if (flow != m_sessions.end() && (*flow)->m_tickInterval == newSession->m_tickInterval &&
+            (*flow)->m_grouping == newSession->m_grouping)
+        {
+            newSession->m_start = (*flow)->m_start;
+            const auto tick = static_cast<long long>(std::ceil(static_cast<double>(now - newSession->m_start) / newSession->m_tickInterval));
+            newSession->m_nextSequenceNumber = tick * newSession->m_grouping;
+        }
+
+        // All the datagrams have the same payload, its CRC is computed once
+        auto& datagram = newSession->m_datagram;
+        datagram.resize(request.m_datagramSize);
+        for (size_t i = c_datagramHeaderLength; i < datagram.size(); ++i)
+        {
+            datagram[i] = static_cast<char>(i);
+        }
+        auto& streamHeader = newSession->m_header;
+        streamHeader.m_flowId = header.m_flowId;
+        streamHeader.m_pathId = header.m_pathId;
+        streamHeader.m_payloadLength = static_cast<uint32_t>(datagram.size() - c_datagramHeaderLength);
+        if ((header.m_flags & c_datagramPayloadCrcFlag) != 0)
+        {
+            streamHeader.m_flags = c_datagramPayloadCrcFlag;
+            streamHeader.m_payloadCrc = ComputeCrc32c(datagram.data() + c_datagramHeaderLength, streamHeader.m_payloadLength);
+        }
+
+        Log<LogLevel::Info>(
+            "Starting a downlink stream for flow %u, path %u: %llu bits per second, from sequence number %lld\n",
+            header.m_flowId,
+            header.m_pathId,
+            request.m_bitrate,
+            newSession->m_nextSequenceNumber);
+        m_sessions.emplace_back(std::move(newSession));
+        m_startedSessions += 1;
+    }
+    catch (...)
+    {
+        m_refusedRequests += 1;
+        return RequestResult::Refused;
+    }
+
+    m_sessionStarted.SetEvent();
+    return RequestResult::Accepted;
+}
+
+uint64_t DownlinkStreamer::Cookie(const ctl::ctSockaddr& remoteAddress, const DatagramHeader& header) const noexcept
+{
+    // The whole address, like the sessions are matched
+    std::array<uint8_t, sizeof(SOCKADDR_INET) + sizeof(header.m_flowId) + sizeof(header.m_pathId)> input{};
+    std::memcpy(input.data(), remoteAddress.sockaddr_inet(), sizeof(SOCKADDR_INET));
+    std::memcpy(input.data() + sizeof(SOCKADDR_INET), &header.m_flowId, sizeof(header.m_flowId));
+    std::memcpy(input.data() + sizeof(SOCKADDR_INET) + sizeof(header.m_flowId), &header.m_pathId, sizeof(header.m_pathId));
+    return SipHash24(m_cookieKey, input.data(), input.size());
+}
+
+void DownlinkStreamer::PrintStatistics() const
+{
+    const std::scoped_lock lock(m_lock);
+    if (m_startedSessions == 0 && m_challengedRequests == 0 && m_refusedRequests == 0)
+    {
+        return;
+    }
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << '\n';
+    std::cout << "-----------------------------------------------------------------------\n";
+    std::cout << "                        DOWNLINK STREAMS                               \n";
+    std::cout << "-----------------------------------------------------------------------\n";
+    std::cout << '\n';
+    std::cout << "Sessions started: " << m_startedSessions << ", requests challenged: " << m_challengedRequests
+              << ", requests refused: " << m_refusedRequests << '\n';
+    std::cout << "Datagrams streamed: " << m_sentDatagrams << " (" << m_sentBytes / 1024 << " kB), failed sends: " << m_failedSends
+              << '\n';
+    std::cout << "Pacing error (actual - intended send time): average " << m_pacingError.Mean() << " microseconds, maximum "
+              << m_pacingError.Max() << " microseconds\n";
+    m_pacingError.Print(std::cout);
+}
+
+long long DownlinkStreamer::Deadline(const Session& session, long long sequenceNumber) noexcept
+{
+    return session.m_start + std::llround(static_cast<double>(sequenceNumber / session.m_grouping) * session.m_tickInterval);
+}
+
+void DownlinkStreamer::Run() noexcept
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    while (!m_stopping)
+    {
+        auto nextDeadline = c_noDeadline;
+        m_dueDatagrams.clear();
+        {
+            const std::scoped_lock lock(m_lock);
+            const auto now = SnapTimestampInNanoSec();
+            // The sessions streamed to their end are kept until their requests stop: a late request does not restart them
+            std::erase_if(m_sessions, [&](const auto& session) {
+                const auto expired = now - session->m_lastRequest > c_sessionTimeout;
+                if (expired)
+                {
+                    Log<LogLevel::Info>(
+                        "Ending the downlink stream of flow %u, path %u at sequence number %lld\n",
+                        session->m_flowId,
+                        session->m_pathId,
+                        session->m_nextSequenceNumber);
+                }
+                return expired;
+            });
+
+            for (auto& session : m_sessions)
+            {
+                nextDeadline = (std::min)(nextDeadline, TakeDue(*session, now));
+            }
+
+            // Wake up to expire the sessions whose requests stopped
+            if (!m_sessions.empty())
+            {
+                nextDeadline = (std::min)(nextDeadline, now + c_sessionTimeout);
+            }
+        }
+
+        for (const auto& due : m_dueDatagrams)
+        {
+            SendDue(due);
+        }
+
+        WaitUntil(nextDeadline);
+    }
+}
+
+long long DownlinkStreamer::TakeDue(Session& session, long long now) noexcept
+{
+    const auto first = session.m_nextSequenceNumber;
+    auto nextDeadline = c_noDeadline;
+    while (session.m_nextSequenceNumber < session.m_endSequenceNumber)
+    {
+        const auto deadline = Deadline(session, session.m_nextSequenceNumber);
+        // The datagrams still due past the limit are taken by the next pass, which does not wait
+        if (deadline > now || session.m_nextSequenceNumber - first >= c_maxDatagramsPerPass)
+        {
+            nextDeadline = deadline;
+            break;
+        }
+        session.m_nextSequenceNumber += 1;
+    }
+
+    if (session.m_nextSequenceNumber > first)
+    {
+        // Reserved for c_maxSessionCount sessions
+        m_dueDatagrams.push_back({&session, first, session.m_nextSequenceNumber});
+    }
+    return nextDeadline;
+}
+
+void DownlinkStreamer::SendDue(const DueDatagrams& due) noexcept
+{
+    auto& session = *due.m_session;
+    for (auto sequenceNumber = due.m_first; sequenceNumber < due.m_end; ++sequenceNumber)
+    {
+        // The send timestamp is taken from the server clock, at the last moment
+        session.m_header.m_sequenceNumber = sequenceNumber;
+        WriteDatagramHeader(session.m_datagram.data(), session.m_header);
+        const auto sendTimestamp = SnapTimestampInNanoSec();
+        StampDatagramSend(session.m_datagram.data(), sendTimestamp);
+        m_pacingError.Add((sendTimestamp - Deadline(session, sequenceNumber)) / 1'000);
+
+        WSABUF wsabuf;
+        wsabuf.buf = session.m_datagram.data();
+        wsabuf.len = static_cast<ULONG>(session.m_datagram.size());
+        DWORD bytesTransferred = 0;
+        if (SOCKET_ERROR ==
+            WSASendTo(m_socket, &wsabuf, 1, &bytesTransferred, 0, session.m_remoteAddress.sockaddr(), session.m_remoteAddressLength, nullptr, nullptr))
+        {
+            // best effort send, the datagram is lost for the client
+            FAILED_WIN32_LOG(WSAGetLastError());
+            m_failedSends += 1;
+        }
+        else
+        {
+            m_sentDatagrams += 1;
+            m_sentBytes += static_cast<long long>(session.m_datagram.size());
+        }
+    }
+}
+
+void DownlinkStreamer::WaitUntil(long long deadline) noexcept
+{
+    if (deadline == c_noDeadline)
+    {
+        WaitForSingleObject(m_sessionStarted.get(), INFINITE);
+        return;
+    }
+
+    // Sleep for the bulk of the wait, until a session starts
+    const auto sleepTime = deadline - SnapTimestampInNanoSec() - c_spinThreshold;
+    if (sleepTime > 0)
+    {
+        // Negative due time: relative, in 100ns
+        LARGE_INTEGER dueTime{};
+        dueTime.QuadPart = -(sleepTime / 100);
+        if (SetWaitableTimer(m_waitableTimer.get(), &dueTime, 0, nullptr, nullptr, FALSE))
+        {
+            const HANDLE handles[] = {m_waitableTimer.get(), m_sessionStarted.get()};
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+            {
+                CancelWaitableTimer(m_waitableTimer.get());
+                return;
+            }
+        }
+    }
+
+    // Spin for the rest
+    while (SnapTimestampInNanoSec() < deadline && !m_stopping)
+    {
+        YieldProcessor();
+    }
+}
+
+} // namespace multipath
@@ -0,0 +1,153 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "datagram_header.h"
+#include "lateness_histogram.h"
+#include "sockaddr.h"
+
+#include <WinSock2.h>
+#include <wil/resource.h>
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace multipath {
+
+// Streams paced, timestamped datagrams to the clients which request it: the server side of the downlink mode
+// - a session streams to one path of a client, identified by its address, flow and path, until the end sequence number
+//   of its last request. It lasts while the client renews its request, and stops c_sessionTimeout after the last one.
+// - the sessions of a flow share its schedule, started by its first request: datagram N is sent at the same time on
+//   each path, the paths of a client can be compared datagram by datagram like when the client sends them
+// - a single thread paces all the sessions: it sleeps on a high resolution timer until shortly before the next
+//   deadline, then spins until it. The deadlines are absolute, a late send does not delay the following ones.
+// - a session only starts or renews when the request carries the cookie of its address, flow and path, which the
+//   server echoes to every request: the stream goes to an address which received the echo, never to a spoofed one.
+// - the bitrate of each session and of all of them is capped, and each pass sends a bounded number of datagrams
+//   per session, outside of the lock taken by the requests.
+class DownlinkStreamer
+{
+public:
+    // The datagrams larger than this would be fragmented on most paths
+    static constexpr uint32_t c_maxDatagramSize = 1472;
+    static constexpr size_t c_maxSessionCount = 64;
+    static constexpr unsigned long long c_maxSessionBitrate = 250ull * 1024 * 1024; // 250 megabits per second
+    static constexpr unsigned long long c_maxTotalBitrate = 1024ull * 1024 * 1024; // 1 gigabit per second
+    static constexpr unsigned long long c_maxSessionDatagramRate = 50'000; // Datagrams per second
+    static constexpr uint32_t c_maxGrouping = 64;
+    // The datagrams sent on a session before the thread serves the others and the requests
+    static constexpr long long c_maxDatagramsPerPass = 32;
+    // The time after which a session whose request is not renewed stops
+    static constexpr long long c_sessionTimeout = 3'000'000'000; // 3 seconds
+    // Below this remaining time, the thread spins instead of sleeping
+    static constexpr long long c_spinThreshold = 500'000; // 500 us
+
+    // The datagrams are sent on the socket of the server, concurrently with the echoes
+    explicit DownlinkStreamer(SOCKET socket);
+    ~DownlinkStreamer() noexcept;
+
+    void Start();
+    void Stop() noexcept;
+
+    enum class RequestResult
+    {
+        Accepted,
+        // The request does not carry the cookie of its sender: it is echoed with the cookie, without stream
+        Challenged,
+        Refused
+    };
+
+    // Starts the session of a request, or renews it
+    RequestResult Request(
+        const ctl::ctSockaddr& remoteAddress, int remoteAddressLength, const DatagramHeader& header, const StreamRequest& request) noexcept;
+
+    // The cookie expected in the requests of an address, flow and path, echoed to all the requests
+    [[nodiscard]] uint64_t Cookie(const ctl::ctSockaddr& remoteAddress, const DatagramHeader& header) const noexcept;
+
+    // Prints the sessions and the pacing error, once stopped
+    void PrintStatistics() const;
+
+    DownlinkStreamer(const DownlinkStreamer&) = delete;
+    DownlinkStreamer& operator=(const DownlinkStreamer&) = delete;
+    DownlinkStreamer(DownlinkStreamer&&) = delete;
+    DownlinkStreamer& operator=(DownlinkStreamer&&) = delete;
+
+private:
+    static constexpr long long c_noDeadline = (std::numeric_limits<long long>::max)();
+
+    struct Session
+    {
+        ctl::ctSockaddr m_remoteAddress{};
+        int m_remoteAddressLength = 0;
+        uint32_t m_flowId = 0;
+        uint16_t m_pathId = 0;
+
+        // The schedule of the flow: the group of datagram N is due at m_start + (N / m_grouping) * m_tickInterval
+        long long m_start = 0;
+        double m_tickInterval = 0.;
+        long long m_grouping = 1;
+        unsigned long long m_bitrate = 0;
+
+        long long m_nextSequenceNumber = 0;
+        long long m_endSequenceNumber = 0;
+        long long m_lastRequest = 0;
+
+        // The header of the next datagram, followed by the payload shared by all the datagrams
+        DatagramHeader m_header{};
+        std::vector<char> m_datagram{};
+    };
+
+    // The datagrams [m_first, m_end) of a session, due in the current pass
+    struct DueDatagrams
+    {
+        Session* m_session = nullptr;
+        long long m_first = 0;
+        long long m_end = 0;
+    };
+
+    [[nodiscard]] static long long Deadline(const Session& session, long long sequenceNumber) noexcept;
+
+    void Run() noexcept;
+
+    // Takes the datagrams due on a session, at most c_maxDatagramsPerPass, and returns the deadline of the next one
+    long long TakeDue(Session& session, long long now) noexcept;
+
+    // Sends the datagrams taken by TakeDue, without the lock: the sessions are only removed by the thread
+    void SendDue(const DueDatagrams& due) noexcept;
+
+    // Sleeps then spins until the deadline, returns early when a session starts or when stopping
+    void WaitUntil(long long deadline) noexcept;
+
+    SOCKET m_socket = INVALID_SOCKET;
+    // The SipHash key of the cookies, drawn at construction
+    std::array<uint64_t, 2> m_cookieKey{};
+    wil::unique_handle m_waitableTimer;
+    wil::unique_event m_sessionStarted{wil::EventOptions::None};
+    std::thread m_thread{};
+    std::atomic<bool> m_stopping{false};
+
+    // Serializes the requests and the schedule of the sessions, the datagrams are sent without it
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<Session>> m_sessions{};
+    // Only used by the thread
+    std::vector<DueDatagrams> m_dueDatagrams{};
+
+    // Updated with the lock held
+    long long m_startedSessions = 0;
+    long long m_challengedRequests = 0;
+    long long m_refusedRequests = 0;
+    // Updated by the thread, read once stopped
+    long long m_sentDatagrams = 0;
+    long long m_sentBytes = 0;
+    long long m_failedSends = 0;
+    // Time a datagram was sent after its deadline
+    LatenessHistogram m_pacingError{};
+};
+
+} // namespace multipath
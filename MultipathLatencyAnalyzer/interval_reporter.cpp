@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "interval_reporter.h"
+#include "logs.h"
+#include "time_utils.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include <wil/result.h>
+
+namespace multipath {
+
+IntervalReporter::IntervalReporter(
+    unsigned long intervalInMs,
+    int significantDigits,
+    std::vector<std::string> pathNames,
+    std::vector<std::pair<PathSet, std::string>> combinations) :
+    m_intervalInMs(intervalInMs),
+    m_pathNames(std::move(pathNames)),
+    m_combinations(std::move(combinations)),
+    m_current(m_pathNames.size(), m_combinations.size(), significantDigits),
+    m_reported(m_pathNames.size(), m_combinations.size(), significantDigits)
+{
+    m_reportWork = CreateThreadpoolWork(ReportCallback, this, nullptr);
+    THROW_LAST_ERROR_IF_MSG(!m_reportWork, "CreateThreadpoolWork failed");
+}
+
+IntervalReporter::~IntervalReporter() noexcept
+{
+    Stop();
+    CloseThreadpoolWork(m_reportWork);
+}
+
+void IntervalReporter::Start() noexcept
+{
+    m_startTime = SnapQpcInMicroSec();
+    m_nextReport = m_startTime + static_cast<long long>(m_intervalInMs) * 1000;
+}
+
+void IntervalReporter::Stop() noexcept
+{
+    // The writer stops, the last report being printed completes
+    m_stopped = true;
+    WaitForThreadpoolWorkCallbacks(m_reportWork, false);
+}
+
+void IntervalReporter::Poll() noexcept
+{
+    const auto now = SnapQpcInMicroSec();
+    if (m_stopped || now < m_nextReport || m_reporting.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // m_reported was reset by the previous report
+    std::swap(m_current, m_reported);
+    m_reportedElapsed = now - m_startTime;
+    const auto interval = static_cast<long long>(m_intervalInMs) * 1000;
+    m_nextReport += ((now - m_nextReport) / interval + 1) * interval;
+
+    m_reporting.store(true, std::memory_order_release);
+    SubmitThreadpoolWork(m_reportWork);
+}
+
+void IntervalReporter::AddSent(size_t path, long long count) noexcept
+{
+    m_current.m_paths[path].m_sent += count;
+}
+
+void IntervalReporter::AddReceived(size_t path, long long latency) noexcept
+{
+    m_current.m_paths[path].m_latencies.Add(latency);
+}
+
+void IntervalReporter::AddLost(size_t path) noexcept
+{
+    m_current.m_paths[path].m_lost += 1;
+}
+
+void IntervalReporter::AddCombinedSent(size_t combination, long long count) noexcept
+{
+    m_current.m_combinations[combination].m_sent += count;
+}
+
+void IntervalReporter::AddCombinedReceived(size_t combination, long long latency, size_t receivedOnPath) noexcept
+{
+    auto& statistics = m_current.m_combinations[combination];
+    statistics.m_latencies.Add(latency);
+    statistics.m_receivedFirst[receivedOnPath] += 1;
+}
+
+void IntervalReporter::AddCombinedLost(size_t combination) noexcept
+{
+    m_current.m_combinations[combination].m_lost += 1;
+}
+
+void CALLBACK IntervalReporter::ReportCallback(PTP_CALLBACK_INSTANCE /*instance*/, PVOID context, PTP_WORK /*work*/) noexcept
+{
+    static_cast<IntervalReporter*>(context)->Report();
+}
+
+void IntervalReporter::Report() noexcept
+{
+    // Align the columns on the longest name
+    int nameWidth = 9;
+    for (const auto& name : m_pathNames)
+    {
+        nameWidth = (std::max)(nameWidth, static_cast<int>(name.size()));
+    }
+    for (const auto& [paths, name] : m_combinations)
+    {
+        nameWidth = (std::max)(nameWidth, static_cast<int>(name.size()));
+    }
+
+    const auto elapsedInSeconds = m_reportedElapsed / 1'000'000.;
+    auto printPath = [&](const std::string& name, const PathStatistics& statistics) {
+        Log<LogLevel::Output>(
+            "[%8.1f s] %-*s | sent %6lld | received %6lld | lost %6lld | p50 %8.2f ms | p99 %8.2f ms\n",
+            elapsedInSeconds,
+            nameWidth,
+            name.c_str(),
+            statistics.m_sent,
+            statistics.m_latencies.Count(),
+            statistics.m_lost,
+            statistics.m_latencies.ValueAtPercentile(50.) / 1'000'000.,
+            statistics.m_latencies.ValueAtPercentile(99.) / 1'000'000.);
+    };
+
+    for (size_t i = 0; i < m_pathNames.size(); ++i)
+    {
+        printPath(m_pathNames[i], m_reported.m_paths[i]);
+    }
+    for (size_t i = 0; i < m_combinations.size(); ++i)
+    {
+        printPath(m_combinations[i].second, m_reported.m_combinations[i]);
+    }
+
+    // How the first copies of the datagrams are distributed on the paths of each combination, e.g. to see the
+    // secondary interface taking over
+    for (size_t i = 0; i < m_combinations.size(); ++i)
+    {
+        const auto [paths, name] = m_combinations[i];
+        std::string distribution;
+        for (size_t path = 0; path < m_pathNames.size(); ++path)
+        {
+            if (ContainsPath(paths, path))
+            {
+                distribution += (distribution.empty() ? "" : ", ") + m_pathNames[path] + ' ' +
+                                std::to_string(m_reported.m_combinations[i].m_receivedFirst[path]);
+            }
+        }
+        Log<LogLevel::Output>("[%8.1f s] %s received first on: %s\n", elapsedInSeconds, name.c_str(), distribution.c_str());
+    }
+
+    // Handed back to the writer
+    m_reported.Reset();
+    m_reporting.store(false, std::memory_order_release);
+}
+
+} // namespace multipath
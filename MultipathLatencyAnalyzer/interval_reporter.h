@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <Windows.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "latencyStatistics.h"
+#include "latency_histogram.h"
+
+namespace multipath {
+
+// Periodically prints the statistics of the last interval, while the client is running
+// - the statistics are updated as the datagrams are sent and received, the cost of a report does not depend on the
+//   length of the run
+// - latencies and received datagrams are reported in the interval they were received, the lost datagrams in the
+//   interval their loss timeout expired
+// - the combinations of paths report the first copy of each datagram, e.g. the effective latency of all the paths
+// - the statistics are updated by a single thread, the timer of the client, without lock: at the end of each interval
+//   it hands them over to a threadpool work item which prints them, and keeps counting in a second set
+class IntervalReporter
+{
+public:
+    // A line is printed for each path, then for each combination of paths
+    IntervalReporter(
+        unsigned long intervalInMs,
+        int significantDigits,
+        std::vector<std::string> pathNames,
+        std::vector<std::pair<PathSet, std::string>> combinations);
+
+    void Start() noexcept;
+    void Stop() noexcept;
+
+    // Called by the writer at each tick: hands the statistics over to the report once the interval ended. A report
+    // still printing delays the handover, the next report covers the intervals missed.
+    void Poll() noexcept;
+
+    void AddSent(size_t path, long long count) noexcept;
+    void AddReceived(size_t path, long long latency) noexcept;
+    void AddLost(size_t path) noexcept;
+
+    // The first copy of a datagram sent or received, on any path of a combination
+    void AddCombinedSent(size_t combination, long long count) noexcept;
+    void AddCombinedReceived(size_t combination, long long latency, size_t receivedOnPath) noexcept;
+    void AddCombinedLost(size_t combination) noexcept;
+
+    // Not copyable or movable
+    IntervalReporter(const IntervalReporter&) = delete;
+    IntervalReporter& operator=(const IntervalReporter&) = delete;
+    IntervalReporter(IntervalReporter&&) = delete;
+    IntervalReporter& operator=(IntervalReporter&&) = delete;
+
+    ~IntervalReporter() noexcept;
+
+private:
+    struct PathStatistics
+    {
+        explicit PathStatistics(int significantDigits) : m_latencies(significantDigits)
+        {
+        }
+
+        void Reset() noexcept
+        {
+            m_sent = 0;
+            m_lost = 0;
+            m_latencies.Reset();
+            m_receivedFirst.fill(0);
+        }
+
+        long long m_sent = 0;
+        long long m_lost = 0;
+        LatencyHistogram m_latencies;
+        // For a combination, the number of datagrams first received on each path
+        std::array<long long, c_maxPathCount> m_receivedFirst{};
+    };
+
+    struct IntervalStatistics
+    {
+        IntervalStatistics(size_t pathCount, size_t combinationCount, int significantDigits) :
+            m_paths(pathCount, PathStatistics{significantDigits}),
+            m_combinations(combinationCount, PathStatistics{significantDigits})
+        {
+        }
+
+        void Reset() noexcept
+        {
+            for (auto& statistics : m_paths)
+            {
+                statistics.Reset();
+            }
+            for (auto& statistics : m_combinations)
+            {
+                statistics.Reset();
+            }
+        }
+
+        std::vector<PathStatistics> m_paths;
+        std::vector<PathStatistics> m_combinations;
+    };
+
+    static void CALLBACK ReportCallback(PTP_CALLBACK_INSTANCE /*instance*/, PVOID context, PTP_WORK /*work*/) noexcept;
+    void Report() noexcept;
+
+    unsigned long m_intervalInMs = 0;
+    long long m_startTime = 0;
+    // Only accessed by the writer
+    long long m_nextReport = 0;
+    bool m_stopped = false;
+
+    std::vector<std::string> m_pathNames;
+    std::vector<std::pair<PathSet, std::string>> m_combinations;
+
+    // Updated by the writer
+    IntervalStatistics m_current;
+    // Swapped with m_current at the end of an interval, then owned by the report until it clears m_reporting
+    IntervalStatistics m_reported;
+    long long m_reportedElapsed = 0;
+    std::atomic<bool> m_reporting{false};
+
+    PTP_WORK m_reportWork = nullptr;
+};
+
+} // namespace multipath
@@ -4,158 +4,422 @@
 #include "latencyStatistics.h"
 
 #include <algorithm>
-#include <functional>
+#include <bit>
+#include <stdexcept>
 #include <iostream>
 #include <iomanip>
-#include <limits>
-#include <numeric>
-#include <ranges>
-#include <vector>
 #include <cmath>
 
 namespace multipath {
 
-constexpr double ConvertMicrosToMillis(long long micros) noexcept
+constexpr double ConvertNanosToMicros(long long nanos) noexcept
 {
-    return micros / 1'000.;
+    return nanos / 1'000.;
 }
 
-constexpr double ConvertMicrosToSeconds(long long micros)
+constexpr double ConvertNanosToMillis(long long nanos) noexcept
 {
-    return micros / 1'000'000.;
+    return nanos / 1'000'000.;
 }
 
-template <std::ranges::range R, class T>
-[[nodiscard]] constexpr T accumulate(R&& range, T val)
+constexpr double ConvertNanosToSeconds(long long nanos)
 {
-    return std::accumulate(std::begin(range), std::end(range), val);
+    return nanos / 1'000'000'000.;
 }
 
-template <std::ranges::range R>
-auto to_vector(R&& r, size_t sizeHint = 0)
+std::string DefaultPathName(size_t path)
 {
-    std::vector<std::ranges::range_value_t<R>> v;
+    switch (path)
+    {
+    case 0:
+        return "primary";
+    case 1:
+        return "secondary";
+    default:
+        return "path " + std::to_string(path);
+    }
+}
 
-    // if we can get a size, reserve that much
-    if (sizeHint != 0)
+void LossRunStatistics::Add(bool lost) noexcept
+{
+    const auto index = m_datagrams;
+    m_datagrams += 1;
+
+    if (!lost)
     {
-        v.reserve(sizeHint);
+        if (m_lossRun > 0)
+        {
+            m_lossRuns.Add(m_lossRun);
+            m_lossRun = 0;
+        }
+        m_receivedRun += 1;
+        return;
     }
 
-    // push all the elements
-    for (auto&& e : r)
+    m_losses += 1;
+    // The datagrams received before the first loss are not between two losses
+    if (m_receivedRun > 0 && m_losses > 1)
     {
-        v.push_back(static_cast<decltype(e)&&>(e));
+        m_receivedRuns.Add(m_receivedRun);
     }
+    m_lossRun += 1;
 
-    return v;
+    if (m_burstLosses > 0 && m_receivedRun < c_minGap)
+    {
+        m_burstLosses += 1;
+        m_burstEnd = index;
+    }
+    else
+    {
+        CloseBurst();
+        m_burstStart = index;
+        m_burstEnd = index;
+        m_burstLosses = 1;
+    }
+    m_receivedRun = 0;
 }
 
-void PrintLatencyStatistics(LatencyData& data)
+void LossRunStatistics::CloseBurst() noexcept
 {
-    using namespace std::views;
+    // A single loss is an isolated loss
+    if (m_burstLosses > 1)
+    {
+        m_bursts += 1;
+        m_burstDatagrams += m_burstEnd - m_burstStart + 1;
+        m_burstDatagramsLost += m_burstLosses;
+    }
+    m_burstLosses = 0;
+}
 
-    // Lambdas for selecting, filtering and transforming data
-    auto selectPrimary = [](const LatencyMeasure& stat) {
-        return std::make_pair(stat.m_primarySendTimestamp, stat.m_primaryReceiveTimestamp);
-    };
-    auto selectSecondary = [](const LatencyMeasure& stat) {
-        return std::make_pair(stat.m_secondarySendTimestamp, stat.m_secondaryReceiveTimestamp);
-    };
-    auto selectEffective = [](const LatencyMeasure& stat) {
-        auto effectiveSend = -1LL;
-        if (stat.m_primarySendTimestamp >= 0 && stat.m_secondarySendTimestamp >= 0)
+void LossRunStatistics::Merge(const LossRunStatistics& other) noexcept
+{
+    m_datagrams += other.m_datagrams;
+    m_losses += other.m_losses;
+    m_lossRuns.Merge(other.m_lossRuns);
+    m_receivedRuns.Merge(other.m_receivedRuns);
+    m_bursts += other.m_bursts;
+    m_burstDatagrams += other.m_burstDatagrams;
+    m_burstDatagramsLost += other.m_burstDatagramsLost;
+}
+
+GilbertElliottModel LossRunStatistics::FitGilbertElliott() const noexcept
+{
+    auto ratio = [](long long a, long long b) { return b > 0 ? static_cast<double>(a) / b : 0.; };
+
+    const auto goodDatagrams = m_datagrams - m_burstDatagrams;
+    GilbertElliottModel model;
+    model.m_goodToBad = ratio(m_bursts, goodDatagrams);
+    model.m_badToGood = ratio(m_bursts, m_burstDatagrams);
+    model.m_lossInGood = ratio(m_losses - m_burstDatagramsLost, goodDatagrams);
+    model.m_lossInBad = ratio(m_burstDatagramsLost, m_burstDatagrams);
+    return model;
+}
+
+LatencyData::LatencyData(
+    size_t pathCount, int significantDigits, const std::vector<PathSet>& combinations, const std::vector<std::string>& pathNames) :
+    m_sendOverhead(significantDigits), m_receiveOverhead(significantDigits)
+{
+    if (pathCount < 1 || pathCount > c_maxPathCount)
+    {
+        throw std::invalid_argument("Invalid number of paths");
+    }
+
+    m_paths.reserve(pathCount);
+    for (size_t i = 0; i < pathCount; ++i)
+    {
+        m_paths.emplace_back(i < pathNames.size() ? pathNames[i] : DefaultPathName(i), significantDigits);
+    }
+
+    if (combinations.empty())
+    {
+        m_combinations.emplace_back(AllPaths(pathCount), significantDigits);
+    }
+    for (const auto paths : combinations)
+    {
+        if (paths == 0 || (paths & ~AllPaths(pathCount)) != 0)
         {
-            effectiveSend = std::min(stat.m_primarySendTimestamp, stat.m_secondarySendTimestamp);
+            throw std::invalid_argument("Invalid combination of paths");
         }
-        else
+        m_combinations.emplace_back(paths, significantDigits);
+    }
+}
+
+std::string LatencyData::CombinationName(const CombinedPathsData& combination) const
+{
+    std::string name;
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        if (ContainsPath(combination.m_paths, i))
         {
-            effectiveSend = std::max(stat.m_primarySendTimestamp, stat.m_secondarySendTimestamp);
+            name += name.empty() ? m_paths[i].m_name : " + " + m_paths[i].m_name;
         }
+    }
+    return name;
+}
 
-        auto effectiveReceive = -1LL;
-        if (stat.m_primaryReceiveTimestamp >= 0 && stat.m_secondaryReceiveTimestamp >= 0)
+void LatencyData::Add(const LatencyMeasure& measure) noexcept
+{
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        if (measure.m_paths[i].m_send >= 0)
         {
-            effectiveReceive = std::min(stat.m_primaryReceiveTimestamp, stat.m_secondaryReceiveTimestamp);
+            m_paths[i].m_latency.AddSent();
+            if (measure.m_paths[i].m_receive >= 0)
+            {
+                m_paths[i].m_latency.AddLatency(measure.m_paths[i].m_receive - measure.m_paths[i].m_send);
+            }
+            m_paths[i].m_lossRuns.Add(measure.m_paths[i].m_receive < 0);
         }
-        else
+        AddKernelTimestamps(m_paths[i], measure.m_paths[i]);
+
+        const auto& timestamps = measure.m_paths[i];
+        if (timestamps.m_send >= 0)
         {
-            effectiveReceive = std::max(stat.m_primaryReceiveTimestamp, stat.m_secondaryReceiveTimestamp);
+            // The datagrams not sent on the path do not break the sequence, the lost ones do
+            const auto latency = timestamps.m_receive >= 0 ? timestamps.m_receive - timestamps.m_send : -1;
+            if (latency >= 0 && m_paths[i].m_previousLatency >= 0)
+            {
+                m_paths[i].m_delayVariation.AddLatency(std::abs(latency - m_paths[i].m_previousLatency));
+            }
+            m_paths[i].m_previousLatency = latency;
         }
-        return std::make_pair(effectiveSend, effectiveReceive);
-    };
 
-    auto received = [](const auto& timestamps) { return timestamps.second >= 0; };
-    auto receivedOnOneInterface = [](const LatencyMeasure& stat) {
-        return stat.m_primaryReceiveTimestamp >= 0 || stat.m_secondaryReceiveTimestamp >= 0;
-    };
-    auto receivedFirstOnSecondary = [](const auto& stat) {
-        return stat.m_secondaryReceiveTimestamp >= 0 &&
-               (stat.m_primaryReceiveTimestamp < 0 || stat.m_secondaryReceiveTimestamp < stat.m_primaryReceiveTimestamp);
-    };
+        // A STAMP reflector timestamps the receive and the send of the echo, the time in between is subtracted
+        const auto reflectorReceive = timestamps.m_reflectorReceive >= 0 ? timestamps.m_reflectorReceive : timestamps.m_echo;
+        if (timestamps.m_reflectorReceive >= 0 && timestamps.m_echo >= 0 && timestamps.m_receive >= 0)
+        {
+            const auto reflectorDelay = timestamps.m_echo - timestamps.m_reflectorReceive;
+            m_paths[i].m_reflectorDelay.AddLatency(reflectorDelay);
+            m_paths[i].m_networkLatency.AddLatency(timestamps.m_receive - timestamps.m_send - reflectorDelay);
+        }
 
-    auto latency = [](const auto& timestamps) { return timestamps.second - timestamps.first; };
+        if (m_clock && timestamps.m_send >= 0 && timestamps.m_echo >= 0 && timestamps.m_receive >= 0)
+        {
+            m_paths[i].m_uplink.AddLatency(m_clock->ToClientTime(reflectorReceive) - timestamps.m_send);
+            m_paths[i].m_downlink.AddLatency(timestamps.m_receive - m_clock->ToClientTime(timestamps.m_echo));
+        }
+    }
 
-    auto sum = [](auto& data) { return accumulate(data, 0LL); };
-    auto average = [](auto& data) { return data.size() > 0 ? accumulate(data, 0LL) / data.size() : 0LL; };
-    auto percent = [](auto a, auto b) { return b > 0 ? a * 100. / b : 0.; };
-    auto median = [](const auto& data) { return data.size() > 0 ? data[data.size() / 2] : 0LL; };
-    auto interquartileRange = [](const auto& data) {
-        const auto s = data.size();
-        return s > 0 ? data[3 * s / 4] - data[s / 4] : 0LL;
-    };
+    for (auto& combination : m_combinations)
+    {
+        const auto effectiveSend = measure.FirstSend(combination.m_paths);
+        if (effectiveSend < 0)
+        {
+            continue;
+        }
+        combination.m_effective.AddSent();
+
+        // The other paths of the set, when they are used to recover the losses of the lowest one
+        const auto reference = static_cast<size_t>(std::countr_zero(combination.m_paths));
+        if (measure.m_paths[reference].m_send >= 0 && measure.m_paths[reference].m_receive < 0)
+        {
+            for (size_t i = reference + 1; i < m_paths.size(); ++i)
+            {
+                if (ContainsPath(combination.m_paths, i) && measure.m_paths[i].m_send >= 0)
+                {
+                    combination.m_lostOnReference[i] += 1;
+                    if (measure.m_paths[i].m_receive >= 0)
+                    {
+                        combination.m_deliveredWhenReferenceLost[i] += 1;
+                    }
+                }
+            }
+        }
 
-    auto standardDeviation = [](auto& data, auto average) {
-        if (data.size() == 0)
+        const auto effectiveReceive = measure.FirstReceive(combination.m_paths);
+        if (effectiveReceive < 0)
         {
-            return 0LL;
+            continue;
         }
+        combination.m_effective.AddLatency(effectiveReceive - effectiveSend);
+
+        // On a tie, the first received is the path with the lowest index
+        for (size_t i = 0; i < m_paths.size(); ++i)
+        {
+            if (ContainsPath(combination.m_paths, i) && measure.m_paths[i].m_receive == effectiveReceive)
+            {
+                combination.m_receivedFirst[i] += 1;
+                break;
+            }
+        }
+    }
+
+    const auto firstSend = measure.FirstSend(AllPaths(m_paths.size()));
+    if (measure.FirstReceive(AllPaths(m_paths.size())) >= 0)
+    {
+        if (m_firstReceivedSendTimestamp < 0)
+        {
+            m_firstReceivedSendTimestamp = firstSend;
+        }
+        m_lastReceivedSendTimestamp = firstSend;
+    }
+}
+
+void LatencyData::AddKernelTimestamps(PathData& path, const PathTimestamps& timestamps) noexcept
+{
+    if (timestamps.m_kernelSend >= 0 && timestamps.m_send >= 0)
+    {
+        m_sendOverhead.AddLatency(timestamps.m_kernelSend - timestamps.m_send);
+    }
+    if (timestamps.m_kernelReceive >= 0 && timestamps.m_receive >= 0)
+    {
+        m_receiveOverhead.AddLatency(timestamps.m_receive - timestamps.m_kernelReceive);
+    }
+
+    // Only the datagrams with both kernel timestamps are accounted, the loss is measured by the application
+    if (timestamps.m_kernelSend >= 0 && timestamps.m_kernelReceive >= 0)
+    {
+        path.m_kernel.AddSent();
+        path.m_kernel.AddLatency(timestamps.m_kernelReceive - timestamps.m_kernelSend);
+    }
+}
 
-        auto r = 0LL;
-        for (const auto& d: data)
+void LatencyData::Merge(const LatencyData& other) noexcept
+{
+    for (size_t i = 0; i < m_paths.size() && i < other.m_paths.size(); ++i)
+    {
+        auto& path = m_paths[i];
+        const auto& otherPath = other.m_paths[i];
+        path.m_latency.Merge(otherPath.m_latency);
+        path.m_kernel.Merge(otherPath.m_kernel);
+        path.m_uplink.Merge(otherPath.m_uplink);
+        path.m_downlink.Merge(otherPath.m_downlink);
+        path.m_reflectorDelay.Merge(otherPath.m_reflectorDelay);
+        path.m_networkLatency.Merge(otherPath.m_networkLatency);
+        path.m_delayVariation.Merge(otherPath.m_delayVariation);
+        path.m_lossRuns.Merge(otherPath.m_lossRuns);
+        path.m_corruptDatagrams += otherPath.m_corruptDatagrams;
+        path.m_foreignDatagrams += otherPath.m_foreignDatagrams;
+        path.m_corruptPayloads += otherPath.m_corruptPayloads;
+        path.m_lateDatagrams += otherPath.m_lateDatagrams;
+        path.m_duplicateDatagrams += otherPath.m_duplicateDatagrams;
+        path.m_reportedBytes += otherPath.m_reportedBytes;
+    }
+
+    for (size_t i = 0; i < m_combinations.size() && i < other.m_combinations.size(); ++i)
+    {
+        auto& combination = m_combinations[i];
+        const auto& otherCombination = other.m_combinations[i];
+        combination.m_effective.Merge(otherCombination.m_effective);
+        for (size_t j = 0; j < c_maxPathCount; ++j)
         {
-            r += d * d;
+            combination.m_receivedFirst[j] += otherCombination.m_receivedFirst[j];
+            combination.m_lostOnReference[j] += otherCombination.m_lostOnReference[j];
+            combination.m_deliveredWhenReferenceLost[j] += otherCombination.m_deliveredWhenReferenceLost[j];
         }
-        return static_cast<long long>(std::sqrt(r / data.size() - average * average));
+    }
+
+    m_sendOverhead.Merge(other.m_sendOverhead);
+    m_receiveOverhead.Merge(other.m_receiveOverhead);
+
+    if (other.m_firstReceivedSendTimestamp >= 0 &&
+        (m_firstReceivedSendTimestamp < 0 || other.m_firstReceivedSendTimestamp < m_firstReceivedSendTimestamp))
+    {
+        m_firstReceivedSendTimestamp = other.m_firstReceivedSendTimestamp;
+    }
+    m_lastReceivedSendTimestamp = std::max(m_lastReceivedSendTimestamp, other.m_lastReceivedSendTimestamp);
+
+    m_datagramSize = std::max(m_datagramSize, other.m_datagramSize);
+}
+
+namespace {
+    // The latencies measured against a STAMP reflector or with header echoes, without the time it took to reflect the
+    // datagrams, and the uplink throughput reported by the server with header echoes
+    void PrintReflectorDelays(const LatencyData& data)
+    {
+        std::cout << '\n';
+        std::cout << "--- REFLECTOR ---\n";
+        std::cout << '\n';
+        std::cout << "Between the receive and send timestamps of the reflector, and the latencies without it "
+                     "(p50 / p90 / p99 / p99.9 / max)\n";
+        for (const auto& path : data.m_paths)
+        {
+            const auto& reflector = path.m_reflectorDelay;
+            if (reflector.Received() == 0)
+            {
+                continue;
+            }
+            const auto& network = path.m_networkLatency;
+            std::cout << "Reflector delay on " << path.m_name << " interface: " << ConvertNanosToMicros(reflector.Percentile(50.))
+                      << " / " << ConvertNanosToMicros(reflector.Percentile(90.)) << " / "
+                      << ConvertNanosToMicros(reflector.Percentile(99.)) << " / "
+                      << ConvertNanosToMicros(reflector.Percentile(99.9)) << " / " << ConvertNanosToMicros(reflector.Max())
+                      << " us\n";
+            std::cout << "Latency without the reflector on " << path.m_name
+                      << " interface: " << ConvertNanosToMillis(network.Percentile(50.)) << " / "
+                      << ConvertNanosToMillis(network.Percentile(90.)) << " / "
+                      << ConvertNanosToMillis(network.Percentile(99.)) << " / "
+                      << ConvertNanosToMillis(network.Percentile(99.9)) << " / " << ConvertNanosToMillis(network.Max())
+                      << " ms\n";
+        }
+
+        // The bytes of the datagrams whose echo was lost are not reported, the uplink throughput is a lower bound
+        const auto runDuration = ConvertNanosToSeconds(data.m_lastReceivedSendTimestamp - data.m_firstReceivedSendTimestamp);
+        for (const auto& path : data.m_paths)
+        {
+            if (path.m_reportedBytes == 0)
+            {
+                continue;
+            }
+            std::cout << "Uplink throughput reported by the server on " << path.m_name << " interface: "
+                      << (runDuration > 0 ? path.m_reportedBytes / 1024. * 8 / runDuration : 0.) << " kb/s ("
+                      << path.m_reportedBytes / 1024 << " kB received)\n";
+        }
+    }
+
+    void PrintOneWayDelays(const LatencyData& data)
+    {
+        const auto& clock = *data.m_clock;
+        std::cout << '\n';
+        std::cout << "--- ONE-WAY DELAYS ---\n";
+        std::cout << '\n';
+        std::cout << "Server clock offset: " << ConvertNanosToMillis(std::llround(clock.m_offset))
+                  << " ms, skew: " << clock.m_skew * 1'000'000. << " ppm (largest deviation from the fit: "
+                  << clock.m_deviation / 1'000. << " us)\n";
+        std::cout << "The delays assume the minimum delays are the same in both directions\n";
+
+        auto printDelays = [](const std::string& name, const LatencyAggregate& aggregate) {
+            std::cout << name << ": " << ConvertNanosToMillis(aggregate.Percentile(50.)) << " / "
+                      << ConvertNanosToMillis(aggregate.Percentile(90.)) << " / "
+                      << ConvertNanosToMillis(aggregate.Percentile(99.)) << " / "
+                      << ConvertNanosToMillis(aggregate.Percentile(99.9)) << " / " << ConvertNanosToMillis(aggregate.Max())
+                      << " ms\n";
+        };
+
+        std::cout << '\n';
+        std::cout << "One-way delays (p50 / p90 / p99 / p99.9 / max)\n";
+        for (const auto& path : data.m_paths)
+        {
+            if (path.m_uplink.Received() == 0)
+            {
+                continue;
+            }
+            printDelays("Uplink delay on " + path.m_name + " interface", path.m_uplink);
+            printDelays("Downlink delay on " + path.m_name + " interface", path.m_downlink);
+        }
+    }
+} // namespace
+
+void PrintLatencyStatistics(const LatencyData& data)
+{
+    auto percent = [](auto a, auto b) { return b > 0 ? a * 100. / b : 0.; };
+
+    const auto& paths = data.m_paths;
+    const auto& combinations = data.m_combinations;
+
+    auto interfaceName = [&](size_t path) { return paths[path].m_name + " interface"; };
+    // The combinations are only named when there are several
+    auto combinationName = [&](const CombinedPathsData& combination) {
+        return combinations.size() > 1 ? "combined interfaces (" + data.CombinationName(combination) + ")"
+                                       : std::string{"combined interfaces"};
+    };
+    // The path with the lowest index in a combination is the reference the combination is compared to
+    auto referencePath = [&](const CombinedPathsData& combination) {
+        return static_cast<size_t>(std::countr_zero(combination.m_paths));
     };
 
-    const auto& latencies = data.m_latencies;
-
-    // Compute latencies on primary, secondary or both simultaneously
-    auto primaryLatencies =
-        to_vector(latencies | transform(selectPrimary) | filter(received) | transform(latency), latencies.size());
-    auto secondaryLatencies =
-        to_vector(latencies | transform(selectSecondary) | filter(received) | transform(latency), latencies.size());
-    auto effectiveLatencies =
-        to_vector(latencies | transform(selectEffective) | filter(received) | transform(latency), latencies.size());
-
-    // Sort the data for median computation
-    std::ranges::sort(primaryLatencies);
-    std::ranges::sort(secondaryLatencies);
-    std::ranges::sort(effectiveLatencies);
-
-    const long long primarySentDatagrams =
-        std::ranges::count_if(latencies, [](const auto& stat) { return stat.m_primarySendTimestamp >= 0; });
-    const long long secondarySentDatagrams =
-        std::ranges::count_if(latencies, [](const auto& stat) { return stat.m_secondarySendTimestamp >= 0; });
-    const long long aggregatedSentDatagrams = std::ranges::count_if(
-        latencies, [](const auto& stat) { return stat.m_primarySendTimestamp >= 0 || stat.m_secondarySendTimestamp >= 0; });
-    const long long receivedOnSecondaryFirst = std::ranges::count_if(latencies, receivedFirstOnSecondary);
-
-    const long long primaryReceivedDatagrams = primaryLatencies.size();
-    const long long secondaryReceivedDatagrams = secondaryLatencies.size();
-    const long long aggregatedReceivedDatagrams = effectiveLatencies.size();
-
-    const long long primaryLostDatagrams = primarySentDatagrams - primaryReceivedDatagrams;
-    const long long secondaryLostDatagrams = secondarySentDatagrams - secondaryReceivedDatagrams;
-    const long long aggregatedLostDatagrams = aggregatedSentDatagrams - aggregatedReceivedDatagrams;
-
-    const long long sumPrimaryLatencies = sum(primaryLatencies);
-    const long long sumEffectiveLatencies = sum(effectiveLatencies);
-
-    const auto secondaryTimeSave = std::max(sumPrimaryLatencies - sumEffectiveLatencies, 0LL);
-    auto effectiveTimestamps = latencies | transform(selectEffective) | filter(received);
-    const auto runDuration = ConvertMicrosToSeconds(effectiveTimestamps.back().first - effectiveTimestamps.front().first);
+    const long long aggregatedSentDatagrams = data.Effective().Sent();
+    const auto runDuration = ConvertNanosToSeconds(data.m_lastReceivedSendTimestamp - data.m_firstReceivedSendTimestamp);
     const auto byteTransfered = aggregatedSentDatagrams * data.m_datagramSize / 1024;
     const auto bitRate = runDuration > 0 ? byteTransfered * 8 / runDuration : 0;
 
@@ -167,116 +431,261 @@ void PrintLatencyStatistics(LatencyData& data)
     std::cout << "                            STATISTICS                                 \n";
     std::cout << "-----------------------------------------------------------------------\n";
 
-    // Effect of the secondary interface
+    // Effect of the additional interfaces
     std::cout << '\n';
     std::cout << "--- OVERVIEW ---\n";
     std::cout << '\n';
     std::cout << byteTransfered << " kB (" << aggregatedSentDatagrams
               << " datagrams) were sent in " << runDuration << " seconds. The effective bitrate was "
               << bitRate << " kb/s.\n";
-    std::cout << '\n';
-    std::cout << "The secondary interface prevented " << primaryLostDatagrams - aggregatedLostDatagrams << " lost datagrams.\n";
-    std::cout << "The secondary interface reduced the overall time waiting for datagrams by " << ConvertMicrosToMillis(secondaryTimeSave)
-              << " ms (" << percent(secondaryTimeSave, sumPrimaryLatencies) << "%).\n";
-    std::cout << receivedOnSecondaryFirst << " datagrams were received first on the secondary interface ("
-              << percent(receivedOnSecondaryFirst, aggregatedReceivedDatagrams) << "%).\n";
+
+    for (const auto& combination : combinations)
+    {
+        const auto& effective = combination.m_effective;
+        const auto reference = referencePath(combination);
+        const auto& referenceLatency = paths[reference].m_latency;
+        const auto timeSave = std::max(referenceLatency.Sum() - effective.Sum(), 0LL);
+
+        // The other paths of the combination, e.g. "secondary interface"
+        std::string addedInterfaces;
+        for (size_t i = reference + 1; i < paths.size(); ++i)
+        {
+            if (ContainsPath(combination.m_paths, i))
+            {
+                addedInterfaces += addedInterfaces.empty() ? paths[i].m_name : " + " + paths[i].m_name;
+            }
+        }
+        const auto addedPathCount = std::popcount(combination.m_paths) - 1;
+        addedInterfaces += addedPathCount > 1 ? " interfaces" : " interface";
+
+        std::cout << '\n';
+        if (addedPathCount > 0)
+        {
+            std::cout << "The " << addedInterfaces << " prevented " << referenceLatency.Lost() - effective.Lost()
+                      << " lost datagrams on the " << interfaceName(reference) << ".\n";
+            std::cout << "The " << addedInterfaces << " reduced the overall time waiting for datagrams by "
+                      << ConvertNanosToMillis(timeSave) << " ms (" << percent(timeSave, referenceLatency.Sum()) << "%).\n";
+            for (size_t i = reference + 1; i < paths.size(); ++i)
+            {
+                if (ContainsPath(combination.m_paths, i) && combination.m_lostOnReference[i] > 0)
+                {
+                    std::cout << "When the " << interfaceName(reference) << " lost a datagram, the " << interfaceName(i)
+                              << " delivered it "
+                              << percent(combination.m_deliveredWhenReferenceLost[i], combination.m_lostOnReference[i])
+                              << "% of the time (" << combination.m_deliveredWhenReferenceLost[i] << " of "
+                              << combination.m_lostOnReference[i] << " datagrams).\n";
+                }
+            }
+        }
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            if (ContainsPath(combination.m_paths, i) && (i != reference || addedPathCount == 0))
+            {
+                std::cout << combination.m_receivedFirst[i] << " datagrams were received first on the " << interfaceName(i)
+                          << " (" << percent(combination.m_receivedFirst[i], effective.Received()) << "%).\n";
+            }
+        }
+    }
 
     std::cout << '\n';
     std::cout << "--- DETAILS ---\n";
     std::cout << '\n';
-    std::cout << "Sent datagrams on primary interface: " << primarySentDatagrams << '\n';
-    std::cout << "Sent datagrams on secondary interface: " << secondarySentDatagrams << '\n';
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Sent datagrams on " << interfaceName(i) << ": " << paths[i].m_latency.Sent() << '\n';
+    }
 
     std::cout << '\n';
-    std::cout << "Received datagrams on primary interface: " << primaryReceivedDatagrams << " ("
-              << percent(primaryReceivedDatagrams, primarySentDatagrams) << "%)\n";
-    std::cout << "Received datagrams on secondary interface: " << secondaryReceivedDatagrams << " ("
-              << percent(secondaryReceivedDatagrams, secondarySentDatagrams) << "%)\n";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto& latency = paths[i].m_latency;
+        std::cout << "Received datagrams on " << interfaceName(i) << ": " << latency.Received() << " ("
+                  << percent(latency.Received(), latency.Sent()) << "%)\n";
+    }
 
     std::cout << '\n';
-    std::cout << "Lost datagrams on primary interface: " << primaryLostDatagrams << " ("
-              << percent(primaryLostDatagrams, primarySentDatagrams) << "%)\n";
-    std::cout << "Lost datagrams on secondary interface: " << secondaryLostDatagrams << " ("
-              << percent(secondaryLostDatagrams, secondarySentDatagrams) << "%)\n";
-    std::cout << "Lost datagrams on both interface simultaneously: " << aggregatedLostDatagrams << " ("
-              << percent(aggregatedLostDatagrams, aggregatedSentDatagrams) << "%)\n";
-
-    // Average latency
-    const long long primaryAverageLatency = average(primaryLatencies);
-    const long long secondaryAverageLatency = average(secondaryLatencies);
-    const long long effectiveAverageLatency = average(effectiveLatencies);
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto& latency = paths[i].m_latency;
+        std::cout << "Lost datagrams on " << interfaceName(i) << ": " << latency.Lost() << " ("
+                  << percent(latency.Lost(), latency.Sent()) << "%)\n";
+    }
+    for (const auto& combination : combinations)
+    {
+        const auto& effective = combination.m_effective;
+        std::cout << "Lost datagrams on " << combinationName(combination) << " simultaneously: " << effective.Lost() << " ("
+                  << percent(effective.Lost(), effective.Sent()) << "%)\n";
+    }
 
-    std::cout << '\n';
-    std::cout << "Average latency on primary interface: " << ConvertMicrosToMillis(primaryAverageLatency) << " ms\n";
-    std::cout << "Average latency on secondary interface: " << ConvertMicrosToMillis(secondaryAverageLatency) << " ms\n";
-    std::cout << "Average effective latency on combined interface: " << ConvertMicrosToMillis(effectiveAverageLatency)
-              << " ms (" << percent(primaryAverageLatency - effectiveAverageLatency, primaryAverageLatency)
-              << "% improvement over primary) \n";
-
-    // Jitter / Standard deviation
-    const auto primaryStandardDeviation = standardDeviation(primaryLatencies, primaryAverageLatency);
-    const auto secondaryStandardDeviation = standardDeviation(secondaryLatencies, secondaryAverageLatency);
-    const auto effectiveStandardDeviation = standardDeviation(effectiveLatencies, effectiveAverageLatency);
-    std::cout << '\n';
-    std::cout << "Jitter (standard deviation) on primary interface: " << ConvertMicrosToMillis(primaryStandardDeviation) << " ms\n";
-    std::cout << "Jitter (standard deviation) on secondary interface: " << ConvertMicrosToMillis(secondaryStandardDeviation)
-              << " ms\n";
-    std::cout << "Jitter (standard deviation) on combined interfaces: " << ConvertMicrosToMillis(effectiveStandardDeviation)
-              << " ms\n";
+    // The statistics of each path, followed by the effective statistics of each combination
+    auto printLatencies = [&](const char* description, auto&& statistic, bool compareToReference) {
+        std::cout << '\n';
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            std::cout << description << " on " << interfaceName(i) << ": "
+                      << ConvertNanosToMillis(statistic(paths[i].m_latency)) << " ms\n";
+        }
+        for (const auto& combination : combinations)
+        {
+            const auto effectiveValue = statistic(combination.m_effective);
+            std::cout << description << " on " << combinationName(combination) << ": "
+                      << ConvertNanosToMillis(effectiveValue) << " ms";
+            if (compareToReference)
+            {
+                const auto reference = referencePath(combination);
+                const auto referenceValue = statistic(paths[reference].m_latency);
+                std::cout << " (" << percent(referenceValue - effectiveValue, referenceValue) << "% improvement over "
+                          << paths[reference].m_name << ")";
+            }
+            std::cout << '\n';
+        }
+    };
 
-    // Median latency
-    const auto primaryMedianLatency = median(primaryLatencies);
-    const auto secondaryMedianLatency = median(secondaryLatencies);
-    const auto effectiveMedianLatency = median(effectiveLatencies);
+    printLatencies("Average latency", [](const LatencyAggregate& aggregate) { return aggregate.Average(); }, true);
+    printLatencies(
+        "Jitter (standard deviation)", [](const LatencyAggregate& aggregate) { return aggregate.StandardDeviation(); }, false);
+    printLatencies("Median latency", [](const LatencyAggregate& aggregate) { return aggregate.Percentile(50.); }, true);
+    printLatencies(
+        "Interquartile range",
+        [](const LatencyAggregate& aggregate) { return aggregate.Percentile(75.) - aggregate.Percentile(25.); },
+        false);
+
+    // Tail latency
+    auto printPercentiles = [](const std::string& interfaceName, const LatencyAggregate& aggregate) {
+        std::cout << "Latency percentiles (p50 / p90 / p99 / p99.9 / p99.99) on " << interfaceName << ": ";
+        std::cout << ConvertNanosToMillis(aggregate.Percentile(50.)) << " / " << ConvertNanosToMillis(aggregate.Percentile(90.))
+                  << " / " << ConvertNanosToMillis(aggregate.Percentile(99.)) << " / "
+                  << ConvertNanosToMillis(aggregate.Percentile(99.9)) << " / "
+                  << ConvertNanosToMillis(aggregate.Percentile(99.99)) << " ms\n";
+    };
 
     std::cout << '\n';
-    std::cout << "Median latency on primary interface: " << ConvertMicrosToMillis(primaryMedianLatency) << " ms\n";
-    std::cout << "Median latency on secondary interface: " << ConvertMicrosToMillis(secondaryMedianLatency) << " ms\n";
-    std::cout << "Median effective latency on combined interfaces: " << ConvertMicrosToMillis(effectiveMedianLatency)
-              << " ms (" << percent(primaryMedianLatency - effectiveMedianLatency, primaryMedianLatency)
-              << "% improvement over primary) \n";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        printPercentiles(interfaceName(i), paths[i].m_latency);
+    }
+    for (const auto& combination : combinations)
+    {
+        printPercentiles(combinationName(combination), combination.m_effective);
+    }
 
-    // Interquartile range
-    const auto primaryIrqLatency = interquartileRange(primaryLatencies);
-    const auto secondaryIrqLatency = interquartileRange(secondaryLatencies);
-    const auto effectiveIrqLatency = interquartileRange(effectiveLatencies);
+    // Minimum and maximum latency
+    std::cout << '\n';
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto& latency = paths[i].m_latency;
+        std::cout << "Minimum / Maximum latency on " << interfaceName(i) << ": " << ConvertNanosToMillis(latency.Min())
+                  << " ms / " << ConvertNanosToMillis(latency.Max()) << " ms\n";
+    }
 
+    // Loss bursts
     std::cout << '\n';
-    std::cout << "Interquartile range on primary interface: " << ConvertMicrosToMillis(primaryIrqLatency) << " ms\n";
-    std::cout << "Interquartile range on secondary interface: " << ConvertMicrosToMillis(secondaryIrqLatency) << " ms\n";
-    std::cout << "Interquartile range latency on combined interfaces: " << ConvertMicrosToMillis(effectiveIrqLatency) << " ms\n";
+    std::cout << "--- LOSS BURSTS ---\n";
+    std::cout << '\n';
+    std::cout << "Lengths in datagrams (p50 / p99 / max)\n";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto& lossRuns = paths[i].m_lossRuns;
+        auto printRuns = [](const LatencyHistogram& runs) {
+            std::cout << runs.ValueAtPercentile(50.) << " / " << runs.ValueAtPercentile(99.) << " / " << runs.Max() << " ("
+                      << runs.Count() << " runs)\n";
+        };
+        std::cout << "Consecutive lost datagrams on " << interfaceName(i) << ": ";
+        printRuns(lossRuns.LossRuns());
+        std::cout << "Received datagrams between losses on " << interfaceName(i) << ": ";
+        printRuns(lossRuns.ReceivedRuns());
+    }
 
-    // Minimum and maximum latency
-    const auto primaryMinimumLatency = std::ranges::min(primaryLatencies);
-    const auto primaryMaximumLatency = std::ranges::max(primaryLatencies);
-    const auto secondaryMinimumLatency = std::ranges::min(secondaryLatencies);
-    const auto secondaryMaximumLatency = std::ranges::max(secondaryLatencies);
     std::cout << '\n';
-    std::cout << "Minimum / Maximum latency on primary interface: " << ConvertMicrosToMillis(primaryMinimumLatency)
-              << " ms / " << ConvertMicrosToMillis(primaryMaximumLatency) << " ms\n";
-    std::cout << "Minimum / Maximum latency on secondary interface: " << ConvertMicrosToMillis(secondaryMinimumLatency)
-              << " ms / " << ConvertMicrosToMillis(secondaryMaximumLatency) << " ms\n";
+    std::cout << "Gilbert-Elliott model (good to bad / bad to good transitions, loss in good / bad state, per datagram)\n";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto model = paths[i].m_lossRuns.FitGilbertElliott();
+        std::cout << "Gilbert-Elliott model on " << interfaceName(i) << ": " << std::setprecision(4)
+                  << model.m_goodToBad << " / " << model.m_badToGood << ", " << model.m_lossInGood * 100. << "% / "
+                  << model.m_lossInBad * 100. << "%" << std::setprecision(2);
+        if (model.m_badToGood > 0.)
+        {
+            std::cout << " (bursts of " << 1. / model.m_badToGood << " datagrams on average)";
+        }
+        std::cout << '\n';
+    }
 
+    // Delay variation between consecutive datagrams
     std::cout << '\n';
-    std::cout << "Corrupt datagrams on primary interface: " << data.m_primaryCorruptDatagrams << '\n';
-    std::cout << "Corrupt datagrams on secondary interface: " << data.m_secondaryCorruptDatagrams << '\n';
-}
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const auto& variation = paths[i].m_delayVariation;
+        std::cout << "Delay variation between consecutive datagrams (IPDV, p50 / p90 / p99 / p99.9 / max) on "
+                  << interfaceName(i) << ": " << ConvertNanosToMillis(variation.Percentile(50.)) << " / "
+                  << ConvertNanosToMillis(variation.Percentile(90.)) << " / "
+                  << ConvertNanosToMillis(variation.Percentile(99.)) << " / "
+                  << ConvertNanosToMillis(variation.Percentile(99.9)) << " / " << ConvertNanosToMillis(variation.Max())
+                  << " ms\n";
+    }
 
-void DumpLatencyData(const LatencyData& data, std::ofstream& file)
-{
-    // Add column header
-    file << "Sequence number, Primary Send timestamp (microsec), Primary Echo timestamp (microsec), Primary Receive "
-            "timestamp (microsec), "
-         << "Secondary Send timestamp (microsec), Secondary Echo timestamp (microsec), Secondary Receive timestamp (microsec)\n";
-    // Add raw timestamp data
-    for (std::size_t i = 0; i < data.m_latencies.size(); ++i)
-    {
-        const auto& stat = data.m_latencies[i];
-        file << i << ", ";
-        file << stat.m_primarySendTimestamp << ", " << stat.m_primaryEchoTimestamp << ", " << stat.m_primaryReceiveTimestamp << ", ";
-        file << stat.m_secondarySendTimestamp << ", " << stat.m_secondaryEchoTimestamp << ", " << stat.m_secondaryReceiveTimestamp;
-        file << "\n";
+    std::cout << '\n';
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Corrupt datagrams on " << interfaceName(i) << ": " << paths[i].m_corruptDatagrams << '\n';
     }
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Datagrams of another flow or path on " << interfaceName(i) << ": " << paths[i].m_foreignDatagrams
+                  << '\n';
+    }
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Datagrams with a corrupt payload on " << interfaceName(i) << ": " << paths[i].m_corruptPayloads
+                  << '\n';
+    }
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Duplicate datagrams on " << interfaceName(i) << ": " << paths[i].m_duplicateDatagrams << '\n';
+    }
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::cout << "Datagrams received after the loss timeout on " << interfaceName(i) << ": "
+                  << paths[i].m_lateDatagrams << '\n';
+    }
+
+    if (std::ranges::any_of(data.m_paths, [](const PathData& path) { return path.m_reflectorDelay.Received() > 0; }))
+    {
+        PrintReflectorDelays(data);
+    }
+
+    if (data.m_clock)
+    {
+        PrintOneWayDelays(data);
+    }
+
+    if (data.m_sendOverhead.Received() == 0 && data.m_receiveOverhead.Received() == 0)
+    {
+        return;
+    }
+
+    // The kernel latencies are printed in milliseconds, the overheads in microseconds
+    auto printKernelPercentiles = [](const std::string& name, const LatencyAggregate& aggregate, bool inMicros) {
+        auto convert = [inMicros](long long nanos) {
+            return inMicros ? ConvertNanosToMicros(nanos) : ConvertNanosToMillis(nanos);
+        };
+        std::cout << name << ": " << convert(aggregate.Percentile(50.)) << " / " << convert(aggregate.Percentile(99.)) << " / "
+                  << convert(aggregate.Percentile(99.9)) << " / " << convert(aggregate.Max()) << (inMicros ? " us (" : " ms (")
+                  << aggregate.Received() << " datagrams)\n";
+    };
+
+    std::cout << '\n';
+    std::cout << "--- TIMESTAMPING ---\n";
+    std::cout << '\n';
+    std::cout << "Latencies between the kernel timestamps, without the client overhead (p50 / p99 / p99.9 / max)\n";
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        printKernelPercentiles("Kernel latency on " + interfaceName(i), paths[i].m_kernel, false);
+    }
+    std::cout << '\n';
+    std::cout << "Client overhead, on all interfaces (p50 / p99 / p99.9 / max)\n";
+    printKernelPercentiles("Send overhead (application to kernel)", data.m_sendOverhead, true);
+    printKernelPercentiles("Receive overhead (kernel to application)", data.m_receiveOverhead, true);
 }
 
-} // namespace multipath
\ No newline at end of file
+} // namespace multipath
@@ -3,34 +3,405 @@
 
 #pragma once
 
-#include <fstream>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string>
 #include <vector>
 
+#include "latency_histogram.h"
+
 namespace multipath {
 
+// The maximum number of paths measured at once
+constexpr size_t c_maxPathCount = 8;
+
+// A set of paths, as a bit mask of their indexes
+using PathSet = uint32_t;
+static_assert(c_maxPathCount <= sizeof(PathSet) * 8);
+
+constexpr PathSet AllPaths(size_t pathCount) noexcept
+{
+    return static_cast<PathSet>((1ULL << pathCount) - 1);
+}
+
+constexpr bool ContainsPath(PathSet paths, size_t path) noexcept
+{
+    return (paths >> path) & 1;
+}
+
+// The paths of the set other than the given one
+constexpr PathSet OtherPaths(PathSet paths, size_t path) noexcept
+{
+    return paths & ~(PathSet{1} << path);
+}
+
+// The timestamps of a datagram on one path
+struct PathTimestamps
+{
+    // All timestamps are in nanoseconds, -1 if the event did not occur
+    long long m_send = -1;
+    long long m_echo = -1;
+    long long m_receive = -1;
+
+    // Taken by the network stack when the datagram left and reached the client, with -timestamping
+    long long m_kernelSend = -1;
+    long long m_kernelReceive = -1;
+
+    // Taken by a STAMP reflector when it received the datagram, server clock like the echo timestamp, which it takes
+    // when it sends the datagram back
+    long long m_reflectorReceive = -1;
+};
+
+enum class TimestampKind
+{
+    Send,
+    Echo,
+    Receive,
+    KernelSend,
+    KernelReceive,
+    ReflectorReceive
+};
+
+constexpr size_t c_timestampKindCount = 6;
+
+// The member of PathTimestamps holding each kind of timestamp
+constexpr long long PathTimestamps::*c_timestampMembers[c_timestampKindCount] = {
+    &PathTimestamps::m_send,
+    &PathTimestamps::m_echo,
+    &PathTimestamps::m_receive,
+    &PathTimestamps::m_kernelSend,
+    &PathTimestamps::m_kernelReceive,
+    &PathTimestamps::m_reflectorReceive};
+
+constexpr long long PathTimestamps::*TimestampMember(TimestampKind kind) noexcept
+{
+    return c_timestampMembers[static_cast<size_t>(kind)];
+}
+
+// The timestamps of a datagram on every path, path 0 being the primary interface and path 1 the secondary interface
 struct LatencyMeasure
 {
-    // All timestamps are in microseconds
-    long long m_primarySendTimestamp = -1;
-    long long m_secondarySendTimestamp = -1;
+    std::array<PathTimestamps, c_maxPathCount> m_paths{};
+
+    // The first send and receive timestamps on the given paths, -1 if there are none
+    [[nodiscard]] long long FirstSend(PathSet paths) const noexcept
+    {
+        return First(paths, &PathTimestamps::m_send);
+    }
+
+    [[nodiscard]] long long FirstReceive(PathSet paths) const noexcept
+    {
+        return First(paths, &PathTimestamps::m_receive);
+    }
+
+private:
+    [[nodiscard]] long long First(PathSet paths, long long PathTimestamps::*member) const noexcept
+    {
+        auto first = -1LL;
+        for (size_t i = 0; i < c_maxPathCount; ++i)
+        {
+            const auto timestamp = m_paths[i].*member;
+            if (ContainsPath(paths, i) && timestamp >= 0 && (first < 0 || timestamp < first))
+            {
+                first = timestamp;
+            }
+        }
+        return first;
+    }
+};
+
+// Aggregates the latencies measured on one path, without keeping the individual measures
+class LatencyAggregate
+{
+public:
+    explicit LatencyAggregate(int significantDigits = LatencyHistogram::c_defaultSignificantDigits) :
+        m_latencies(significantDigits)
+    {
+    }
+
+    void AddSent() noexcept
+    {
+        m_sent += 1;
+    }
+
+    void AddLatency(long long latency) noexcept
+    {
+        m_latencies.Add(latency);
+    }
+
+    // The aggregates must have the same precision
+    void Merge(const LatencyAggregate& other) noexcept
+    {
+        m_sent += other.m_sent;
+        m_latencies.Merge(other.m_latencies);
+    }
 
-    long long m_primaryEchoTimestamp = -1;
-    long long m_secondaryEchoTimestamp = -1;
+    [[nodiscard]] long long Sent() const noexcept
+    {
+        return m_sent;
+    }
 
-    long long m_primaryReceiveTimestamp = -1;
-    long long m_secondaryReceiveTimestamp = -1;
+    [[nodiscard]] long long Received() const noexcept
+    {
+        return m_latencies.Count();
+    }
+
+    [[nodiscard]] long long Lost() const noexcept
+    {
+        return m_sent - Received();
+    }
+
+    [[nodiscard]] long long Sum() const noexcept
+    {
+        return m_latencies.Sum();
+    }
+
+    [[nodiscard]] long long Min() const noexcept
+    {
+        return m_latencies.Min();
+    }
+
+    [[nodiscard]] long long Max() const noexcept
+    {
+        return m_latencies.Max();
+    }
+
+    [[nodiscard]] long long Average() const noexcept
+    {
+        return Received() > 0 ? Sum() / Received() : 0LL;
+    }
+
+    [[nodiscard]] long long StandardDeviation() const noexcept
+    {
+        return static_cast<long long>(m_latencies.StandardDeviation());
+    }
+
+    // The latency below which the given percentage of the latencies are, with the precision of the histogram
+    [[nodiscard]] long long Percentile(double percentile) const noexcept
+    {
+        return m_latencies.ValueAtPercentile(percentile);
+    }
+
+    [[nodiscard]] const LatencyHistogram& Latencies() const noexcept
+    {
+        return m_latencies;
+    }
+
+private:
+    long long m_sent = 0;
+    LatencyHistogram m_latencies;
+};
+
+// A 2-state Gilbert-Elliott model of the losses of a path: the datagrams are lost with a low probability in the
+// good state and a high probability in the bad state
+struct GilbertElliottModel
+{
+    // The probabilities of the transitions, for each datagram
+    double m_goodToBad = 0.;
+    double m_badToGood = 0.;
+    // The probabilities of losing a datagram in each state
+    double m_lossInGood = 0.;
+    double m_lossInBad = 0.;
+};
+
+// The runs of lost and received datagrams of a path, added in the order of their sequence numbers
+// - the lengths of the runs of lost datagrams, and of the runs of received datagrams between two losses
+// - the bursts of losses, which fit a Gilbert-Elliott model: a burst is the longest sequence starting and ending with a
+//   loss, holding at least two losses and less than c_minGap consecutive received datagrams (Gmin in RFC 3611), the
+//   other losses are isolated losses of the good state
+// - the runs still open when the datagrams stop are not counted, nor those open at the end of a part of a run merged
+class LossRunStatistics
+{
+public:
+    static constexpr long long c_minGap = 16;
+
+    explicit LossRunStatistics(int significantDigits = LatencyHistogram::c_defaultSignificantDigits) :
+        m_lossRuns(significantDigits), m_receivedRuns(significantDigits)
+    {
+    }
+
+    void Add(bool lost) noexcept;
+
+    // The statistics must have the same precision
+    void Merge(const LossRunStatistics& other) noexcept;
+
+    // The model fitted on the bursts: the bad state lasts for the average burst length, the good state for the
+    // average length between two bursts
+    [[nodiscard]] GilbertElliottModel FitGilbertElliott() const noexcept;
+
+    [[nodiscard]] const LatencyHistogram& LossRuns() const noexcept
+    {
+        return m_lossRuns;
+    }
+
+    [[nodiscard]] const LatencyHistogram& ReceivedRuns() const noexcept
+    {
+        return m_receivedRuns;
+    }
+
+private:
+    void CloseBurst() noexcept;
+
+    long long m_datagrams = 0;
+    long long m_losses = 0;
+    LatencyHistogram m_lossRuns;
+    LatencyHistogram m_receivedRuns;
+    long long m_lossRun = 0;
+    long long m_receivedRun = 0;
+
+    // The burst being built, from its first to its last loss
+    long long m_burstStart = 0;
+    long long m_burstEnd = 0;
+    long long m_burstLosses = 0;
+
+    long long m_bursts = 0;
+    long long m_burstDatagrams = 0;
+    long long m_burstDatagramsLost = 0;
+};
+
+// The server clock relative to the client clock, estimated by ClockEstimator:
+// server time = client time + offset + skew * (client time - reference), in nanoseconds
+struct ClockModel
+{
+    long long m_reference = 0;
+    double m_offset = 0.;
+    double m_skew = 0.;
+    // The largest difference between the model and the offsets it was fitted to, in nanoseconds
+    double m_deviation = 0.;
+
+    [[nodiscard]] long long ToClientTime(long long serverTime) const noexcept
+    {
+        return m_reference + std::llround((static_cast<double>(serverTime - m_reference) - m_offset) / (1. + m_skew));
+    }
+};
+
+// The statistics of one path
+struct PathData
+{
+    explicit PathData(std::string name, int significantDigits) :
+        m_name(std::move(name)),
+        m_latency(significantDigits),
+        m_kernel(significantDigits),
+        m_uplink(significantDigits),
+        m_downlink(significantDigits),
+        m_reflectorDelay(significantDigits),
+        m_networkLatency(significantDigits),
+        m_delayVariation(significantDigits),
+        m_lossRuns(significantDigits)
+    {
+    }
+
+    std::string m_name;
+    LatencyAggregate m_latency;
+    // The latency between the kernel send and receive timestamps, without the time spent in the application
+    // and the scheduling delays of the client
+    LatencyAggregate m_kernel;
+    // The one-way delays from the client to the server and back, when the server clock is estimated
+    LatencyAggregate m_uplink;
+    LatencyAggregate m_downlink;
+    // With STAMP or header echoes, the time spent in the reflector between its receive and send timestamps, and the
+    // latency without it
+    LatencyAggregate m_reflectorDelay;
+    LatencyAggregate m_networkLatency;
+    // The absolute difference between the latencies of consecutive datagrams of the path, when both are received
+    // (IPDV, RFC 3393): the datagrams must be added in the order of their sequence numbers
+    LatencyAggregate m_delayVariation;
+    long long m_previousLatency = -1;
+    // The datagrams sent on the path, lost or received, in the order of their sequence numbers
+    LossRunStatistics m_lossRuns;
+
+    // Datagrams with an invalid header, or whose sequence number was not sent
+    long long m_corruptDatagrams = 0;
+    // Valid datagrams of another client or path, echoed to this path by the server
+    long long m_foreignDatagrams = 0;
+    // Datagrams whose payload does not match the CRC of their header, which are counted as lost
+    long long m_corruptPayloads = 0;
+    // Datagrams received after the loss timeout, which are counted as lost
+    long long m_lateDatagrams = 0;
+    // Additional copies of a datagram received on the path, they are ignored
+    long long m_duplicateDatagrams = 0;
+    // With header echoes, the bytes the server reported receiving on the path, in the echoes received
+    long long m_reportedBytes = 0;
+};
+
+// The statistics of a set of paths used together: each datagram is sent on every path of the set, and the
+// latency is the one of the first copy received
+struct CombinedPathsData
+{
+    CombinedPathsData(PathSet paths, int significantDigits) : m_paths(paths), m_effective(significantDigits)
+    {
+    }
+
+    PathSet m_paths;
+    // The latency between the first send and the first receive, on any path of the set
+    LatencyAggregate m_effective;
+    // The number of datagrams first received on each path
+    std::array<long long, c_maxPathCount> m_receivedFirst{};
+    // For each other path of the set, the datagrams it was sent while the lowest path of the set lost them,
+    // and how many of these it delivered
+    std::array<long long, c_maxPathCount> m_lostOnReference{};
+    std::array<long long, c_maxPathCount> m_deliveredWhenReferenceLost{};
 };
 
 struct LatencyData
 {
-    std::vector<LatencyMeasure> m_latencies;
+    // Paths without a name are named after their index: primary, secondary, path 2...
+    // The combinations default to all the paths together.
+    explicit LatencyData(
+        size_t pathCount = 2,
+        int significantDigits = LatencyHistogram::c_defaultSignificantDigits,
+        const std::vector<PathSet>& combinations = {},
+        const std::vector<std::string>& pathNames = {});
+
+    // Accumulates a datagram which can no longer be updated
+    void Add(const LatencyMeasure& measure) noexcept;
+
+    // Accumulates the aggregates of another set of datagrams, e.g. another part of the same run.
+    // Both must have the same paths and combinations.
+    void Merge(const LatencyData& other) noexcept;
+
+    [[nodiscard]] size_t PathCount() const noexcept
+    {
+        return m_paths.size();
+    }
+
+    // The first combination, all the paths by default
+    [[nodiscard]] const LatencyAggregate& Effective() const noexcept
+    {
+        return m_combinations.front().m_effective;
+    }
+
+    // e.g. "primary + secondary"
+    [[nodiscard]] std::string CombinationName(const CombinedPathsData& combination) const;
+
+    std::vector<PathData> m_paths;
+    std::vector<CombinedPathsData> m_combinations;
+
+    // On all paths: the time between the application and kernel send timestamps,
+    // and between the kernel and application receive timestamps
+    LatencyAggregate m_sendOverhead;
+    LatencyAggregate m_receiveOverhead;
+
+    // When set, the echo timestamps are converted to the client clock to split the latencies in one-way delays.
+    // It must be set before the datagrams are added.
+    std::optional<ClockModel> m_clock{};
+
+    // Send timestamps of the first and last datagrams received, on any path
+    long long m_firstReceivedSendTimestamp = -1;
+    long long m_lastReceivedSendTimestamp = -1;
 
     size_t m_datagramSize = 0;
-    long long m_primaryCorruptDatagrams = 0;
-    long long m_secondaryCorruptDatagrams = 0;
+
+private:
+    // Accumulates the kernel latency and the client overhead of one path, when timestamps are present
+    void AddKernelTimestamps(PathData& path, const PathTimestamps& timestamps) noexcept;
 };
 
-void PrintLatencyStatistics(LatencyData& data);
-void DumpLatencyData(const LatencyData& data, std::ofstream& file);
+// The name of a path in the statistics and the output files, when it has no other name
+std::string DefaultPathName(size_t path);
+
+void PrintLatencyStatistics(const LatencyData& data);
 
-} // namespace multipath
\ No newline at end of file
+} // namespace multipath
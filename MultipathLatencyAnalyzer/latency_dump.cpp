@@ -0,0 +1,541 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "latency_dump.h"
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace multipath {
+namespace {
+    constexpr uint32_t c_fileMagic = 0x44414c4d;  // "MLAD"
+    constexpr uint32_t c_blockMagic = 0x42414c4d; // "MLAB"
+    constexpr uint32_t c_version = 4;
+    constexpr size_t c_fileHeaderSize = 64;
+    // The number of columns of the version 1 files, which have no kernel timestamps
+    constexpr size_t c_legacyColumnCount = 6;
+
+    constexpr size_t BlockHeaderSize(size_t columnCount) noexcept
+    {
+        return 16 + 4 * columnCount;
+    }
+
+    long long& Timestamp(LatencyMeasure& measure, const LatencyDumpColumn& column) noexcept
+    {
+        return measure.m_paths[column.m_path].*TimestampMember(column.m_kind);
+    }
+
+    long long Timestamp(const LatencyMeasure& measure, const LatencyDumpColumn& column) noexcept
+    {
+        return measure.m_paths[column.m_path].*TimestampMember(column.m_kind);
+    }
+
+    // e.g. "Secondary Kernel Send timestamp (nanosec)"
+    std::string CsvColumnName(const LatencyDumpColumn& column)
+    {
+        constexpr const char* c_kindNames[c_timestampKindCount] = {
+            "Send", "Echo", "Receive", "Kernel Send", "Kernel Receive", "Reflector Receive"};
+
+        auto name = DefaultPathName(column.m_path);
+        name[0] = static_cast<char>(name[0] - 'a' + 'A');
+        return name + ' ' + c_kindNames[static_cast<size_t>(column.m_kind)] + " timestamp (nanosec)";
+    }
+
+    void Store32(uint8_t* destination, uint32_t value) noexcept
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            destination[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    void Store64(uint8_t* destination, uint64_t value) noexcept
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            destination[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    uint32_t Load32(const std::byte* source) noexcept
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            value |= static_cast<uint32_t>(source[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t Load64(const std::byte* source) noexcept
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            value |= static_cast<uint64_t>(source[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    void AppendVarint(std::vector<uint8_t>& column, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            column.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        column.push_back(static_cast<uint8_t>(value));
+    }
+
+    uint64_t ReadVarint(const std::byte*& current, const std::byte* end)
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (current == end)
+            {
+                throw std::runtime_error("Truncated column in the latency dump");
+            }
+
+            const auto byte = static_cast<uint64_t>(*current++);
+            value |= (byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        throw std::runtime_error("Invalid varint in the latency dump");
+    }
+
+    uint64_t ZigZagEncode(long long value) noexcept
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    long long ZigZagDecode(uint64_t value) noexcept
+    {
+        return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+    }
+} // namespace
+
+std::vector<LatencyDumpColumn> LatencyDumpColumns(size_t pathCount, bool kernelTimestamps, bool reflectorTimestamps)
+{
+    std::vector<LatencyDumpColumn> columns;
+    for (size_t path = 0; path < pathCount; ++path)
+    {
+        for (const auto kind : {TimestampKind::Send, TimestampKind::Echo, TimestampKind::Receive})
+        {
+            columns.push_back({path, kind});
+        }
+    }
+    if (kernelTimestamps)
+    {
+        for (const auto kind : {TimestampKind::KernelSend, TimestampKind::KernelReceive})
+        {
+            for (size_t path = 0; path < pathCount; ++path)
+            {
+                columns.push_back({path, kind});
+            }
+        }
+    }
+    if (reflectorTimestamps)
+    {
+        for (size_t path = 0; path < pathCount; ++path)
+        {
+            columns.push_back({path, TimestampKind::ReflectorReceive});
+        }
+    }
+    return columns;
+}
+
+std::vector<LatencyDumpColumn> LatencyDumpColumns(const LatencyDumpHeader& header)
+{
+    return LatencyDumpColumns(
+        header.m_pathCount,
+        (header.m_flags & LatencyDumpHeader::c_flagTimestamping) != 0,
+        (header.m_flags & LatencyDumpHeader::c_flagReflectorTimestamps) != 0);
+}
+
+LatencyCsvWriter::LatencyCsvWriter(
+    const std::filesystem::path& path, size_t pathCount, bool kernelTimestamps, bool reflectorTimestamps) :
+    m_file(path, std::ios::binary | std::ios::trunc),
+    m_buffer(c_bufferSize),
+    m_layout(LatencyDumpColumns(pathCount, kernelTimestamps, reflectorTimestamps))
+{
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to open the output file");
+    }
+
+    // Add column header
+    std::string header = "Sequence number";
+    for (const auto& column : m_layout)
+    {
+        header += ", " + CsvColumnName(column);
+    }
+    m_file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    m_file.put('\n');
+}
+
+LatencyCsvWriter::~LatencyCsvWriter() noexcept
+try
+{
+    Flush();
+}
+catch (...)
+{
+}
+
+void LatencyCsvWriter::Add(long long sequenceNumber, const LatencyMeasure& measure)
+{
+    // A value is at most 22 characters with its separator
+    const auto maxLineSize = (m_layout.size() + 1) * 22 + 1;
+    if (m_buffer.size() - m_size < maxLineSize)
+    {
+        Flush();
+    }
+
+    Append(sequenceNumber);
+    for (const auto& column : m_layout)
+    {
+        m_buffer[m_size++] = ',';
+        m_buffer[m_size++] = ' ';
+        Append(Timestamp(measure, column));
+    }
+    m_buffer[m_size++] = '\n';
+}
+
+void LatencyCsvWriter::Append(long long value) noexcept
+{
+    const auto result = std::to_chars(m_buffer.data() + m_size, m_buffer.data() + m_buffer.size(), value);
+    m_size = static_cast<size_t>(result.ptr - m_buffer.data());
+}
+
+void LatencyCsvWriter::Flush()
+{
+    m_file.write(m_buffer.data(), static_cast<std::streamsize>(m_size));
+    m_size = 0;
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to write to the output file");
+    }
+}
+
+LatencyBinaryWriter::LatencyBinaryWriter(const std::filesystem::path& path, const LatencyDumpHeader& header) :
+    m_file(path, std::ios::binary | std::ios::trunc),
+    m_layout(LatencyDumpColumns(header))
+{
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to open the output file");
+    }
+
+    uint8_t fileHeader[c_fileHeaderSize]{};
+    Store32(fileHeader, c_fileMagic);
+    Store32(fileHeader + 4, c_version);
+    Store32(fileHeader + 8, static_cast<uint32_t>(c_fileHeaderSize));
+    Store32(fileHeader + 12, header.m_datagramSize);
+    Store64(fileHeader + 16, header.m_bitrate);
+    Store32(fileHeader + 24, header.m_grouping);
+    Store32(fileHeader + 28, header.m_duration);
+    Store32(fileHeader + 32, header.m_lossTimeout);
+    Store32(fileHeader + 36, header.m_flags);
+    Store64(fileHeader + 40, header.m_startTime);
+    Store32(fileHeader + 48, static_cast<uint32_t>(m_layout.size()));
+    Store32(fileHeader + 52, header.m_pathCount);
+    Store32(fileHeader + 56, header.m_scheduler);
+    m_file.write(reinterpret_cast<const char*>(fileHeader), sizeof fileHeader);
+
+    for (size_t i = 0; i < m_layout.size(); ++i)
+    {
+        // Most deltas fit in 2 or 3 bytes
+        m_columns[i].reserve(c_measuresPerBlock * 3);
+    }
+}
+
+LatencyBinaryWriter::~LatencyBinaryWriter() noexcept
+try
+{
+    Flush();
+}
+catch (...)
+{
+}
+
+void LatencyBinaryWriter::Add(long long sequenceNumber, const LatencyMeasure& measure)
+{
+    if (m_count == 0)
+    {
+        m_firstSequenceNumber = sequenceNumber;
+    }
+
+    for (size_t i = 0; i < m_layout.size(); ++i)
+    {
+        const auto timestamp = Timestamp(measure, m_layout[i]);
+        if (timestamp < 0)
+        {
+            AppendVarint(m_columns[i], 0);
+        }
+        else
+        {
+            AppendVarint(m_columns[i], ZigZagEncode(timestamp - m_previous[i]) + 1);
+            m_previous[i] = timestamp;
+        }
+    }
+
+    m_count += 1;
+    if (m_count == c_measuresPerBlock)
+    {
+        Flush();
+    }
+}
+
+void LatencyBinaryWriter::Flush()
+{
+    if (m_count == 0)
+    {
+        return;
+    }
+
+    // Assemble the block to write it at once
+    size_t blockSize = BlockHeaderSize(m_layout.size());
+    for (size_t i = 0; i < m_layout.size(); ++i)
+    {
+        blockSize += m_columns[i].size();
+    }
+    m_block.resize(blockSize);
+
+    Store32(m_block.data(), c_blockMagic);
+    Store32(m_block.data() + 4, m_count);
+    Store64(m_block.data() + 8, static_cast<uint64_t>(m_firstSequenceNumber));
+    auto offset = BlockHeaderSize(m_layout.size());
+    for (size_t i = 0; i < m_layout.size(); ++i)
+    {
+        Store32(m_block.data() + 16 + 4 * i, static_cast<uint32_t>(m_columns[i].size()));
+        std::memcpy(m_block.data() + offset, m_columns[i].data(), m_columns[i].size());
+        offset += m_columns[i].size();
+
+        m_columns[i].clear();
+        m_previous[i] = 0;
+    }
+    m_count = 0;
+
+    m_file.write(reinterpret_cast<const char*>(m_block.data()), static_cast<std::streamsize>(m_block.size()));
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to write to the output file");
+    }
+}
+
+LatencyBinaryReader::LatencyBinaryReader(std::span<const std::byte> data) : m_data(data)
+{
+    if (m_data.size() < c_fileHeaderSize || Load32(m_data.data()) != c_fileMagic)
+    {
+        throw std::runtime_error("Not a latency dump");
+    }
+    const auto version = Load32(m_data.data() + 4);
+    if (version < 1 || version > c_version)
+    {
+        throw std::runtime_error("Unsupported latency dump version");
+    }
+
+    const auto headerSize = Load32(m_data.data() + 8);
+    if (headerSize < c_fileHeaderSize || headerSize > m_data.size())
+    {
+        throw std::runtime_error("Invalid latency dump header");
+    }
+
+    m_header.m_datagramSize = Load32(m_data.data() + 12);
+    m_header.m_bitrate = Load64(m_data.data() + 16);
+    m_header.m_grouping = Load32(m_data.data() + 24);
+    m_header.m_duration = Load32(m_data.data() + 28);
+    m_header.m_lossTimeout = Load32(m_data.data() + 32);
+    m_header.m_flags = Load32(m_data.data() + 36);
+    m_header.m_startTime = Load64(m_data.data() + 40);
+
+    // The timestamps were stored in microseconds before version 4
+    m_timestampScale = version < 4 ? 1'000 : 1;
+
+    const auto columnCount = version == 1 ? c_legacyColumnCount : Load32(m_data.data() + 48);
+    m_header.m_pathCount = version < 3 ? 2 : Load32(m_data.data() + 52);
+    m_header.m_scheduler = version < 3 ? 0 : Load32(m_data.data() + 56);
+    if (m_header.m_pathCount < 1 || m_header.m_pathCount > c_maxPathCount)
+    {
+        throw std::runtime_error("Invalid number of paths in the latency dump");
+    }
+    m_layout = LatencyDumpColumns(m_header);
+    if (columnCount != m_layout.size())
+    {
+        throw std::runtime_error("Invalid number of columns in the latency dump");
+    }
+    const auto blockHeaderSize = BlockHeaderSize(m_layout.size());
+
+    // Index the blocks
+    size_t offset = headerSize;
+    while (offset < m_data.size())
+    {
+        if (m_data.size() - offset < blockHeaderSize || Load32(m_data.data() + offset) != c_blockMagic)
+        {
+            throw std::runtime_error("Invalid block in the latency dump");
+        }
+
+        Block block{};
+        block.m_count = Load32(m_data.data() + offset + 4);
+        block.m_firstSequenceNumber = static_cast<long long>(Load64(m_data.data() + offset + 8));
+
+        auto columnOffset = offset + blockHeaderSize;
+        for (size_t i = 0; i < m_layout.size(); ++i)
+        {
+            block.m_columnOffsets[i] = columnOffset;
+            block.m_columnSizes[i] = Load32(m_data.data() + offset + 16 + 4 * i);
+            columnOffset += block.m_columnSizes[i];
+        }
+        if (columnOffset > m_data.size())
+        {
+            throw std::runtime_error("Truncated block in the latency dump");
+        }
+
+        m_blocks.push_back(block);
+        offset = columnOffset;
+    }
+}
+
+long long LatencyBinaryReader::DecodeBlock(size_t index, std::vector<LatencyMeasure>& measures) const
+{
+    const auto& block = m_blocks.at(index);
+    measures.assign(block.m_count, LatencyMeasure{});
+
+    for (size_t i = 0; i < m_layout.size(); ++i)
+    {
+        const auto* current = m_data.data() + block.m_columnOffsets[i];
+        const auto* end = current + block.m_columnSizes[i];
+        long long previous = 0;
+        for (auto& measure : measures)
+        {
+            const auto value = ReadVarint(current, end);
+            if (value == 0)
+            {
+                Timestamp(measure, m_layout[i]) = -1;
+            }
+            else
+            {
+                previous += ZigZagDecode(value - 1);
+                Timestamp(measure, m_layout[i]) = previous * m_timestampScale;
+            }
+        }
+    }
+    return block.m_firstSequenceNumber;
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    m_file = CreateFileW(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        m_file = nullptr;
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(m_file, &size))
+    {
+        CloseHandle(m_file);
+        throw std::runtime_error("Failed to get the size of " + path.string());
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0)
+    {
+        // An empty file cannot be mapped
+        return;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+    {
+        m_data = static_cast<const std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!m_data)
+    {
+        if (m_mapping)
+        {
+            CloseHandle(m_mapping);
+        }
+        CloseHandle(m_file);
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+}
+
+MappedFile::~MappedFile() noexcept
+{
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+    }
+    if (m_file)
+    {
+        CloseHandle(m_file);
+    }
+}
+#else
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0)
+    {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    struct stat status{};
+    if (fstat(m_file, &status) != 0)
+    {
+        close(m_file);
+        throw std::runtime_error("Failed to get the size of " + path.string());
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    if (m_size == 0)
+    {
+        // An empty file cannot be mapped
+        return;
+    }
+
+    auto* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (data == MAP_FAILED)
+    {
+        close(m_file);
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const std::byte*>(data);
+}
+
+MappedFile::~MappedFile() noexcept
+{
+    if (m_data)
+    {
+        munmap(const_cast<std::byte*>(m_data), m_size);
+    }
+    if (m_file >= 0)
+    {
+        close(m_file);
+    }
+}
+#endif
+
+} // namespace multipath
@@ -0,0 +1,207 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <vector>
+
+#include "latencyStatistics.h"
+
+namespace multipath {
+
+enum class LatencyDumpFormat
+{
+    Csv,
+    Binary
+};
+
+// The configuration of the run, stored in the header of the binary dumps
+struct LatencyDumpHeader
+{
+    static constexpr uint32_t c_flagSecondaryInterface = 0x1;
+    static constexpr uint32_t c_flagBatchSend = 0x2;
+    static constexpr uint32_t c_flagPrecisePacing = 0x4;
+    // The kernel send and receive timestamps are stored after the application timestamps
+    static constexpr uint32_t c_flagTimestamping = 0x8;
+    // The receive timestamps of a STAMP reflector are stored after the kernel timestamps
+    static constexpr uint32_t c_flagReflectorTimestamps = 0x10;
+    // The datagrams were streamed by the server: the send timestamps are the ones of the server converted to the client
+    // clock, and the latencies are one-way delays
+    static constexpr uint32_t c_flagDownlink = 0x20;
+
+    uint32_t m_datagramSize = 0;
+    uint64_t m_bitrate = 0;
+    uint32_t m_grouping = 0;
+    // In seconds, 0 if the run was stopped manually
+    uint32_t m_duration = 0;
+    // In milliseconds
+    uint32_t m_lossTimeout = 0;
+    uint32_t m_flags = 0;
+    // Seconds since the Unix epoch
+    uint64_t m_startTime = 0;
+    // Path 0 is the primary interface, path 1 the secondary interface
+    uint32_t m_pathCount = 2;
+    // The SchedulingPolicy of the client, 0 (all the datagrams duplicated) in the files written before it was stored
+    uint32_t m_scheduler = 0;
+};
+
+// A column of the dumps: one kind of timestamp on one path
+struct LatencyDumpColumn
+{
+    size_t m_path;
+    TimestampKind m_kind;
+};
+
+// The columns of the dumps, in order: the send, echo and receive timestamps of each path, then with kernel timestamps,
+// the kernel send timestamps of each path followed by the kernel receive timestamps of each path, then with reflector
+// timestamps, the reflector receive timestamps of each path
+std::vector<LatencyDumpColumn> LatencyDumpColumns(size_t pathCount, bool kernelTimestamps, bool reflectorTimestamps = false);
+
+// The columns of the binary dumps with the given header
+std::vector<LatencyDumpColumn> LatencyDumpColumns(const LatencyDumpHeader& header);
+
+// Writes the measures as text, one datagram per line
+// - the values are formatted with std::to_chars in a large buffer, written to the file when full
+// - the columns are described by LatencyDumpColumns, the timestamps are in nanoseconds
+class LatencyCsvWriter
+{
+public:
+    static constexpr size_t c_bufferSize = 1024 * 1024;
+
+    LatencyCsvWriter(
+        const std::filesystem::path& path, size_t pathCount, bool kernelTimestamps = false, bool reflectorTimestamps = false);
+    ~LatencyCsvWriter() noexcept;
+
+    void Add(long long sequenceNumber, const LatencyMeasure& measure);
+    void Flush();
+
+    // Not copyable or movable
+    LatencyCsvWriter(const LatencyCsvWriter&) = delete;
+    LatencyCsvWriter& operator=(const LatencyCsvWriter&) = delete;
+    LatencyCsvWriter(LatencyCsvWriter&&) = delete;
+    LatencyCsvWriter& operator=(LatencyCsvWriter&&) = delete;
+
+private:
+    void Append(long long value) noexcept;
+
+    std::ofstream m_file;
+    std::vector<char> m_buffer;
+    size_t m_size = 0;
+    std::vector<LatencyDumpColumn> m_layout;
+};
+
+// Writes the measures in the binary columnar format (.mla)
+//
+// The file starts with a header, followed by blocks of consecutive sequence numbers:
+// - file header (64 bytes): magic "MLAD", version, header size, the fields of LatencyDumpHeader, the number of
+//   columns (version 2), the number of paths and the scheduling policy (version 3)
+// - block header (16 bytes + 4 per column): magic "MLAB", number of datagrams, first sequence number, size of each column
+// - the columns described by LatencyDumpColumns, with the kernel timestamps when c_flagTimestamping is set and the
+//   reflector receive timestamps when c_flagReflectorTimestamps is set
+// Version 1 files, without the number of columns, always have 6 columns. Version 1 and 2 files always have 2 paths.
+// The timestamps are in nanoseconds, in microseconds before version 4: the reader converts them to nanoseconds.
+// Each column encodes the difference between a timestamp and the previous timestamp present in the same column of the
+// block, zigzag-encoded, plus one, as a LEB128 varint. 0 encodes a missing timestamp. All integers are little-endian.
+class LatencyBinaryWriter
+{
+public:
+    static constexpr size_t c_measuresPerBlock = 64 * 1024;
+
+    LatencyBinaryWriter(const std::filesystem::path& path, const LatencyDumpHeader& header);
+    ~LatencyBinaryWriter() noexcept;
+
+    // The sequence numbers must be consecutive
+    void Add(long long sequenceNumber, const LatencyMeasure& measure);
+    void Flush();
+
+    // Not copyable or movable
+    LatencyBinaryWriter(const LatencyBinaryWriter&) = delete;
+    LatencyBinaryWriter& operator=(const LatencyBinaryWriter&) = delete;
+    LatencyBinaryWriter(LatencyBinaryWriter&&) = delete;
+    LatencyBinaryWriter& operator=(LatencyBinaryWriter&&) = delete;
+
+    static constexpr size_t c_maxColumnCount = c_timestampKindCount * c_maxPathCount;
+
+private:
+    std::ofstream m_file;
+    std::vector<LatencyDumpColumn> m_layout;
+    std::vector<uint8_t> m_columns[c_maxColumnCount];
+    long long m_previous[c_maxColumnCount]{};
+    std::vector<uint8_t> m_block;
+    long long m_firstSequenceNumber = 0;
+    uint32_t m_count = 0;
+};
+
+// Reads a binary dump from memory, typically a mapped file
+// - the blocks are indexed when the reader is created and can be decoded independently, in any order
+// - throws std::runtime_error if the data is not a valid dump
+class LatencyBinaryReader
+{
+public:
+    explicit LatencyBinaryReader(std::span<const std::byte> data);
+
+    [[nodiscard]] const LatencyDumpHeader& Header() const noexcept
+    {
+        return m_header;
+    }
+
+    [[nodiscard]] size_t BlockCount() const noexcept
+    {
+        return m_blocks.size();
+    }
+
+    // Decodes a block, returns the sequence number of its first measure
+    long long DecodeBlock(size_t index, std::vector<LatencyMeasure>& measures) const;
+
+private:
+    struct Block
+    {
+        long long m_firstSequenceNumber;
+        uint32_t m_count;
+        size_t m_columnOffsets[LatencyBinaryWriter::c_maxColumnCount];
+        size_t m_columnSizes[LatencyBinaryWriter::c_maxColumnCount];
+    };
+
+    std::span<const std::byte> m_data;
+    LatencyDumpHeader m_header{};
+    // Converts the stored timestamps to nanoseconds
+    long long m_timestampScale = 1;
+    std::vector<LatencyDumpColumn> m_layout;
+    std::vector<Block> m_blocks;
+};
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile() noexcept;
+
+    [[nodiscard]] std::span<const std::byte> Data() const noexcept
+    {
+        return {m_data, m_size};
+    }
+
+    // Not copyable or movable
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+private:
+    const std::byte* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+};
+
+} // namespace multipath
@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace multipath {
+
+// Log-linear histogram of latencies, in nanoseconds, modeled after HdrHistogram
+// - values are grouped in buckets covering powers of two, each divided in linear sub-buckets
+// - the relative error on any recorded value is bounded by the number of significant digits
+// - memory is proportional to the number of sub-buckets, not to the number of values
+// - min, max, mean and standard deviation are tracked exactly
+class LatencyHistogram
+{
+public:
+    static constexpr int c_defaultSignificantDigits = 3;
+    // Values above are counted as the highest trackable value
+    static constexpr long long c_defaultHighestTrackableValue = 3'600'000'000'000LL; // 1 hour
+
+    explicit LatencyHistogram(
+        int significantDigits = c_defaultSignificantDigits, long long highestTrackableValue = c_defaultHighestTrackableValue) :
+        m_highestTrackableValue(highestTrackableValue)
+    {
+        if (significantDigits < 1 || significantDigits > 5)
+        {
+            throw std::invalid_argument("The number of significant digits must be between 1 and 5");
+        }
+
+        // Enough sub-buckets to distinguish 1 unit in the largest value with the requested number of digits
+        long long largestValueWithSingleUnitResolution = 2;
+        for (int i = 0; i < significantDigits; ++i)
+        {
+            largestValueWithSingleUnitResolution *= 10;
+        }
+        m_subBucketCountMagnitude =
+            static_cast<int>(std::bit_width(static_cast<unsigned long long>(largestValueWithSingleUnitResolution - 1)));
+        m_subBucketHalfCountMagnitude = m_subBucketCountMagnitude - 1;
+        m_subBucketCount = 1LL << m_subBucketCountMagnitude;
+        m_subBucketHalfCount = m_subBucketCount / 2;
+        m_subBucketMask = m_subBucketCount - 1;
+
+        // Each bucket doubles the range covered
+        long long smallestUntrackableValue = m_subBucketCount;
+        int bucketCount = 1;
+        while (smallestUntrackableValue <= m_highestTrackableValue)
+        {
+            smallestUntrackableValue <<= 1;
+            bucketCount += 1;
+        }
+        m_counts.resize(static_cast<size_t>((bucketCount + 1) * m_subBucketHalfCount), 0);
+    }
+
+    void Add(long long value) noexcept
+    {
+        value = value < 0 ? 0 : (value > m_highestTrackableValue ? m_highestTrackableValue : value);
+
+        m_counts[CountsIndex(value)] += 1;
+        m_count += 1;
+        m_sum += value;
+        m_sumOfSquares += static_cast<double>(value) * value;
+        m_min = value < m_min ? value : m_min;
+        m_max = value > m_max ? value : m_max;
+    }
+
+    // The histograms must have the same precision
+    void Merge(const LatencyHistogram& other) noexcept
+    {
+        for (size_t i = 0; i < m_counts.size() && i < other.m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        m_sumOfSquares += other.m_sumOfSquares;
+        m_min = other.m_min < m_min ? other.m_min : m_min;
+        m_max = other.m_max > m_max ? other.m_max : m_max;
+    }
+
+    void Reset() noexcept
+    {
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        m_count = 0;
+        m_sum = 0;
+        m_sumOfSquares = 0.;
+        m_min = (std::numeric_limits<long long>::max)();
+        m_max = 0;
+    }
+
+    [[nodiscard]] long long Count() const noexcept
+    {
+        return m_count;
+    }
+
+    [[nodiscard]] long long Sum() const noexcept
+    {
+        return m_sum;
+    }
+
+    [[nodiscard]] long long Min() const noexcept
+    {
+        return m_count > 0 ? m_min : 0;
+    }
+
+    [[nodiscard]] long long Max() const noexcept
+    {
+        return m_max;
+    }
+
+    [[nodiscard]] double Mean() const noexcept
+    {
+        return m_count > 0 ? static_cast<double>(m_sum) / m_count : 0.;
+    }
+
+    [[nodiscard]] double StandardDeviation() const noexcept
+    {
+        if (m_count == 0)
+        {
+            return 0.;
+        }
+
+        const auto mean = Mean();
+        const auto variance = m_sumOfSquares / m_count - mean * mean;
+        return variance > 0. ? std::sqrt(variance) : 0.;
+    }
+
+    // The highest value equivalent to the value below which the given percentage of the values are
+    [[nodiscard]] long long ValueAtPercentile(double percentile) const noexcept
+    {
+        if (m_count == 0)
+        {
+            return 0;
+        }
+
+        const auto requestedCount = static_cast<long long>(std::ceil(percentile / 100. * m_count));
+        const auto countAtPercentile = requestedCount > 0 ? requestedCount : 1;
+
+        long long cumulativeCount = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            cumulativeCount += m_counts[i];
+            if (cumulativeCount >= countAtPercentile)
+            {
+                const auto value = HighestEquivalentValue(ValueFromIndex(i));
+                return value < m_max ? (value > m_min ? value : m_min) : m_max;
+            }
+        }
+        return m_max;
+    }
+
+private:
+    [[nodiscard]] size_t CountsIndex(long long value) const noexcept
+    {
+        const auto bucketIndex = BucketIndex(value);
+        const auto subBucketIndex = value >> bucketIndex;
+        return static_cast<size_t>(((bucketIndex + 1LL) << m_subBucketHalfCountMagnitude) + (subBucketIndex - m_subBucketHalfCount));
+    }
+
+    [[nodiscard]] int BucketIndex(long long value) const noexcept
+    {
+        // The smallest power of two containing the value, relative to the first bucket
+        const auto pow2Ceiling = static_cast<int>(std::bit_width(static_cast<unsigned long long>(value | m_subBucketMask)));
+        return pow2Ceiling - (m_subBucketHalfCountMagnitude + 1);
+    }
+
+    [[nodiscard]] long long ValueFromIndex(size_t index) const noexcept
+    {
+        auto bucketIndex = static_cast<int>(index >> m_subBucketHalfCountMagnitude) - 1;
+        auto subBucketIndex = static_cast<long long>(index & (m_subBucketHalfCount - 1)) + m_subBucketHalfCount;
+        if (bucketIndex < 0)
+        {
+            subBucketIndex -= m_subBucketHalfCount;
+            bucketIndex = 0;
+        }
+        return subBucketIndex << bucketIndex;
+    }
+
+    [[nodiscard]] long long HighestEquivalentValue(long long value) const noexcept
+    {
+        // All the values in a sub-bucket are equivalent
+        const auto subBucketSize = 1LL << BucketIndex(value);
+        return (value & ~(subBucketSize - 1)) + subBucketSize - 1;
+    }
+
+    long long m_highestTrackableValue = 0;
+    int m_subBucketCountMagnitude = 0;
+    int m_subBucketHalfCountMagnitude = 0;
+    long long m_subBucketCount = 0;
+    long long m_subBucketHalfCount = 0;
+    long long m_subBucketMask = 0;
+
+    std::vector<long long> m_counts;
+    long long m_count = 0;
+    long long m_sum = 0;
+    double m_sumOfSquares = 0.;
+    long long m_min = (std::numeric_limits<long long>::max)();
+    long long m_max = 0;
+};
+
+} // namespace multipath
@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "latency_spill.h"
+
+#include <wil/result.h>
+
+#include <algorithm>
+
+namespace multipath {
+namespace {
+    struct SpillChunkHeader
+    {
+        long long m_firstSequenceNumber;
+        unsigned long m_measureCount;
+        unsigned long m_pathCount;
+        unsigned long m_compressedSize;
+    };
+
+    // XPRESS with Huffman encoding: fast and efficient on the mostly increasing timestamps
+    constexpr DWORD c_compressionAlgorithm = COMPRESS_ALGORITHM_XPRESS_HUFF;
+} // namespace
+
+LatencySpillWriter::LatencySpillWriter(const std::filesystem::path& path, size_t pathCount) :
+    m_file(path, std::ios::binary | std::ios::trunc), m_pathCount(pathCount)
+{
+    THROW_HR_IF_MSG(E_FAIL, !m_file, "Failed to open the spill file");
+    THROW_IF_WIN32_BOOL_FALSE(CreateCompressor(c_compressionAlgorithm, nullptr, m_compressor.put()));
+    m_columns.resize(c_timestampKindCount * m_pathCount * c_measuresPerChunk);
+}
+
+void LatencySpillWriter::Add(long long sequenceNumber, const LatencyMeasure& measure)
+{
+    if (m_count == 0)
+    {
+        m_firstSequenceNumber = sequenceNumber;
+    }
+
+    for (size_t kind = 0; kind < c_timestampKindCount; ++kind)
+    {
+        for (size_t path = 0; path < m_pathCount; ++path)
+        {
+            m_columns[(kind * m_pathCount + path) * c_measuresPerChunk + m_count] =
+                measure.m_paths[path].*c_timestampMembers[kind];
+        }
+    }
+
+    m_count += 1;
+    if (m_count == c_measuresPerChunk)
+    {
+        Flush();
+    }
+}
+
+void LatencySpillWriter::Flush()
+{
+    if (m_count == 0)
+    {
+        return;
+    }
+
+    // Pack the columns of a partial chunk
+    const auto columnCount = c_timestampKindCount * m_pathCount;
+    if (m_count < c_measuresPerChunk)
+    {
+        for (size_t i = 1; i < columnCount; ++i)
+        {
+            std::copy_n(m_columns.begin() + i * c_measuresPerChunk, m_count, m_columns.begin() + i * m_count);
+        }
+    }
+    const auto uncompressedSize = columnCount * m_count * sizeof(long long);
+
+    // Query the size of the compressed buffer first
+    SIZE_T compressedSize = 0;
+    if (!Compress(m_compressor.get(), m_columns.data(), uncompressedSize, nullptr, 0, &compressedSize))
+    {
+        THROW_LAST_ERROR_IF(GetLastError() != ERROR_INSUFFICIENT_BUFFER);
+    }
+    if (m_compressedBuffer.size() < compressedSize)
+    {
+        m_compressedBuffer.resize(compressedSize);
+    }
+    THROW_IF_WIN32_BOOL_FALSE(Compress(
+        m_compressor.get(), m_columns.data(), uncompressedSize, m_compressedBuffer.data(), m_compressedBuffer.size(), &compressedSize));
+
+    const SpillChunkHeader header{
+        m_firstSequenceNumber,
+        static_cast<unsigned long>(m_count),
+        static_cast<unsigned long>(m_pathCount),
+        static_cast<unsigned long>(compressedSize)};
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    m_file.write(m_compressedBuffer.data(), static_cast<std::streamsize>(compressedSize));
+    m_file.flush();
+    THROW_HR_IF_MSG(E_FAIL, !m_file, "Failed to write to the spill file");
+
+    m_count = 0;
+}
+
+void ReadLatencySpill(
+    const std::filesystem::path& path, const std::function<void(long long sequenceNumber, const LatencyMeasure& measure)>& callback)
+{
+    std::ifstream file(path, std::ios::binary);
+    THROW_HR_IF_MSG(E_FAIL, !file, "Failed to open the spill file");
+
+    wil::unique_decompressor_handle decompressor;
+    THROW_IF_WIN32_BOOL_FALSE(CreateDecompressor(c_compressionAlgorithm, nullptr, decompressor.put()));
+
+    std::vector<char> compressedBuffer;
+    std::vector<long long> columns;
+
+    SpillChunkHeader header{};
+    while (file.read(reinterpret_cast<char*>(&header), sizeof header))
+    {
+        THROW_HR_IF_MSG(E_FAIL, header.m_pathCount > c_maxPathCount, "Corrupt chunk in the spill file");
+        compressedBuffer.resize(header.m_compressedSize);
+        THROW_HR_IF_MSG(
+            E_FAIL, !file.read(compressedBuffer.data(), header.m_compressedSize), "Truncated chunk in the spill file");
+
+        const size_t count = header.m_measureCount;
+        const size_t pathCount = header.m_pathCount;
+        columns.resize(c_timestampKindCount * pathCount * count);
+        SIZE_T uncompressedSize = 0;
+        THROW_IF_WIN32_BOOL_FALSE(Decompress(
+            decompressor.get(),
+            compressedBuffer.data(),
+            compressedBuffer.size(),
+            columns.data(),
+            columns.size() * sizeof(long long),
+            &uncompressedSize));
+        THROW_HR_IF_MSG(E_FAIL, uncompressedSize != columns.size() * sizeof(long long), "Corrupt chunk in the spill file");
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            LatencyMeasure measure{};
+            for (size_t kind = 0; kind < c_timestampKindCount; ++kind)
+            {
+                for (size_t path = 0; path < pathCount; ++path)
+                {
+                    measure.m_paths[path].*c_timestampMembers[kind] = columns[(kind * pathCount + path) * count + i];
+                }
+            }
+            callback(header.m_firstSequenceNumber + static_cast<long long>(i), measure);
+        }
+    }
+}
+
+} // namespace multipath
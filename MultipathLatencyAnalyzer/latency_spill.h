@@ -0,0 +1,58 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <Windows.h>
+#include <compressapi.h>
+
+#include <wil/resource.h>
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+#include "latencyStatistics.h"
+
+namespace multipath {
+
+// Writes finalized latency measures to a file, in compressed chunks of consecutive sequence numbers
+// - each chunk is a SpillChunkHeader followed by the compressed timestamps, a column per kind of timestamp and path
+// - the measures are buffered until a chunk is full, so memory usage is bounded by the chunk size
+class LatencySpillWriter
+{
+public:
+    static constexpr size_t c_measuresPerChunk = 64 * 1024;
+
+    LatencySpillWriter(const std::filesystem::path& path, size_t pathCount);
+
+    // The sequence numbers must be consecutive
+    void Add(long long sequenceNumber, const LatencyMeasure& measure);
+    // Writes the buffered measures
+    void Flush();
+
+    // Not copyable or movable
+    LatencySpillWriter(const LatencySpillWriter&) = delete;
+    LatencySpillWriter& operator=(const LatencySpillWriter&) = delete;
+    LatencySpillWriter(LatencySpillWriter&&) = delete;
+    LatencySpillWriter& operator=(LatencySpillWriter&&) = delete;
+
+    ~LatencySpillWriter() = default;
+
+private:
+    std::ofstream m_file;
+    wil::unique_compressor_handle m_compressor;
+    size_t m_pathCount = 0;
+    // The column of (kind, path) starts at (kind * m_pathCount + path) * c_measuresPerChunk
+    std::vector<long long> m_columns;
+    size_t m_count = 0;
+    std::vector<char> m_compressedBuffer;
+    long long m_firstSequenceNumber = 0;
+};
+
+// Reads back a file written by LatencySpillWriter, calling the callback for each measure in order
+void ReadLatencySpill(
+    const std::filesystem::path& path, const std::function<void(long long sequenceNumber, const LatencyMeasure& measure)>& callback);
+
+} // namespace multipath
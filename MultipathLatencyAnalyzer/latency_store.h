@@ -0,0 +1,231 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "latencyStatistics.h"
+
+namespace multipath {
+
+// Keeps the measures of the datagrams which can still be updated, in a sliding window of sequence numbers
+// - the window covers the last sent datagrams, its size is chosen to match the loss timeout
+// - when a datagram leaves the window, it is finalized: it is passed to the finalize callback then discarded
+// - the memory used does not depend on the duration of the run
+// - the timestamps are stored in a column per kind of timestamp and path, indexed by sequence number: the memory used
+//   grows with the number of paths measured, and finalizing the datagrams in order reads each column sequentially
+// - the completions update the timestamps without a lock: each timestamp is set once, by the first completion which
+//   knows it, and a datagram is only finalized once the completions updating it are done with it
+class LatencyStore
+{
+public:
+    using FinalizeCallback = std::function<void(long long sequenceNumber, const LatencyMeasure& measure)>;
+
+    enum class UpdateResult
+    {
+        Updated,
+        AlreadyFinalized,
+        NotSent
+    };
+
+    // The timestamps of a datagram in the window, spread over the columns
+    class Entry
+    {
+    public:
+        [[nodiscard]] long long Get(size_t path, TimestampKind kind) const noexcept
+        {
+            return m_store.Column(path, kind)[m_slot].load();
+        }
+
+        void Set(size_t path, TimestampKind kind, long long timestamp) noexcept
+        {
+            m_store.Column(path, kind)[m_slot].store(timestamp);
+        }
+
+        // Sets the timestamp only if it is not set yet, returns whether it was set
+        bool SetFirst(size_t path, TimestampKind kind, long long timestamp) noexcept
+        {
+            auto unset = -1LL;
+            return m_store.Column(path, kind)[m_slot].compare_exchange_strong(unset, timestamp);
+        }
+
+        // The first timestamp of this kind on the given paths, -1 if there are none
+        [[nodiscard]] long long First(PathSet paths, TimestampKind kind) const noexcept
+        {
+            auto first = -1LL;
+            for (size_t i = 0; i < m_store.m_pathCount; ++i)
+            {
+                const auto timestamp = m_store.Column(i, kind)[m_slot].load();
+                if (ContainsPath(paths, i) && timestamp >= 0 && (first < 0 || timestamp < first))
+                {
+                    first = timestamp;
+                }
+            }
+            return first;
+        }
+
+    private:
+        friend class LatencyStore;
+
+        Entry(LatencyStore& store, size_t slot) noexcept : m_store(store), m_slot(slot)
+        {
+        }
+
+        LatencyStore& m_store;
+        size_t m_slot;
+    };
+
+    LatencyStore(size_t windowSize, size_t pathCount, FinalizeCallback callback) :
+        m_windowSize(windowSize > 0 ? windowSize : 1),
+        m_pathCount(pathCount),
+        m_timestamps(m_windowSize * pathCount * c_timestampKindCount),
+        m_slots(m_windowSize),
+        m_callback(std::move(callback))
+    {
+        for (auto& timestamp : m_timestamps)
+        {
+            timestamp.store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    // Extends the window up to endSequenceNumber (excluded), before the datagrams are sent.
+    // The datagrams which leave the window are finalized.
+    void Advance(long long endSequenceNumber)
+    {
+        const auto lock = std::scoped_lock{m_finalizeLock};
+        const auto end = m_end.load(std::memory_order_relaxed);
+        if (endSequenceNumber <= end)
+        {
+            return;
+        }
+
+        const auto windowSize = static_cast<long long>(m_windowSize);
+        while (endSequenceNumber - m_begin > windowSize)
+        {
+            FinalizeOldest();
+        }
+
+        // The slots are handed to the new datagrams before the completions can look for them
+        for (auto sequenceNumber = (std::max)(end, m_begin); sequenceNumber < endSequenceNumber; ++sequenceNumber)
+        {
+            m_slots[Slot(sequenceNumber)].m_sequenceNumber.store(sequenceNumber, std::memory_order_release);
+        }
+        m_end.store(endSequenceNumber, std::memory_order_release);
+    }
+
+    // Updates the timestamps of a datagram in the window, the callback receives an Entry.
+    // Called concurrently by the completions: the callback must only use the atomic accessors of the Entry.
+    template <typename Callback>
+    UpdateResult Update(long long sequenceNumber, Callback&& update)
+    {
+        if (sequenceNumber < 0 || sequenceNumber >= m_end.load(std::memory_order_acquire))
+        {
+            return UpdateResult::NotSent;
+        }
+
+        // Registered before checking the slot, as the finalization releases the slot before waiting for the writers
+        auto& slot = m_slots[Slot(sequenceNumber)];
+        slot.m_writers.fetch_add(1);
+        auto result = UpdateResult::AlreadyFinalized;
+        if (slot.m_sequenceNumber.load() == sequenceNumber)
+        {
+            Entry entry{*this, Slot(sequenceNumber)};
+            update(entry);
+            result = UpdateResult::Updated;
+        }
+        slot.m_writers.fetch_sub(1, std::memory_order_release);
+        return result;
+    }
+
+    // Finalizes all the datagrams in the window, at the end of the run
+    void FinalizeAll()
+    {
+        const auto lock = std::scoped_lock{m_finalizeLock};
+        while (m_begin < m_end.load(std::memory_order_relaxed))
+        {
+            FinalizeOldest();
+        }
+    }
+
+    // Not copyable or movable
+    LatencyStore(const LatencyStore&) = delete;
+    LatencyStore& operator=(const LatencyStore&) = delete;
+    LatencyStore(LatencyStore&&) = delete;
+    LatencyStore& operator=(LatencyStore&&) = delete;
+
+    ~LatencyStore() = default;
+
+private:
+    [[nodiscard]] size_t Slot(long long sequenceNumber) const noexcept
+    {
+        return static_cast<size_t>(sequenceNumber % static_cast<long long>(m_windowSize));
+    }
+
+    [[nodiscard]] std::atomic<long long>* Column(size_t path, TimestampKind kind) noexcept
+    {
+        return m_timestamps.data() + (static_cast<size_t>(kind) * m_pathCount + path) * m_windowSize;
+    }
+
+    [[nodiscard]] const std::atomic<long long>* Column(size_t path, TimestampKind kind) const noexcept
+    {
+        return m_timestamps.data() + (static_cast<size_t>(kind) * m_pathCount + path) * m_windowSize;
+    }
+
+    // Must be called with the finalize lock held
+    void FinalizeOldest()
+    {
+        const auto slot = Slot(m_begin);
+
+        // The completions which found the datagram in its slot finish their update first, the next ones ignore it.
+        // A completion only holds the slot for a few instructions, and the oldest datagram is rarely still received.
+        // The store and the load are both sequentially consistent, like the registration and the check of the writers:
+        // either the writer sees the slot released, or the finalization sees the writer.
+        m_slots[slot].m_sequenceNumber.store(-1);
+        while (m_slots[slot].m_writers.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+
+        LatencyMeasure measure{};
+        for (size_t kind = 0; kind < c_timestampKindCount; ++kind)
+        {
+            for (size_t path = 0; path < m_pathCount; ++path)
+            {
+                auto& timestamp = Column(path, static_cast<TimestampKind>(kind))[slot];
+                measure.m_paths[path].*c_timestampMembers[kind] = timestamp.load(std::memory_order_relaxed);
+                timestamp.store(-1, std::memory_order_relaxed);
+            }
+        }
+
+        m_callback(m_begin, measure);
+        m_begin += 1;
+    }
+
+    // The datagram held by a slot of the window, and the completions updating it
+    struct SlotState
+    {
+        // -1 while the slot is finalized, until the next datagram is sent
+        std::atomic<long long> m_sequenceNumber{-1};
+        std::atomic<long> m_writers{0};
+    };
+
+    // Serializes the finalizations, the completions never take it
+    std::mutex m_finalizeLock;
+    size_t m_windowSize;
+    size_t m_pathCount;
+    // Column of (kind, path) at offset (kind * m_pathCount + path) * m_windowSize
+    std::vector<std::atomic<long long>> m_timestamps;
+    std::vector<SlotState> m_slots;
+    // Sequence numbers in [m_begin, m_end) are in the window, m_begin is only accessed under the finalize lock
+    long long m_begin = 0;
+    std::atomic<long long> m_end{0};
+    FinalizeCallback m_callback;
+};
+
+} // namespace multipath
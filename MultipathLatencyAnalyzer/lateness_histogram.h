@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <iomanip>
+#include <iostream>
+
+namespace multipath {
+
+// Distribution of the lateness of periodic events (actual time - intended time), in microseconds
+// - bucket 0 counts events less than 1us late, bucket N counts events between 2^(N-1) and 2^N us late
+// - events which happened early are counted separately
+class LatenessHistogram
+{
+public:
+    static constexpr size_t c_bucketCount = 32;
+
+    void Add(long long latenessInMicroSec) noexcept
+    {
+        if (latenessInMicroSec < 0)
+        {
+            m_earlyCount += 1;
+            latenessInMicroSec = 0;
+        }
+
+        const auto bucket = static_cast<size_t>(std::bit_width(static_cast<unsigned long long>(latenessInMicroSec)));
+        m_buckets[bucket < c_bucketCount ? bucket : c_bucketCount - 1] += 1;
+
+        m_count += 1;
+        m_sum += latenessInMicroSec;
+        if (latenessInMicroSec > m_max)
+        {
+            m_max = latenessInMicroSec;
+        }
+    }
+
+    [[nodiscard]] long long Count() const noexcept
+    {
+        return m_count;
+    }
+
+    [[nodiscard]] long long Max() const noexcept
+    {
+        return m_max;
+    }
+
+    [[nodiscard]] double Mean() const noexcept
+    {
+        return m_count > 0 ? static_cast<double>(m_sum) / m_count : 0.;
+    }
+
+    void Print(std::ostream& out) const
+    {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+
+        out << "Early events: " << m_earlyCount << '\n';
+        for (size_t i = 0; i < c_bucketCount; ++i)
+        {
+            if (m_buckets[i] == 0)
+            {
+                continue;
+            }
+
+            if (i == 0)
+            {
+                out << "  < 1 us: ";
+            }
+            else
+            {
+                out << "  " << (1ULL << (i - 1)) << " - " << (1ULL << i) << " us: ";
+            }
+            out << m_buckets[i] << " (" << std::setprecision(2) << std::fixed << m_buckets[i] * 100. / m_count << "%)\n";
+        }
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    std::array<long long, c_bucketCount> m_buckets{};
+    long long m_count = 0;
+    long long m_earlyCount = 0;
+    long long m_sum = 0;
+    long long m_max = 0;
+};
+
+} // namespace multipath
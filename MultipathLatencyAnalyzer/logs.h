@@ -4,6 +4,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <wchar.h>
 #include <utility>
 
 enum class LogLevel
@@ -26,7 +27,11 @@ void Log(const char* format, T... args)
     {
         try
         {
+#ifdef _WIN32
             ::printf_s(format, std::forward<T>(args)...);
+#else
+            ::printf(format, std::forward<T>(args)...);
+#endif
         }
         catch (...)
         {
@@ -41,7 +46,11 @@ void Log(const wchar_t* format, T... args)
     {
         try
         {
+#ifdef _WIN32
             ::wprintf_s(format, std::forward<T>(args)...);
+#else
+            ::wprintf(format, std::forward<T>(args)...);
+#endif
         }
         catch (...)
         {
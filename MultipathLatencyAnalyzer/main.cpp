@@ -3,7 +3,9 @@
 
 // ReSharper disable StringLiteralTypo
 #include "adapters.h"
+#include "arguments.h"
 #include "config.h"
+#include "crc32c.h"
 #include "logs.h"
 #include "sockaddr.h"
 #include "stream_client.h"
@@ -14,6 +16,8 @@
 #include <fstream>
 #include <filesystem>
 #include <locale>
+#include <string>
+#include <vector>
 
 #include <Windows.h>
 #include <winrt/Windows.Foundation.h>
@@ -64,6 +68,21 @@ unsigned long integer_cast<unsigned long>(const std::wstring_view str)
     return value;
 }
 
+// Splits a list of values, e.g. "0+1,0+2"
+std::vector<std::wstring_view> SplitArgumentValue(std::wstring_view value, wchar_t separator)
+{
+    std::vector<std::wstring_view> values;
+    size_t begin = 0;
+    while (begin <= value.size())
+    {
+        auto end = value.find(separator, begin);
+        end = end == std::wstring_view::npos ? value.size() : end;
+        values.push_back(value.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return values;
+}
+
 void PrintUsage()
 {
     fwprintf(
@@ -75,22 +94,35 @@ void PrintUsage()
         L"\nOnce started, Ctrl-C or Ctrl-Break will cleanly shutdown the application."
         L"\n\n"
         L"Server-side usage:\n"
-        L"\tMultipathLatencyTool -listen:<addr or *> [-port:####] [-prepostrecvs:####]\n"
+        L"\tMultipathLatencyTool -listen:<addr or *> [-port:####] [-protocol:<native,stamp>] [-prepostrecvs:####] [-clock:<qpc,tsc>] [-threads:####] [-echobatch:####] [-downlink:#]\n"
         L"\n"
         L"Client-side usage:\n"
-        L"\tMultipathLatencyTool -target:<addr or name> [-port:####] [-bitrate:<see below>] [-grouping:<see below>] "
-        L"[-duration:####] [-secondary:#] [-output:<path>]"
-        L"[-prepostrecvs:####]\n"
+        L"\tMultipathLatencyTool -target:<addr or name> [-port:####] [-protocol:<native,stamp>] [-bitrate:<see below>] [-grouping:<see below>] "
+        L"[-duration:####] [-losstimeout:####] [-report:<Ns,Nms>] [-histogramdigits:#] [-secondary:#] [-paths:<list>] [-combine:<list>] [-scheduler:<see below>] [-output:<path>] [-format:<csv,binary>]"
+        L"[-prepostrecvs:####] [-batchsend:#] [-pacing:<timer,precise>] [-catchup:<see below>] [-catchuplimit:####] [-iopool:####] [-timestamping:#] [-verifypayload:#] [-echo:<full,header>] [-mode:<echo,downlink>] [-clock:<qpc,tsc>]\n"
         L"\n\n"
         L"---------------------------------------------------------\n"
         L"                      Common Options                     \n"
         L"---------------------------------------------------------\n"
         L"-port:####\n"
         L"\t- the port on which the server will listen and the client will connect\n"
-        L"\t- (default value: 8888)\n"
+        L"\t- (default value: 8888, 862 with -protocol:stamp)\n"
+        L"-protocol:<native,stamp>\n"
+        L"\t- the datagrams exchanged by the client and the server:\n"
+        L"\t\t- native uses the datagram header of this tool (default)\n"
+        L"\t\t- stamp uses the test packets of STAMP (RFC 8762) and TWAMP-Light, to measure against a standard\n"
+        L"\t\t  reflector, or to reflect the packets of standard senders. The reflector timestamps the receive and\n"
+        L"\t\t  the send of each packet: the time spent in the reflector is reported and subtracted from the latency.\n"
+        L"\t\t  The server still echoes the native datagrams, not the ones of the previous versions\n"
         L"-prepostrecvs:####\n"
         L"\t- the number of receive requests to be kept in-flight\n"
         L"\t- (default value: 2)\n"
+        L"-clock:<qpc,tsc>\n"
+        L"\t- the clock of the datagram timestamps, recorded in nanoseconds:\n"
+        L"\t\t- qpc uses QueryPerformanceCounter, usually with a resolution of 100 ns (default)\n"
+        L"\t\t- tsc reads the time stamp counter of the processor, calibrated against QPC, with a resolution\n"
+        L"\t\t  below 1 ns. Falls back to qpc if the processor has no invariant TSC (x86 and x64 only).\n"
+        L"\t\t  Not supported with -timestamping, the kernel timestamps are taken with QPC\n"
         L"-help\n"
         L"\t- prints this usage information\n"
         L"\n\n"
@@ -99,6 +131,23 @@ void PrintUsage()
         L"---------------------------------------------------------\n"
         L"-listen:<addr or *>\n"
         L"\t- the IP address on which the server will listen for incoming datagrams, or '*' for all addresses\n"
+        L"-threads:####\n"
+        L"\t- the number of dedicated threads echoing the datagrams, each pinned to a processor\n"
+        L"\t- each thread keeps -prepostrecvs receives in flight and dequeues completions in batches\n"
+        L"\t- the threads share the single socket and receive queue of the server, they spread the echoes only\n"
+        L"\t- their throughput and queueing delay are printed when the server is stopped with Ctrl-C\n"
+        L"\t- (default value: 0, the datagrams are echoed from the system threadpool)\n"
+        L"-echobatch:####\n"
+        L"\t- the maximum number of datagrams each thread dequeues at once and echoes together\n"
+        L"\t- consecutive datagrams from the same client with the same size are echoed with a single send\n"
+        L"\t- requires -threads, one thread is used if not specified\n"
+        L"\t- (default value: 1, the datagrams are echoed one by one)\n"
+        L"-downlink:<0,1>\n"
+        L"\t- whether to stream datagrams to the clients run with -mode:downlink:\n"
+        L"\t\t- set to 1 to serve their stream requests, at the bitrate they request on each of their paths, up to\n"
+        L"\t\t  250 megabits per second each and 1 gigabit per second in total\n"
+        L"\t\t- set to 0 to drop the stream requests (default), a client can then not make the server send more\n"
+        L"\t\t  than it receives\n"
         L"\n\n"
         L"---------------------------------------------------------\n"
         L"                      Client Options                     \n"
@@ -113,42 +162,86 @@ void PrintUsage()
         L"\t\t- ## specifies the desired bitrate in magatbits per second\n"
         L"-grouping:####\n"
         L"\t- the number of datagrams to process during each send operation (default: 30)\n"
+        L"-batchsend:<0,1>\n"
+        L"\t- whether to send the datagrams of each send operation with a single send call:\n"
+        L"\t\t- set to 1 to hand the whole group to the network stack at once, using UDP send offload\n"
+        L"\t\t- set to 0 to send each datagram with its own send call (default)\n"
+        L"-pacing:<timer,precise>\n"
+        L"\t- how the send operations are scheduled:\n"
+        L"\t\t- timer uses a threadpool timer, with the resolution of the system timer (default)\n"
+        L"\t\t- precise uses a dedicated thread, which sleeps then spins until each deadline. Allows sub-millisecond\n"
+        L"\t\t  intervals, e.g. -grouping:1 at high bitrates, at the cost of additional CPU usage. The datagrams of\n"
+        L"\t\t  a group are each sent at their own deadline, unless -batchsend:1 sends the group at once\n"
+        L"-catchup:<burst,skip,spread>\n"
+        L"\t- what the timer pacing does when send operations are late, e.g. when the system is overloaded:\n"
+        L"\t\t- burst runs the late send operations back-to-back, up to -catchuplimit, and skips the others (default)\n"
+        L"\t\t- skip skips the late send operations, the bitrate offered is lower than requested\n"
+        L"\t\t- spread runs the late send operations along the next ones, over -catchuplimit send operations\n"
+        L"-catchuplimit:####\n"
+        L"\t- the maximum burst, or the number of send operations to spread the late ones over (default: 16)\n"
+        L"-iopool:####\n"
+        L"\t- the number of I/O requests preallocated for each socket (default: 256)\n"
+        L"\t- requests beyond this number are allocated on demand, which is reported in the statistics\n"
+        L"-timestamping:<0,1>\n"
+        L"\t- whether to record the timestamps taken by the network stack when the datagrams are sent and received:\n"
+        L"\t\t- set to 1 to report the latency between the kernel timestamps and the overhead of the application\n"
+        L"\t\t  timestamps, if the OS supports socket timestamping\n"
+        L"\t\t- set to 0 to only record the application timestamps (default)\n"
+        L"-verifypayload:<0,1>\n"
+        L"\t- whether to verify the payload of the datagrams with a CRC32C carried in their header:\n"
+        L"\t\t- set to 1 to count the datagrams corrupted on the way, in each direction. They are counted as lost\n"
+        L"\t\t- set to 0 to only check the header of the datagrams (default)\n"
+        L"-echo:<full,header>\n"
+        L"\t- what the server echoes of each datagram:\n"
+        L"\t\t- full: the whole datagram, the return path carries as much as the forward path (default)\n"
+        L"\t\t- header: the header only, with the time and the length the server received it. The return path carries\n"
+        L"\t\t  72 bytes per datagram, and the uplink throughput reported by the server is printed for each interface\n"
+        L"-mode:<echo,downlink>\n"
+        L"\t- the direction measured:\n"
+        L"\t\t- echo: the client sends the datagrams and the server echoes them, the round trip is measured (default)\n"
+        L"\t\t- downlink: the server streams the datagrams at -bitrate and -grouping on each path, the one-way delay,\n"
+        L"\t\t  the jitter and the loss from the server are measured. The server must be run with -downlink:1\n"
         L"-duration:####\n"
         L"\t- the total number of seconds to run (default: 60 seconds)\n"
+        L"\t- set to 0 to run until Ctrl-C is pressed. The memory used does not depend on the duration\n"
+        L"-losstimeout:####\n"
+        L"\t- the number of milliseconds after which a datagram not received is counted as lost (default: 5000)\n"
+        L"-report:<Ns,Nms>\n"
+        L"\t- print the statistics of each interval of N seconds or milliseconds during the run, for each interface:\n"
+        L"\t\t- sent, received and lost datagrams, median and 99th percentile latency\n"
+        L"\t\t- a datagram is reported lost in the interval its loss timeout expired\n"
+        L"-histogramdigits:<1-5>\n"
+        L"\t- the number of significant digits of the latencies reported by the statistics (default: 3)\n"
+        L"\t- the memory used by the latency histograms grows tenfold with each digit\n"
         L"-secondary:<0,1>\n"
         L"\t- whether or not use a secondary wlan interface:\n"
         L"\t\t- set to 1 to make a best effort of using a secondary interface (default)\n"
         L"\t\t- set to 0 to not use a secondary interface. This can be used for comparison.\n"
+        L"-paths:<list>\n"
+        L"\t- additional paths to measure along the primary and secondary interfaces, separated by commas\n"
+        L"\t\t- a number sends from the network interface with this index, e.g. -paths:12,15\n"
+        L"\t\t- an address sends from this local address, e.g. -paths:192.168.1.20\n"
+        L"\t- the paths are numbered after the primary (0) and secondary (1) interfaces, starting at 2\n"
+        L"-combine:<list>\n"
+        L"\t- the sets of paths whose effective latency is reported, separated by commas (default: all the paths)\n"
+        L"\t\t- e.g. -combine:0+1,0+2 compares using the secondary interface or path 2 along the primary interface\n"
+        L"-scheduler:<duplicate,minrtt,onloss,onlatency>\n"
+        L"\t- how the paths each datagram is sent on are chosen:\n"
+        L"\t\t- duplicate sends every datagram on all the paths (default)\n"
+        L"\t\t- minrtt sends each datagram on the path with the lowest latency\n"
+        L"\t\t- onloss sends on the primary interface, and on all the paths for a while after a loss\n"
+        L"\t\t- onlatency sends on the primary interface, and on all the paths while its latency is above a threshold\n"
+        L"\t- the single path policies send a datagram on all the paths regularly, to keep measuring them\n"
+        L"-duplicatethreshold:####\n"
+        L"\t- the latency above which the onlatency policy duplicates the datagrams, in milliseconds (default: 20)\n"
+        L"-duplicateholdoff:####\n"
+        L"\t- the time during which the onloss policy duplicates the datagrams after a loss, in milliseconds (default: 1000)\n"
         L"-output:<path>\n"
-        L"\t- the path of a file where measured data will be stored\n");
-}
-
-std::wstring_view ParseArgumentValue(const std::wstring_view str)
-{
-    const auto delim = str.find(L':');
-    if (delim == std::wstring_view::npos)
-    {
-        return {};
-    }
-
-    return str.substr(delim + 1);
-}
-
-std::optional<std::wstring_view> ParseArgument(const std::wstring_view name, std::vector<const wchar_t*>& args)
-{
-    auto foundParameter = std::ranges::find_if(args, [&](const std::wstring_view arg) { return arg.starts_with(name); });
-    if (foundParameter != args.end())
-    {
-        auto value = ParseArgumentValue(*foundParameter);
-        if (value.empty())
-        {
-            throw std::invalid_argument("Found parameter without value");
-        }
-
-        args.erase(foundParameter);
-        return value;
-    }
-    return {};
+        L"\t- the path of a file where measured data will be stored\n"
+        L"-format:<csv,binary>\n"
+        L"\t- the format of the output file:\n"
+        L"\t\t- csv writes one line of text per datagram (default)\n"
+        L"\t\t- binary writes a compact columnar file (.mla), see the documentation for the layout\n");
 }
 
 Configuration ParseArguments(std::vector<const wchar_t*>& args)
@@ -196,6 +289,23 @@ Configuration ParseArguments(std::vector<const wchar_t*>& args)
         throw std::invalid_argument("-listen or -target must be specified");
     }
 
+    if (auto protocol = ParseArgument(L"-protocol", args))
+    {
+        if (L"native" == protocol)
+        {
+            config.m_protocol = DatagramProtocol::Native;
+        }
+        else if (L"stamp" == protocol)
+        {
+            config.m_protocol = DatagramProtocol::Stamp;
+            config.m_port = c_stampPort;
+        }
+        else
+        {
+            throw std::invalid_argument("-protocol invalid argument");
+        }
+    }
+
     if (auto port = ParseArgument(L"-port", args))
     {
         config.m_port = integer_cast<unsigned short>(*port);
@@ -240,12 +350,235 @@ Configuration ParseArguments(std::vector<const wchar_t*>& args)
         }
     }
 
+    if (auto batchSend = ParseArgument(L"-batchsend", args))
+    {
+        config.m_batchSend = (integer_cast<unsigned long>(*batchSend) != 0);
+    }
+
+    if (auto timestamping = ParseArgument(L"-timestamping", args))
+    {
+        config.m_timestamping = (integer_cast<unsigned long>(*timestamping) != 0);
+    }
+
+    if (auto verifyPayload = ParseArgument(L"-verifypayload", args))
+    {
+        config.m_verifyPayload = (integer_cast<unsigned long>(*verifyPayload) != 0);
+        // the CRC is carried in the native header
+        if (config.m_verifyPayload && config.m_protocol == DatagramProtocol::Stamp)
+        {
+            throw std::invalid_argument("-verifypayload is not supported with -protocol:stamp");
+        }
+    }
+
+    if (auto echo = ParseArgument(L"-echo", args))
+    {
+        if (L"full" == echo)
+        {
+            config.m_headerEcho = false;
+        }
+        else if (L"header" == echo)
+        {
+            // the request is carried in the native header
+            if (config.m_protocol == DatagramProtocol::Stamp)
+            {
+                throw std::invalid_argument("-echo:header is not supported with -protocol:stamp");
+            }
+            config.m_headerEcho = true;
+        }
+        else
+        {
+            throw std::invalid_argument("-echo invalid argument");
+        }
+    }
+
+    if (auto mode = ParseArgument(L"-mode", args))
+    {
+        if (L"echo" == mode)
+        {
+            config.m_downlink = false;
+        }
+        else if (L"downlink" == mode)
+        {
+            // the request is carried in the native header, and the server streams the datagrams whole
+            if (config.m_protocol == DatagramProtocol::Stamp)
+            {
+                throw std::invalid_argument("-mode:downlink is not supported with -protocol:stamp");
+            }
+            if (config.m_headerEcho)
+            {
+                throw std::invalid_argument("-mode:downlink is not supported with -echo:header");
+            }
+            // the server refuses the streams above its cap
+            if (config.m_bitrate > DownlinkStreamer::c_maxSessionBitrate)
+            {
+                throw std::invalid_argument("-mode:downlink is limited to a -bitrate of 250 megabits per second");
+            }
+            if (config.m_grouping > DownlinkStreamer::c_maxGrouping)
+            {
+                throw std::invalid_argument("-mode:downlink is limited to a -grouping of 64");
+            }
+            config.m_downlink = true;
+        }
+        else
+        {
+            throw std::invalid_argument("-mode invalid argument");
+        }
+    }
+
+    if (auto pacing = ParseArgument(L"-pacing", args))
+    {
+        if (L"timer" == pacing)
+        {
+            config.m_precisePacing = false;
+        }
+        else if (L"precise" == pacing)
+        {
+            config.m_precisePacing = true;
+        }
+        else
+        {
+            throw std::invalid_argument("-pacing invalid argument");
+        }
+    }
+
+    if (auto catchUp = ParseArgument(L"-catchup", args))
+    {
+        if (L"burst" == catchUp)
+        {
+            config.m_catchUp.m_policy = TimerCatchUpPolicy::Burst;
+        }
+        else if (L"skip" == catchUp)
+        {
+            config.m_catchUp.m_policy = TimerCatchUpPolicy::Skip;
+        }
+        else if (L"spread" == catchUp)
+        {
+            config.m_catchUp.m_policy = TimerCatchUpPolicy::Spread;
+        }
+        else
+        {
+            throw std::invalid_argument("-catchup invalid argument");
+        }
+    }
+
+    if (auto catchUpLimit = ParseArgument(L"-catchuplimit", args))
+    {
+        config.m_catchUp.m_limit = integer_cast<unsigned long>(*catchUpLimit);
+        if (config.m_catchUp.m_limit == 0)
+        {
+            throw std::invalid_argument("-catchuplimit must be greater than 0");
+        }
+    }
+
+    if (auto scheduler = ParseArgument(L"-scheduler", args))
+    {
+        if (L"duplicate" == scheduler)
+        {
+            config.m_schedulingPolicy = SchedulingPolicy::DuplicateAll;
+        }
+        else if (L"minrtt" == scheduler)
+        {
+            config.m_schedulingPolicy = SchedulingPolicy::MinLatency;
+        }
+        else if (L"onloss" == scheduler)
+        {
+            config.m_schedulingPolicy = SchedulingPolicy::DuplicateOnLoss;
+        }
+        else if (L"onlatency" == scheduler)
+        {
+            config.m_schedulingPolicy = SchedulingPolicy::DuplicateOnLatency;
+        }
+        else
+        {
+            throw std::invalid_argument("-scheduler invalid argument");
+        }
+    }
+
+    if (auto duplicateThreshold = ParseArgument(L"-duplicatethreshold", args))
+    {
+        config.m_duplicateThreshold = integer_cast<unsigned long>(*duplicateThreshold);
+    }
+
+    if (auto duplicateHoldoff = ParseArgument(L"-duplicateholdoff", args))
+    {
+        config.m_duplicateHoldoff = integer_cast<unsigned long>(*duplicateHoldoff);
+    }
+
+    if (auto ioPool = ParseArgument(L"-iopool", args))
+    {
+        config.m_ioPoolCapacity = integer_cast<unsigned long>(*ioPool);
+        if (config.m_ioPoolCapacity < 1)
+        {
+            throw std::invalid_argument("-iopool invalid argument");
+        }
+    }
+
     if (auto duration = ParseArgument(L"-duration", args))
     {
         config.m_duration = integer_cast<unsigned long>(*duration);
-        if (config.m_duration < 1)
+    }
+
+    if (auto lossTimeout = ParseArgument(L"-losstimeout", args))
+    {
+        config.m_lossTimeout = integer_cast<unsigned long>(*lossTimeout);
+        if (config.m_lossTimeout < 1)
+        {
+            throw std::invalid_argument("-losstimeout invalid argument");
+        }
+    }
+
+    if (auto report = ParseArgument(L"-report", args))
+    {
+        // Accept a number of seconds or milliseconds: 1s, 500ms
+        std::wstring_view interval{*report};
+        unsigned long multiplier = 1000;
+        if (interval.ends_with(L"ms"))
+        {
+            interval.remove_suffix(2);
+            multiplier = 1;
+        }
+        else if (interval.ends_with(L"s"))
+        {
+            interval.remove_suffix(1);
+        }
+
+        config.m_reportInterval = integer_cast<unsigned long>(interval) * multiplier;
+        // The threadpool timer period is limited to 2^32 x 100ns
+        if (config.m_reportInterval < 1 || config.m_reportInterval > 300'000)
+        {
+            throw std::invalid_argument("-report invalid argument");
+        }
+    }
+
+    if (auto histogramDigits = ParseArgument(L"-histogramdigits", args))
+    {
+        const auto digits = integer_cast<unsigned long>(*histogramDigits);
+        if (digits < 1 || digits > 5)
+        {
+            throw std::invalid_argument("-histogramdigits invalid argument");
+        }
+        config.m_histogramDigits = static_cast<int>(digits);
+    }
+
+    if (auto clock = ParseArgument(L"-clock", args))
+    {
+        if (L"qpc" == clock)
+        {
+            config.m_clock = ClockSource::Qpc;
+        }
+        else if (L"tsc" == clock)
+        {
+            config.m_clock = ClockSource::Tsc;
+        }
+        else
+        {
+            throw std::invalid_argument("-clock invalid argument");
+        }
+
+        // The kernel timestamps are taken with QPC: the TSC, calibrated once, drifts from them during the run
+        if (config.m_clock == ClockSource::Tsc && config.m_timestamping)
         {
-            throw std::invalid_argument("-duration invalid argument");
+            throw std::invalid_argument("-clock:tsc is not supported with -timestamping");
         }
     }
 
@@ -258,11 +591,81 @@ Configuration ParseArguments(std::vector<const wchar_t*>& args)
         }
     }
 
+    if (auto threads = ParseArgument(L"-threads", args))
+    {
+        config.m_serverThreads = integer_cast<unsigned long>(*threads);
+        if (config.m_serverThreads > 1024)
+        {
+            throw std::invalid_argument("-threads invalid argument");
+        }
+    }
+
+    if (auto echoBatch = ParseArgument(L"-echobatch", args))
+    {
+        config.m_echoBatchSize = integer_cast<unsigned long>(*echoBatch);
+        if (config.m_echoBatchSize < 1 || config.m_echoBatchSize > 1024)
+        {
+            throw std::invalid_argument("-echobatch invalid argument");
+        }
+        // echo batching is done by the dedicated threads
+        if (config.m_echoBatchSize > 1 && config.m_serverThreads == 0)
+        {
+            config.m_serverThreads = 1;
+        }
+    }
+
+    if (auto downlink = ParseArgument(L"-downlink", args))
+    {
+        config.m_downlinkStreams = (integer_cast<unsigned long>(*downlink) != 0);
+    }
+
     if (auto secondary = ParseArgument(L"-secondary", args))
     {
         config.m_useSecondaryWlanInterface = (integer_cast<unsigned long>(*secondary) != 0);
     }
 
+    if (auto paths = ParseArgument(L"-paths", args))
+    {
+        for (const auto path : SplitArgumentValue(*paths, L','))
+        {
+            PathConfiguration pathConfiguration;
+            if (!path.empty() && path.find_first_not_of(L"0123456789") == std::wstring_view::npos)
+            {
+                pathConfiguration.m_interfaceIndex = static_cast<int>(integer_cast<unsigned long>(path));
+            }
+            else if (!pathConfiguration.m_sourceAddress.SetAddress(std::wstring{path}.c_str()) ||
+                     pathConfiguration.m_sourceAddress.family() != config.m_targetAddress.family())
+            {
+                throw std::invalid_argument("-paths invalid argument");
+            }
+            config.m_additionalPaths.push_back(pathConfiguration);
+        }
+
+        if (2 + config.m_additionalPaths.size() > c_maxPathCount)
+        {
+            throw std::invalid_argument("-paths too many paths");
+        }
+    }
+
+    if (auto combinations = ParseArgument(L"-combine", args))
+    {
+        const auto pathCount = 2 + config.m_additionalPaths.size();
+        for (const auto combination : SplitArgumentValue(*combinations, L','))
+        {
+            PathSet paths = 0;
+            for (const auto path : SplitArgumentValue(combination, L'+'))
+            {
+                const auto index = integer_cast<unsigned long>(path);
+                if (index >= pathCount)
+                {
+                    throw std::invalid_argument("-combine invalid path");
+                }
+                paths |= PathSet{1} << index;
+            }
+            config.m_combinations.push_back(paths);
+        }
+    }
+
     if (auto outputPath = ParseArgument(L"-output", args))
     {
         config.m_outputFile = *outputPath;
@@ -274,6 +677,22 @@ Configuration ParseArguments(std::vector<const wchar_t*>& args)
         }
     }
 
+    if (auto format = ParseArgument(L"-format", args))
+    {
+        if (L"csv" == format)
+        {
+            config.m_outputFormat = LatencyDumpFormat::Csv;
+        }
+        else if (L"binary" == format)
+        {
+            config.m_outputFormat = LatencyDumpFormat::Binary;
+        }
+        else
+        {
+            throw std::invalid_argument("-format invalid argument");
+        }
+    }
+
     // Undocumented options for debug purpose
 
     if (auto logLevel = ParseArgument(L"-loglevel", args))
@@ -295,6 +714,19 @@ Configuration ParseArguments(std::vector<const wchar_t*>& args)
     return config;
 }
 
+// Signaled on Ctrl-C or Ctrl-Break to stop the client or the server
+wil::unique_event g_stopEvent;
+
+BOOL WINAPI StopCtrlHandler(DWORD ctrlType) noexcept
+{
+    if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT)
+    {
+        g_stopEvent.SetEvent();
+        return TRUE;
+    }
+    return FALSE;
+}
+
 void RunServerMode(Configuration& config)
 {
     if (config.m_listenAddress.port() == 0)
@@ -304,15 +736,23 @@ void RunServerMode(Configuration& config)
 
     Log<LogLevel::Output>("Starting the echo server...\n");
 
-    StreamServer server(config.m_listenAddress);
+    StreamServer server(
+        config.m_listenAddress, config.m_serverThreads, config.m_echoBatchSize, config.m_protocol, config.m_downlinkStreams);
     server.Start(config.m_prePostRecvs);
 
     Log<LogLevel::Output>("Ready to echo data\n");
 
-    // Sleep until the program is interrupted with Ctrl-C
-    Sleep(INFINITE);
+    // Run until the program is interrupted with Ctrl-C
+    g_stopEvent.create(wil::EventOptions::ManualReset);
+    THROW_IF_WIN32_BOOL_FALSE(SetConsoleCtrlHandler(StopCtrlHandler, TRUE));
+    g_stopEvent.wait(INFINITE);
+
+    Log<LogLevel::Output>("Stopping the echo server...\n");
+    server.Stop();
+    server.PrintStatistics();
 }
 
+
 void RunClientMode(Configuration& config)
 {
     if (config.m_targetAddress.port() == 0)
@@ -326,19 +766,35 @@ void RunClientMode(Configuration& config)
 
     Log<LogLevel::Output>("Starting connection setup...\n");
     StreamClient client(config.m_targetAddress, config.m_prePostRecvs, completionEvent.get());
+
+    // Ctrl-C stops the run early, the statistics are still printed
+    g_stopEvent.create(wil::EventOptions::ManualReset);
+    THROW_IF_WIN32_BOOL_FALSE(SetConsoleCtrlHandler(StopCtrlHandler, TRUE));
     if (config.m_useSecondaryWlanInterface)
     {
         client.RequestSecondaryWlanConnection();
     }
 
     Log<LogLevel::Output>("Start transmitting data...\n");
-    client.Start(config.m_bitrate, config.m_grouping, config.m_duration);
+    client.Start(config);
 
-    // wait for twice as long as the duration
-    if (!completionEvent.wait(config.m_duration * 2 * 1000))
+    // wait for twice as long as the duration, or until stopped if there is no duration
+    const HANDLE events[] = {completionEvent.get(), g_stopEvent.get()};
+    const DWORD timeout = config.m_duration > 0 ? config.m_duration * 2 * 1000 : INFINITE;
+    switch (WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, timeout))
     {
+    case WAIT_OBJECT_0:
+        break;
+
+    case WAIT_OBJECT_0 + 1:
+        Log<LogLevel::Output>("Stopping the run...\n");
+        client.Stop();
+        break;
+
+    default:
         Log<LogLevel::Error>("Timed out waiting for run to complete\n");
         client.Stop();
+        break;
     }
 
     Log<LogLevel::Output>("Transmission complete\n");
@@ -347,9 +803,7 @@ void RunClientMode(Configuration& config)
     if (!config.m_outputFile.empty())
     {
         Log<LogLevel::Output>("Dumping data to file...\n");
-        std::ofstream file{config.m_outputFile};
-        client.DumpLatencyData(file);
-        file.close();
+        client.DumpLatencyData(config.m_outputFile, config.m_outputFormat);
     }
 }
 
@@ -396,13 +850,35 @@ try
 
     Configuration config = ParseArguments(args);
 
+    // The clock must be selected before the first datagram is timestamped
+    if (!TimestampClock::Select(config.m_clock))
+    {
+        std::cout << "The processor has no invariant TSC, the timestamps are taken with QPC\n";
+    }
+
     if (config.m_listenAddress.family() != AF_UNSPEC)
     {
         // Start the server if "-listen" is specified
         std::cout << "--- Server Mode ---\n";
         std::wcout << L"Port: " << config.m_port << L'\n';
+        std::wcout << L"Protocol: " << (config.m_protocol == DatagramProtocol::Stamp ? L"STAMP" : L"native") << L'\n';
         std::wcout << L"Listen Address: " << config.m_listenAddress.WriteCompleteAddress() << L'\n';
         std::wcout << L"Number of receive buffers: " << config.m_prePostRecvs << L'\n';
+        std::cout << "Clock: " << ClockSourceName(TimestampClock::Source()) << " (" << TimestampClock::Frequency() / 1'000'000.
+                  << " MHz)\n";
+        if (config.m_serverThreads > 0)
+        {
+            std::wcout << L"Echo threads: " << config.m_serverThreads << L'\n';
+        }
+        else
+        {
+            std::wcout << L"Echo threads: system threadpool\n";
+        }
+        if (config.m_echoBatchSize > 1)
+        {
+            std::wcout << L"Echo batch size: " << config.m_echoBatchSize << L'\n';
+        }
+        std::wcout << L"Downlink streams: " << (config.m_downlinkStreams ? L"enabled" : L"disabled") << L'\n';
         std::cout << "-------------------\n\n";
 
         RunServerMode(config);
@@ -412,11 +888,62 @@ try
         // Start a client if "-target" is specified
         std::cout << "--- Client Mode ---\n";
         std::wcout << L"Port: " << config.m_port << L'\n';
+        std::wcout << L"Protocol: " << (config.m_protocol == DatagramProtocol::Stamp ? L"STAMP" : L"native") << L'\n';
         std::wcout << L"Target Address: " << config.m_targetAddress.WriteCompleteAddress() << L'\n';
         std::wcout << L"Bitrate: " << config.m_bitrate << L" bits per second\n";
         std::wcout << L"Datagram grouping: " << config.m_grouping << L'\n';
-        std::wcout << L"Duration: " << config.m_duration << L" seconds\n";
+        std::wcout << L"Batched send: " << (config.m_batchSend ? L"enabled" : L"disabled") << L'\n';
+        std::wcout << L"Pacing: " << (config.m_precisePacing ? L"precise" : L"timer") << L'\n';
+        if (!config.m_precisePacing)
+        {
+            std::wcout << L"Catch-up policy: " << TimerCatchUpPolicyName(config.m_catchUp.m_policy) << L", limit "
+                       << config.m_catchUp.m_limit << L'\n';
+        }
+        std::wcout << L"Kernel timestamping: " << (config.m_timestamping ? L"enabled" : L"disabled") << L'\n';
+        std::wcout << L"Payload verification: "
+                   << (config.m_verifyPayload ? (IsCrc32cAccelerated() ? L"CRC32C (hardware)" : L"CRC32C (table)") : L"disabled")
+                   << L'\n';
+        std::wcout << L"Echo: " << (config.m_headerEcho ? L"header only" : L"full") << L'\n';
+        std::wcout << L"Mode: " << (config.m_downlink ? L"downlink, streamed by the server" : L"echo") << L'\n';
+        std::cout << "Clock: " << ClockSourceName(TimestampClock::Source()) << " (" << TimestampClock::Frequency() / 1'000'000.
+                  << " MHz)\n";
+        if (config.m_duration > 0)
+        {
+            std::wcout << L"Duration: " << config.m_duration << L" seconds\n";
+        }
+        else
+        {
+            std::wcout << L"Duration: until stopped with Ctrl-C\n";
+        }
+        std::wcout << L"Loss timeout: " << config.m_lossTimeout << L" milliseconds\n";
+        if (config.m_reportInterval > 0)
+        {
+            std::wcout << L"Report interval: " << config.m_reportInterval << L" milliseconds\n";
+        }
         std::wcout << L"Number of receive buffers: " << config.m_prePostRecvs << L'\n';
+        std::wcout << L"Scheduler: " << SchedulingPolicyName(config.m_schedulingPolicy);
+        if (config.m_schedulingPolicy == SchedulingPolicy::DuplicateOnLatency)
+        {
+            std::wcout << L", duplicating above " << config.m_duplicateThreshold << L" milliseconds";
+        }
+        else if (config.m_schedulingPolicy == SchedulingPolicy::DuplicateOnLoss)
+        {
+            std::wcout << L", duplicating for " << config.m_duplicateHoldoff << L" milliseconds after a loss";
+        }
+        std::wcout << L'\n';
+        for (size_t i = 0; i < config.m_additionalPaths.size(); ++i)
+        {
+            const auto& path = config.m_additionalPaths[i];
+            std::wcout << L"Path " << 2 + i << L": ";
+            if (path.m_interfaceIndex != 0)
+            {
+                std::wcout << L"interface " << path.m_interfaceIndex << L'\n';
+            }
+            else
+            {
+                std::wcout << L"source address " << path.m_sourceAddress.WriteAddress() << L'\n';
+            }
+        }
         std::cout << "-------------------\n\n";
 
         RunClientMode(config);
@@ -16,6 +16,53 @@ namespace multipath {
 
 namespace {
     constexpr DWORD c_defaultSocketReceiveBufferSize = 1048576; // 1MB receive buffer
+
+    // Sends with a SO_TIMESTAMP_ID control message, to retrieve the kernel timestamp of the send once completed
+    int SendWithTimestampId(SOCKET socket, WSABUF* buffers, DWORD bufferCount, UINT32 timestampId, OVERLAPPED* ov) noexcept
+    {
+        alignas(WSACMSGHDR) char control[WSA_CMSG_SPACE(sizeof(UINT32))]{};
+        WSAMSG message{};
+        message.lpBuffers = buffers;
+        message.dwBufferCount = bufferCount;
+        message.Control.buf = control;
+        message.Control.len = sizeof(control);
+
+        auto* controlHeader = WSA_CMSG_FIRSTHDR(&message);
+        controlHeader->cmsg_len = WSA_CMSG_LEN(sizeof(UINT32));
+        controlHeader->cmsg_level = SOL_SOCKET;
+        controlHeader->cmsg_type = SO_TIMESTAMP_ID;
+        *reinterpret_cast<UINT32*>(WSA_CMSG_DATA(controlHeader)) = timestampId;
+
+        return WSASendMsg(socket, &message, 0, nullptr, ov, nullptr);
+    }
+
+    // Returns the kernel timestamp of a completed send in nanoseconds, or -1 if it is not available
+    long long GetKernelSendTimestamp(SOCKET socket, UINT32 timestampId) noexcept
+    {
+        UINT64 timestamp = 0;
+        DWORD bytesReturned = 0;
+        const auto error = WSAIoctl(
+            socket, SIO_GET_TX_TIMESTAMP, &timestampId, sizeof(timestampId), &timestamp, sizeof(timestamp), &bytesReturned, nullptr, nullptr);
+        if (SOCKET_ERROR == error)
+        {
+            return -1;
+        }
+        return ConvertQpcToNanoSec(static_cast<long long>(timestamp));
+    }
+
+    // Returns the kernel timestamp in the control messages of a received datagram in nanoseconds, or -1 if absent
+    long long GetKernelReceiveTimestamp(WSAMSG& message) noexcept
+    {
+        for (auto* controlHeader = WSA_CMSG_FIRSTHDR(&message); controlHeader; controlHeader = WSA_CMSG_NXTHDR(&message, controlHeader))
+        {
+            if (controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SO_TIMESTAMP)
+            {
+                const auto timestamp = *reinterpret_cast<const UINT64*>(WSA_CMSG_DATA(controlHeader));
+                return ConvertQpcToNanoSec(static_cast<long long>(timestamp));
+            }
+        }
+        return -1;
+    }
 }
 
 MeasuredSocket::~MeasuredSocket() noexcept
@@ -24,7 +71,13 @@ MeasuredSocket::~MeasuredSocket() noexcept
     Cancel();
 }
 
-void MeasuredSocket::Setup(const ctl::ctSockaddr& targetAddress, int numReceivedBuffers, int interfaceIndex)
+void MeasuredSocket::Setup(
+    const ctl::ctSockaddr& targetAddress,
+    int numReceivedBuffers,
+    int interfaceIndex,
+    size_t ioPoolCapacity,
+    bool timestamping,
+    const ctl::ctSockaddr& sourceAddress)
 {
     auto lock = m_lock.lock();
 
@@ -33,30 +86,85 @@ void MeasuredSocket::Setup(const ctl::ctSockaddr& targetAddress, int numReceived
     SetSocketOutgoingInterface(m_socket.get(), targetAddress.family(), interfaceIndex);
     m_receiveStates.resize(numReceivedBuffers);
 
+    m_sendOffloadEnabled = TryEnableUdpSendOffload(m_socket.get(), static_cast<DWORD>(c_bufferSize));
+    if (!m_sendOffloadEnabled)
+    {
+        Log<LogLevel::Info>("UDP send offload is not supported, batched sends will use one send call per datagram\n");
+    }
+
+    m_timestampingEnabled = false;
+    if (timestamping)
+    {
+        // Keep a kernel timestamp for each send which can be in flight
+        const auto txTimestampsBuffered = static_cast<USHORT>((std::min)(ioPoolCapacity, size_t{USHRT_MAX}));
+        m_timestampingEnabled = TryEnableTimestamping(m_socket.get(), txTimestampsBuffered);
+        if (m_timestampingEnabled)
+        {
+            m_receiveMessage = GetReceiveMessageFunction(m_socket.get());
+        }
+        else
+        {
+            Log<LogLevel::Output>("Socket timestamping is not supported, only the application timestamps are recorded\n");
+        }
+    }
+
+    if (sourceAddress.family() != AF_UNSPEC)
+    {
+        const auto bindError = bind(m_socket.get(), sourceAddress.sockaddr(), sourceAddress.length());
+        THROW_LAST_ERROR_IF_MSG(SOCKET_ERROR == bindError, "bind failed");
+    }
+
     auto error = WSAConnect(m_socket.get(), targetAddress.sockaddr(), targetAddress.length(), nullptr, nullptr, nullptr, nullptr);
     THROW_LAST_ERROR_IF_MSG(SOCKET_ERROR == error, "WSAConnect failed");
 
-    m_threadpoolIo = std::make_unique<ctl::ctThreadIocp>(m_socket.get());
+    m_threadpoolIo = std::make_unique<ctl::ctThreadIocp>(m_socket.get(), nullptr, ioPoolCapacity);
+    m_socketUsers.Open();
 }
 
 void MeasuredSocket::Cancel() noexcept
 {
     // Ensure the socket is torn down and wait for all callbacks
+    const auto lock = m_lock.lock();
+    m_adapterStatus = AdapterStatus::Disabled;
+
+    // The users registered before the socket was marked canceled are done with it once they are all released,
+    // the next ones see it canceled. The callbacks of the requests still pending see it canceled too.
+    m_socketUsers.Cancel();
+    m_socket.reset();
+
+    // no new request can be issued once the socket is closed, the counters are final
+    if (m_threadpoolIo)
     {
-        const auto lock = m_lock.lock();
-        m_adapterStatus = AdapterStatus::Disabled;
-        m_socket.reset();
+        m_previousIoPoolStatistics = GetIoPoolStatistics();
+        m_previousIoPoolStatistics.in_use = 0;
     }
+
+    // the callbacks do not take the lock, waiting for them here cannot deadlock
     m_threadpoolIo.reset();
 }
 
+ctl::ctThreadIocpStatistics MeasuredSocket::GetIoPoolStatistics() const noexcept
+{
+    const auto lock = m_lock.lock();
+    if (!m_threadpoolIo)
+    {
+        return m_previousIoPoolStatistics;
+    }
+
+    auto statistics = m_threadpoolIo->statistics();
+    statistics.peak_in_use = (std::max)(statistics.peak_in_use, m_previousIoPoolStatistics.peak_in_use);
+    statistics.exhausted_count += m_previousIoPoolStatistics.exhausted_count;
+    statistics.total_requests += m_previousIoPoolStatistics.total_requests;
+    return statistics;
+}
+
 void MeasuredSocket::PrepareToReceivePing(wil::shared_event pingReceived)
 {
-    auto lock = m_lock.lock();
-    if (!m_socket.is_valid())
+    if (!m_socketUsers.Acquire())
     {
         THROW_WIN32_MSG(ERROR_INVALID_PARAMETER, "Invalid socket");
     }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
     DWORD flags = 0;
     WSABUF wsabuf;
@@ -64,12 +172,12 @@ void MeasuredSocket::PrepareToReceivePing(wil::shared_event pingReceived)
     wsabuf.len = static_cast<ULONG>(m_receiveStates[0].m_buffer.size());
 
     auto callback = [pingReceived, this](OVERLAPPED* ov) noexcept {
-        auto lock = m_lock.lock();
-        if (!m_socket.is_valid())
+        if (!m_socketUsers.Acquire())
         {
             Log<LogLevel::Info>("Ping reception callback canceled\n");
             return;
         }
+        const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
         DWORD bytesTransferred = 0;
         DWORD flags = 0;
@@ -78,6 +186,16 @@ void MeasuredSocket::PrepareToReceivePing(wil::shared_event pingReceived)
             FAIL_FAST_LAST_ERROR_MSG("A ping receive operation failed on socket %zu", m_socket.get());
         }
 
+        // An older server echoes the datagrams in its own format, it would corrupt the header of the current one
+        ReceiveResult result{};
+        if (!ParseReceivedDatagram(m_receiveStates[0].m_buffer.data(), bytesTransferred, result))
+        {
+            Log<LogLevel::Error>(
+                "Received an invalid ping answer on socket %zu, the server may run an older version or use another protocol\n",
+                m_socket.get());
+            return;
+        }
+
         Log<LogLevel::Info>("Received a ping answer on socket %zu\n", m_socket.get());
         pingReceived.SetEvent();
     };
@@ -101,16 +219,16 @@ void MeasuredSocket::PrepareToReceivePing(wil::shared_event pingReceived)
 
 void MeasuredSocket::PingEchoServer()
 {
-    auto lock = m_lock.lock();
-    if (!m_socket.is_valid())
+    if (!m_socketUsers.Acquire())
     {
         THROW_WIN32_MSG(ERROR_INVALID_PARAMETER, "Invalid socket");
     }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
     Log<LogLevel::Info>("Sending a ping on socket %zu\n", m_socket.get());
 
     const auto sequenceNumber = -1;
-    DatagramSendRequest sendRequest{sequenceNumber, s_sharedSendBuffer};
+    DatagramSendRequest sendRequest{MakeHeader(sequenceNumber), s_sharedSendBuffer, m_protocol};
     auto& buffers = sendRequest.GetBuffers();
 
     // Synchronous send
@@ -119,6 +237,111 @@ void MeasuredSocket::PingEchoServer()
     THROW_LAST_ERROR_IF_MSG(SOCKET_ERROR == error, "Failed to send a ping");
 }
 
+DatagramHeader MeasuredSocket::MakeHeader(long long sequenceNumber) const noexcept
+{
+    DatagramHeader header;
+    header.m_flowId = m_flowId;
+    header.m_pathId = m_pathId;
+    header.m_payloadLength = static_cast<uint32_t>(c_bufferSize - c_datagramHeaderLength);
+    header.m_sequenceNumber = sequenceNumber;
+    if (m_payloadCrc)
+    {
+        // All the datagrams have the same payload
+        static const auto payloadCrc = ComputeCrc32c(s_sharedSendBuffer.data() + c_datagramHeaderLength, header.m_payloadLength);
+        header.m_flags |= c_datagramPayloadCrcFlag;
+        header.m_payloadCrc = payloadCrc;
+    }
+    if (m_headerEcho)
+    {
+        header.m_flags |= c_datagramHeaderEchoFlag;
+    }
+    return header;
+}
+
+bool MeasuredSocket::ParseReceivedDatagram(const char* buffer, DWORD bytesTransferred, ReceiveResult& result) noexcept
+{
+    if (m_protocol == DatagramProtocol::Stamp)
+    {
+        // The reflector sends back the length it received: a shorter packet is truncated. The sequence number of the
+        // sender is used, a stateful reflector numbers its own packets.
+        StampReflectorPacket packet;
+        if (bytesTransferred != c_bufferSize || !ParseStampReflectorPacket(buffer, bytesTransferred, packet))
+        {
+            Log<LogLevel::Debug>("Received an invalid STAMP packet of %lu bytes on socket %zu\n", bytesTransferred, m_socket.get());
+            m_invalidDatagrams += 1;
+            return false;
+        }
+
+        // The 32-bit sequence numbers wrap after 2^32 datagrams, the ping is 2^32 - 1
+        result.m_sequenceNumber = static_cast<long long>(packet.m_senderSequenceNumber);
+        result.m_sendTimestamp = ConvertNtpToTimestamp(packet.m_senderTimestamp);
+        result.m_echoTimestamp = ConvertNtpToTimestamp(packet.m_timestamp);
+        result.m_reflectorReceiveTimestamp = ConvertNtpToTimestamp(packet.m_receiveTimestamp);
+        return true;
+    }
+
+    DatagramHeader header;
+    if (!ParseDatagramHeader(buffer, bytesTransferred, header))
+    {
+        Log<LogLevel::Debug>("Received an invalid datagram of %lu bytes on socket %zu\n", bytesTransferred, m_socket.get());
+        m_invalidDatagrams += 1;
+        return false;
+    }
+    if (header.m_flowId != m_flowId || header.m_pathId != m_pathId)
+    {
+        Log<LogLevel::Debug>(
+            "Received a datagram of flow %u, path %u on socket %zu\n", header.m_flowId, header.m_pathId, m_socket.get());
+        m_foreignDatagrams += 1;
+        return false;
+    }
+    if (!VerifyDatagramPayload(buffer, header))
+    {
+        Log<LogLevel::Debug>(
+            "Received a corrupt payload, sequence number %lld on socket %zu\n", header.m_sequenceNumber, m_socket.get());
+        m_corruptPayloads += 1;
+        return false;
+    }
+
+    if ((header.m_flags & c_datagramStreamRequestFlag) != 0)
+    {
+        // The server echoes the requests it does not refuse as header echoes, followed by the cookie of the path
+        EchoReport report;
+        uint64_t cookie = 0;
+        if (!ParseEchoReport(buffer, header, report) || !ParseStreamCookie(buffer, header, cookie))
+        {
+            Log<LogLevel::Debug>("Received a stream request echo without report or cookie on socket %zu\n", m_socket.get());
+            m_invalidDatagrams += 1;
+            return false;
+        }
+        result.m_streamRequest = true;
+        result.m_reflectorReceiveTimestamp = report.m_receiveTimestamp;
+        // The requests sent once the cookie is known start or renew the stream, the first one only obtains it
+        if (m_streamCookie.exchange(cookie) == cookie)
+        {
+            m_confirmedStreamRequests += 1;
+        }
+    }
+    else if (m_headerEcho)
+    {
+        // A server which does not know the flag echoes the whole datagram, without report
+        EchoReport report;
+        if (!ParseEchoReport(buffer, header, report))
+        {
+            Log<LogLevel::Debug>(
+                "Received an echo without report, sequence number %lld on socket %zu\n", header.m_sequenceNumber, m_socket.get());
+            m_invalidDatagrams += 1;
+            return false;
+        }
+        result.m_reflectorReceiveTimestamp = report.m_receiveTimestamp;
+        m_reportedBytes += report.m_bytesReceived;
+    }
+
+    result.m_sequenceNumber = header.m_sequenceNumber;
+    result.m_sendTimestamp = header.m_sendTimestamp;
+    result.m_echoTimestamp = header.m_echoTimestamp;
+    return true;
+}
+
 void MeasuredSocket::CheckConnectivity()
 {
     wil::shared_event connectedEvent(wil::EventOptions::ManualReset);
@@ -148,37 +371,85 @@ void MeasuredSocket::CheckConnectivity()
     THROW_WIN32_MSG(ERROR_NOT_CONNECTED, "Could not reach the server on socket %zu", m_socket.get());
 }
 
-void MeasuredSocket::SendDatagram(long long sequenceNumber, std::function<void(const SendResult&)> clientCallback) noexcept
+void MeasuredSocket::PrepareToSend(std::function<void(const SendResult&)> clientCallback) noexcept
 {
-    auto lock = m_lock.lock();
-    if (!m_socket.is_valid())
+    // Set before the first send, the completions only read it
+    m_sendCallback = std::move(clientCallback);
+}
+
+void MeasuredSocket::SendStreamRequest(const StreamRequest& request) noexcept
+{
+    if (!m_socketUsers.Acquire())
+    {
+        Log<LogLevel::Error>("Invalid socket, ignoring stream request\n");
+        return;
+    }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
+
+    // The requests are numbered separately from the datagrams streamed
+    auto header = MakeHeader(m_streamRequests);
+    header.m_flags |= c_datagramHeaderEchoFlag;
+    auto cookieRequest = request;
+    cookieRequest.m_cookie = m_streamCookie.load();
+    std::array<char, c_streamRequestDatagramLength> buffer{};
+    const auto length = WriteStreamRequest(buffer.data(), header, cookieRequest);
+    StampDatagramSend(buffer.data(), SnapTimestampInNanoSec());
+
+    Log<LogLevel::All>("Sending stream request %lld on socket %zu\n", m_streamRequests, m_socket.get());
+    m_streamRequests += 1;
+
+    // Synchronous send, like the ping
+    WSABUF wsabuf;
+    wsabuf.buf = buffer.data();
+    wsabuf.len = static_cast<ULONG>(length);
+    DWORD transmitedBytes = 0;
+    if (SOCKET_ERROR == WSASend(m_socket.get(), &wsabuf, 1, &transmitedBytes, 0, nullptr, nullptr))
+    {
+        // best effort send, the request is renewed
+        FAILED_WIN32_LOG(WSAGetLastError());
+    }
+}
+
+void MeasuredSocket::SendDatagram(long long sequenceNumber) noexcept
+{
+    if (!m_socketUsers.Acquire())
     {
         Log<LogLevel::Error>("Invalid socket, ignoring send request\n");
         return;
     }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
-    DatagramSendRequest sendRequest{sequenceNumber, s_sharedSendBuffer};
+    DatagramSendRequest sendRequest{MakeHeader(sequenceNumber), s_sharedSendBuffer, m_protocol};
     auto& buffers = sendRequest.GetBuffers();
     const MeasuredSocket::SendResult sendState{sequenceNumber, sendRequest.GetQpc()};
+    const auto timestampId = m_nextTimestampId++;
 
     Log<LogLevel::All>("Sending sequence number %lld on socket %zu\n", sequenceNumber, m_socket.get());
 
-    auto callback = [clientCallback = std::move(clientCallback), this, sendState](OVERLAPPED* ov) noexcept {
+    auto callback = [this, sendState, timestampId](OVERLAPPED* ov) noexcept {
         try
         {
-            auto lock = m_lock.lock();
-
-            if (!m_socket.is_valid())
+            if (!m_socketUsers.Acquire())
             {
                 Log<LogLevel::Info>("Send callback canceled\n");
                 return;
             }
+            const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
             DWORD bytesTransmitted = 0;
             DWORD flags = 0;
             if (WSAGetOverlappedResult(m_socket.get(), ov, &bytesTransmitted, false, &flags))
             {
-                clientCallback(sendState);
+                if (!m_timestampingEnabled)
+                {
+                    m_sendCallback(sendState);
+                    return;
+                }
+
+                auto result = sendState;
+                result.m_kernelSendTimestamp = GetKernelSendTimestamp(m_socket.get(), timestampId);
+                m_missingKernelSendTimestamps += result.m_kernelSendTimestamp < 0 ? 1 : 0;
+                m_sendCallback(result);
             }
             else
             {
@@ -190,7 +461,11 @@ void MeasuredSocket::SendDatagram(long long sequenceNumber, std::function<void(c
 
     OVERLAPPED* ov = m_threadpoolIo->new_request(callback);
 
-    auto error = WSASend(m_socket.get(), buffers.data(), static_cast<DWORD>(buffers.size()), nullptr, 0, ov, nullptr);
+    m_sendCalls += 1;
+    m_sentDatagrams += 1;
+    auto error = m_timestampingEnabled
+                     ? SendWithTimestampId(m_socket.get(), buffers.data(), static_cast<DWORD>(buffers.size()), timestampId, ov)
+                     : WSASend(m_socket.get(), buffers.data(), static_cast<DWORD>(buffers.size()), nullptr, 0, ov, nullptr);
     if (SOCKET_ERROR == error)
     {
         error = WSAGetLastError();
@@ -202,41 +477,153 @@ void MeasuredSocket::SendDatagram(long long sequenceNumber, std::function<void(c
     }
 }
 
+MeasuredSocket::SendBatch* MeasuredSocket::GetSendBatch()
+{
+    // only called by the sending thread, the completions only clear the in-flight flag
+    for (size_t i = 0; i < m_sendBatches.size(); ++i)
+    {
+        const auto index = (m_nextSendBatch + i) % m_sendBatches.size();
+        auto* sendBatch = m_sendBatches[index].get();
+        if (!sendBatch->m_inFlight.load(std::memory_order_acquire))
+        {
+            m_nextSendBatch = (index + 1) % m_sendBatches.size();
+            sendBatch->m_inFlight.store(true, std::memory_order_relaxed);
+            return sendBatch;
+        }
+    }
+
+    // only allocates until enough batches are in circulation for the send rate
+    m_sendBatches.emplace_back(std::make_unique<SendBatch>(c_maxDatagramsPerSend, s_sharedSendBuffer, m_protocol));
+    m_sendBatches.back()->m_inFlight.store(true, std::memory_order_relaxed);
+    return m_sendBatches.back().get();
+}
+
+void MeasuredSocket::SendDatagramBatch(long long firstSequenceNumber, long long count) noexcept
+{
+    if (!m_sendOffloadEnabled)
+    {
+        for (auto i = 0LL; i < count; ++i)
+        {
+            SendDatagram(firstSequenceNumber + i);
+        }
+        return;
+    }
+
+    if (!m_socketUsers.Acquire())
+    {
+        Log<LogLevel::Error>("Invalid socket, ignoring send request\n");
+        return;
+    }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
+
+    for (auto sent = 0LL; sent < count; sent += c_maxDatagramsPerSend)
+    {
+        // The batch is not reused until the send completes
+        auto* inFlightBatch = GetSendBatch();
+        auto* sendBatch = &inFlightBatch->m_batch;
+        sendBatch->Prepare(MakeHeader(firstSequenceNumber + sent), count - sent);
+        auto& buffer = sendBatch->GetBuffer();
+
+        Log<LogLevel::All>(
+            "Sending sequence numbers %lld to %lld on socket %zu\n",
+            firstSequenceNumber + sent,
+            firstSequenceNumber + sent + sendBatch->GetCount() - 1,
+            m_socket.get());
+
+        // The kernel timestamps the send call: the datagrams of the batch share the same kernel send timestamp
+        const auto timestampId = m_nextTimestampId++;
+        auto callback = [this, inFlightBatch, sendBatch, timestampId](OVERLAPPED* ov) noexcept {
+            try
+            {
+                auto releaseBatch = wil::scope_exit(
+                    [&]() noexcept { inFlightBatch->m_inFlight.store(false, std::memory_order_release); });
+
+                if (!m_socketUsers.Acquire())
+                {
+                    Log<LogLevel::Info>("Send callback canceled\n");
+                    return;
+                }
+                const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
+
+                DWORD bytesTransmitted = 0;
+                DWORD flags = 0;
+                if (WSAGetOverlappedResult(m_socket.get(), ov, &bytesTransmitted, false, &flags))
+                {
+                    auto kernelSendTimestamp = -1LL;
+                    if (m_timestampingEnabled)
+                    {
+                        kernelSendTimestamp = GetKernelSendTimestamp(m_socket.get(), timestampId);
+                        m_missingKernelSendTimestamps += kernelSendTimestamp < 0 ? sendBatch->GetCount() : 0;
+                    }
+
+                    for (auto i = 0LL; i < sendBatch->GetCount(); ++i)
+                    {
+                        const auto header = sendBatch->GetHeader(i);
+                        m_sendCallback(SendResult{header.m_sequenceNumber, header.m_sendTimestamp, kernelSendTimestamp});
+                    }
+                }
+                else
+                {
+                    Log<LogLevel::Error>("The batched send operation failed: %u\n", WSAGetLastError());
+                }
+            }
+            CATCH_FAIL_FAST_MSG("Unhandled exception in batched send completion callback");
+        };
+
+        OVERLAPPED* ov = m_threadpoolIo->new_request(callback);
+
+        m_sendCalls += 1;
+        m_sentDatagrams += sendBatch->GetCount();
+        auto error = m_timestampingEnabled ? SendWithTimestampId(m_socket.get(), &buffer, 1, timestampId, ov)
+                                           : WSASend(m_socket.get(), &buffer, 1, nullptr, 0, ov, nullptr);
+        if (SOCKET_ERROR == error)
+        {
+            error = WSAGetLastError();
+            if (WSA_IO_PENDING != error)
+            {
+                m_threadpoolIo->cancel_request(ov);
+                FAIL_FAST_WIN32_MSG(error, "Failed to initiate a batched send operation");
+            }
+        }
+    }
+}
+
 void MeasuredSocket::PrepareToReceive(std::function<void(ReceiveResult&)> clientCallback) noexcept
 {
+    // Set before the first receive, the completions only read it
+    m_receiveCallback = std::move(clientCallback);
+
     for (auto& s : m_receiveStates)
     {
-        PrepareToReceiveDatagram(s, clientCallback);
+        PrepareToReceiveDatagram(s);
     }
 }
 
-void MeasuredSocket::PrepareToReceiveDatagram(ReceiveState& receiveState, std::function<void(ReceiveResult&)> clientCallback) noexcept
+void MeasuredSocket::PrepareToReceiveDatagram(ReceiveState& receiveState) noexcept
 {
-    auto lock = m_lock.lock();
-
-    if (!m_socket.is_valid())
+    if (!m_socketUsers.Acquire())
     {
         Log<LogLevel::Error>("Invalid socket\n");
         return;
     }
+    const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
     DWORD flags = 0;
     WSABUF wsabuf;
     wsabuf.buf = receiveState.m_buffer.data();
     wsabuf.len = static_cast<ULONG>(receiveState.m_buffer.size());
 
-    auto callback = [this, &receiveState, clientCallback = std::move(clientCallback)](OVERLAPPED* ov) noexcept {
+    auto callback = [this, &receiveState](OVERLAPPED* ov) noexcept {
         try
         {
-            const auto receiveTimestamp = SnapQpcInMicroSec();
-
-            auto lock = m_lock.lock();
+            const auto receiveTimestamp = SnapTimestampInNanoSec();
 
-            if (!m_socket.is_valid())
+            if (!m_socketUsers.Acquire())
             {
                 Log<LogLevel::Info>("Receive callback canceled\n");
                 return;
             }
+            const auto release = wil::scope_exit([&]() noexcept { m_socketUsers.Release(); });
 
             DWORD bytesTransferred = 0;
             DWORD flags = 0;
@@ -245,19 +632,18 @@ void MeasuredSocket::PrepareToReceiveDatagram(ReceiveState& receiveState, std::f
                 FAIL_FAST_LAST_ERROR_MSG("A receive operation failed");
             }
 
-            FAIL_FAST_IF_MSG(!ValidateBufferLength(bytesTransferred), "Received an invalid message");
-
-            const auto& header = ParseDatagramHeader(receiveState.m_buffer.data());
-            Log<LogLevel::All>("Received sequence number %lld on socket %zu\n", header.m_sequenceNumber, m_socket.get());
+            ReceiveResult result{};
+            if (ParseReceivedDatagram(receiveState.m_buffer.data(), bytesTransferred, result))
+            {
+                Log<LogLevel::All>("Received sequence number %lld on socket %zu\n", result.m_sequenceNumber, m_socket.get());
 
-            ReceiveResult result = {
-                .m_sequenceNumber{header.m_sequenceNumber},
-                .m_sendTimestamp{header.m_sendTimestamp},
-                .m_receiveTimestamp{receiveTimestamp},
-                .m_echoTimestamp{header.m_echoTimestamp}};
-            clientCallback(result);
+                result.m_receiveTimestamp = receiveTimestamp;
+                result.m_receiver = static_cast<size_t>(&receiveState - m_receiveStates.data());
+                result.m_kernelReceiveTimestamp = m_timestampingEnabled ? GetKernelReceiveTimestamp(receiveState.m_message) : -1;
+                m_receiveCallback(result);
+            }
 
-            PrepareToReceiveDatagram(receiveState, std::move(clientCallback));
+            PrepareToReceiveDatagram(receiveState);
         }
         CATCH_FAIL_FAST_MSG("Unhandled exception in send completion callback");
     };
@@ -266,7 +652,22 @@ void MeasuredSocket::PrepareToReceiveDatagram(ReceiveState& receiveState, std::f
 
     DWORD bytesTransferred = 0;
     OVERLAPPED* ov = m_threadpoolIo->new_request(callback);
-    auto error = WSARecv(m_socket.get(), &wsabuf, 1, &bytesTransferred, &flags, ov, nullptr);
+    auto error = 0;
+    if (m_timestampingEnabled)
+    {
+        // The message must stay valid until the receive completes
+        receiveState.m_wsabuf = wsabuf;
+        receiveState.m_message = {};
+        receiveState.m_message.lpBuffers = &receiveState.m_wsabuf;
+        receiveState.m_message.dwBufferCount = 1;
+        receiveState.m_message.Control.buf = receiveState.m_control.data();
+        receiveState.m_message.Control.len = static_cast<ULONG>(receiveState.m_control.size());
+        error = m_receiveMessage(m_socket.get(), &receiveState.m_message, &bytesTransferred, ov, nullptr);
+    }
+    else
+    {
+        error = WSARecv(m_socket.get(), &wsabuf, 1, &bytesTransferred, &flags, ov, nullptr);
+    }
     if (SOCKET_ERROR == error)
     {
         error = WSAGetLastError();
@@ -4,25 +4,37 @@
 #pragma once
 
 #include <Windows.h>
+#include <WinSock2.h>
+#include <mswsock.h>
 
 #include <wil/resource.h>
 
 #include <array>
+#include <atomic>
 #include <functional>
 #include <memory>
 
+#include "datagram.h"
 #include "latencyStatistics.h"
 #include "sockaddr.h"
+#include "socket_users.h"
 #include "threadpool_io.h"
 
 namespace multipath {
 
+// A datagram socket sending and receiving the measured datagrams on one path
+// - the sends, the receives and their completions do not take a lock: they register as users of the socket, and
+//   Cancel waits for the registered users before closing it
+// - the setup, the teardown and the statistics are serialized by a lock, they are never on the path of a datagram
 class MeasuredSocket
 {
 public:
     // Size of the buffer used to send or receive
     static constexpr size_t c_bufferSize = 1024; // 1KB
 
+    // A single send offload call is limited to the maximum size of an IP datagram
+    static constexpr long long c_maxDatagramsPerSend = 65'535 / c_bufferSize;
+
     enum class AdapterStatus
     {
         Disabled,
@@ -33,18 +45,38 @@ public:
     struct SendResult
     {
         long long m_sequenceNumber;
-        long long m_sendTimestamp; // Microsec
+        long long m_sendTimestamp; // Nanosec
+        long long m_kernelSendTimestamp = -1; // Nanosec, only with timestamping
     };
 
     struct ReceiveResult
     {
         long long m_sequenceNumber;
-        long long m_sendTimestamp; // Microsec
-        long long m_receiveTimestamp; // Microsec
-        long long m_echoTimestamp; // Microsec
+        long long m_sendTimestamp; // Nanosec
+        long long m_receiveTimestamp; // Nanosec
+        long long m_echoTimestamp; // Nanosec
+        long long m_kernelReceiveTimestamp = -1; // Nanosec, only with timestamping
+        long long m_reflectorReceiveTimestamp = -1; // Nanosec, only with STAMP or header echoes
+        // The echo of a stream request, whose sequence number is the one of the request
+        bool m_streamRequest = false;
+        // The receive which completed, in [0, receive buffer count): the completions of a receive never overlap
+        size_t m_receiver = 0;
     };
 
-    MeasuredSocket() = default;
+    // The datagrams are sent with the flow id of the client and the path id of the socket: only the echoes with the
+    // same ids are received. With payloadCrc, they carry the CRC of their payload, which is verified once echoed.
+    // With headerEcho, the server echoes their header only, with the time and the length it received them.
+    // With STAMP, they are sent as STAMP test packets, which have no flow, path or CRC: the socket only receives from
+    // the reflector it is connected to. Their timestamps are converted to and from the clock of the datagrams.
+    MeasuredSocket(
+        uint32_t flowId,
+        uint16_t pathId,
+        bool payloadCrc = false,
+        DatagramProtocol protocol = DatagramProtocol::Native,
+        bool headerEcho = false) noexcept :
+        m_flowId(flowId), m_pathId(pathId), m_payloadCrc(payloadCrc), m_protocol(protocol), m_headerEcho(headerEcho)
+    {
+    }
 
     // Not copyable or movable
     MeasuredSocket(const MeasuredSocket&) = delete;
@@ -53,34 +85,120 @@ public:
     MeasuredSocket& operator=(MeasuredSocket&&) = delete;
     ~MeasuredSocket() noexcept;
 
-    void Setup(const ctl::ctSockaddr& targetAddress, int numReceivedBuffers, int interfaceIndex = 0);
+    // With timestamping, the network stack timestamps the datagrams when they are sent and received, if supported.
+    // The socket sends from the given interface, or from the given source address, when they are set.
+    void Setup(
+        const ctl::ctSockaddr& targetAddress,
+        int numReceivedBuffers,
+        int interfaceIndex = 0,
+        size_t ioPoolCapacity = ctl::ctThreadIocp::c_default_pool_capacity,
+        bool timestamping = false,
+        const ctl::ctSockaddr& sourceAddress = ctl::ctSockaddr{});
     void Cancel() noexcept;
 
     void CheckConnectivity();
+
+    // The client callbacks are stored once: issuing a send or a receive does not allocate
     void PrepareToReceive(std::function<void(ReceiveResult&)> clientCallback) noexcept;
+    void PrepareToSend(std::function<void(const SendResult&)> clientCallback) noexcept;
+
+    void SendDatagram(long long sequenceNumber) noexcept;
 
-    void SendDatagram(long long sequenceNumber, std::function<void(const SendResult&)> clientCallback) noexcept;
+    // Send `count` consecutive datagrams with as few send calls as possible
+    // - the send callback is invoked once per datagram
+    void SendDatagramBatch(long long firstSequenceNumber, long long count) noexcept;
+
+    // Asks the server to stream datagrams to this path, or renews the request: it is sent synchronously, and echoed as
+    // a header echo. The streamed datagrams carry the CRC of their payload when the socket verifies payloads.
+    void SendStreamRequest(const StreamRequest& request) noexcept;
+
+    // Counters over the I/O request pool, accumulated over each setup of the socket
+    [[nodiscard]] ctl::ctThreadIocpStatistics GetIoPoolStatistics() const noexcept;
 
     std::atomic<AdapterStatus> m_adapterStatus{AdapterStatus::Disabled};
-    long long m_corruptDatagrams = 0;
+    // The datagrams received with an invalid header, and the valid ones of another flow or path, they are ignored
+    std::atomic<long long> m_invalidDatagrams{0};
+    std::atomic<long long> m_foreignDatagrams{0};
+    // The datagrams whose payload does not match its CRC, they are ignored and counted as lost
+    std::atomic<long long> m_corruptPayloads{0};
+    // With header echoes, the bytes of the datagrams received by the server, as reported in their echoes
+    std::atomic<long long> m_reportedBytes{0};
+    // The stream requests sent, only updated by the sending thread, and the ones whose echo confirmed them
+    long long m_streamRequests = 0;
+    std::atomic<long long> m_confirmedStreamRequests{0};
+    // The last stream cookie echoed by the server, sent in the following requests
+    std::atomic<uint64_t> m_streamCookie{0};
+
+    // Send path counters, for measuring the cost of sending, only updated by the sending thread
+    long long m_sendCalls = 0;
+    long long m_sentDatagrams = 0;
+
+    // Whether the network stack timestamps the datagrams, and the sends whose timestamp was not available
+    bool m_timestampingEnabled = false;
+    std::atomic<long long> m_missingKernelSendTimestamps{0};
 
 private:
     struct ReceiveState
     {
         std::array<char, c_bufferSize> m_buffer{};
         long long m_receiveTimestamp{};
+
+        // With timestamping, the datagram is received with WSARecvMsg to get the kernel timestamp as a control message
+        WSABUF m_wsabuf{};
+        WSAMSG m_message{};
+        alignas(WSACMSGHDR) std::array<char, WSA_CMSG_SPACE(sizeof(UINT64))> m_control{};
+    };
+
+    // A buffer used for batched sends, reused once its send completes
+    struct SendBatch
+    {
+        SendBatch(long long maxCount, std::span<const char> sendBuffer, DatagramProtocol protocol) :
+            m_batch(maxCount, sendBuffer, protocol)
+        {
+        }
+
+        DatagramSendBatch m_batch;
+        // Set by the sending thread when the batch is sent, cleared by the send completion
+        std::atomic<bool> m_inFlight{false};
     };
 
-    void PrepareToReceiveDatagram(ReceiveState& receiveState, std::function<void(ReceiveResult&)> clientCallback) noexcept;
+    void PrepareToReceiveDatagram(ReceiveState& receiveState) noexcept;
+    SendBatch* GetSendBatch();
     void PrepareToReceivePing(wil::shared_event pingReceived);
     void PingEchoServer();
+    [[nodiscard]] DatagramHeader MakeHeader(long long sequenceNumber) const noexcept;
+    // Decodes a received datagram, returns false if it is dropped, after counting it
+    [[nodiscard]] bool ParseReceivedDatagram(const char* buffer, DWORD bytesTransferred, ReceiveResult& result) noexcept;
+
+    const uint32_t m_flowId = 0;
+    const uint16_t m_pathId = 0;
+    const bool m_payloadCrc = false;
+    const DatagramProtocol m_protocol = DatagramProtocol::Native;
+    const bool m_headerEcho = false;
 
     // the contexts used for each posted receive
     std::vector<ReceiveState> m_receiveStates;
 
-    wil::critical_section m_lock{500};
+    std::function<void(ReceiveResult&)> m_receiveCallback{};
+    std::function<void(const SendResult&)> m_sendCallback{};
+
+    // the buffers used for batched sends, only accessed by the sending thread
+    std::vector<std::unique_ptr<SendBatch>> m_sendBatches;
+    // the next batch to check for reuse, the batches complete mostly in the order they are sent
+    size_t m_nextSendBatch = 0;
+
+    // serializes the setup, the teardown and the statistics
+    mutable wil::critical_section m_lock{500};
     wil::unique_socket m_socket;
+    // the socket can be used while it is open, by the registered users only
+    SocketUsers m_socketUsers;
+    bool m_sendOffloadEnabled = false;
+    LPFN_WSARECVMSG m_receiveMessage = nullptr;
+    // Identifies the sends to retrieve their kernel timestamp
+    UINT32 m_nextTimestampId = 0;
     std::unique_ptr<ctl::ctThreadIocp> m_threadpoolIo;
+    // the request pool counters of the previous setups of the socket
+    ctl::ctThreadIocpStatistics m_previousIoPoolStatistics{};
 
     // All interfaces are sending the same data, stored in a shared buffer
     static constexpr const std::array<char, c_bufferSize> s_sharedSendBuffer = []() {
@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "path_scheduler.h"
+
+#include <bit>
+
+namespace multipath {
+namespace {
+    constexpr size_t c_primaryPath = 0;
+
+    // The lowest path of the set
+    constexpr PathSet LowestPath(PathSet paths) noexcept
+    {
+        return paths & (~paths + 1);
+    }
+
+    class DuplicateAllScheduler : public PathScheduler
+    {
+    public:
+        using PathScheduler::PathScheduler;
+
+    protected:
+        PathSet SelectPaths(long long, PathSet readyPaths) noexcept override
+        {
+            return readyPaths;
+        }
+    };
+
+    class MinLatencyScheduler : public PathScheduler
+    {
+    public:
+        using PathScheduler::PathScheduler;
+
+    protected:
+        PathSet SelectPaths(long long sequenceNumber, PathSet readyPaths) noexcept override
+        {
+            if (IsProbe(sequenceNumber))
+            {
+                return readyPaths;
+            }
+
+            size_t bestPath = c_maxPathCount;
+            for (size_t i = 0; i < m_pathCount; ++i)
+            {
+                if (!ContainsPath(readyPaths, i))
+                {
+                    continue;
+                }
+
+                // Until all the ready paths are measured, send on all of them
+                if (LatencyEstimate(i) < 0 || IsStale(i))
+                {
+                    return readyPaths;
+                }
+                if (bestPath == c_maxPathCount || LatencyEstimate(i) < LatencyEstimate(bestPath))
+                {
+                    bestPath = i;
+                }
+            }
+            return bestPath == c_maxPathCount ? readyPaths : PathSet{1} << bestPath;
+        }
+    };
+
+    class DuplicateOnLossScheduler : public PathScheduler
+    {
+    public:
+        DuplicateOnLossScheduler(size_t pathCount, long long holdoff) noexcept :
+            PathScheduler(pathCount), m_holdoff(holdoff)
+        {
+        }
+
+    protected:
+        PathSet SelectPaths(long long sequenceNumber, PathSet readyPaths) noexcept override
+        {
+            const auto lastLoss = LastLoss();
+            if (IsProbe(sequenceNumber) || (lastLoss >= 0 && sequenceNumber <= lastLoss + m_holdoff))
+            {
+                return readyPaths;
+            }
+            return PathSet{1} << c_primaryPath;
+        }
+
+    private:
+        long long m_holdoff;
+    };
+
+    class DuplicateOnLatencyScheduler : public PathScheduler
+    {
+    public:
+        DuplicateOnLatencyScheduler(size_t pathCount, long long threshold) noexcept :
+            PathScheduler(pathCount), m_threshold(threshold)
+        {
+        }
+
+    protected:
+        PathSet SelectPaths(long long sequenceNumber, PathSet readyPaths) noexcept override
+        {
+            // A primary path which stopped receiving has no meaningful estimate
+            if (IsProbe(sequenceNumber) || LatencyEstimate(c_primaryPath) < 0 ||
+                LatencyEstimate(c_primaryPath) > m_threshold || IsStale(c_primaryPath))
+            {
+                return readyPaths;
+            }
+            return PathSet{1} << c_primaryPath;
+        }
+
+    private:
+        long long m_threshold;
+    };
+} // namespace
+
+PathScheduler::PathScheduler(size_t pathCount) noexcept : m_pathCount(pathCount)
+{
+    for (size_t i = 0; i < c_maxPathCount; ++i)
+    {
+        m_latencyEstimates[i].store(-1, std::memory_order_relaxed);
+        m_lastReceived[i].store(-1, std::memory_order_relaxed);
+    }
+}
+
+PathSet PathScheduler::Schedule(long long sequenceNumber, long long count, PathSet readyPaths) noexcept
+{
+    m_nextSequenceNumber.store(sequenceNumber + count, std::memory_order_relaxed);
+
+    auto paths = SelectPaths(sequenceNumber, readyPaths) & readyPaths;
+    if (paths == 0)
+    {
+        // The selected path is not ready, e.g. the secondary interface just disconnected
+        paths = LowestPath(readyPaths);
+    }
+
+    if (std::popcount(paths) > 1)
+    {
+        m_duplicatedDatagrams += count;
+    }
+    return paths;
+}
+
+void PathScheduler::OnReceived(size_t path, long long sequenceNumber, long long latency) noexcept
+{
+    // The updates of the estimates from concurrent completions may be lost, which does not matter for an estimate
+    const auto estimate = m_latencyEstimates[path].load(std::memory_order_relaxed);
+    m_latencyEstimates[path].store(estimate < 0 ? latency : estimate + (latency - estimate) / 8, std::memory_order_relaxed);
+
+    auto lastReceived = m_lastReceived[path].load(std::memory_order_relaxed);
+    while (lastReceived < sequenceNumber &&
+           !m_lastReceived[path].compare_exchange_weak(lastReceived, sequenceNumber, std::memory_order_relaxed))
+    {
+    }
+
+    // A gap in the datagrams received on all the paths together means the datagrams in between are lost, or reordered
+    auto highestReceived = m_highestReceived.load(std::memory_order_relaxed);
+    while (highestReceived < sequenceNumber &&
+           !m_highestReceived.compare_exchange_weak(highestReceived, sequenceNumber, std::memory_order_relaxed))
+    {
+    }
+    if (highestReceived >= 0 && sequenceNumber > highestReceived + 1)
+    {
+        m_lastLoss.store(m_nextSequenceNumber.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+bool PathScheduler::IsProbe(long long sequenceNumber) const noexcept
+{
+    // A batch of datagrams is a probe when it holds a multiple of the probe interval
+    const auto nextProbe = (sequenceNumber + c_probeInterval - 1) / c_probeInterval * c_probeInterval;
+    return nextProbe < m_nextSequenceNumber.load(std::memory_order_relaxed);
+}
+
+bool PathScheduler::IsStale(size_t path) const noexcept
+{
+    return m_lastReceived[path].load(std::memory_order_relaxed) <
+           m_highestReceived.load(std::memory_order_relaxed) - 4 * c_probeInterval;
+}
+
+std::unique_ptr<PathScheduler> MakePathScheduler(const SchedulerSettings& settings, size_t pathCount)
+{
+    switch (settings.m_policy)
+    {
+    case SchedulingPolicy::MinLatency:
+        return std::make_unique<MinLatencyScheduler>(pathCount);
+    case SchedulingPolicy::DuplicateOnLoss:
+        return std::make_unique<DuplicateOnLossScheduler>(pathCount, settings.m_lossHoldoff);
+    case SchedulingPolicy::DuplicateOnLatency:
+        return std::make_unique<DuplicateOnLatencyScheduler>(pathCount, settings.m_latencyThreshold);
+    case SchedulingPolicy::DuplicateAll:
+    default:
+        return std::make_unique<DuplicateAllScheduler>(pathCount);
+    }
+}
+
+} // namespace multipath
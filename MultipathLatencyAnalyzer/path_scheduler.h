@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "latencyStatistics.h"
+
+namespace multipath {
+
+// How the client chooses the paths each datagram is sent on
+enum class SchedulingPolicy : uint32_t
+{
+    // Send every datagram on all the ready paths
+    DuplicateAll = 0,
+    // Send each datagram on the ready path with the lowest latency estimate
+    MinLatency = 1,
+    // Send on the primary path, and on all the ready paths for a while after a datagram is lost
+    DuplicateOnLoss = 2,
+    // Send on the primary path, and on all the ready paths while its latency estimate is above a threshold
+    DuplicateOnLatency = 3,
+};
+
+// The name of the policy on the command line, e.g. "minrtt"
+inline const char* SchedulingPolicyName(SchedulingPolicy policy) noexcept
+{
+    switch (policy)
+    {
+    case SchedulingPolicy::DuplicateAll:
+        return "duplicate";
+    case SchedulingPolicy::MinLatency:
+        return "minrtt";
+    case SchedulingPolicy::DuplicateOnLoss:
+        return "onloss";
+    case SchedulingPolicy::DuplicateOnLatency:
+        return "onlatency";
+    }
+    return "unknown";
+}
+
+struct SchedulerSettings
+{
+    static constexpr long long c_defaultLatencyThreshold = 20'000'000; // 20 ms
+
+    SchedulingPolicy m_policy = SchedulingPolicy::DuplicateAll;
+    // Above this latency estimate, in nanoseconds, DuplicateOnLatency duplicates the datagrams
+    long long m_latencyThreshold = c_defaultLatencyThreshold;
+    // The number of datagrams DuplicateOnLoss duplicates after detecting a loss
+    long long m_lossHoldoff = 0;
+};
+
+// Chooses the paths on which each datagram is sent
+// - the policies are implemented by overriding SelectPaths, from the latency and loss feedback collected here
+// - the latency of a path is estimated from its received datagrams, with the same smoothing as the TCP RTT estimate
+// - a datagram is presumed lost when a datagram sent after it is received first, on any path
+// - the policies sending on a single path probe all the ready paths regularly, to keep their estimates up to date
+class PathScheduler
+{
+public:
+    // Every path is probed once in this number of datagrams
+    static constexpr long long c_probeInterval = 64;
+
+    explicit PathScheduler(size_t pathCount) noexcept;
+    virtual ~PathScheduler() = default;
+
+    // Returns the paths on which to send the datagrams starting at sequenceNumber, among the ready paths
+    // Only called by the sending thread: a batch of datagrams is sent on the same paths.
+    [[nodiscard]] PathSet Schedule(long long sequenceNumber, long long count, PathSet readyPaths) noexcept;
+
+    // Called on the first reception of a datagram on a path, from any thread
+    void OnReceived(size_t path, long long sequenceNumber, long long latency) noexcept;
+
+    // The number of datagrams sent on more than one path
+    [[nodiscard]] long long DuplicatedDatagrams() const noexcept
+    {
+        return m_duplicatedDatagrams;
+    }
+
+    // Not copyable or movable
+    PathScheduler(const PathScheduler&) = delete;
+    PathScheduler& operator=(const PathScheduler&) = delete;
+    PathScheduler(PathScheduler&&) = delete;
+    PathScheduler& operator=(PathScheduler&&) = delete;
+
+protected:
+    [[nodiscard]] virtual PathSet SelectPaths(long long sequenceNumber, PathSet readyPaths) noexcept = 0;
+
+    // The smoothed latency of the path in nanoseconds, -1 before its first datagram is received
+    [[nodiscard]] long long LatencyEstimate(size_t path) const noexcept
+    {
+        return m_latencyEstimates[path].load(std::memory_order_relaxed);
+    }
+
+    // Whether the datagrams starting at sequenceNumber must be sent on all the ready paths, to measure them
+    [[nodiscard]] bool IsProbe(long long sequenceNumber) const noexcept;
+
+    // Whether the path has received no datagram over the last probe intervals, while others did
+    [[nodiscard]] bool IsStale(size_t path) const noexcept;
+
+    // The sequence number being sent when the last loss was detected, -1 if none
+    [[nodiscard]] long long LastLoss() const noexcept
+    {
+        return m_lastLoss.load(std::memory_order_relaxed);
+    }
+
+    size_t m_pathCount;
+
+private:
+    std::array<std::atomic<long long>, c_maxPathCount> m_latencyEstimates;
+    std::array<std::atomic<long long>, c_maxPathCount> m_lastReceived;
+    std::atomic<long long> m_highestReceived{-1};
+    std::atomic<long long> m_lastLoss{-1};
+    // The next sequence number to send, published for the loss detection
+    std::atomic<long long> m_nextSequenceNumber{0};
+
+    // Only accessed by the sending thread
+    long long m_duplicatedDatagrams = 0;
+};
+
+std::unique_ptr<PathScheduler> MakePathScheduler(const SchedulerSettings& settings, size_t pathCount);
+
+} // namespace multipath
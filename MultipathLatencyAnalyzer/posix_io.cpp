@@ -0,0 +1,674 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// ReSharper disable CppInconsistentNaming
+#include "posix_io.h"
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace ctl {
+
+class ctPosixIoEngine
+{
+public:
+    enum class operation
+    {
+        receive,
+        send
+    };
+
+    explicit ctPosixIoEngine(ctPosixIoRequestPool& _pool) noexcept : pool(_pool)
+    {
+    }
+    virtual ~ctPosixIoEngine() noexcept = default;
+    // non-copyable
+    ctPosixIoEngine(const ctPosixIoEngine&) = delete;
+    ctPosixIoEngine& operator=(const ctPosixIoEngine&) = delete;
+    ctPosixIoEngine(ctPosixIoEngine&&) = delete;
+    ctPosixIoEngine& operator=(ctPosixIoEngine&&) = delete;
+
+    // returns 0 once the request is started, or an errno value
+    virtual int submit(ctPosixIoRequest* _request, operation _operation) noexcept = 0;
+
+    // cancels the requests in-flight, waits for all the callbacks and stops the completion thread
+    virtual void stop() noexcept = 0;
+
+    [[nodiscard]] virtual ctPosixIoBackend backend() const noexcept = 0;
+
+protected:
+    // the requests which are not started yet fail with ECANCELED once stopping, the others complete or are canceled
+    void wait_for_requests() const noexcept
+    {
+        while (pool.statistics().in_use > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ctPosixIoRequestPool& pool;
+};
+
+namespace {
+    [[noreturn]] void throw_errno(int _error, const char* _message)
+    {
+        throw std::system_error(_error, std::generic_category(), _message);
+    }
+
+    //
+    // io_uring through its system calls: one submission queue shared by the threads starting requests,
+    // one completion queue drained by the completion thread
+    //
+    class ctIoUringEngine final : public ctPosixIoEngine
+    {
+    public:
+        ctIoUringEngine(int _socket, size_t _capacity, ctPosixIoRequestPool& _pool) : ctPosixIoEngine(_pool), socket(_socket)
+        {
+            // the completion queue is sized for more requests than the pool holds, the kernel keeps the completions
+            // which overflow it anyway (IORING_FEAT_NODROP)
+            const auto entries = static_cast<unsigned>(std::bit_ceil(std::clamp<size_t>(_capacity, 8, 4096)));
+            io_uring_params params{};
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 8;
+            ring = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+            if (ring < 0)
+            {
+                throw_errno(errno, "io_uring_setup");
+            }
+
+            // receiving without a worker thread per request requires polling the socket from the ring (5.7)
+            if ((params.features & IORING_FEAT_FAST_POLL) == 0 || (params.features & IORING_FEAT_NODROP) == 0)
+            {
+                unmap();
+                throw_errno(ENOTSUP, "io_uring does not support IORING_FEAT_FAST_POLL");
+            }
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap)
+            {
+                sq_ring_size = cq_ring_size = (std::max)(sq_ring_size, cq_ring_size);
+            }
+
+            sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+            cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+
+            auto* const sq_base = static_cast<char*>(sq_ring);
+            sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+            sq_mask = *reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+
+            auto* const cq_base = static_cast<char*>(cq_ring);
+            cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+            cq_mask = *reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+
+            // the teardown cancels the requests by socket (5.19): probe it while the completions are not consumed yet
+            {
+                const std::scoped_lock lock(submit_lock);
+                push(IORING_OP_ASYNC_CANCEL, nullptr, IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD);
+            }
+            const auto probe = wait_for_completion();
+            if (probe == -EINVAL)
+            {
+                unmap();
+                throw_errno(ENOTSUP, "io_uring does not support IORING_ASYNC_CANCEL_FD");
+            }
+
+            completion_thread = std::thread([this]() noexcept { run(); });
+        }
+
+        ~ctIoUringEngine() noexcept override
+        {
+            unmap();
+        }
+
+        // non-copyable
+        ctIoUringEngine(const ctIoUringEngine&) = delete;
+        ctIoUringEngine& operator=(const ctIoUringEngine&) = delete;
+        ctIoUringEngine(ctIoUringEngine&&) = delete;
+        ctIoUringEngine& operator=(ctIoUringEngine&&) = delete;
+
+        int submit(ctPosixIoRequest* _request, operation _operation) noexcept override
+        {
+            const std::scoped_lock lock(submit_lock);
+            if (stopping)
+            {
+                return ECANCELED;
+            }
+            return push(operation::receive == _operation ? IORING_OP_RECVMSG : IORING_OP_SENDMSG, _request);
+        }
+
+        void stop() noexcept override
+        {
+            {
+                const std::scoped_lock lock(submit_lock);
+                stopping = true;
+                push(IORING_OP_ASYNC_CANCEL, nullptr, IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD);
+            }
+            wait_for_requests();
+
+            // wake up the completion thread
+            {
+                const std::scoped_lock lock(submit_lock);
+                exiting.store(true);
+                push(IORING_OP_NOP, nullptr);
+            }
+            completion_thread.join();
+        }
+
+        [[nodiscard]] ctPosixIoBackend backend() const noexcept override
+        {
+            return ctPosixIoBackend::io_uring;
+        }
+
+    private:
+        void* map(size_t _size, unsigned long long _offset)
+        {
+            void* const address = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, static_cast<off_t>(_offset));
+            if (MAP_FAILED == address)
+            {
+                const auto error = errno;
+                unmap();
+                throw_errno(error, "mmap of the io_uring queues");
+            }
+            return address;
+        }
+
+        void unmap() noexcept
+        {
+            if (sqes)
+            {
+                ::munmap(sqes, sqes_size);
+                sqes = nullptr;
+            }
+            if (cq_ring && cq_ring != sq_ring)
+            {
+                ::munmap(cq_ring, cq_ring_size);
+            }
+            cq_ring = nullptr;
+            if (sq_ring)
+            {
+                ::munmap(sq_ring, sq_ring_size);
+                sq_ring = nullptr;
+            }
+            if (ring >= 0)
+            {
+                ::close(ring);
+                ring = -1;
+            }
+        }
+
+        // the submission lock must be held: the requests are submitted one at a time, the kernel consumes them
+        // before io_uring_enter returns and the submission queue never fills up
+        int push(unsigned char _opcode, ctPosixIoRequest* _request, unsigned _cancel_flags = 0) noexcept
+        {
+            const unsigned tail = *sq_tail;
+            const unsigned index = tail & sq_mask;
+            io_uring_sqe* const sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            sqe->opcode = _opcode;
+            sqe->fd = IORING_OP_NOP == _opcode ? -1 : socket;
+            if (_request)
+            {
+                sqe->addr = reinterpret_cast<unsigned long long>(&_request->message);
+                sqe->len = 1;
+                sqe->msg_flags = MSG_NOSIGNAL;
+            }
+            else
+            {
+                // shares its storage with the message flags
+                sqe->cancel_flags = _cancel_flags;
+            }
+            // the internal requests have no user data, their completions are ignored
+            sqe->user_data = reinterpret_cast<unsigned long long>(_request);
+            sq_array[index] = index;
+            std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+            submitted.fetch_add(1, std::memory_order_release);
+
+            for (;;)
+            {
+                if (::syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0) >= 0)
+                {
+                    return 0;
+                }
+
+                const auto error = errno;
+                if (EINTR == error || EAGAIN == error || EBUSY == error)
+                {
+                    // the completion thread drains the completion queue
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                // the entry was not consumed
+                std::atomic_ref<unsigned>(*sq_tail).store(tail, std::memory_order_release);
+                return error;
+            }
+        }
+
+        // only used before the completion thread starts
+        int wait_for_completion() noexcept
+        {
+            for (;;)
+            {
+                const unsigned head = *cq_head;
+                if (head != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire))
+                {
+                    const auto result = cqes[head & cq_mask].res;
+                    std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+                    return result;
+                }
+                ::syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+        }
+
+        void run() noexcept
+        {
+            for (;;)
+            {
+                unsigned head = *cq_head;
+                const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+                if (head == tail)
+                {
+                    if (exiting.load())
+                    {
+                        return;
+                    }
+                    ::syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    continue;
+                }
+
+                // the kernel orders each completion after its submission, the C++ memory model does not know it
+                [[maybe_unused]] const auto submissions = submitted.load(std::memory_order_acquire);
+                for (; head != tail; ++head)
+                {
+                    const auto& cqe = cqes[head & cq_mask];
+                    auto* const request = reinterpret_cast<ctPosixIoRequest*>(cqe.user_data);
+                    const auto result = cqe.res;
+                    std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+
+                    if (request)
+                    {
+                        request->result = result;
+                        pool.complete(request);
+                    }
+                }
+            }
+        }
+
+        int socket = -1;
+        int ring = -1;
+        void* sq_ring = nullptr;
+        void* cq_ring = nullptr;
+        size_t sq_ring_size = 0;
+        size_t cq_ring_size = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqes_size = 0;
+
+        unsigned* sq_tail = nullptr;
+        unsigned sq_mask = 0;
+        unsigned* sq_array = nullptr;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned cq_mask = 0;
+        io_uring_cqe* cqes = nullptr;
+
+        std::mutex submit_lock;
+        bool stopping = false; // guarded by submit_lock
+        std::atomic<unsigned long long> submitted{0};
+        std::atomic<bool> exiting{false};
+        std::thread completion_thread;
+    };
+
+    //
+    // epoll fallback: the receives wait in a queue until the socket is readable, the sends are made when started
+    // - the completions are queued and the callbacks invoked from the completion thread, as with io_uring
+    //
+    class ctEpollEngine final : public ctPosixIoEngine
+    {
+    public:
+        ctEpollEngine(int _socket, ctPosixIoRequestPool& _pool) : ctPosixIoEngine(_pool), socket(_socket)
+        {
+            epoll = ::epoll_create1(EPOLL_CLOEXEC);
+            if (epoll < 0)
+            {
+                throw_errno(errno, "epoll_create1");
+            }
+            wake_event = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (wake_event < 0)
+            {
+                const auto error = errno;
+                ::close(epoll);
+                throw_errno(error, "eventfd");
+            }
+
+            // the socket is armed only while receives are queued
+            epoll_event socket_event{};
+            socket_event.data.fd = socket;
+            epoll_event wake{};
+            wake.events = EPOLLIN;
+            wake.data.fd = wake_event;
+            if (::epoll_ctl(epoll, EPOLL_CTL_ADD, socket, &socket_event) != 0 ||
+                ::epoll_ctl(epoll, EPOLL_CTL_ADD, wake_event, &wake) != 0)
+            {
+                const auto error = errno;
+                ::close(wake_event);
+                ::close(epoll);
+                throw_errno(error, "epoll_ctl");
+            }
+
+            completion_thread = std::thread([this]() noexcept { run(); });
+        }
+
+        ~ctEpollEngine() noexcept override
+        {
+            ::close(wake_event);
+            ::close(epoll);
+        }
+
+        // non-copyable
+        ctEpollEngine(const ctEpollEngine&) = delete;
+        ctEpollEngine& operator=(const ctEpollEngine&) = delete;
+        ctEpollEngine(ctEpollEngine&&) = delete;
+        ctEpollEngine& operator=(ctEpollEngine&&) = delete;
+
+        int submit(ctPosixIoRequest* _request, operation _operation) noexcept override
+        {
+            if (operation::receive == _operation)
+            {
+                const std::scoped_lock lock(queue_lock);
+                if (stopping)
+                {
+                    return ECANCELED;
+                }
+                receives.push_back(_request);
+                arm();
+                return 0;
+            }
+
+            {
+                const std::scoped_lock lock(queue_lock);
+                if (stopping)
+                {
+                    return ECANCELED;
+                }
+            }
+
+            // a datagram socket rarely blocks on send, the send is made by the caller
+            const auto sent = ::sendmsg(socket, &_request->message, MSG_NOSIGNAL);
+            _request->result = sent < 0 ? -errno : sent;
+
+            const std::scoped_lock lock(queue_lock);
+            completed.push_back(_request);
+            wake();
+            return 0;
+        }
+
+        void stop() noexcept override
+        {
+            {
+                const std::scoped_lock lock(queue_lock);
+                stopping = true;
+                for (auto* request : receives)
+                {
+                    request->result = -ECANCELED;
+                    completed.push_back(request);
+                }
+                receives.clear();
+                wake();
+            }
+            wait_for_requests();
+
+            {
+                const std::scoped_lock lock(queue_lock);
+                exiting = true;
+                wake();
+            }
+            completion_thread.join();
+        }
+
+        [[nodiscard]] ctPosixIoBackend backend() const noexcept override
+        {
+            return ctPosixIoBackend::epoll;
+        }
+
+    private:
+        // the queue lock must be held
+        void arm() noexcept
+        {
+            if (!armed && !receives.empty())
+            {
+                epoll_event socket_event{};
+                socket_event.events = EPOLLIN | EPOLLONESHOT;
+                socket_event.data.fd = socket;
+                armed = ::epoll_ctl(epoll, EPOLL_CTL_MOD, socket, &socket_event) == 0;
+            }
+        }
+
+        // the queue lock must be held
+        void wake() const noexcept
+        {
+            const uint64_t one = 1;
+            [[maybe_unused]] const auto written = ::write(wake_event, &one, sizeof(one));
+        }
+
+        // the queue lock must be held
+        void receive_ready() noexcept
+        {
+            armed = false;
+            while (!receives.empty())
+            {
+                auto* const request = receives.front();
+                const auto received = ::recvmsg(socket, &request->message, MSG_DONTWAIT);
+                if (received < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+                {
+                    break;
+                }
+
+                request->result = received < 0 ? -errno : received;
+                receives.pop_front();
+                completed.push_back(request);
+            }
+            arm();
+        }
+
+        void run() noexcept
+        {
+            std::vector<ctPosixIoRequest*> ready;
+            for (;;)
+            {
+                epoll_event events[2]{};
+                const auto count = ::epoll_wait(epoll, events, 2, -1);
+
+                {
+                    const std::scoped_lock lock(queue_lock);
+                    for (auto i = 0; i < count; ++i)
+                    {
+                        if (events[i].data.fd == wake_event)
+                        {
+                            uint64_t value = 0;
+                            [[maybe_unused]] const auto read = ::read(wake_event, &value, sizeof(value));
+                        }
+                        else
+                        {
+                            receive_ready();
+                        }
+                    }
+
+                    if (exiting && completed.empty())
+                    {
+                        return;
+                    }
+                    ready.assign(completed.begin(), completed.end());
+                    completed.clear();
+                }
+
+                // the callbacks start new requests, they are invoked without the lock
+                for (auto* request : ready)
+                {
+                    pool.complete(request);
+                }
+            }
+        }
+
+        int socket = -1;
+        int epoll = -1;
+        int wake_event = -1;
+
+        std::mutex queue_lock;
+        std::deque<ctPosixIoRequest*> receives;
+        std::vector<ctPosixIoRequest*> completed;
+        bool armed = false;
+        bool stopping = false;
+        bool exiting = false;
+        std::thread completion_thread;
+    };
+} // namespace
+
+ctPosixIoRequestPool::ctPosixIoRequestPool(size_t _capacity) :
+    requests(std::make_unique<ctPosixIoRequest[]>(_capacity)), capacity(_capacity)
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        requests[i].pooled = true;
+        requests[i].next_free = free_list;
+        free_list = &requests[i];
+    }
+}
+
+ctPosixIoRequest* ctPosixIoRequestPool::acquire()
+{
+    ctPosixIoRequest* request = nullptr;
+    {
+        const std::scoped_lock lock(free_list_lock);
+        request = free_list;
+        if (request)
+        {
+            free_list = request->next_free;
+        }
+    }
+    if (!request)
+    {
+        request = new ctPosixIoRequest();
+        exhausted_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    total_requests.fetch_add(1, std::memory_order_relaxed);
+    const auto current = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+    auto peak = peak_in_use.load(std::memory_order_relaxed);
+    while (current > peak && !peak_in_use.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+    {
+    }
+    return request;
+}
+
+void ctPosixIoRequestPool::release(ctPosixIoRequest* _request) noexcept
+{
+    _request->callback.reset();
+    if (_request->pooled)
+    {
+        const std::scoped_lock lock(free_list_lock);
+        _request->next_free = free_list;
+        free_list = _request;
+    }
+    else
+    {
+        delete _request;
+    }
+    // released last, the teardown waits for it before destroying the pool
+    in_use.fetch_sub(1, std::memory_order_release);
+}
+
+void ctPosixIoRequestPool::complete(ctPosixIoRequest* _request) noexcept
+{
+    try
+    {
+        _request->callback(_request);
+    }
+    catch (...)
+    {
+        // as with ctThreadIocp, an exception escaping a callback is fatal
+        std::terminate();
+    }
+    release(_request);
+}
+
+ctPosixIoStatistics ctPosixIoRequestPool::statistics() const noexcept
+{
+    ctPosixIoStatistics stats;
+    stats.capacity = static_cast<long long>(capacity);
+    stats.in_use = in_use.load(std::memory_order_acquire);
+    stats.peak_in_use = peak_in_use.load(std::memory_order_relaxed);
+    stats.exhausted_count = exhausted_count.load(std::memory_order_relaxed);
+    stats.total_requests = total_requests.load(std::memory_order_relaxed);
+    return stats;
+}
+
+ctPosixIo::ctPosixIo(int _socket, size_t _pool_capacity, ctPosixIoBackend _backend) :
+    request_pool(std::make_unique<ctPosixIoRequestPool>(_pool_capacity))
+{
+    if (ctPosixIoBackend::epoll != _backend)
+    {
+        try
+        {
+            engine = std::make_unique<ctIoUringEngine>(_socket, _pool_capacity, *request_pool);
+        }
+        catch (const std::system_error&)
+        {
+            // e.g. an older kernel, or io_uring disabled by the seccomp policy of a container
+            if (ctPosixIoBackend::io_uring == _backend)
+            {
+                throw;
+            }
+        }
+    }
+    if (!engine)
+    {
+        engine = std::make_unique<ctEpollEngine>(_socket, *request_pool);
+    }
+}
+
+ctPosixIo::~ctPosixIo() noexcept
+{
+    stop();
+}
+
+void ctPosixIo::stop() noexcept
+{
+    std::call_once(stopped, [this]() noexcept { engine->stop(); });
+}
+
+int ctPosixIo::start_receive(ctPosixIoRequest* _request) const noexcept
+{
+    return engine->submit(_request, ctPosixIoEngine::operation::receive);
+}
+
+int ctPosixIo::start_send(ctPosixIoRequest* _request) const noexcept
+{
+    return engine->submit(_request, ctPosixIoEngine::operation::send);
+}
+
+ctPosixIoBackend ctPosixIo::backend() const noexcept
+{
+    return engine->backend();
+}
+} // namespace ctl
@@ -0,0 +1,246 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// ReSharper disable CppInconsistentNaming
+#pragma once
+
+// cpp headers
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+// os headers
+#include <sys/socket.h>
+
+namespace ctl {
+
+struct ctPosixIoRequest;
+
+//
+// type-erased callback invoked with the completed request, the POSIX counterpart of ctThreadIocpCallback
+// - the callable is stored inline: constructing or invoking a callback never allocates
+//
+class ctPosixIoCallback
+{
+public:
+    static constexpr size_t c_inline_size = 64;
+
+    ctPosixIoCallback() noexcept = default;
+    ~ctPosixIoCallback() noexcept
+    {
+        reset();
+    }
+    // non-copyable
+    ctPosixIoCallback(const ctPosixIoCallback&) = delete;
+    ctPosixIoCallback& operator=(const ctPosixIoCallback&) = delete;
+    ctPosixIoCallback(ctPosixIoCallback&&) = delete;
+    ctPosixIoCallback& operator=(ctPosixIoCallback&&) = delete;
+
+    template <typename Callback>
+    void assign(Callback&& _callback) noexcept
+    {
+        using callback_t = std::decay_t<Callback>;
+        static_assert(sizeof(callback_t) <= c_inline_size, "the callback state must fit in ctPosixIoCallback");
+        static_assert(alignof(callback_t) <= alignof(std::max_align_t), "the callback state is over-aligned");
+        static_assert(std::is_nothrow_move_constructible_v<callback_t> || std::is_nothrow_copy_constructible_v<callback_t>);
+
+        reset();
+        new (storage) callback_t(std::forward<Callback>(_callback));
+        invoke_function = [](void* _storage, ctPosixIoRequest* _request) { (*static_cast<callback_t*>(_storage))(_request); };
+        destroy_function = [](void* _storage) noexcept { static_cast<callback_t*>(_storage)->~callback_t(); };
+    }
+
+    void operator()(ctPosixIoRequest* _request)
+    {
+        invoke_function(storage, _request);
+    }
+
+    void reset() noexcept
+    {
+        if (destroy_function)
+        {
+            destroy_function(storage);
+            invoke_function = nullptr;
+            destroy_function = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char storage[c_inline_size]{};
+    void (*invoke_function)(void*, ctPosixIoRequest*) = nullptr;
+    void (*destroy_function)(void*) noexcept = nullptr;
+};
+
+//
+// an I/O request on the socket of a ctPosixIo, the POSIX counterpart of the OVERLAPPED* of ctThreadIocp
+// - the caller describes the buffers and the address in message before starting the request, like for WSARecvMsg
+// - on completion, result is the number of bytes transferred, or a negated errno value (-ECANCELED on teardown)
+//
+struct ctPosixIoRequest
+{
+    msghdr message{};
+    long long result = 0;
+
+    ctPosixIoRequest* next_free = nullptr;
+    bool pooled = false; // false when allocated on the heap because the pool was exhausted
+    ctPosixIoCallback callback;
+};
+
+//
+// counters exposed by ctPosixIo to size its request pool, the same as ctThreadIocpStatistics
+//
+struct ctPosixIoStatistics
+{
+    long long capacity = 0;        // number of requests preallocated in the pool
+    long long in_use = 0;          // number of requests currently in-flight
+    long long peak_in_use = 0;     // maximum number of requests simultaneously in-flight
+    long long exhausted_count = 0; // number of requests allocated on the heap because the pool was empty
+    long long total_requests = 0;  // number of requests issued
+};
+
+//
+// fixed-capacity pool of ctPosixIoRequest, shared between the threads issuing IO and completing IO
+// - taking or returning a request only holds the lock of the free list, it allocates only when the pool is exhausted
+//
+class ctPosixIoRequestPool
+{
+public:
+    explicit ctPosixIoRequestPool(size_t _capacity);
+    ~ctPosixIoRequestPool() noexcept = default;
+    // non-copyable
+    ctPosixIoRequestPool(const ctPosixIoRequestPool&) = delete;
+    ctPosixIoRequestPool& operator=(const ctPosixIoRequestPool&) = delete;
+    ctPosixIoRequestPool(ctPosixIoRequestPool&&) = delete;
+    ctPosixIoRequestPool& operator=(ctPosixIoRequestPool&&) = delete;
+
+    // can fail by throwing std::bad_alloc, only when the pool is exhausted
+    ctPosixIoRequest* acquire();
+    void release(ctPosixIoRequest* _request) noexcept;
+
+    // invokes the callback of a completed request, then returns it to the pool
+    void complete(ctPosixIoRequest* _request) noexcept;
+
+    [[nodiscard]] ctPosixIoStatistics statistics() const noexcept;
+
+private:
+    std::mutex free_list_lock;
+    ctPosixIoRequest* free_list = nullptr;
+    std::unique_ptr<ctPosixIoRequest[]> requests;
+    size_t capacity = 0;
+
+    std::atomic<long long> in_use{0};
+    std::atomic<long long> peak_in_use{0};
+    std::atomic<long long> exhausted_count{0};
+    std::atomic<long long> total_requests{0};
+};
+
+enum class ctPosixIoBackend
+{
+    automatic, // io_uring when the kernel supports it, epoll otherwise
+    io_uring,
+    epoll
+};
+
+inline const char* ctPosixIoBackendName(ctPosixIoBackend _backend) noexcept
+{
+    switch (_backend)
+    {
+    case ctPosixIoBackend::io_uring:
+        return "io_uring";
+    case ctPosixIoBackend::epoll:
+        return "epoll";
+    case ctPosixIoBackend::automatic:
+        break;
+    }
+    return "automatic";
+}
+
+// the kernel interface delivering the completions, implemented over io_uring or epoll
+class ctPosixIoEngine;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// ctPosixIo
+///
+/// the POSIX counterpart of ctThreadIocp: completion-based IO on a datagram socket, on Linux
+///
+/// - with io_uring, the receives and sends are submitted to the kernel and complete asynchronously
+/// - with epoll, the receives are queued until the socket is readable and the sends are made immediately:
+///   the callbacks are still invoked asynchronously, as with io_uring
+/// - the callbacks are invoked from a completion thread owned by the ctPosixIo
+///
+/// Basic usage, as with ctThreadIocp:
+/// - call new_request to get a request, passing a function to be invoked on completion
+/// - fill the message of the request then start it with start_receive or start_send
+/// - if starting the request succeeds (returns 0), the callback will be invoked on completion [if succeeds or fails]
+///    - from the callback function, the result of the request gives the bytes transferred or the error
+/// - if starting the request fails, the user *must* call cancel_request with the request
+///
+/// Stopping or destroying the ctPosixIo cancels the requests in-flight and waits for all the callbacks: the requests
+/// started by the callbacks meanwhile fail with ECANCELED
+///
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class ctPosixIo
+{
+public:
+    //
+    // This c'tor can fail under low resources, or when the requested backend is not supported
+    // - std::system_error
+    //
+    static constexpr size_t c_default_pool_capacity = 256;
+
+    explicit ctPosixIo(int _socket, size_t _pool_capacity = c_default_pool_capacity, ctPosixIoBackend _backend = ctPosixIoBackend::automatic);
+    ~ctPosixIo() noexcept;
+
+    template <typename Callback>
+    ctPosixIoRequest* new_request(Callback&& _callback) const
+    {
+        // this can fail by throwing std::bad_alloc, only if the pool is exhausted
+        auto* new_callback = request_pool->acquire();
+        new_callback->callback.assign(std::forward<Callback>(_callback));
+        new_callback->message = {};
+        new_callback->result = 0;
+        return new_callback;
+    }
+
+    // returns 0 once the request is started, or an errno value
+    [[nodiscard]] int start_receive(ctPosixIoRequest* _request) const noexcept;
+    [[nodiscard]] int start_send(ctPosixIoRequest* _request) const noexcept;
+
+    // to be called only if starting the request failed
+    void cancel_request(ctPosixIoRequest* _request) const noexcept
+    {
+        request_pool->release(_request);
+    }
+
+    [[nodiscard]] ctPosixIoStatistics statistics() const noexcept
+    {
+        return request_pool->statistics();
+    }
+
+    // cancels the requests in-flight and waits for all the callbacks, no request can be started afterwards
+    // - the callbacks can still use the ctPosixIo while it stops, which they cannot while it is destroyed
+    void stop() noexcept;
+
+    // the backend actually used, never automatic
+    [[nodiscard]] ctPosixIoBackend backend() const noexcept;
+
+    //
+    // No default c'tor - preventing zombie objects
+    // No copy c'tors
+    //
+    ctPosixIo() = delete;
+    ctPosixIo(const ctPosixIo&) = delete;
+    ctPosixIo& operator=(const ctPosixIo&) = delete;
+    ctPosixIo(ctPosixIo&&) = delete;
+    ctPosixIo& operator=(ctPosixIo&&) = delete;
+
+private:
+    std::unique_ptr<ctPosixIoRequestPool> request_pool;
+    std::unique_ptr<ctPosixIoEngine> engine;
+    std::once_flag stopped;
+};
+} // namespace ctl
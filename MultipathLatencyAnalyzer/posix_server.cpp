@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// The echo server of MultipathLatencyAnalyzer on Linux: the same StreamServer as the -listen mode of the tool, over the
+// portable I/O backend. The echo threads, echo batching and downlink streams of the Windows server are not available.
+
+#include <signal.h>
+
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "logs.h"
+#include "stamp_packet.h"
+#include "stream_server.h"
+#include "time_utils.h"
+
+using namespace multipath;
+
+namespace {
+constexpr unsigned short c_defaultPort = 8888; // same as Configuration::c_defaultPort
+constexpr long long c_defaultPrePostRecvs = 2; // same as Configuration::c_defaultPrePostRecvs
+
+void PrintUsage()
+{
+    std::cout << "posix_server echoes the datagrams of the MultipathLatencyAnalyzer clients until interrupted\n"
+                 "\n"
+                 "posix_server -listen:<addr or *> [-port:####] [-protocol:<native,stamp>] [-prepostrecvs:####]\n"
+                 "\n"
+                 "-listen:<addr or *>         the IP address on which the server listens, or '*' for all IPv4 addresses\n"
+                 "-port:####                  the port on which the server listens (default: 8888, 862 with STAMP)\n"
+                 "-protocol:<native,stamp>    also reflect the STAMP test packets (default: native)\n"
+                 "-prepostrecvs:####          the receives kept posted on the socket (default: 2)\n";
+}
+
+bool ParseNumber(std::string_view value, long long& number)
+{
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return error == std::errc{} && end == value.data() + value.size() && number > 0;
+}
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    SocketAddress listenAddress;
+    long long port = 0;
+    auto protocol = DatagramProtocol::Native;
+    long long receiveCount = c_defaultPrePostRecvs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view argument{argv[i]};
+        const auto separator = argument.find(':');
+        const auto name = argument.substr(0, separator);
+        const auto value = separator == std::string_view::npos ? std::string_view{} : argument.substr(separator + 1);
+
+        bool valid = true;
+        if (name == "-listen" && !value.empty())
+        {
+            listenAddress = value == "*" ? SocketAddress{AF_INET} : SocketAddress::Resolve(std::string{value}.c_str());
+        }
+        else if (name == "-port")
+        {
+            valid = ParseNumber(value, port) && port <= 65535;
+        }
+        else if (name == "-protocol")
+        {
+            valid = value == "native" || value == "stamp";
+            protocol = value == "stamp" ? DatagramProtocol::Stamp : DatagramProtocol::Native;
+        }
+        else if (name == "-prepostrecvs")
+        {
+            valid = ParseNumber(value, receiveCount);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (listenAddress.family() == AF_UNSPEC)
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (listenAddress.port() == 0)
+    {
+        listenAddress.SetPort(port > 0 ? static_cast<unsigned short>(port)
+                              : protocol == DatagramProtocol::Stamp ? c_stampPort
+                                                                    : c_defaultPort);
+    }
+
+    // Blocked before the completion thread starts, which inherits the mask: the signals are only taken by sigwait
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    std::cout << "--- Server Mode ---\n";
+    std::cout << "Protocol: " << (protocol == DatagramProtocol::Stamp ? "STAMP" : "native") << '\n';
+    std::cout << "Listen Address: " << listenAddress.WriteCompleteAddress() << '\n';
+    std::cout << "Number of receive buffers: " << receiveCount << '\n';
+    std::cout << "Clock: " << ClockSourceName(TimestampClock::Source()) << " (" << TimestampClock::Frequency() / 1'000'000.
+              << " MHz)\n";
+    std::cout << "-------------------\n\n";
+
+    Log<LogLevel::Output>("Starting the echo server...\n");
+    StreamServer server(listenAddress, 0, 1, protocol);
+    server.Start(static_cast<unsigned long>(receiveCount));
+    Log<LogLevel::Output>("Ready to echo data\n");
+
+    // Run until the program is interrupted with Ctrl-C
+    int signal = 0;
+    sigwait(&stopSignals, &signal);
+
+    Log<LogLevel::Output>("Stopping the echo server...\n");
+    server.Stop();
+    server.PrintStatistics();
+    return 0;
+}
+catch (const std::exception& ex)
+{
+    std::cerr << "Error: " << ex.what() << '\n';
+    return 1;
+}
@@ -0,0 +1,224 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+// The POSIX equivalents of the helpers of socket_utils.h, for the portable I/O backend
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace multipath {
+
+// Owns a file descriptor, the POSIX counterpart of wil::unique_socket
+class UniqueFd
+{
+public:
+    UniqueFd() noexcept = default;
+    explicit UniqueFd(int fd) noexcept : m_fd(fd)
+    {
+    }
+
+    ~UniqueFd() noexcept
+    {
+        reset();
+    }
+
+    UniqueFd(UniqueFd&& other) noexcept : m_fd(std::exchange(other.m_fd, -1))
+    {
+    }
+
+    UniqueFd& operator=(UniqueFd&& other) noexcept
+    {
+        reset(std::exchange(other.m_fd, -1));
+        return *this;
+    }
+
+    // Not copyable
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+
+    void reset(int fd = -1) noexcept
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+        m_fd = fd;
+    }
+
+    [[nodiscard]] int get() const noexcept
+    {
+        return m_fd;
+    }
+
+    [[nodiscard]] bool is_valid() const noexcept
+    {
+        return m_fd >= 0;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+[[noreturn]] inline void ThrowLastError(const char* message)
+{
+    throw std::system_error(errno, std::generic_category(), message);
+}
+
+// An IPv4 or IPv6 socket address, the POSIX counterpart of the parts of ctl::ctSockaddr used by the server
+class SocketAddress
+{
+public:
+    SocketAddress() noexcept = default;
+
+    // The wildcard address of the family
+    explicit SocketAddress(int family) noexcept
+    {
+        m_address.ss_family = static_cast<sa_family_t>(family);
+    }
+
+    SocketAddress(const ::sockaddr* address, size_t length) noexcept
+    {
+        std::memcpy(&m_address, address, (std::min)(length, sizeof(m_address)));
+    }
+
+    // Resolves a name or a numeric address, throws std::invalid_argument if it does not resolve
+    [[nodiscard]] static SocketAddress Resolve(const char* name)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(name, nullptr, &hints, &result) != 0 || !result)
+        {
+            throw std::invalid_argument(std::string{"failed to resolve "} + name);
+        }
+        const SocketAddress address{result->ai_addr, result->ai_addrlen};
+        freeaddrinfo(result);
+        return address;
+    }
+
+    [[nodiscard]] ::sockaddr* sockaddr() noexcept
+    {
+        return reinterpret_cast<::sockaddr*>(&m_address);
+    }
+
+    [[nodiscard]] const ::sockaddr* sockaddr() const noexcept
+    {
+        return reinterpret_cast<const ::sockaddr*>(&m_address);
+    }
+
+    // The length of the address of the family, the whole storage when the family is not set yet (to receive)
+    [[nodiscard]] int length() const noexcept
+    {
+        switch (m_address.ss_family)
+        {
+        case AF_INET:
+            return sizeof(sockaddr_in);
+        case AF_INET6:
+            return sizeof(sockaddr_in6);
+        default:
+            return sizeof(m_address);
+        }
+    }
+
+    [[nodiscard]] int family() const noexcept
+    {
+        return m_address.ss_family;
+    }
+
+    [[nodiscard]] unsigned short port() const noexcept
+    {
+        const auto port = m_address.ss_family == AF_INET6 ? reinterpret_cast<const sockaddr_in6*>(&m_address)->sin6_port
+                                                           : reinterpret_cast<const sockaddr_in*>(&m_address)->sin_port;
+        return ntohs(port);
+    }
+
+    void SetPort(unsigned short port) noexcept
+    {
+        if (m_address.ss_family == AF_INET6)
+        {
+            reinterpret_cast<sockaddr_in6*>(&m_address)->sin6_port = htons(port);
+        }
+        else
+        {
+            reinterpret_cast<sockaddr_in*>(&m_address)->sin_port = htons(port);
+        }
+    }
+
+    // The address and port, e.g. 127.0.0.1:4444 or [::1]:4444
+    [[nodiscard]] std::string WriteCompleteAddress() const
+    {
+        char address[INET6_ADDRSTRLEN]{};
+        if (m_address.ss_family == AF_INET6)
+        {
+            inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&m_address)->sin6_addr, address, sizeof(address));
+            return std::string{"["} + address + "]:" + std::to_string(port());
+        }
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&m_address)->sin_addr, address, sizeof(address));
+        return std::string{address} + ":" + std::to_string(port());
+    }
+
+private:
+    sockaddr_storage m_address{};
+};
+
+inline int CreateDatagramSocket(int family = AF_INET)
+{
+    // The completions are delivered by the I/O backend, the socket itself stays blocking
+    const int socket = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (socket < 0)
+    {
+        ThrowLastError("socket failed");
+    }
+
+    return socket;
+}
+
+inline void SetSocketOutgoingInterface(int socket, int outgoingIfIndex)
+{
+    if (outgoingIfIndex == 0)
+    {
+        // do nothing if no interface index given
+        return;
+    }
+
+    // Unlike IP_UNICAST_IF, binding to a device also restricts the receives to the interface
+    const auto error = setsockopt(socket, SOL_SOCKET, SO_BINDTOIFINDEX, &outgoingIfIndex, sizeof(outgoingIfIndex));
+    if (error != 0)
+    {
+        ThrowLastError("setsockopt(SOL_SOCKET, SO_BINDTOIFINDEX) failed");
+    }
+}
+
+// Let the network stack split a single send into multiple datagrams of segmentSize bytes (UDP GSO)
+// - returns false if the OS does not support it, the caller must then send each datagram separately
+inline bool TryEnableUdpSendOffload(int socket, uint16_t segmentSize) noexcept
+{
+    const int value = segmentSize;
+    return setsockopt(socket, IPPROTO_UDP, UDP_SEGMENT, &value, sizeof(value)) == 0;
+}
+
+inline void SetSocketReceiveBufferSize(int socket, int size)
+{
+    const auto error = setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (error != 0)
+    {
+        ThrowLastError("setsockopt(SOL_SOCKET, SO_RCVBUF) failed");
+    }
+}
+
+} // namespace multipath
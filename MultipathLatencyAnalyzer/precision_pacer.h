@@ -0,0 +1,145 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include <wil/resource.h>
+#include <wil/result.h>
+
+#include "lateness_histogram.h"
+#include "time_utils.h"
+
+namespace multipath {
+
+using PrecisionPacerCallback = std::function<void()>;
+
+// Invokes a callback periodically, with a precision far below the resolution of the OS timers
+// - runs on a dedicated thread, the deadlines are computed on the QPC clock
+// - sleeps on a high resolution waitable timer until shortly before the deadline, then spins until the deadline
+// - the deadlines are absolute (start + N * period): a late callback does not delay the following ones
+// - records the pacing error (actual - intended callback time) of every callback
+class PrecisionPacer
+{
+public:
+    // Below this remaining time, the pacer spins instead of sleeping
+    static constexpr long long c_spinThresholdInMicroSec = 500;
+
+    explicit PrecisionPacer(PrecisionPacerCallback callback) : m_callback(std::move(callback))
+    {
+        // A high resolution timer is available from Windows 10 1803, fall back to a regular timer otherwise
+        m_waitableTimer.reset(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+        if (!m_waitableTimer)
+        {
+            m_waitableTimer.reset(CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS));
+            THROW_LAST_ERROR_IF_MSG(!m_waitableTimer, "CreateWaitableTimerExW failed");
+        }
+    }
+
+    ~PrecisionPacer() noexcept
+    {
+        Stop();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    PrecisionPacer(const PrecisionPacer&) = delete;
+    PrecisionPacer& operator=(const PrecisionPacer&) = delete;
+    PrecisionPacer(PrecisionPacer&&) = delete;
+    PrecisionPacer& operator=(PrecisionPacer&&) = delete;
+
+    void Schedule(double periodInMicroSec)
+    {
+        FAIL_FAST_IF_MSG(m_thread.joinable(), "The pacer can only be scheduled once");
+
+        m_exiting = false;
+        m_periodInQpc = periodInMicroSec * GetQpcFrequency() / 1'000'000.;
+        m_thread = std::thread([this]() noexcept { Run(); });
+    }
+
+    // Can be called from the callback
+    void Stop() noexcept
+    {
+        m_exiting = true;
+        if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        {
+            m_thread.join();
+        }
+    }
+
+    // Only valid once the pacer is stopped
+    [[nodiscard]] const LatenessHistogram& GetPacingError() const noexcept
+    {
+        return m_pacingError;
+    }
+
+private:
+    void Run() noexcept
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+        const auto start = SnapQpc();
+        for (long long tick = 0; !m_exiting; ++tick)
+        {
+            const auto deadline = start + std::llround(tick * m_periodInQpc);
+            WaitUntil(deadline);
+
+            if (m_exiting)
+            {
+                break;
+            }
+
+            m_pacingError.Add(ConvertQpcToMicroSec(SnapQpc() - deadline));
+
+            try
+            {
+                m_callback();
+            }
+            catch (...)
+            {
+                // immediately break if we catch an exception
+                FAIL_FAST_MSG("exception raised in pacer callback routine");
+            }
+        }
+    }
+
+    void WaitUntil(long long deadline) noexcept
+    {
+        const auto spinThreshold = c_spinThresholdInMicroSec * GetQpcFrequency() / 1'000'000;
+
+        // Sleep for the bulk of the wait
+        const auto sleepTime = ConvertQpcToMicroSec(deadline - SnapQpc() - spinThreshold);
+        if (sleepTime > 0)
+        {
+            // Negative due time: relative, in 100ns
+            LARGE_INTEGER dueTime{};
+            dueTime.QuadPart = -sleepTime * 10;
+            if (SetWaitableTimer(m_waitableTimer.get(), &dueTime, 0, nullptr, nullptr, FALSE))
+            {
+                WaitForSingleObject(m_waitableTimer.get(), INFINITE);
+            }
+        }
+
+        // Spin for the rest
+        while (SnapQpc() < deadline && !m_exiting)
+        {
+            YieldProcessor();
+        }
+    }
+
+    std::atomic_bool m_exiting = false;
+    double m_periodInQpc = 0.;
+    wil::unique_handle m_waitableTimer;
+    std::thread m_thread;
+    LatenessHistogram m_pacingError{};
+    PrecisionPacerCallback m_callback{};
+};
+
+} // namespace multipath
@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "latency_histogram.h"
+
+namespace multipath {
+
+// Measures the reordering of the datagrams received on one path, in the order they are received (RFC 4737)
+// - a datagram is reordered when a datagram with a higher sequence number was received before it
+// - its extent is the number of datagrams received since the first of these datagrams: only the last c_historySize
+//   arrivals are kept, larger extents are counted as c_historySize
+// - its displacement is how far its sequence number is behind the highest sequence number received
+// - the duplicates must not be added, the cost of a datagram does not depend on the length of the run
+// - it is only updated by a single thread, which merges the arrivals of the concurrent receives of the path
+class ReorderingTracker
+{
+public:
+    static constexpr size_t c_historySize = 1024;
+
+    ReorderingTracker() : m_history(c_historySize, -1)
+    {
+    }
+
+    void Add(long long sequenceNumber) noexcept
+    {
+        if (sequenceNumber < m_nextExpected)
+        {
+            m_reordered += 1;
+
+            // The earliest arrival with a higher sequence number, from the most recent one
+            long long extent = static_cast<long long>(c_historySize);
+            const auto available = (std::min)(m_arrivals, static_cast<long long>(c_historySize));
+            for (long long back = 1; back <= available; ++back)
+            {
+                if (m_history[static_cast<size_t>((m_arrivals - back) % c_historySize)] > sequenceNumber)
+                {
+                    extent = back;
+                }
+            }
+            m_extents.Add(extent);
+            m_displacements.Add(m_nextExpected - 1 - sequenceNumber);
+        }
+        else
+        {
+            m_nextExpected = sequenceNumber + 1;
+        }
+
+        m_history[static_cast<size_t>(m_arrivals % c_historySize)] = sequenceNumber;
+        m_arrivals += 1;
+    }
+
+    // Only read once the datagrams are no longer received
+    [[nodiscard]] long long Arrivals() const noexcept
+    {
+        return m_arrivals;
+    }
+
+    [[nodiscard]] long long Reordered() const noexcept
+    {
+        return m_reordered;
+    }
+
+    [[nodiscard]] const LatencyHistogram& Extents() const noexcept
+    {
+        return m_extents;
+    }
+
+    [[nodiscard]] const LatencyHistogram& Displacements() const noexcept
+    {
+        return m_displacements;
+    }
+
+    // Not copyable or movable
+    ReorderingTracker(const ReorderingTracker&) = delete;
+    ReorderingTracker& operator=(const ReorderingTracker&) = delete;
+    ReorderingTracker(ReorderingTracker&&) = delete;
+    ReorderingTracker& operator=(ReorderingTracker&&) = delete;
+
+    ~ReorderingTracker() = default;
+
+private:
+    long long m_nextExpected = 0;
+    long long m_arrivals = 0;
+    long long m_reordered = 0;
+    // The sequence numbers of the last arrivals, indexed by arrival modulo the size of the history
+    std::vector<long long> m_history;
+
+    LatencyHistogram m_extents;
+    LatencyHistogram m_displacements;
+};
+
+} // namespace multipath
@@ -0,0 +1,33 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+// The socket types of the platform, for the code built on Windows and Linux (the receive and echo path of the server)
+// - SocketAddress: an IPv4 or IPv6 address, with sockaddr(), length() and family()
+// - UniqueSocket: owns the socket, with get()
+// - SocketIo: completes the asynchronous operations on the socket from its own threads, new_request(callback) gives a
+//   SocketIoRequest for one operation, and cancel_request(request) releases it if the operation could not be started
+#ifdef _WIN32
+#include "sockaddr.h"
+#include "socket_utils.h"
+#include "threadpool_io.h"
+
+#include <wil/resource.h>
+#else
+#include "posix_io.h"
+#include "posix_socket_utils.h"
+#endif
+
+namespace multipath {
+#ifdef _WIN32
+using SocketAddress = ctl::ctSockaddr;
+using UniqueSocket = wil::unique_socket;
+using SocketIo = ctl::ctThreadIocp;
+using SocketIoRequest = OVERLAPPED;
+#else
+using UniqueSocket = UniqueFd;
+using SocketIo = ctl::ctPosixIo;
+using SocketIoRequest = ctl::ctPosixIoRequest;
+#endif
+} // namespace multipath
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+
+namespace multipath {
+
+// Lets the sends, the receives and their completions use a socket without a lock, while another thread closes it
+// - a user registers with Acquire, which fails once the socket is canceled, and unregisters with Release
+// - Cancel marks the socket canceled then waits for the registered users: once it returns, none is using the socket
+// - the handshake relies on sequential consistency: a user registers then checks the socket is open, Cancel marks it
+//   canceled then checks the users, and at least one of them sees the other
+class SocketUsers
+{
+public:
+    // Once the socket is open, before its first user
+    void Open() noexcept
+    {
+        m_open = true;
+    }
+
+    // Registers the caller as a user of the socket, returns false once the socket is canceled
+    [[nodiscard]] bool Acquire() noexcept
+    {
+        // Registered before checking the socket is open, as Cancel marks it canceled before waiting for the users
+        m_users.fetch_add(1);
+        if (m_open.load())
+        {
+            return true;
+        }
+
+        Release();
+        return false;
+    }
+
+    void Release() noexcept
+    {
+        // Cancel only waits once the socket is marked canceled, the last user wakes it up
+        if (m_users.fetch_sub(1) == 1 && !m_open.load())
+        {
+            m_users.notify_all();
+        }
+    }
+
+    // The users registered before are done with the socket once it returns, the next ones see it canceled
+    void Cancel() noexcept
+    {
+        m_open = false;
+        for (auto users = m_users.load(); users != 0; users = m_users.load())
+        {
+            m_users.wait(users);
+        }
+    }
+
+private:
+    std::atomic<bool> m_open{false};
+    std::atomic<long> m_users{0};
+};
+
+} // namespace multipath
@@ -4,6 +4,9 @@
 #pragma once
 
 #include <WinSock2.h>
+#include <ws2ipdef.h>
+#include <mstcpip.h>
+#include <mswsock.h>
 #include <wil/result.h>
 
 //
@@ -56,6 +59,58 @@ inline void SetSocketOutgoingInterface(SOCKET socket, short family, int outgoing
     }
 }
 
+// Let the network stack split a single send into multiple datagrams of segmentSize bytes (UDP send offload)
+// - returns false if the OS does not support it, the caller must then send each datagram separately
+inline bool TryEnableUdpSendOffload(SOCKET socket, DWORD segmentSize) noexcept
+{
+    const auto optionLength = sizeof(segmentSize);
+    const auto error =
+        setsockopt(socket, IPPROTO_UDP, UDP_SEND_MSG_SIZE, reinterpret_cast<const char*>(&segmentSize), optionLength);
+    return ERROR_SUCCESS == error;
+}
+
+// Whether the OS supports UDP send offload, without setting a segment size for all the sends of the socket
+// - the segment size can then be given per send, with a UDP_SEND_MSG_SIZE control message
+inline bool IsUdpSendOffloadSupported(SOCKET socket) noexcept
+{
+    DWORD segmentSize = 0;
+    int optionLength = sizeof(segmentSize);
+    const auto error =
+        getsockopt(socket, IPPROTO_UDP, UDP_SEND_MSG_SIZE, reinterpret_cast<char*>(&segmentSize), &optionLength);
+    return ERROR_SUCCESS == error;
+}
+
+// Let the network stack timestamp the datagrams sent and received on the socket
+// - the receive timestamps are delivered as SO_TIMESTAMP control messages, which requires WSARecvMsg
+// - the send timestamps are retrieved with SIO_GET_TX_TIMESTAMP, for the sends identified by a SO_TIMESTAMP_ID
+//   control message, up to txTimestampsBuffered at a time
+// - returns false if the OS does not support it
+inline bool TryEnableTimestamping(SOCKET socket, USHORT txTimestampsBuffered) noexcept
+{
+    TIMESTAMPING_CONFIG config{};
+    config.Flags = TIMESTAMPING_FLAG_RX | TIMESTAMPING_FLAG_TX;
+    config.TxTimestampsBuffered = txTimestampsBuffered;
+
+    DWORD bytesReturned = 0;
+    const auto error =
+        WSAIoctl(socket, SIO_TIMESTAMPING, &config, sizeof(config), nullptr, 0, &bytesReturned, nullptr, nullptr);
+    return ERROR_SUCCESS == error;
+}
+
+inline LPFN_WSARECVMSG GetReceiveMessageFunction(SOCKET socket)
+{
+    GUID guid = WSAID_WSARECVMSG;
+    LPFN_WSARECVMSG function = nullptr;
+    DWORD bytesReturned = 0;
+    const auto error = WSAIoctl(
+        socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &function, sizeof(function), &bytesReturned, nullptr, nullptr);
+    if (ERROR_SUCCESS != error)
+    {
+        THROW_WIN32_MSG(WSAGetLastError(), "WSAIoctl(SIO_GET_EXTENSION_FUNCTION_POINTER, WSARecvMsg) failed");
+    }
+    return function;
+}
+
 inline void SetSocketReceiveBufferSize(SOCKET socket, int size)
 {
     const auto optionValue = size;
@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace multipath {
+
+// A bounded queue from a single producer thread to a single consumer thread, without lock
+// - the capacity is rounded up to a power of two, the items are copied in and out
+// - a push to a full queue fails: the producer never waits for the consumer
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : m_items(std::bit_ceil(capacity > 0 ? capacity : size_t{1})), m_mask(m_items.size() - 1)
+    {
+    }
+
+    [[nodiscard]] size_t Capacity() const noexcept
+    {
+        return m_items.size();
+    }
+
+    // Only called by the producer, returns false if the queue is full
+    bool TryPush(const T& item) noexcept
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_items.size())
+        {
+            return false;
+        }
+
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the consumer: passes the items queued to the callback in order, returns their number
+    template <typename Callback>
+    size_t Drain(Callback&& callback)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto tail = m_tail.load(std::memory_order_acquire);
+        for (auto i = head; i != tail; ++i)
+        {
+            callback(m_items[i & m_mask]);
+        }
+        m_head.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+
+    // Not copyable or movable
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+    SpscQueue(SpscQueue&&) = delete;
+    SpscQueue& operator=(SpscQueue&&) = delete;
+
+    ~SpscQueue() = default;
+
+private:
+    std::vector<T> m_items;
+    size_t m_mask;
+    // The producer and the consumer each write their own index, on separate cache lines
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+} // namespace multipath
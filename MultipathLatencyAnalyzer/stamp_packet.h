@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "datagram_header.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace multipath {
+
+// The test packets of STAMP (RFC 8762) in unauthenticated mode, free of OS dependencies like the datagram header.
+// TWAMP-Light uses the same layout, the tool interoperates with the reflectors and the senders of both.
+//
+// Session-Sender test packet, in network byte order:
+//  0  sequence number (4)
+//  4  timestamp (8)               T1, NTP format: seconds since 1900 (4), fraction of second (4)
+// 12  error estimate (2)
+// 14  MBZ (30)
+// 44  packet padding
+//
+// Session-Reflector test packet, of the same length as the packet it reflects:
+//  0  sequence number (4)         the one of the sender packet: the reflector is stateless
+//  4  timestamp (8)               T3, taken when the packet is sent back
+// 12  error estimate (2)
+// 14  MBZ (2)
+// 16  receive timestamp (8)       T2, taken when the sender packet was received
+// 24  session-sender sequence number (4)
+// 28  session-sender timestamp (8)
+// 36  session-sender error estimate (2)
+// 38  MBZ (2)
+// 40  session-sender TTL (1)      not reported by the server, always 0
+// 41  MBZ (3)
+// 44  packet padding
+constexpr size_t c_stampPacketLength = 44;
+
+// The port assigned to STAMP, the one the standard reflectors listen on
+constexpr unsigned short c_stampPort = 862;
+
+// Multiplier 1, scale 9: 2^-23 s, about 120 ns, the resolution of the default clock. Not synchronized to UTC (S bit),
+// NTP timestamps (Z bit).
+constexpr uint16_t c_stampErrorEstimate = 0x0901;
+
+// The fields of a reflector packet, the timestamps in NTP format
+struct StampReflectorPacket
+{
+    uint32_t m_sequenceNumber = 0;
+    uint64_t m_timestamp = 0;
+    uint16_t m_errorEstimate = 0;
+    uint64_t m_receiveTimestamp = 0;
+    uint32_t m_senderSequenceNumber = 0;
+    uint64_t m_senderTimestamp = 0;
+    uint16_t m_senderErrorEstimate = 0;
+    uint8_t m_senderTtl = 0;
+};
+
+namespace details {
+    constexpr size_t c_stampSequenceNumberOffset = 0;
+    constexpr size_t c_stampTimestampOffset = 4;
+    constexpr size_t c_stampErrorEstimateOffset = 12;
+    constexpr size_t c_stampReceiveTimestampOffset = 16;
+    constexpr size_t c_stampSenderSequenceNumberOffset = 24;
+    constexpr size_t c_stampSenderTimestampOffset = 28;
+    constexpr size_t c_stampSenderErrorEstimateOffset = 36;
+    constexpr size_t c_stampSenderTtlOffset = 40;
+
+    // Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+    constexpr uint64_t c_ntpToUnixSeconds = 2'208'988'800;
+    constexpr uint64_t c_nanoSecPerSecond = 1'000'000'000;
+} // namespace details
+
+// Converts nanoseconds since the Unix epoch to an NTP timestamp, rounded to the nearest fraction (233 ps): the
+// conversion back gives the same nanoseconds
+inline uint64_t ConvertUnixNanoSecToNtp(long long unixNanoSec) noexcept
+{
+    using namespace details;
+    const auto nanoSec = static_cast<uint64_t>(unixNanoSec);
+    const auto seconds = nanoSec / c_nanoSecPerSecond + c_ntpToUnixSeconds;
+    const auto fraction = (((nanoSec % c_nanoSecPerSecond) << 32) + c_nanoSecPerSecond / 2) / c_nanoSecPerSecond;
+    // A fraction rounded up to a whole second carries into the seconds, which wrap in 2036 (NTP era 1)
+    return (seconds << 32) + fraction;
+}
+
+// Converts an NTP timestamp to nanoseconds since the Unix epoch
+// - the seconds below 2^31 are taken in NTP era 1, from 2036 (RFC 4330): the timestamps span 1968 to 2104
+inline long long ConvertNtpToUnixNanoSec(uint64_t ntpTimestamp) noexcept
+{
+    using namespace details;
+    auto seconds = ntpTimestamp >> 32;
+    if ((seconds & 0x8000'0000) == 0)
+    {
+        seconds += uint64_t{1} << 32;
+    }
+    const auto fraction = ntpTimestamp & 0xFFFF'FFFF;
+    const auto nanoSec = (fraction * c_nanoSecPerSecond + (uint64_t{1} << 31)) >> 32;
+    return static_cast<long long>((seconds - c_ntpToUnixSeconds) * c_nanoSecPerSecond + nanoSec);
+}
+
+// Writes a sender packet without its timestamp, set when it is sent
+// - the buffer must hold at least c_stampPacketLength bytes, the padding after them is left as is
+inline void WriteStampSenderPacket(char* buffer, uint32_t sequenceNumber) noexcept
+{
+    using namespace details;
+    std::memset(buffer, 0, c_stampPacketLength);
+    Store32(buffer + c_stampSequenceNumberOffset, sequenceNumber);
+    Store16(buffer + c_stampErrorEstimateOffset, c_stampErrorEstimate);
+}
+
+inline void SetStampSenderTimestamp(char* buffer, uint64_t ntpTimestamp) noexcept
+{
+    details::Store64(buffer + details::c_stampTimestampOffset, ntpTimestamp);
+}
+
+// Turns a received sender packet into a reflector packet, in place, with the time it was received
+// - returns false if the packet is too short to be a sender packet, it is dropped
+// - the packet is sent back with its padding, of the same length: the reflector timestamp is set when sent
+inline bool ReflectStampPacket(char* buffer, size_t completedBytes, uint64_t receiveNtpTimestamp) noexcept
+{
+    using namespace details;
+    if (completedBytes < c_stampPacketLength)
+    {
+        return false;
+    }
+
+    const auto sequenceNumber = Load32(buffer + c_stampSequenceNumberOffset);
+    const auto senderTimestamp = Load64(buffer + c_stampTimestampOffset);
+    const auto senderErrorEstimate = Load16(buffer + c_stampErrorEstimateOffset);
+
+    std::memset(buffer, 0, c_stampPacketLength);
+    Store32(buffer + c_stampSequenceNumberOffset, sequenceNumber);
+    Store16(buffer + c_stampErrorEstimateOffset, c_stampErrorEstimate);
+    Store64(buffer + c_stampReceiveTimestampOffset, receiveNtpTimestamp);
+    Store32(buffer + c_stampSenderSequenceNumberOffset, sequenceNumber);
+    Store64(buffer + c_stampSenderTimestampOffset, senderTimestamp);
+    Store16(buffer + c_stampSenderErrorEstimateOffset, senderErrorEstimate);
+    return true;
+}
+
+// Sets the timestamp of a reflector packet, at the last moment before it is sent
+inline void SetStampReflectorTimestamp(char* buffer, uint64_t ntpTimestamp) noexcept
+{
+    details::Store64(buffer + details::c_stampTimestampOffset, ntpTimestamp);
+}
+
+// Decodes a reflector packet of completedBytes bytes, returns false if it is too short
+// - the packet has no checksum of its own, the UDP checksum covers it
+inline bool ParseStampReflectorPacket(const char* buffer, size_t completedBytes, StampReflectorPacket& packet) noexcept
+{
+    using namespace details;
+    if (completedBytes < c_stampPacketLength)
+    {
+        return false;
+    }
+
+    packet.m_sequenceNumber = Load32(buffer + c_stampSequenceNumberOffset);
+    packet.m_timestamp = Load64(buffer + c_stampTimestampOffset);
+    packet.m_errorEstimate = Load16(buffer + c_stampErrorEstimateOffset);
+    packet.m_receiveTimestamp = Load64(buffer + c_stampReceiveTimestampOffset);
+    packet.m_senderSequenceNumber = Load32(buffer + c_stampSenderSequenceNumberOffset);
+    packet.m_senderTimestamp = Load64(buffer + c_stampSenderTimestampOffset);
+    packet.m_senderErrorEstimate = Load16(buffer + c_stampSenderErrorEstimateOffset);
+    packet.m_senderTtl = static_cast<uint8_t>(buffer[c_stampSenderTtlOffset]);
+    return true;
+}
+
+} // namespace multipath
@@ -4,10 +4,16 @@
 #include "stream_client.h"
 #include "adapters.h"
 #include "logs.h"
+#include "time_utils.h"
 
 #include <wil/result.h>
 
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <string>
 
 namespace multipath {
 namespace {
@@ -30,12 +36,33 @@ namespace {
         return (duration * byteRate) / datagramSize;
     }
 
+    // e.g. "interface 12" or "192.168.1.10"
+    std::string PathName(const PathConfiguration& path)
+    {
+        if (path.m_interfaceIndex != 0)
+        {
+            return "interface " + std::to_string(path.m_interfaceIndex);
+        }
+
+        // The textual form of an address is ASCII
+        std::string name;
+        for (const auto character : path.m_sourceAddress.WriteAddress())
+        {
+            name.push_back(static_cast<char>(character));
+        }
+        return name;
+    }
+
 } // namespace
 
 StreamClient::StreamClient(ctl::ctSockaddr targetAddress, unsigned long receiveBufferCount, HANDLE completeEvent) :
-    m_targetAddress(std::move(targetAddress)), m_completeEvent(completeEvent), m_receiveBufferCount(receiveBufferCount)
+    m_targetAddress(std::move(targetAddress)),
+    m_completeEvent(completeEvent),
+    m_receiveBufferCount(receiveBufferCount),
+    m_flowId(std::random_device{}())
 {
     m_threadpoolTimer = std::make_unique<ThreadpoolTimer>([this]() noexcept { TimerCallback(); });
+    m_precisionPacer = std::make_unique<PrecisionPacer>([this]() noexcept { TimerCallback(); });
 }
 
 void StreamClient::RequestSecondaryWlanConnection()
@@ -59,7 +86,10 @@ void StreamClient::SetupSecondaryInterface()
     }
 
     // Callback to update the secondary interface state in response to network status events
-    auto updateSecondaryInterfaceStatus = [this, primaryInterfaceGuid = winrt::guid{}, secondaryInterfaceGuid = winrt::guid{}]() mutable {
+    auto updateSecondaryInterfaceStatus = [this,
+                                           secondary = m_paths[c_secondaryPath].get(),
+                                           primaryInterfaceGuid = winrt::guid{},
+                                           secondaryInterfaceGuid = winrt::guid{}]() mutable {
         try
         {
 
@@ -75,9 +105,9 @@ void StreamClient::SetupSecondaryInterface()
                 Log<LogLevel::Dualsta>("The preferred primary interface changed. Updating the secondary interface.\n");
 
                 // If a secondary wlan interface was used for the previous primary, tear it down
-                if (m_secondaryState.m_adapterStatus == MeasuredSocket::AdapterStatus::Ready)
+                if (secondary->m_adapterStatus == MeasuredSocket::AdapterStatus::Ready)
                 {
-                    m_secondaryState.Cancel();
+                    secondary->Cancel();
                     Log<LogLevel::Dualsta>("Secondary interface removed\n");
                 }
 
@@ -85,7 +115,7 @@ void StreamClient::SetupSecondaryInterface()
                 if (auto secondaryGuid = GetSecondaryInterfaceGuid(m_wlanHandle.get(), primaryInterfaceGuid))
                 {
                     secondaryInterfaceGuid = *secondaryGuid;
-                    m_secondaryState.m_adapterStatus = MeasuredSocket::AdapterStatus::Connecting;
+                    secondary->m_adapterStatus = MeasuredSocket::AdapterStatus::Connecting;
                     Log<LogLevel::Dualsta>("Secondary interface added. Waiting for connectivity.\n");
                 }
                 else
@@ -95,17 +125,23 @@ void StreamClient::SetupSecondaryInterface()
             }
 
             // Once the secondary interface has network connectivity, setup it up for sending data
-            if (m_secondaryState.m_adapterStatus == MeasuredSocket::AdapterStatus::Connecting && IsAdapterConnected(secondaryInterfaceGuid))
+            if (secondary->m_adapterStatus == MeasuredSocket::AdapterStatus::Connecting && IsAdapterConnected(secondaryInterfaceGuid))
             {
                 try
                 {
                     Log<LogLevel::Dualsta>("Secondary interface connected. Setting up a socket.\n");
-                    m_secondaryState.Setup(m_targetAddress, m_receiveBufferCount, ConvertInterfaceGuidToIndex(secondaryInterfaceGuid));
-                    m_secondaryState.CheckConnectivity();
-                    m_secondaryState.PrepareToReceive([this](auto& r) { ReceiveCompletion(Interface::Secondary, r); });
+                    secondary->Setup(
+                        m_targetAddress,
+                        m_receiveBufferCount,
+                        ConvertInterfaceGuidToIndex(secondaryInterfaceGuid),
+                        m_ioPoolCapacity,
+                        m_timestamping);
+                    secondary->CheckConnectivity();
+                    secondary->PrepareToReceive([this](auto& r) { ReceiveCompletion(c_secondaryPath, r); });
+                    secondary->PrepareToSend([this](const auto& r) { SendCompletion(c_secondaryPath, r); });
 
                     // The secondary interface is ready to send data, the client can start using it
-                    m_secondaryState.m_adapterStatus = MeasuredSocket::AdapterStatus::Ready;
+                    secondary->m_adapterStatus = MeasuredSocket::AdapterStatus::Ready;
                     Log<LogLevel::Info>("Secondary interface ready for use.\n");
                 }
                 catch (wil::ResultException& ex)
@@ -116,8 +152,8 @@ void StreamClient::SetupSecondaryInterface()
                         Log<LogLevel::Dualsta>(
                             "Secondary interface could not reach the echo server. It will retry after a "
                             "network status change.");
-                        m_secondaryState.Cancel();
-                        m_secondaryState.m_adapterStatus = MeasuredSocket::AdapterStatus::Connecting;
+                        secondary->Cancel();
+                        secondary->m_adapterStatus = MeasuredSocket::AdapterStatus::Connecting;
                     }
                     else
                     {
@@ -125,9 +161,9 @@ void StreamClient::SetupSecondaryInterface()
                     }
                 }
             }
-            else if (m_secondaryState.m_adapterStatus == MeasuredSocket::AdapterStatus::Ready && !IsAdapterConnected(secondaryInterfaceGuid))
+            else if (secondary->m_adapterStatus == MeasuredSocket::AdapterStatus::Ready && !IsAdapterConnected(secondaryInterfaceGuid))
             {
-                m_secondaryState.Cancel();
+                secondary->Cancel();
                 Log<LogLevel::Dualsta>("Secondary interface removed after losing connectivity\n");
             }
         }
@@ -147,42 +183,219 @@ void StreamClient::SetupSecondaryInterface()
         });
 }
 
-void StreamClient::Start(unsigned long bitRate, unsigned long grouping, unsigned long duration)
+void StreamClient::Start(const Configuration& config)
 {
-    m_grouping = grouping;
-    const auto tickInterval = CalculateTickInterval(bitRate, grouping, MeasuredSocket::c_bufferSize);
-    const auto nbDatagramToSend = CalculateNumberOfDatagramToSend(duration, bitRate, MeasuredSocket::c_bufferSize);
-    m_finalSequenceNumber += nbDatagramToSend;
-
-    // allocate statistics buffer
-    FAIL_FAST_IF_MSG(m_finalSequenceNumber > MAXSIZE_T, "Final sequence number exceeds limit of vector storage");
-    m_latencyData.m_latencies.resize(static_cast<size_t>(m_finalSequenceNumber));
+    m_grouping = config.m_grouping;
+    m_batchSend = config.m_batchSend;
+    m_precisePacing = config.m_precisePacing;
+    m_catchUp = config.m_catchUp;
+    m_timestamping = config.m_timestamping;
+    m_protocol = config.m_protocol;
+    m_headerEcho = config.m_headerEcho;
+    m_downlink = config.m_downlink;
+    m_schedulingPolicy = config.m_schedulingPolicy;
+    m_ioPoolCapacity = config.m_ioPoolCapacity;
+    const auto tickInterval = CalculateTickInterval(config.m_bitrate, m_grouping, MeasuredSocket::c_bufferSize);
+
+    // A duration of 0 means the client runs until it is stopped
+    const auto nbDatagramToSend = CalculateNumberOfDatagramToSend(config.m_duration, config.m_bitrate, MeasuredSocket::c_bufferSize);
+    if (config.m_duration > 0)
+    {
+        m_finalSequenceNumber += nbDatagramToSend;
+    }
+    else
+    {
+        m_finalSequenceNumber = (std::numeric_limits<long long>::max)();
+    }
+
+    // The primary and secondary paths always exist, the secondary one is only used once its interface is connected
+    const auto pathCount = 2 + config.m_additionalPaths.size();
+    std::vector<std::string> pathNames{DefaultPathName(c_primaryPath), DefaultPathName(c_secondaryPath)};
+    for (const auto& path : config.m_additionalPaths)
+    {
+        pathNames.push_back(PathName(path));
+    }
+    for (size_t i = 0; i < pathCount; ++i)
+    {
+        m_paths.push_back(
+            std::make_unique<MeasuredSocket>(m_flowId, static_cast<uint16_t>(i), config.m_verifyPayload, m_protocol, m_headerEcho));
+        m_reordering.push_back(std::make_unique<ReorderingTracker>());
+
+        std::vector<std::unique_ptr<SpscQueue<Arrival>>> arrivals;
+        for (unsigned long receiver = 0; receiver < m_receiveBufferCount; ++receiver)
+        {
+            arrivals.push_back(std::make_unique<SpscQueue<Arrival>>(c_arrivalQueueCapacity));
+        }
+        m_arrivals.push_back(std::move(arrivals));
+    }
+    // Enough for all the queues of a path, the timer never allocates
+    m_drainedArrivals.reserve(m_receiveBufferCount * c_arrivalQueueCapacity);
+
+    // The holdoff after a loss is converted from milliseconds to datagrams
+    SchedulerSettings schedulerSettings;
+    schedulerSettings.m_policy = m_schedulingPolicy;
+    schedulerSettings.m_latencyThreshold = static_cast<long long>(config.m_duplicateThreshold) * 1'000'000;
+    schedulerSettings.m_lossHoldoff =
+        CalculateNumberOfDatagramToSend(config.m_duplicateHoldoff, config.m_bitrate, MeasuredSocket::c_bufferSize) / 1000;
+    m_scheduler = MakePathScheduler(schedulerSettings, pathCount);
+
+    // A datagram is finalized once the datagrams sent during the loss timeout (in ms) are sent after it
+    const auto datagramsPerTimeout =
+        CalculateNumberOfDatagramToSend(config.m_lossTimeout, config.m_bitrate, MeasuredSocket::c_bufferSize) / 1000;
+    auto windowSize = static_cast<size_t>(datagramsPerTimeout + m_grouping);
+    if (m_downlink)
+    {
+        // The server streams the same datagrams as the client would send: the same size, rate and grouping
+        m_downlinkLead = CalculateNumberOfDatagramToSend(c_downlinkLead, config.m_bitrate, MeasuredSocket::c_bufferSize) / 1000;
+        m_downlinkTickInterval = static_cast<double>(tickInterval) * 100.;
+        m_streamRequest.m_bitrate = config.m_bitrate;
+        m_streamRequest.m_datagramSize = static_cast<uint32_t>(MeasuredSocket::c_bufferSize);
+        m_streamRequest.m_grouping = static_cast<uint32_t>(m_grouping);
+        for (auto& first : m_downlinkFirst)
+        {
+            first = (std::numeric_limits<long long>::max)();
+        }
+        windowSize += static_cast<size_t>(m_downlinkLead);
+    }
+    m_latencyStore = std::make_unique<LatencyStore>(
+        windowSize, pathCount, [this](long long sequenceNumber, const LatencyMeasure& measure) {
+            FinalizeDatagram(sequenceNumber, measure);
+        });
+    m_latencyData = LatencyData{pathCount, config.m_histogramDigits, config.m_combinations, pathNames};
     m_latencyData.m_datagramSize = MeasuredSocket::c_bufferSize;
 
+    if (config.m_reportInterval > 0)
+    {
+        // A single combination is reported as the effective path
+        std::vector<std::pair<PathSet, std::string>> combinations;
+        for (const auto& combination : m_latencyData.m_combinations)
+        {
+            combinations.emplace_back(
+                combination.m_paths,
+                m_latencyData.m_combinations.size() > 1 ? m_latencyData.CombinationName(combination) : "effective");
+        }
+        m_intervalReporter = std::make_unique<IntervalReporter>(
+            config.m_reportInterval, config.m_histogramDigits, pathNames, std::move(combinations));
+    }
+
+    m_dumpHeader.m_datagramSize = static_cast<uint32_t>(MeasuredSocket::c_bufferSize);
+    m_dumpHeader.m_bitrate = config.m_bitrate;
+    m_dumpHeader.m_grouping = config.m_grouping;
+    m_dumpHeader.m_duration = config.m_duration;
+    m_dumpHeader.m_lossTimeout = config.m_lossTimeout;
+    m_dumpHeader.m_flags = (config.m_useSecondaryWlanInterface ? LatencyDumpHeader::c_flagSecondaryInterface : 0) |
+                           (config.m_batchSend ? LatencyDumpHeader::c_flagBatchSend : 0) |
+                           (config.m_precisePacing ? LatencyDumpHeader::c_flagPrecisePacing : 0) |
+                           (config.m_timestamping ? LatencyDumpHeader::c_flagTimestamping : 0) |
+                           (HasReflectorTimestamps() ? LatencyDumpHeader::c_flagReflectorTimestamps : 0) |
+                           (m_downlink ? LatencyDumpHeader::c_flagDownlink : 0);
+    m_dumpHeader.m_startTime = static_cast<uint64_t>(std::time(nullptr));
+    m_dumpHeader.m_pathCount = static_cast<uint32_t>(pathCount);
+    m_dumpHeader.m_scheduler = static_cast<uint32_t>(config.m_schedulingPolicy);
+
+    if (!config.m_outputFile.empty())
+    {
+        // The raw measures are converted to the output format at the end of the run
+        m_spillFile = config.m_outputFile;
+        m_spillFile += L".spill";
+        m_spillWriter = std::make_unique<LatencySpillWriter>(m_spillFile, pathCount);
+    }
+
     // Setup the interfaces
     Log<LogLevel::Info>("Setting up the interfaces\n");
-    m_primaryState.Setup(m_targetAddress, m_receiveBufferCount);
-    m_primaryState.CheckConnectivity();
+    m_paths[c_primaryPath]->Setup(m_targetAddress, m_receiveBufferCount, 0, m_ioPoolCapacity, m_timestamping);
+    m_paths[c_primaryPath]->CheckConnectivity();
+
+    // The additional paths are fixed: the client fails to start if one cannot reach the server
+    for (size_t i = 0; i < config.m_additionalPaths.size(); ++i)
+    {
+        const auto& path = config.m_additionalPaths[i];
+        Log<LogLevel::Info>("Setting up %s\n", pathNames[2 + i].c_str());
+        m_paths[2 + i]->Setup(
+            m_targetAddress, m_receiveBufferCount, path.m_interfaceIndex, m_ioPoolCapacity, m_timestamping, path.m_sourceAddress);
+        m_paths[2 + i]->CheckConnectivity();
+    }
 
     SetupSecondaryInterface();
 
     // initiate receives before starting the send timer
-    m_primaryState.PrepareToReceive([this](auto& r) { ReceiveCompletion(Interface::Primary, r); });
-    m_primaryState.m_adapterStatus = MeasuredSocket::AdapterStatus::Ready;
+    for (size_t i = 0; i < pathCount; ++i)
+    {
+        if (i == c_secondaryPath)
+        {
+            continue;
+        }
+        m_paths[i]->PrepareToReceive([this, i](auto& r) { ReceiveCompletion(i, r); });
+        m_paths[i]->PrepareToSend([this, i](const auto& r) { SendCompletion(i, r); });
+        m_paths[i]->m_adapterStatus = MeasuredSocket::AdapterStatus::Ready;
+    }
 
-    Log<LogLevel::Output>(
-        "%d datagrams will be sent, by groups of %d every %lld microseconds\n", nbDatagramToSend, m_grouping, tickInterval / 10);
+    if (m_downlink)
+    {
+        Log<LogLevel::Output>(
+            "The server will stream the datagrams on each path, by groups of %lld every %lld microseconds\n",
+            m_grouping,
+            tickInterval / 10);
+    }
+    else if (config.m_duration > 0)
+    {
+        Log<LogLevel::Output>(
+            "%lld datagrams will be sent, by groups of %lld every %lld microseconds\n", nbDatagramToSend, m_grouping, tickInterval / 10);
+    }
+    else
+    {
+        Log<LogLevel::Output>(
+            "Datagrams will be sent until the client is stopped, by groups of %lld every %lld microseconds\n", m_grouping, tickInterval / 10);
+    }
 
     // start sending data
     Log<LogLevel::Info>("Start sending datagrams\n");
-    // TODO: Clean types
-    m_threadpoolTimer->Schedule(static_cast<unsigned long>(tickInterval));
+    m_startCpuTime = SnapProcessCpuTimeInHundredNs();
+    if (m_intervalReporter)
+    {
+        m_intervalReporter->Start();
+    }
+    if (m_precisePacing)
+    {
+        m_datagramsPerTick = m_batchSend || m_downlink ? m_grouping : 1;
+        m_precisionPacer->Schedule(tickInterval / 10. * static_cast<double>(m_datagramsPerTick) / static_cast<double>(m_grouping));
+    }
+    else
+    {
+        // TODO: Clean types
+        m_datagramsPerTick = m_grouping;
+        m_threadpoolTimer->Schedule(static_cast<unsigned long>(tickInterval), m_catchUp);
+    }
 }
 
 void StreamClient::Stop() noexcept
 {
+    // The statistics are only complete once the first call returns
+    if (m_stopping.exchange(true))
+    {
+        WaitForSingleObject(m_completeEvent, INFINITE);
+        return;
+    }
+    Shutdown();
+}
+
+void StreamClient::Shutdown() noexcept
+{
+    // The timer and the pacer return once the sender is done with its last tick
     Log<LogLevel::Info>("Stop sending datagrams\n");
     m_threadpoolTimer->Stop();
+    m_precisionPacer->Stop();
+    if (m_intervalReporter)
+    {
+        m_intervalReporter->Stop();
+    }
+    m_stopCpuTime = SnapProcessCpuTimeInHundredNs();
+
+    // The last requests end the streams at the datagrams expected, the others would be counted as corrupt
+    if (m_downlink)
+    {
+        SendStreamRequests(ExpectedEnd());
+    }
 
     Log<LogLevel::Info>("Canceling network status changed event subscription\n");
     m_networkInformationEventRevoker.revoke();
@@ -191,8 +404,40 @@ void StreamClient::Stop() noexcept
     Sleep(1000); // 1 sec
 
     Log<LogLevel::Info>("Closing the sockets\n");
-    m_primaryState.Cancel();
-    m_secondaryState.Cancel();
+    for (auto& path : m_paths)
+    {
+        path->Cancel();
+    }
+
+    // No completion can update the counters once the sockets are closed
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        auto& path = m_latencyData.m_paths[i];
+        path.m_duplicateDatagrams = m_receiveCounters[i].m_duplicateDatagrams.load();
+        path.m_lateDatagrams = m_receiveCounters[i].m_lateDatagrams.load();
+        path.m_corruptDatagrams = m_receiveCounters[i].m_corruptDatagrams.load() + m_paths[i]->m_invalidDatagrams.load();
+        path.m_foreignDatagrams = m_paths[i]->m_foreignDatagrams.load();
+        path.m_corruptPayloads = m_paths[i]->m_corruptPayloads.load();
+        path.m_reportedBytes = m_paths[i]->m_reportedBytes.load();
+    }
+
+    // The timer is stopped, the last arrivals are taken here
+    DrainArrivals();
+
+    // The remaining datagrams can no longer be received, the statistics show the clock model of the whole run
+    UpdateClockModel();
+    m_latencyStore->FinalizeAll();
+    if (m_spillWriter)
+    {
+        try
+        {
+            m_spillWriter->Flush();
+        }
+        catch (...)
+        {
+            Log<LogLevel::Error>("Failed to write the raw measures to the spill file\n");
+        }
+    }
 
     Log<LogLevel::Info>("The client has stopped\n");
     SetEvent(m_completeEvent);
@@ -201,18 +446,200 @@ void StreamClient::Stop() noexcept
 void StreamClient::PrintStatistics()
 {
     PrintLatencyStatistics(m_latencyData);
+
+    auto datagramsPerCall = [](const MeasuredSocket& socket) {
+        return socket.m_sendCalls > 0 ? static_cast<double>(socket.m_sentDatagrams) / socket.m_sendCalls : 0.;
+    };
+    auto interfaceName = [this](size_t path) { return m_latencyData.m_paths[path].m_name + " interface"; };
+
+    // The send completions run after the timer is stopped, the CPU time is measured until the sockets are closed
+    long long sentDatagrams = 0;
+    for (const auto& path : m_paths)
+    {
+        sentDatagrams += path->m_sentDatagrams;
+    }
+    const auto cpuTimePerDatagram = sentDatagrams > 0 ? (m_stopCpuTime - m_startCpuTime) / 10. / sentDatagrams : 0.;
+
+    auto printIoPoolStatistics = [](const std::string& interfaceName, const MeasuredSocket& socket) {
+        const auto statistics = socket.GetIoPoolStatistics();
+        std::cout << "I/O requests on " << interfaceName << ": " << statistics.total_requests << ", at most "
+                  << statistics.peak_in_use << " in-flight for a pool of " << statistics.capacity << ". The pool was exhausted "
+                  << statistics.exhausted_count << " times.\n";
+    };
+
+    std::cout << '\n';
+    std::cout << "--- REORDERING ---\n";
+    std::cout << '\n';
+    std::cout << "Reordered datagrams: received after a datagram with a higher sequence number (RFC 4737)\n";
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        const auto& reordering = *m_reordering[i];
+        const auto& extents = reordering.Extents();
+        std::cout << "Reordered datagrams on " << interfaceName(i) << ": " << reordering.Reordered() << " ("
+                  << (reordering.Arrivals() > 0 ? 100. * reordering.Reordered() / reordering.Arrivals() : 0.)
+                  << "%), extent (p50 / p99 / max): " << extents.ValueAtPercentile(50.) << " / "
+                  << extents.ValueAtPercentile(99.) << " / " << extents.Max() << " datagrams, maximum displacement: "
+                  << reordering.Displacements().Max() << " sequence numbers\n";
+        if (const auto untracked = m_receiveCounters[i].m_untrackedArrivals.load(); untracked > 0)
+        {
+            std::cout << "Arrivals not tracked on " << interfaceName(i) << ": " << untracked
+                      << " (the timer did not take them in time, they are missing from the reordering)\n";
+        }
+    }
+
+    std::cout << '\n';
+    std::cout << "--- I/O PATH ---\n";
+    std::cout << '\n';
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        std::cout << "Send calls on " << interfaceName(i) << ": " << m_paths[i]->m_sendCalls << " ("
+                  << datagramsPerCall(*m_paths[i]) << " datagrams per call)\n";
+    }
+    std::cout << "Process CPU time per datagram sent: " << cpuTimePerDatagram << " microseconds\n";
+    std::cout << '\n';
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        printIoPoolStatistics(interfaceName(i), *m_paths[i]);
+    }
+
+    if (m_timestamping)
+    {
+        std::cout << '\n';
+        for (size_t i = 0; i < m_paths.size(); ++i)
+        {
+            std::cout << "Kernel send timestamps missing on " << interfaceName(i) << ": "
+                      << m_paths[i]->m_missingKernelSendTimestamps.load()
+                      << (m_paths[i]->m_timestampingEnabled ? "\n" : " (timestamping not supported)\n");
+        }
+    }
+
+    if (m_downlink)
+    {
+        std::cout << '\n';
+        std::cout << "--- DOWNLINK ---\n";
+        std::cout << '\n';
+        std::cout << "The latencies are the one-way delays of the datagrams streamed by the server, measured from its send\n"
+                     "timestamps converted to the client clock\n";
+        if (m_downlinkClock)
+        {
+            std::cout << "Server clock offset: " << m_downlinkClock->m_offset / 1'000'000.
+                      << " ms, skew: " << m_downlinkClock->m_skew * 1'000'000. << " ppm (largest deviation from the fit: "
+                      << m_downlinkClock->m_deviation / 1'000. << " us)\n";
+            std::cout << "The delays assume the minimum delays of the stream requests are the same in both directions\n";
+        }
+        long long confirmedRequests = 0;
+        for (size_t i = 0; i < m_paths.size(); ++i)
+        {
+            confirmedRequests += m_paths[i]->m_confirmedStreamRequests.load();
+            std::cout << "Stream requests on " << interfaceName(i) << ": " << m_paths[i]->m_streamRequests << " sent, "
+                      << m_paths[i]->m_confirmedStreamRequests.load() << " confirmed\n";
+        }
+        if (confirmedRequests == 0)
+        {
+            std::cout << "No stream request was confirmed: the server must be run with -downlink:1\n";
+        }
+        std::cout << "Datagrams received before the server clock was estimated, not accounted: " << m_unclockedDatagrams << '\n';
+    }
+    else
+    {
+        // The cost of the scheduling policy, against the effective latency and loss above
+        const auto& effective = m_latencyData.Effective();
+        const auto copiesPerDatagram = m_sequenceNumber > 0 ? static_cast<double>(sentDatagrams) / m_sequenceNumber : 0.;
+        std::cout << '\n';
+        std::cout << "--- SCHEDULER ---\n";
+        std::cout << '\n';
+        std::cout << "Policy: " << SchedulingPolicyName(m_schedulingPolicy) << '\n';
+        std::cout << "Datagrams sent on all paths: " << sentDatagrams << " for " << m_sequenceNumber << " datagrams ("
+                  << copiesPerDatagram << " copies per datagram, " << sentDatagrams * MeasuredSocket::c_bufferSize / 1024
+                  << " kB)\n";
+        std::cout << "Datagrams duplicated: " << m_scheduler->DuplicatedDatagrams() << '\n';
+        std::cout << "Effective loss: " << (effective.Sent() > 0 ? 100. * effective.Lost() / effective.Sent() : 0.)
+                  << "%, effective p99 latency: " << effective.Percentile(99.) / 1'000'000. << " ms\n";
+    }
+
+    if (m_precisePacing)
+    {
+        const auto& pacingError = m_precisionPacer->GetPacingError();
+        std::cout << '\n';
+        std::cout << "--- PACING ---\n";
+        std::cout << '\n';
+        std::cout << "Pacing error (actual - intended send time) over " << pacingError.Count()
+                  << " send operations: average " << pacingError.Mean() << " microseconds, maximum " << pacingError.Max()
+                  << " microseconds\n";
+        pacingError.Print(std::cout);
+    }
+    else
+    {
+        // Whether the ticks really ran at the requested rate, i.e. whether the configured bitrate was offered
+        const auto& timer = m_threadpoolTimer->GetStatistics();
+        std::cout << '\n';
+        std::cout << "--- PACING ---\n";
+        std::cout << '\n';
+        std::cout << "Catch-up policy: " << TimerCatchUpPolicyName(m_catchUp.m_policy) << ", limit " << m_catchUp.m_limit
+                  << '\n';
+        std::cout << "Send operations: " << timer.m_callbacks << ", late: " << timer.m_missedPeriods
+                  << ", skipped: " << timer.m_skippedPeriods << ", maximum burst: " << timer.m_maxBurst << '\n';
+        std::cout << "Timer lateness (actual - intended expiration) over " << timer.m_lateness.Count()
+                  << " expirations: average " << timer.m_lateness.Mean() << " microseconds, maximum "
+                  << timer.m_lateness.Max() << " microseconds\n";
+        timer.m_lateness.Print(std::cout);
+    }
 }
 
-void StreamClient::DumpLatencyData(std::ofstream& file)
+void StreamClient::DumpLatencyData(const std::filesystem::path& path, LatencyDumpFormat format)
 {
-    multipath::DumpLatencyData(m_latencyData, file);
+    if (m_spillFile.empty())
+    {
+        return;
+    }
+
+    m_spillWriter.reset();
+
+    if (format == LatencyDumpFormat::Binary)
+    {
+        LatencyBinaryWriter writer{path, m_dumpHeader};
+        ReadLatencySpill(m_spillFile, [&](long long sequenceNumber, const LatencyMeasure& measure) {
+            writer.Add(sequenceNumber, measure);
+        });
+        writer.Flush();
+    }
+    else
+    {
+        LatencyCsvWriter writer{path, m_paths.size(), m_timestamping, HasReflectorTimestamps()};
+        ReadLatencySpill(m_spillFile, [&](long long sequenceNumber, const LatencyMeasure& measure) {
+            writer.Add(sequenceNumber, measure);
+        });
+        writer.Flush();
+    }
+
+    std::error_code error;
+    std::filesystem::remove(m_spillFile, error);
 }
 
 void StreamClient::TimerCallback() noexcept
 {
-    for (auto i = 0; i < m_grouping && m_sequenceNumber < m_finalSequenceNumber; ++i)
+    DrainArrivals();
+    if (m_intervalReporter)
     {
-        SendDatagrams();
+        m_intervalReporter->Poll();
+    }
+
+    if (m_downlink)
+    {
+        const auto remaining = m_finalSequenceNumber - m_sequenceNumber;
+        ExpectDatagrams(m_grouping < remaining ? m_grouping : remaining);
+    }
+    else if (m_batchSend)
+    {
+        const auto remaining = m_finalSequenceNumber - m_sequenceNumber;
+        SendDatagramBatch(m_grouping < remaining ? m_grouping : remaining);
+    }
+    else
+    {
+        for (auto i = 0; i < m_datagramsPerTick && m_sequenceNumber < m_finalSequenceNumber; ++i)
+        {
+            SendDatagrams();
+        }
     }
 
     // Stop when the last sequence number is reached
@@ -220,66 +647,403 @@ void StreamClient::TimerCallback() noexcept
     {
         Log<LogLevel::Info>("Final sequence number sent, canceling timer callback\n");
         FAIL_FAST_IF_MSG(m_sequenceNumber > m_finalSequenceNumber, "Exceeded the expected number of packets sent");
-        Stop();
+
+        // The sender never waits for a stop in progress, which is waiting for this tick to return
+        if (!m_stopping.exchange(true))
+        {
+            Shutdown();
+        }
+    }
+}
+
+PathSet StreamClient::ReadyPaths() const noexcept
+{
+    PathSet paths = 0;
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        if (m_paths[i]->m_adapterStatus == MeasuredSocket::AdapterStatus::Ready)
+        {
+            paths |= PathSet{1} << i;
+        }
     }
+    return paths;
 }
 
 void StreamClient::SendDatagrams() noexcept
 {
-    m_primaryState.SendDatagram(m_sequenceNumber, [this](const auto& r) { SendCompletion(Interface::Primary, r); });
+    m_latencyStore->Advance(m_sequenceNumber + 1);
 
-    if (m_secondaryState.m_adapterStatus == MeasuredSocket::AdapterStatus::Ready)
+    const auto paths = m_scheduler->Schedule(m_sequenceNumber, 1, ReadyPaths());
+    for (size_t i = 0; i < m_paths.size(); ++i)
     {
-        m_secondaryState.SendDatagram(
-            m_sequenceNumber, [this](const auto& r) { SendCompletion(Interface::Secondary, r); });
+        if (ContainsPath(paths, i))
+        {
+            m_paths[i]->SendDatagram(m_sequenceNumber);
+        }
     }
+    ReportSent(paths, 1);
 
     m_sequenceNumber += 1;
 }
 
-void StreamClient::SendCompletion(const Interface interface, const MeasuredSocket::SendResult& sendState) noexcept
+void StreamClient::SendDatagramBatch(long long count) noexcept
 {
-    auto& stat = m_latencyData.m_latencies[static_cast<size_t>(sendState.m_sequenceNumber)];
+    if (count <= 0)
+    {
+        return;
+    }
+
+    m_latencyStore->Advance(m_sequenceNumber + count);
 
-    if (interface == Interface::Primary)
+    // The datagrams of a batch are sent with a single call on each path, they are all scheduled together
+    const auto paths = m_scheduler->Schedule(m_sequenceNumber, count, ReadyPaths());
+    for (size_t i = 0; i < m_paths.size(); ++i)
     {
-        stat.m_primarySendTimestamp = sendState.m_sendTimestamp;
+        if (ContainsPath(paths, i))
+        {
+            m_paths[i]->SendDatagramBatch(m_sequenceNumber, count);
+        }
     }
-    else
+    ReportSent(paths, count);
+
+    m_sequenceNumber += count;
+}
+
+void StreamClient::ExpectDatagrams(long long count) noexcept
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // The window runs ahead of the server, which follows the same schedule from its first request
+    m_sequenceNumber += count;
+    m_latencyStore->Advance(ExpectedEnd());
+
+    // The datagrams are counted as sent on the paths already streamed
+    PathSet streamedPaths = 0;
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        if (m_downlinkFirst[i].load() < m_sequenceNumber)
+        {
+            streamedPaths |= PathSet{1} << i;
+        }
+    }
+    ReportSent(streamedPaths, count);
+
+    // The requests are renewed on the paths ready, a path which becomes ready joins the stream
+    const auto now = SnapTimestampInNanoSec();
+    if (now >= m_nextStreamRequest)
+    {
+        m_nextStreamRequest = now + c_streamRequestInterval;
+        SendStreamRequests(m_finalSequenceNumber < (std::numeric_limits<long long>::max)() ? m_finalSequenceNumber : 0);
+    }
+}
+
+void StreamClient::SendStreamRequests(long long endSequenceNumber) noexcept
+{
+    auto request = m_streamRequest;
+    request.m_endSequenceNumber = endSequenceNumber;
+    const auto paths = ReadyPaths();
+    for (size_t i = 0; i < m_paths.size(); ++i)
     {
-        stat.m_secondarySendTimestamp = sendState.m_sendTimestamp;
+        if (ContainsPath(paths, i))
+        {
+            m_paths[i]->SendStreamRequest(request);
+        }
     }
 }
 
-void StreamClient::ReceiveCompletion(const Interface interface, const MeasuredSocket::ReceiveResult& result) noexcept
+void StreamClient::SendCompletion(size_t path, const MeasuredSocket::SendResult& sendState) noexcept
+{
+    m_latencyStore->Update(sendState.m_sequenceNumber, [&](LatencyStore::Entry& entry) {
+        // The send timestamp is known either from the send completion or from the echoed datagram, whichever comes first
+        entry.SetFirst(path, TimestampKind::Send, sendState.m_sendTimestamp);
+        if (sendState.m_kernelSendTimestamp >= 0)
+        {
+            entry.Set(path, TimestampKind::KernelSend, sendState.m_kernelSendTimestamp);
+        }
+    });
+}
+
+void StreamClient::ReceiveCompletion(size_t path, const MeasuredSocket::ReceiveResult& result) noexcept
 {
-    if (result.m_sequenceNumber < 0 || result.m_sequenceNumber >= m_finalSequenceNumber)
+    Arrival arrival;
+    arrival.m_sequenceNumber = result.m_sequenceNumber;
+    arrival.m_sendTimestamp = result.m_sendTimestamp;
+    arrival.m_reflectorReceiveTimestamp =
+        result.m_reflectorReceiveTimestamp >= 0 ? result.m_reflectorReceiveTimestamp : result.m_echoTimestamp;
+    arrival.m_echoTimestamp = result.m_echoTimestamp;
+    arrival.m_receiveTimestamp = result.m_receiveTimestamp;
+
+    if (result.m_streamRequest)
+    {
+        // The stream only goes one way: the round trips of its requests give the offset of the server clock
+        arrival.m_streamRequest = true;
+        QueueArrival(path, result.m_receiver, arrival);
+        return;
+    }
+
+    if (m_downlink)
+    {
+        // Set before the datagram can be finalized
+        auto first = m_downlinkFirst[path].load();
+        while (result.m_sequenceNumber < first && !m_downlinkFirst[path].compare_exchange_weak(first, result.m_sequenceNumber))
+        {
+        }
+    }
+
+    bool duplicate = false;
+    const auto updateResult = m_latencyStore->Update(result.m_sequenceNumber, [&](LatencyStore::Entry& entry) {
+        // Only the first copy of a duplicated datagram is accounted, the latency is added when it is finalized
+        if (!entry.SetFirst(path, TimestampKind::Receive, result.m_receiveTimestamp))
+        {
+            m_receiveCounters[path].m_duplicateDatagrams += 1;
+            duplicate = true;
+            return;
+        }
+        arrival.m_first = true;
+
+        if (m_downlink)
+        {
+            // The send timestamp of the server is kept in its clock, it is converted once the datagram is finalized
+            entry.Set(path, TimestampKind::Echo, result.m_sendTimestamp);
+            entry.Set(path, TimestampKind::KernelReceive, result.m_kernelReceiveTimestamp);
+            return;
+        }
+
+        m_scheduler->OnReceived(path, result.m_sequenceNumber, result.m_receiveTimestamp - result.m_sendTimestamp);
+        entry.SetFirst(path, TimestampKind::Send, result.m_sendTimestamp);
+        entry.Set(path, TimestampKind::Echo, result.m_echoTimestamp);
+        entry.Set(path, TimestampKind::KernelReceive, result.m_kernelReceiveTimestamp);
+        entry.Set(path, TimestampKind::ReflectorReceive, result.m_reflectorReceiveTimestamp);
+    });
+
+    if (updateResult == LatencyStore::UpdateResult::NotSent)
     {
         Log<LogLevel::Debug>("Received a corrupt datagrams, sequence number: %lld\n", result.m_sequenceNumber);
-        if (interface == Interface::Primary)
+        m_receiveCounters[path].m_corruptDatagrams += 1;
+    }
+    else if (updateResult == LatencyStore::UpdateResult::AlreadyFinalized)
+    {
+        // The datagram was already counted as lost
+        Log<LogLevel::Debug>("Received a datagram after the loss timeout, sequence number: %lld\n", result.m_sequenceNumber);
+        m_receiveCounters[path].m_lateDatagrams += 1;
+    }
+
+    // The datagrams received after their loss timeout are reordered too, but their duplicates cannot be detected
+    arrival.m_ordered = !duplicate && updateResult != LatencyStore::UpdateResult::NotSent;
+    if (arrival.m_first || arrival.m_ordered)
+    {
+        QueueArrival(path, result.m_receiver, arrival);
+    }
+}
+
+void StreamClient::QueueArrival(size_t path, size_t receiver, const Arrival& arrival) noexcept
+{
+    const auto& arrivals = m_arrivals[path];
+    if (receiver >= arrivals.size() || !arrivals[receiver]->TryPush(arrival))
+    {
+        m_receiveCounters[path].m_untrackedArrivals += 1;
+    }
+}
+
+void StreamClient::DrainArrivals() noexcept
+{
+    for (size_t path = 0; path < m_arrivals.size(); ++path)
+    {
+        // The receives of a path complete concurrently, their arrivals are merged in the order they were received
+        m_drainedArrivals.clear();
+        for (const auto& arrivals : m_arrivals[path])
         {
-            m_latencyData.m_primaryCorruptDatagrams += 1;
+            arrivals->Drain([this](const Arrival& arrival) { m_drainedArrivals.push_back(arrival); });
         }
-        else
+        std::ranges::stable_sort(m_drainedArrivals, {}, &Arrival::m_receiveTimestamp);
+
+        for (const auto& arrival : m_drainedArrivals)
         {
-            m_latencyData.m_secondaryCorruptDatagrams += 1;
+            RecordArrival(path, arrival);
         }
+    }
+}
+
+void StreamClient::RecordArrival(size_t path, const Arrival& arrival) noexcept
+{
+    if (arrival.m_ordered)
+    {
+        m_reordering[path]->Add(arrival.m_sequenceNumber);
+    }
+    if (!arrival.m_streamRequest && !arrival.m_first)
+    {
         return;
     }
 
-    auto& stat = m_latencyData.m_latencies[static_cast<size_t>(result.m_sequenceNumber)];
-    if (interface == Interface::Primary)
+    // In downlink mode, only the stream requests are round trips
+    if (arrival.m_streamRequest || !m_downlink)
     {
-        stat.m_primarySendTimestamp = result.m_sendTimestamp;
-        stat.m_primaryEchoTimestamp = result.m_echoTimestamp;
-        stat.m_primaryReceiveTimestamp = result.m_receiveTimestamp;
+        m_clockEstimator.AddSample(
+            arrival.m_sendTimestamp, arrival.m_reflectorReceiveTimestamp, arrival.m_echoTimestamp, arrival.m_receiveTimestamp);
     }
-    else
+    if (arrival.m_streamRequest || !m_intervalReporter)
     {
-        stat.m_secondarySendTimestamp = result.m_sendTimestamp;
-        stat.m_secondaryEchoTimestamp = result.m_echoTimestamp;
-        stat.m_secondaryReceiveTimestamp = result.m_receiveTimestamp;
+        return;
+    }
+
+    // The datagrams streamed are sent at the same time on all the paths, their latency is known once the server clock is
+    if (m_downlink && !m_downlinkClock)
+    {
+        return;
+    }
+    const auto send = m_downlink ? m_downlinkClock->ToClientTime(arrival.m_sendTimestamp) : arrival.m_sendTimestamp;
+    m_intervalReporter->AddReceived(path, arrival.m_receiveTimestamp - send);
+
+    // The first copy received on the paths of a combination gives its effective latency, measured from the first send on
+    // any of its paths. A datagram already finalized is missing from the interval report, not from the final statistics.
+    m_latencyStore->Update(arrival.m_sequenceNumber, [&](LatencyStore::Entry& entry) {
+        for (size_t i = 0; i < m_latencyData.m_combinations.size(); ++i)
+        {
+            const auto paths = m_latencyData.m_combinations[i].m_paths;
+            if (!ContainsPath(paths, path) || entry.First(paths, TimestampKind::Receive) != arrival.m_receiveTimestamp ||
+                entry.First(paths & ((PathSet{1} << path) - 1), TimestampKind::Receive) == arrival.m_receiveTimestamp)
+            {
+                continue;
+            }
+            const auto combinedSend = m_downlink ? send : entry.First(paths, TimestampKind::Send);
+            m_intervalReporter->AddCombinedReceived(i, arrival.m_receiveTimestamp - combinedSend, path);
+        }
+    });
+}
+
+void StreamClient::ReportSent(PathSet paths, long long count) noexcept
+{
+    if (!m_intervalReporter)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        if (ContainsPath(paths, i))
+        {
+            m_intervalReporter->AddSent(i, count);
+        }
+    }
+    for (size_t i = 0; i < m_latencyData.m_combinations.size(); ++i)
+    {
+        if ((m_latencyData.m_combinations[i].m_paths & paths) != 0)
+        {
+            m_intervalReporter->AddCombinedSent(i, count);
+        }
+    }
+}
+
+void StreamClient::UpdateClockModel() noexcept
+{
+    if (m_downlink)
+    {
+        m_downlinkClock = m_clockEstimator.Estimate();
+        return;
+    }
+    m_latencyData.m_clock = m_clockEstimator.Estimate();
+}
+
+bool StreamClient::ConvertDownlinkMeasure(
+    long long sequenceNumber, const LatencyMeasure& measure, LatencyMeasure& converted) noexcept
+{
+    converted = measure;
+
+    // The send timestamp replaces the one of the server, no one-way delay is estimated from the converted measures
+    long long send = -1;
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        auto& timestamps = converted.m_paths[i];
+        if (timestamps.m_receive < 0)
+        {
+            continue;
+        }
+        if (!m_downlinkClock)
+        {
+            m_unclockedDatagrams += 1;
+            return false;
+        }
+        timestamps.m_send = m_downlinkClock->ToClientTime(timestamps.m_echo);
+        timestamps.m_echo = -1;
+        send = send < 0 ? timestamps.m_send : (std::min)(send, timestamps.m_send);
+    }
+
+    // A datagram lost on all the paths was sent on the schedule of the previous ones
+    if (send >= 0)
+    {
+        m_lastDownlinkSequenceNumber = sequenceNumber;
+        m_lastDownlinkSend = send;
+    }
+    else if (m_lastDownlinkSend >= 0)
+    {
+        const auto ticks = sequenceNumber / m_grouping - m_lastDownlinkSequenceNumber / m_grouping;
+        send = m_lastDownlinkSend + std::llround(static_cast<double>(ticks) * m_downlinkTickInterval);
+    }
+
+    // The datagrams lost on a path count as sent once the path is streamed
+    for (size_t i = 0; i < m_paths.size(); ++i)
+    {
+        auto& timestamps = converted.m_paths[i];
+        if (timestamps.m_receive < 0 && sequenceNumber >= m_downlinkFirst[i].load())
+        {
+            timestamps.m_send = send;
+        }
+    }
+    return true;
+}
+
+void StreamClient::FinalizeDatagram(long long sequenceNumber, const LatencyMeasure& storedMeasure) noexcept
+{
+    // The datagrams are finalized after their loss timeout: the model is fitted on the datagrams received
+    // until then, which surround them
+    if (sequenceNumber % c_clockUpdateInterval == 0 || !(m_downlink ? m_downlinkClock : m_latencyData.m_clock))
+    {
+        UpdateClockModel();
+    }
+
+    LatencyMeasure downlinkMeasure;
+    if (m_downlink && !ConvertDownlinkMeasure(sequenceNumber, storedMeasure, downlinkMeasure))
+    {
+        return;
+    }
+    const auto& measure = m_downlink ? downlinkMeasure : storedMeasure;
+    m_latencyData.Add(measure);
+
+    if (m_intervalReporter)
+    {
+        for (size_t i = 0; i < m_paths.size(); ++i)
+        {
+            if (measure.m_paths[i].m_send >= 0 && measure.m_paths[i].m_receive < 0)
+            {
+                m_intervalReporter->AddLost(i);
+            }
+        }
+        for (size_t i = 0; i < m_latencyData.m_combinations.size(); ++i)
+        {
+            const auto paths = m_latencyData.m_combinations[i].m_paths;
+            if (measure.FirstSend(paths) >= 0 && measure.FirstReceive(paths) < 0)
+            {
+                m_intervalReporter->AddCombinedLost(i);
+            }
+        }
+    }
+
+    if (m_spillWriter)
+    {
+        try
+        {
+            m_spillWriter->Add(sequenceNumber, measure);
+        }
+        catch (...)
+        {
+            // Keep measuring, only the raw data is lost
+            Log<LogLevel::Error>("Failed to write the raw measures to the spill file, they will not be saved\n");
+            m_spillWriter.reset();
+        }
     }
 }
 
-} // namespace multipath
\ No newline at end of file
+} // namespace multipath
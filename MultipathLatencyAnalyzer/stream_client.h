@@ -9,13 +9,27 @@
 
 #include <wil/resource.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <filesystem>
 #include <fstream>
 #include <memory>
+#include <optional>
 #include <vector>
 
+#include "clock_estimator.h"
+#include "config.h"
+#include "interval_reporter.h"
 #include "latencyStatistics.h"
+#include "latency_dump.h"
+#include "latency_spill.h"
+#include "latency_store.h"
 #include "measuredSocket.h"
+#include "path_scheduler.h"
+#include "precision_pacer.h"
+#include "reordering_tracker.h"
+#include "spsc_queue.h"
 #include "threadpool_timer.h"
 
 using namespace winrt;
@@ -30,11 +44,13 @@ public:
 
     void RequestSecondaryWlanConnection();
 
-    void Start(unsigned long bitRate, unsigned long grouping, unsigned long duration);
+    void Start(const Configuration& config);
+    // Runs once, from the sender when the last datagram is sent or from the caller: a second caller waits for the first
+    // one to complete the run
     void Stop() noexcept;
 
     void PrintStatistics();
-    void DumpLatencyData(std::ofstream& file);
+    void DumpLatencyData(const std::filesystem::path& path, LatencyDumpFormat format);
 
     // Not copyable or movable
     StreamClient(const StreamClient&) = delete;
@@ -45,11 +61,17 @@ public:
     ~StreamClient() = default;
 
 private:
-    enum class Interface
-    {
-        Primary,
-        Secondary
-    };
+    // Path 0 is the primary interface and path 1 the secondary wlan interface, the additional paths follow
+    static constexpr size_t c_primaryPath = 0;
+    static constexpr size_t c_secondaryPath = 1;
+    // The number of datagrams finalized between two updates of the clock model
+    static constexpr long long c_clockUpdateInterval = 1024;
+    // In downlink mode, the time the datagrams are expected ahead of the schedule of the client, which the server
+    // follows from its first request, and the interval at which the stream requests are renewed
+    static constexpr unsigned long c_downlinkLead = 100; // 100 ms
+    static constexpr long long c_streamRequestInterval = 100'000'000; // 100 ms
+    // The arrivals each receive of a path can queue to the timer between two ticks
+    static constexpr size_t c_arrivalQueueCapacity = 4096;
 
     NetworkInformation::NetworkStatusChanged_revoker m_networkInformationEventRevoker{};
     // The client must keep this handle open to keep the secondary STA port active
@@ -59,27 +81,157 @@ private:
 
     void TimerCallback() noexcept;
 
+    // The paths whose socket can send
+    PathSet ReadyPaths() const noexcept;
+    // Whether the echoes carry the time the server received the datagrams
+    bool HasReflectorTimestamps() const noexcept
+    {
+        return m_protocol == DatagramProtocol::Stamp || m_headerEcho;
+    }
     void SendDatagrams() noexcept;
-    void SendCompletion(const Interface interface, const MeasuredSocket::SendResult& sendState) noexcept;
-    void ReceiveCompletion(const Interface interface, const MeasuredSocket::ReceiveResult& result) noexcept;
+    void SendDatagramBatch(long long count) noexcept;
+    void SendCompletion(size_t path, const MeasuredSocket::SendResult& sendState) noexcept;
+    void ReceiveCompletion(size_t path, const MeasuredSocket::ReceiveResult& result) noexcept;
+    // Counts the datagrams sent on the paths scheduled, and on the combinations including any of them
+    void ReportSent(PathSet paths, long long count) noexcept;
+    void FinalizeDatagram(long long sequenceNumber, const LatencyMeasure& measure) noexcept;
+    // Stops the sender, drains the sockets and finalizes the datagrams, called once
+    void Shutdown() noexcept;
+    void UpdateClockModel() noexcept;
+
+    // In downlink mode, the timer extends the window of the datagrams expected instead of sending them
+    void ExpectDatagrams(long long count) noexcept;
+    // The end of the window of the datagrams expected, the sequence number the stream requests end at when stopping
+    [[nodiscard]] long long ExpectedEnd() const noexcept
+    {
+        return (std::min)(m_sequenceNumber + m_downlinkLead, m_finalSequenceNumber);
+    }
+    // With an end sequence number of 0, the server streams until the requests stop
+    void SendStreamRequests(long long endSequenceNumber) noexcept;
+    // Converts the server send timestamps of a finalized datagram to the client clock, the latency of each path is
+    // then its one-way delay. Returns false if the datagram was received before the server clock was estimated.
+    bool ConvertDownlinkMeasure(long long sequenceNumber, const LatencyMeasure& measure, LatencyMeasure& converted) noexcept;
 
     ctl::ctSockaddr m_targetAddress{};
 
-    MeasuredSocket m_primaryState{};
-    MeasuredSocket m_secondaryState{};
+    // A datagram received, queued by its receive to the timer, which updates the state kept per path: the clock
+    // samples, the reordering and the interval statistics have a single writer, the receive path takes no lock
+    struct Arrival
+    {
+        long long m_sequenceNumber = 0;
+        // In downlink mode, the send timestamp is the one of the server
+        long long m_sendTimestamp = -1;
+        long long m_reflectorReceiveTimestamp = -1;
+        long long m_echoTimestamp = -1;
+        long long m_receiveTimestamp = -1;
+        // The echo of a stream request, only a clock sample
+        bool m_streamRequest = false;
+        // The first copy of a datagram sent: a clock sample, and a datagram received in the interval statistics
+        bool m_first = false;
+        // A datagram sent, not a duplicate: added to the reordering of its path
+        bool m_ordered = false;
+    };
+
+    // Queues an arrival to the timer from a receive of a path, counts it as untracked if the queue is full
+    void QueueArrival(size_t path, size_t receiver, const Arrival& arrival) noexcept;
+    // Called by the timer: takes the arrivals queued on each path, in the order they were received
+    void DrainArrivals() noexcept;
+    void RecordArrival(size_t path, const Arrival& arrival) noexcept;
+
+    // The socket of each path, created when the client starts
+    std::vector<std::unique_ptr<MeasuredSocket>> m_paths{};
+    // The arrivals of each receive of each path, from the receive to the timer
+    std::vector<std::vector<std::unique_ptr<SpscQueue<Arrival>>>> m_arrivals{};
+    // The arrivals of a path taken by the timer, sorted by receive time, only used by the timer
+    std::vector<Arrival> m_drainedArrivals{};
+    // The order in which the datagrams of each path are received, only updated by the timer
+    std::vector<std::unique_ptr<ReorderingTracker>> m_reordering{};
+
+    // The counters of the receive completions, copied to m_latencyData once the sockets are closed
+    struct ReceiveCounters
+    {
+        std::atomic<long long> m_duplicateDatagrams{0};
+        std::atomic<long long> m_lateDatagrams{0};
+        std::atomic<long long> m_corruptDatagrams{0};
+        // The arrivals dropped as the timer did not take them in time, missing from the clock samples, the reordering
+        // and the interval statistics
+        std::atomic<long long> m_untrackedArrivals{0};
+    };
+    std::array<ReceiveCounters, c_maxPathCount> m_receiveCounters{};
+    // Chooses the paths each datagram is sent on
+    SchedulingPolicy m_schedulingPolicy = SchedulingPolicy::DuplicateAll;
+    std::unique_ptr<PathScheduler> m_scheduler{};
 
     // The number of datagrams to send on each timer callback
     long long m_grouping = 0;
+    // The datagrams sent by each tick of the sender: with the precise pacing, each datagram of a group has its own
+    // deadline, unless the group is sent with a single send call
+    long long m_datagramsPerTick = 0;
+    // Whether the datagrams of a timer callback are sent with a single send call
+    bool m_batchSend = false;
     unsigned long m_receiveBufferCount = 1;
+    // The number of I/O requests preallocated for each socket
+    size_t m_ioPoolCapacity = ctl::ctThreadIocp::c_default_pool_capacity;
+
+    // Whether the ticks are paced by the precision pacer instead of the threadpool timer
+    bool m_precisePacing = false;
+    // What the threadpool timer does with the ticks it missed
+    TimerCatchUpSettings m_catchUp{};
+    // Whether the kernel timestamps of the sends and receives are recorded
+    bool m_timestamping = false;
+    // With STAMP or header echoes, the receive timestamps of the reflector are recorded along its send timestamps
+    DatagramProtocol m_protocol = DatagramProtocol::Native;
+    bool m_headerEcho = false;
+
+    // In downlink mode, the server streams the datagrams of the client: the timer only renews the stream requests
+    bool m_downlink = false;
+    StreamRequest m_streamRequest{};
+    long long m_downlinkLead = 0;
+    double m_downlinkTickInterval = 0.; // Nanosec, the interval between two groups streamed
+    long long m_nextStreamRequest = 0;
+    // The first sequence number received on each path: the server streams a path from the next group of the flow
+    // when its first request arrives, the datagrams before were not sent on it
+    std::array<std::atomic<long long>, c_maxPathCount> m_downlinkFirst{};
+    // The send time of the last datagram finalized with a receive, to estimate the one of the datagrams lost on all paths
+    long long m_lastDownlinkSequenceNumber = -1;
+    long long m_lastDownlinkSend = -1;
+    // The datagrams finalized before the server clock was estimated, they are not accounted
+    long long m_unclockedDatagrams = 0;
 
     std::unique_ptr<ThreadpoolTimer> m_threadpoolTimer{};
+    std::unique_ptr<PrecisionPacer> m_precisionPacer{};
 
     // Initialize to -1 as the first datagram has sequence number 0
     long long m_finalSequenceNumber = -1;
     long long m_sequenceNumber = 0;
 
+    // Aggregates of the finalized datagrams
     LatencyData m_latencyData;
+    // Estimates the server clock from the received datagrams, to split their latency in one-way delays.
+    // The model used by m_latencyData is updated regularly as the datagrams are finalized.
+    // In downlink mode, it is estimated from the echoes of the stream requests, and converts the send timestamps of
+    // the server instead: m_latencyData has no model, its latencies are already one-way.
+    // The samples are added from the arrivals and the model is fitted as the datagrams are finalized, both by the timer.
+    ClockEstimator m_clockEstimator;
+    std::optional<ClockModel> m_downlinkClock{};
+    // The datagrams which can still be received, the others are finalized
+    std::unique_ptr<LatencyStore> m_latencyStore{};
+    // The raw measures of the finalized datagrams, when they must be written to a file
+    std::filesystem::path m_spillFile{};
+    std::unique_ptr<LatencySpillWriter> m_spillWriter{};
+    // The configuration of the run, saved with the raw measures
+    LatencyDumpHeader m_dumpHeader{};
+
+    // Prints the statistics periodically during the run, when requested
+    std::unique_ptr<IntervalReporter> m_intervalReporter{};
+
+    // Process CPU time, for measuring the cost of the send path
+    long long m_startCpuTime = 0;
+    long long m_stopCpuTime = 0;
 
     HANDLE m_completeEvent = nullptr;
+    std::atomic<bool> m_stopping{false};
+    // Identifies the datagrams of this client, as a server can echo other clients over the same paths
+    const uint32_t m_flowId = 0;
 };
 } // namespace multipath
\ No newline at end of file
@@ -2,14 +2,56 @@
 // Licensed under the MIT License.
 
 #include "stream_server.h"
-#include "datagram.h"
 #include "logs.h"
-#include "socket_utils.h"
 #include "time_utils.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
 namespace multipath {
-StreamServer::StreamServer(ctl::ctSockaddr listenAddress) :
-    m_listenAddress{std::move(listenAddress)}, m_socket{CreateDatagramSocket()}
+#ifdef _WIN32
+namespace {
+    // Pins the calling thread to the processor of the given index, across all processor groups
+    void PinCurrentThread(unsigned long index) noexcept
+    {
+        const auto processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        if (processorCount == 0)
+        {
+            return;
+        }
+
+        auto processor = index % processorCount;
+        const auto groupCount = GetActiveProcessorGroupCount();
+        for (WORD group = 0; group < groupCount; ++group)
+        {
+            const auto groupProcessorCount = GetActiveProcessorCount(group);
+            if (processor < groupProcessorCount)
+            {
+                GROUP_AFFINITY affinity{};
+                affinity.Group = group;
+                affinity.Mask = static_cast<KAFFINITY>(1) << processor;
+                LOG_IF_WIN32_BOOL_FALSE(SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr));
+                return;
+            }
+            processor -= groupProcessorCount;
+        }
+    }
+} // namespace
+
+StreamServer::StreamServer(
+    ctl::ctSockaddr listenAddress,
+    unsigned long threadCount,
+    unsigned long echoBatchSize,
+    DatagramProtocol protocol,
+    bool downlinkStreams) :
+    m_listenAddress{std::move(listenAddress)},
+    m_socket{CreateDatagramSocket(m_listenAddress.family())},
+    m_echoBatchSize{(std::max)(echoBatchSize, 1ul)},
+    m_protocol{protocol}
 {
     constexpr int defaultSocketReceiveBufferSize = 1048576; // 1MB socket receive buffer
     SetSocketReceiveBufferSize(m_socket.get(), defaultSocketReceiveBufferSize);
@@ -20,31 +62,240 @@ StreamServer::StreamServer(ctl::ctSockaddr listenAddress) :
         THROW_WIN32_MSG(WSAGetLastError(), "Failed to bind the socket");
     }
 
-    m_threadpoolIo = std::make_unique<ctl::ctThreadIocp>(m_socket.get());
+    if (downlinkStreams)
+    {
+        m_streamer = std::make_unique<DownlinkStreamer>(m_socket.get());
+    }
+
+    if (m_echoBatchSize > 1)
+    {
+        threadCount = (std::max)(threadCount, 1ul);
+        m_echoOffloadEnabled = IsUdpSendOffloadSupported(m_socket.get());
+        if (!m_echoOffloadEnabled)
+        {
+            Log<LogLevel::Info>("UDP send offload is not supported, the datagrams of a batch are echoed separately\n");
+        }
+    }
+
+    if (threadCount == 0)
+    {
+        m_socketIo = std::make_unique<SocketIo>(m_socket.get());
+        return;
+    }
+
+    // Windows has no equivalent to SO_REUSEPORT to spread the datagrams of one port across several sockets:
+    // the shards share the socket, and its completions are distributed between them by a completion port of the
+    // server. The receive queue of the socket is the limit of the server, whatever the number of shards.
+    m_completionPort.reset(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, threadCount));
+    THROW_LAST_ERROR_IF_NULL_MSG(m_completionPort.get(), "CreateIoCompletionPort failed");
+    THROW_LAST_ERROR_IF_NULL_MSG(
+        CreateIoCompletionPort(reinterpret_cast<HANDLE>(m_socket.get()), m_completionPort.get(), 0, 0),
+        "Failed to associate the socket with the completion port");
+
+    for (unsigned long i = 0; i < threadCount; ++i)
+    {
+        auto& shard = *m_shards.emplace_back(std::make_unique<Shard>());
+        shard.m_index = i;
+    }
+}
+#else
+StreamServer::StreamServer(
+    SocketAddress listenAddress,
+    unsigned long threadCount,
+    unsigned long echoBatchSize,
+    DatagramProtocol protocol,
+    bool downlinkStreams) :
+    m_listenAddress{std::move(listenAddress)},
+    m_socket{CreateDatagramSocket(m_listenAddress.family())},
+    m_echoBatchSize{(std::max)(echoBatchSize, 1ul)},
+    m_protocol{protocol}
+{
+    if (threadCount > 0 || m_echoBatchSize > 1 || downlinkStreams)
+    {
+        throw std::invalid_argument("the echo threads, echo batching and downlink streams are only supported on Windows");
+    }
+
+    constexpr int defaultSocketReceiveBufferSize = 1048576; // 1MB socket receive buffer
+    SetSocketReceiveBufferSize(m_socket.get(), defaultSocketReceiveBufferSize);
+
+    if (bind(m_socket.get(), m_listenAddress.sockaddr(), static_cast<socklen_t>(m_listenAddress.length())) != 0)
+    {
+        ThrowLastError("Failed to bind the socket");
+    }
+
+    m_socketIo = std::make_unique<SocketIo>(m_socket.get());
+}
+#endif
+
+StreamServer::~StreamServer() noexcept
+{
+    Stop();
 }
 
 void StreamServer::Start(unsigned long receiveBufferCount)
 {
-    // allocate our receive contexts
-    m_receiveContexts.resize(receiveBufferCount);
+    m_startTime = SnapQpcInMicroSec();
 
-    // post a receive for each buffer
-    for (auto& receiveContext : m_receiveContexts)
+#ifdef _WIN32
+    if (m_streamer)
     {
-        InitiateReceive(receiveContext);
+        m_streamer->Start();
+    }
+#endif
+
+    if (m_socketIo)
+    {
+        // allocate our receive contexts
+        m_receiveContexts.resize(receiveBufferCount);
+
+        // post a receive for each buffer
+        for (auto& receiveContext : m_receiveContexts)
+        {
+            InitiateReceive(receiveContext);
+        }
+        return;
     }
+
+#ifdef _WIN32
+    // Each shard keeps its own receives in flight, posted from its own thread, at least enough to fill a batch
+    const auto completionBatchSize = m_echoBatchSize > 1 ? m_echoBatchSize : c_completionBatchSize;
+    for (auto& shard : m_shards)
+    {
+        shard->m_receiveContexts.resize((std::max)(receiveBufferCount, m_echoBatchSize));
+        shard->m_completions.resize(completionBatchSize);
+        if (m_echoBatchSize > 1)
+        {
+            shard->m_echoBatch.reserve(m_echoBatchSize);
+            shard->m_echoBuffer.resize(c_maxEchoBatchBytes);
+        }
+        shard->m_thread = std::thread([this, &shard = *shard] { RunShard(shard); });
+    }
+#endif
+}
+
+void StreamServer::Stop() noexcept
+{
+    if (m_stopping.exchange(true))
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    // Stopped first, the streams do not outlive the requests
+    if (m_streamer)
+    {
+        m_streamer->Stop();
+    }
+
+    // The receives are not reposted once stopping: cancel the pending ones until they have all completed.
+    // Cancel repeatedly, as a receive may be reposted by a completion which started before stopping.
+    while (m_pendingReceives.load() > 0)
+    {
+        CancelIoEx(reinterpret_cast<HANDLE>(m_socket.get()), nullptr);
+        Sleep(1);
+    }
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        // A null overlapped tells a shard to exit
+        LOG_IF_WIN32_BOOL_FALSE(PostQueuedCompletionStatus(m_completionPort.get(), 0, 0, nullptr));
+    }
+    for (auto& shard : m_shards)
+    {
+        if (shard->m_thread.joinable())
+        {
+            shard->m_thread.join();
+        }
+    }
+#else
+    // The pending receives complete with ECANCELED, and are not reposted once stopping
+    m_socketIo->stop();
+#endif
+}
+
+void StreamServer::PrintStatistics() const
+{
+    if (m_invalidDatagrams > 0 || m_legacyDatagrams > 0 || m_corruptPayloads > 0 || m_stampPackets > 0 || m_headerEchoes > 0 ||
+        m_refusedStreamRequests > 0)
+    {
+        std::cout << '\n';
+        std::cout << "Invalid datagrams dropped: " << m_invalidDatagrams << '\n';
+        std::cout << "Datagrams echoed in the format of the previous versions: " << m_legacyDatagrams << '\n';
+        std::cout << "Datagrams received with a corrupt payload: " << m_corruptPayloads << '\n';
+        std::cout << "STAMP test packets reflected: " << m_stampPackets << '\n';
+        std::cout << "Datagrams echoed as their header only: " << m_headerEchoes << '\n';
+        std::cout << "Stream requests refused: " << m_refusedStreamRequests << '\n';
+    }
+
+#ifdef _WIN32
+    if (m_streamer)
+    {
+        m_streamer->PrintStatistics();
+    }
+
+    if (m_shards.empty())
+    {
+        return;
+    }
+
+    const auto duration = static_cast<double>(SnapQpcInMicroSec() - m_startTime) / 1'000'000.;
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << '\n';
+    std::cout << "-----------------------------------------------------------------------\n";
+    std::cout << "                            SHARDS                                     \n";
+    std::cout << "-----------------------------------------------------------------------\n";
+
+    for (const auto& shard : m_shards)
+    {
+        std::cout << '\n';
+        std::cout << "Shard " << shard->m_index << ": " << shard->m_echoedDatagrams << " datagrams echoed ("
+                  << (duration > 0 ? shard->m_echoedDatagrams / duration : 0.) << " datagrams/s, "
+                  << (duration > 0 ? shard->m_echoedBytes * 8 / duration / 1'000. : 0.) << " kb/s)\n";
+        std::cout << "Failed receives: " << shard->m_failedReceives << '\n';
+        std::cout << "Echo send calls: " << shard->m_sendCalls << " ("
+                  << (shard->m_sendCalls > 0 ? static_cast<double>(shard->m_echoedDatagrams) / shard->m_sendCalls : 0.)
+                  << " datagrams per call)\n";
+        std::cout << "Completions dequeued per call: "
+                  << (shard->m_dequeueCalls > 0
+                          ? static_cast<double>(shard->m_echoedDatagrams + shard->m_failedReceives) / shard->m_dequeueCalls
+                          : 0.)
+                  << " on average, " << shard->m_maxBatchSize << " at most\n";
+        std::cout << "Queueing delay in the dequeued batches: " << shard->m_queueingDelay.Mean() << " us on average, "
+                  << shard->m_queueingDelay.Max() << " us at most\n";
+        shard->m_queueingDelay.Print(std::cout);
+    }
+#endif
 }
 
 void StreamServer::InitiateReceive(ReceiveContext& receiveContext)
 {
+    // Counted as pending before checking whether stopping: Stop either waits for this receive or prevents it
+    m_pendingReceives += 1;
+    if (m_stopping)
+    {
+        m_pendingReceives -= 1;
+        return;
+    }
+
     receiveContext.m_remoteAddressLen = receiveContext.m_remoteAddress.length();
 
+#ifdef _WIN32
     WSABUF wsabuf;
     wsabuf.buf = receiveContext.m_buffer.data();
     wsabuf.len = static_cast<ULONG>(receiveContext.m_buffer.size());
 
-    OVERLAPPED* ov = m_threadpoolIo->new_request(
-        [this, &receiveContext](OVERLAPPED* ov) noexcept { CompleteReceive(receiveContext, ov); });
+    OVERLAPPED* ov = nullptr;
+    if (m_socketIo)
+    {
+        ov = m_socketIo->new_request(
+            [this, &receiveContext](OVERLAPPED* ov) noexcept { CompleteReceive(receiveContext, ov); });
+    }
+    else
+    {
+        receiveContext.m_overlapped = {};
+        ov = &receiveContext.m_overlapped;
+    }
 
     const auto error = WSARecvFrom(
         m_socket.get(),
@@ -62,45 +313,416 @@ void StreamServer::InitiateReceive(ReceiveContext& receiveContext)
         const auto lastError = WSAGetLastError();
         if (WSA_IO_PENDING != lastError)
         {
+            m_pendingReceives -= 1;
+
             // must cancel the threadpool IO request
-            m_threadpoolIo->cancel_request(ov);
+            if (m_socketIo)
+            {
+                m_socketIo->cancel_request(ov);
+            }
+            if (m_stopping)
+            {
+                return;
+            }
             FAIL_FAST_WIN32_MSG(lastError, "Failed to initiate a receive operation");
         }
     }
+#else
+    auto* request = m_socketIo->new_request(
+        [this, &receiveContext](SocketIoRequest* request) noexcept { CompleteReceive(receiveContext, request); });
+    receiveContext.m_receiveBuffer = {receiveContext.m_buffer.data(), receiveContext.m_buffer.size()};
+    request->message.msg_name = receiveContext.m_remoteAddress.sockaddr();
+    request->message.msg_namelen = static_cast<socklen_t>(receiveContext.m_remoteAddressLen);
+    request->message.msg_iov = &receiveContext.m_receiveBuffer;
+    request->message.msg_iovlen = 1;
+
+    if (const auto error = m_socketIo->start_receive(request); error != 0)
+    {
+        m_pendingReceives -= 1;
+
+        // must cancel the request which was not started
+        m_socketIo->cancel_request(request);
+        if (m_stopping || error == ECANCELED)
+        {
+            return;
+        }
+        Log<LogLevel::Error>("Failed to initiate a receive operation: %d\n", error);
+        std::abort();
+    }
+#endif
 }
 
-void StreamServer::CompleteReceive(ReceiveContext& receiveContext, OVERLAPPED* ov) noexcept
+void StreamServer::CompleteReceive(ReceiveContext& receiveContext, SocketIoRequest* request) noexcept
 {
+    if (const auto bytesReceived = GetReceiveResult(receiveContext, request); bytesReceived > 0)
+    {
+        EchoDatagram(receiveContext, bytesReceived);
+    }
+    m_pendingReceives -= 1;
+
+    // post another receive
+    if (!m_stopping)
+    {
+        InitiateReceive(receiveContext);
+    }
+}
+
+uint32_t StreamServer::GetReceiveResult(ReceiveContext& receiveContext, SocketIoRequest* request) noexcept
+{
+#ifdef _WIN32
     DWORD bytesReceived = 0;
-    if (WSAGetOverlappedResult(m_socket.get(), ov, &bytesReceived, false, &receiveContext.m_receiveFlags))
+    if (!WSAGetOverlappedResult(m_socket.get(), request, &bytesReceived, false, &receiveContext.m_receiveFlags))
+    {
+        const auto error = WSAGetLastError();
+        if (error != WSA_OPERATION_ABORTED || !m_stopping)
+        {
+            Log<LogLevel::Error>("The receive operation failed: %u\n", error);
+        }
+        return 0;
+    }
+    return bytesReceived;
+#else
+    if (request->result < 0)
+    {
+        if (request->result != -ECANCELED || !m_stopping)
+        {
+            Log<LogLevel::Error>("The receive operation failed: %lld\n", -request->result);
+        }
+        return 0;
+    }
+    receiveContext.m_remoteAddressLen = static_cast<int>(request->message.msg_namelen);
+    return static_cast<uint32_t>(request->result);
+#endif
+}
+
+bool StreamServer::AcceptDatagram(ReceiveContext& receiveContext, uint32_t bytesReceived) noexcept
+{
+    // Taken first, the receive timestamp reflected or reported does not include the classification of the datagram
+    const auto receiveTimestamp = SnapTimestampInNanoSec();
+
+    // The datagrams of each flow are echoed to their sender, the clients of the previous versions in their own format
+    DatagramHeader header;
+    receiveContext.m_format = ClassifyDatagram(receiveContext.m_buffer.data(), bytesReceived, header);
+    if (receiveContext.m_format != DatagramFormat::Current && m_protocol == DatagramProtocol::Stamp)
+    {
+        // STAMP has no magic: a sender packet may start like the header, with the sequence number 0x4D504C41
+        const auto reflected =
+            ReflectStampPacket(receiveContext.m_buffer.data(), bytesReceived, ConvertTimestampToNtp(receiveTimestamp));
+        receiveContext.m_format = reflected ? DatagramFormat::Stamp : DatagramFormat::Invalid;
+    }
+    receiveContext.m_echoLength = bytesReceived;
+    switch (receiveContext.m_format)
+    {
+    case DatagramFormat::Current:
+        Log<LogLevel::All>(
+            "Echoing sequence number %lld of flow %u, path %u\n", header.m_sequenceNumber, header.m_flowId, header.m_pathId);
+        if (!VerifyDatagramPayload(receiveContext.m_buffer.data(), header))
+        {
+            Log<LogLevel::Debug>(
+                "Received a corrupt payload, sequence number %lld of flow %u, path %u\n",
+                header.m_sequenceNumber,
+                header.m_flowId,
+                header.m_pathId);
+            m_corruptPayloads += 1;
+        }
+        if ((header.m_flags & c_datagramStreamRequestFlag) != 0)
+        {
+            if (!AcceptStreamRequest(receiveContext, header, bytesReceived, receiveTimestamp))
+            {
+                m_refusedStreamRequests += 1;
+                return false;
+            }
+            return true;
+        }
+        if ((header.m_flags & c_datagramHeaderEchoFlag) != 0)
+        {
+            receiveContext.m_echoLength = static_cast<uint32_t>(
+                TruncateDatagramEcho(receiveContext.m_buffer.data(), header, bytesReceived, receiveTimestamp));
+            receiveContext.m_format = DatagramFormat::HeaderEcho;
+            m_headerEchoes += 1;
+        }
+        return true;
+
+    case DatagramFormat::Legacy:
+        m_legacyDatagrams += 1;
+        return true;
+
+    case DatagramFormat::Stamp:
+        Log<LogLevel::All>("Reflecting a STAMP packet of %u bytes\n", bytesReceived);
+        m_stampPackets += 1;
+        return true;
+
+    case DatagramFormat::HeaderEcho: // only set once accepted
+    case DatagramFormat::Invalid:
+        break;
+    }
+
+    Log<LogLevel::Debug>("Dropping an invalid datagram of %u bytes\n", bytesReceived);
+    m_invalidDatagrams += 1;
+    return false;
+}
+
+#ifdef _WIN32
+bool StreamServer::AcceptStreamRequest(
+    ReceiveContext& receiveContext, const DatagramHeader& header, uint32_t bytesReceived, long long receiveTimestamp) noexcept
+{
+    // The cookie is returned in the header echo, a request without the flag could never start a stream
+    StreamRequest request;
+    if (!m_streamer || (header.m_flags & c_datagramHeaderEchoFlag) == 0 ||
+        !ParseStreamRequest(receiveContext.m_buffer.data(), header, request))
+    {
+        Log<LogLevel::Debug>("Dropping a stream request of flow %u, path %u\n", header.m_flowId, header.m_pathId);
+        return false;
+    }
+
+    const auto result = m_streamer->Request(receiveContext.m_remoteAddress, receiveContext.m_remoteAddressLen, header, request);
+    if (result == DownlinkStreamer::RequestResult::Refused)
+    {
+        return false;
+    }
+
+    // Accepted or not, the echo is smaller than the request: it cannot amplify a spoofed request
+    static_assert(c_streamRequestEchoLength <= c_streamRequestDatagramLength);
+    const auto cookie = m_streamer->Cookie(receiveContext.m_remoteAddress, header);
+    receiveContext.m_echoLength = static_cast<uint32_t>(
+        TruncateStreamRequestEcho(receiveContext.m_buffer.data(), header, bytesReceived, receiveTimestamp, cookie));
+    receiveContext.m_format = DatagramFormat::HeaderEcho;
+    m_headerEchoes += 1;
+    return true;
+}
+#else
+bool StreamServer::AcceptStreamRequest(ReceiveContext&, const DatagramHeader& header, uint32_t, long long) noexcept
+{
+    // The downlink streams are only supported on Windows
+    Log<LogLevel::Debug>("Dropping a stream request of flow %u, path %u\n", header.m_flowId, header.m_pathId);
+    return false;
+}
+#endif
+
+void StreamServer::StampEcho(ReceiveContext& receiveContext) noexcept
+{
+    if (receiveContext.m_format == DatagramFormat::Stamp)
+    {
+        SetStampReflectorTimestamp(receiveContext.m_buffer.data(), ConvertTimestampToNtp(SnapTimestampInNanoSec()));
+        return;
+    }
+    StampDatagramEcho(receiveContext.m_buffer.data(), receiveContext.m_format, SnapTimestampInNanoSec());
+}
+
+bool StreamServer::EchoDatagram(ReceiveContext& receiveContext, uint32_t bytesReceived) noexcept
+{
+    if (!AcceptDatagram(receiveContext, bytesReceived))
+    {
+        return false;
+    }
+
+    // Update the echo timestamp
+    StampEcho(receiveContext);
+
+    // echo the data received. A synchronous send is enough.
+#ifdef _WIN32
+    WSABUF wsabuf;
+    wsabuf.buf = receiveContext.m_buffer.data();
+    wsabuf.len = receiveContext.m_echoLength;
+
+    DWORD bytesTransferred = 0;
+    const auto error = WSASendTo(
+        m_socket.get(), &wsabuf, 1, &bytesTransferred, 0, receiveContext.m_remoteAddress.sockaddr(), receiveContext.m_remoteAddressLen, nullptr, nullptr);
+    if (SOCKET_ERROR == error)
     {
-        auto& header = *reinterpret_cast<DatagramHeader*>(receiveContext.m_buffer.data());
+        // best effort send
+        FAILED_WIN32_LOG(WSAGetLastError());
+    }
+#else
+    if (sendto(m_socket.get(), receiveContext.m_buffer.data(), receiveContext.m_echoLength, 0,
+            receiveContext.m_remoteAddress.sockaddr(), static_cast<socklen_t>(receiveContext.m_remoteAddressLen)) < 0)
+    {
+        // best effort send
+        Log<LogLevel::Debug>("Failed to echo a datagram: %d\n", errno);
+    }
+#endif
 
-        // Update the echo timestamp
+    return true;
+}
 
-        header.m_echoTimestamp = SnapQpcInMicroSec();
-        Log<LogLevel::All>("Echoing sequence number %lld\n", header.m_sequenceNumber);
+#ifdef _WIN32
+void StreamServer::EchoBatch(Shard& shard) noexcept
+{
+    auto& batch = shard.m_echoBatch;
+    for (size_t first = 0; first < batch.size();)
+    {
+        auto& [firstContext, size] = batch[first];
 
-        // echo the data received. A synchronous send is enough.
-        WSABUF wsabuf;
-        wsabuf.buf = receiveContext.m_buffer.data();
-        wsabuf.len = bytesReceived;
+        // Find the consecutive datagrams which can be sent together
+        size_t last = first + 1;
+        if (m_echoOffloadEnabled)
+        {
+            const auto maxCount = (std::max)(c_maxEchoBatchBytes / size, size_t{1});
+            while (last < batch.size() && last - first < maxCount && batch[last].second == size &&
+                   batch[last].first->m_remoteAddress == firstContext->m_remoteAddress)
+            {
+                ++last;
+            }
+        }
 
-        DWORD bytesTransferred = 0;
-        const auto error = WSASendTo(
-            m_socket.get(), &wsabuf, 1, &bytesTransferred, 0, receiveContext.m_remoteAddress.sockaddr(), receiveContext.m_remoteAddressLen, nullptr, nullptr);
-        if (SOCKET_ERROR == error)
+        if (last - first == 1)
+        {
+            StampEcho(*firstContext);
+            SendEcho(shard, *firstContext, firstContext->m_buffer.data(), size, 0);
+        }
+        else
         {
-            // best effort send
-            FAILED_WIN32_LOG(WSAGetLastError());
+            // Each datagram is stamped when it is copied in the send buffer
+            auto* buffer = shard.m_echoBuffer.data();
+            for (auto i = first; i < last; ++i)
+            {
+                auto& context = *batch[i].first;
+                StampEcho(context);
+                std::memcpy(buffer + (i - first) * size, batch[i].first->m_buffer.data(), size);
+            }
+            SendEcho(shard, *firstContext, buffer, static_cast<DWORD>((last - first) * size), size);
         }
+
+        shard.m_echoedDatagrams += static_cast<long long>(last - first);
+        shard.m_echoedBytes += static_cast<long long>((last - first) * size);
+        first = last;
     }
-    else
+}
+
+void StreamServer::SendEcho(Shard& shard, ReceiveContext& destination, char* buffer, DWORD size, DWORD segmentSize) noexcept
+{
+    WSABUF wsabuf;
+    wsabuf.buf = buffer;
+    wsabuf.len = size;
+
+    // The segment size is given per send, as the size of the datagrams differs between clients
+    alignas(WSACMSGHDR) char control[WSA_CMSG_SPACE(sizeof(DWORD))]{};
+    WSAMSG message{};
+    message.name = destination.m_remoteAddress.sockaddr();
+    message.namelen = destination.m_remoteAddressLen;
+    message.lpBuffers = &wsabuf;
+    message.dwBufferCount = 1;
+    if (segmentSize > 0)
     {
-        Log<LogLevel::Error>("The receive operation failed: %u\n", WSAGetLastError());
+        message.Control.buf = control;
+        message.Control.len = sizeof(control);
+        auto* controlHeader = WSA_CMSG_FIRSTHDR(&message);
+        controlHeader->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+        controlHeader->cmsg_level = IPPROTO_UDP;
+        controlHeader->cmsg_type = UDP_SEND_MSG_SIZE;
+        *reinterpret_cast<DWORD*>(WSA_CMSG_DATA(controlHeader)) = segmentSize;
     }
 
-    // post another receive
-    InitiateReceive(receiveContext);
+    shard.m_sendCalls += 1;
+    DWORD bytesTransferred = 0;
+    if (SOCKET_ERROR == WSASendMsg(m_socket.get(), &message, 0, &bytesTransferred, nullptr, nullptr))
+    {
+        // best effort send
+        FAILED_WIN32_LOG(WSAGetLastError());
+    }
+}
+
+void StreamServer::RunShard(Shard& shard) noexcept
+{
+    PinCurrentThread(shard.m_index);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    for (auto& receiveContext : shard.m_receiveContexts)
+    {
+        if (m_stopping)
+        {
+            break;
+        }
+        InitiateReceive(receiveContext);
+    }
+
+    auto& entries = shard.m_completions;
+    for (;;)
+    {
+        ULONG entryCount = 0;
+        if (!GetQueuedCompletionStatusEx(
+                m_completionPort.get(), entries.data(), static_cast<ULONG>(entries.size()), &entryCount, INFINITE, FALSE))
+        {
+            FAIL_FAST_LAST_ERROR_MSG("GetQueuedCompletionStatusEx failed");
+        }
+
+        const auto dequeueTime = SnapQpcInMicroSec();
+        shard.m_dequeueCalls += 1;
+        shard.m_maxBatchSize = (std::max)(shard.m_maxBatchSize, static_cast<long long>(entryCount));
+
+        bool exit = false;
+        for (ULONG i = 0; i < entryCount; ++i)
+        {
+            auto* ov = entries[i].lpOverlapped;
+            if (!ov)
+            {
+                exit = true;
+                continue;
+            }
+
+            // The completion may be for a receive posted by another shard, it is accounted to the one echoing it
+            auto& receiveContext = *CONTAINING_RECORD(ov, ReceiveContext, m_overlapped);
+            m_pendingReceives -= 1;
+
+            if (m_echoBatchSize > 1)
+            {
+                // The receive is reposted once the batch is echoed, as the datagram is echoed from its buffer
+                const auto bytes = GetReceiveResult(receiveContext, ov);
+                if (bytes > 0 && AcceptDatagram(receiveContext, bytes))
+                {
+                    shard.m_echoBatch.emplace_back(&receiveContext, receiveContext.m_echoLength);
+                }
+                else
+                {
+                    shard.m_failedReceives += bytes == 0 && !m_stopping ? 1 : 0;
+                    if (!m_stopping)
+                    {
+                        InitiateReceive(receiveContext);
+                    }
+                }
+                continue;
+            }
+
+            const auto queueingDelay = SnapQpcInMicroSec() - dequeueTime;
+            if (const auto bytes = GetReceiveResult(receiveContext, ov); bytes == 0)
+            {
+                shard.m_failedReceives += m_stopping ? 0 : 1;
+            }
+            else if (EchoDatagram(receiveContext, bytes))
+            {
+                shard.m_echoedDatagrams += 1;
+                shard.m_echoedBytes += receiveContext.m_echoLength;
+                shard.m_sendCalls += 1;
+                shard.m_queueingDelay.Add(queueingDelay);
+            }
+
+            if (!m_stopping)
+            {
+                InitiateReceive(receiveContext);
+            }
+        }
+
+        if (!shard.m_echoBatch.empty())
+        {
+            // All the datagrams of the batch are echoed together, they all waited for the whole batch to be dequeued
+            const auto queueingDelay = SnapQpcInMicroSec() - dequeueTime;
+            EchoBatch(shard);
+            for (const auto& [receiveContext, bytes] : shard.m_echoBatch)
+            {
+                shard.m_queueingDelay.Add(queueingDelay);
+                if (!m_stopping)
+                {
+                    InitiateReceive(*receiveContext);
+                }
+            }
+            shard.m_echoBatch.clear();
+        }
+
+        if (exit)
+        {
+            return;
+        }
+    }
 }
-} // namespace multipath
\ No newline at end of file
+#endif
+} // namespace multipath
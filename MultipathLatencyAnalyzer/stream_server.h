@@ -3,24 +3,56 @@
 
 #pragma once
 
-#include "sockaddr.h"
-#include "threadpool_io.h"
-
-#include <WinSock2.h>
-#include <wil/resource.h>
+#include "datagram_header.h"
+#include "lateness_histogram.h"
+#include "socket_io.h"
+#ifdef _WIN32
+#include "downlink_streamer.h"
+#endif
 
 #include <array>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace multipath {
 class StreamServer
 {
 public:
-    StreamServer(ctl::ctSockaddr listenAddress);
+    // With a thread count of 0, the datagrams are echoed from the system threadpool.
+    // Otherwise, they are echoed by threadCount dedicated threads (shards), each pinned to a processor,
+    // which dequeue the receive completions in batches from a completion port they share. The shards share the socket
+    // and its receive queue too: they spread the echoes across processors, not the reception of the datagrams.
+    // With an echo batch size above 1, each shard dequeues up to echoBatchSize datagrams per wakeup and echoes
+    // the consecutive ones sent by the same client with the same size in a single send (UDP send offload).
+    // Echo batching requires shards, one is used if the thread count is 0.
+    // With STAMP, the datagrams without the header of the current version are reflected as STAMP test packets
+    // instead of being echoed in the format of the previous versions: the clients of this tool are still echoed.
+    // The datagrams asking for a header echo are echoed as their header and a report of their reception.
+    // With downlink streams, the stream requests of the clients are served by a DownlinkStreamer sending on the same
+    // socket; otherwise they are dropped.
+    // Off Windows, the datagrams are echoed from the completion thread of the socket: the shards, echo batching and
+    // downlink streams are not supported, constructing the server with them throws std::invalid_argument.
+    StreamServer(
+        SocketAddress listenAddress,
+        unsigned long threadCount = 0,
+        unsigned long echoBatchSize = 1,
+        DatagramProtocol protocol = DatagramProtocol::Native,
+        bool downlinkStreams = false);
 
-    ~StreamServer() noexcept = default;
+    ~StreamServer() noexcept;
 
     void Start(unsigned long receiveBufferCount);
 
+    // Cancels the pending receives and waits for their completions and the shards to exit
+    void Stop() noexcept;
+
+    // Prints the throughput and queueing delay of each shard, once stopped
+    void PrintStatistics() const;
+
     // not copyable or movable
     StreamServer(const StreamServer&) = delete;
     StreamServer& operator=(const StreamServer&) = delete;
@@ -29,24 +61,121 @@ public:
 
 private:
     static constexpr std::size_t c_receiveBufferSize = 1024; // 1KB receive buffer
+#ifdef _WIN32
+    // Maximum number of completions dequeued at once by a shard, without echo batching
+    static constexpr ULONG c_completionBatchSize = 64;
+    // Maximum size of a single send with UDP send offload
+    static constexpr size_t c_maxEchoBatchBytes = 65000;
+#endif
 
     struct ReceiveContext
     {
         std::array<char, c_receiveBufferSize> m_buffer{};
-        ctl::ctSockaddr m_remoteAddress{};
+        SocketAddress m_remoteAddress{};
         int m_remoteAddressLen = 0;
+        // The format of the datagram received and the length to echo, once accepted
+        DatagramFormat m_format = DatagramFormat::Invalid;
+        uint32_t m_echoLength = 0;
+#ifdef _WIN32
         DWORD m_receiveFlags = 0;
+        // Only used by the shards, the threadpool allocates its own requests
+        OVERLAPPED m_overlapped{};
+#else
+        iovec m_receiveBuffer{};
+#endif
     };
 
+#ifdef _WIN32
+    struct Shard
+    {
+        unsigned long m_index = 0;
+        std::thread m_thread{};
+        std::vector<ReceiveContext> m_receiveContexts{};
+        std::vector<OVERLAPPED_ENTRY> m_completions{};
+
+        // The datagrams received in the current batch and the buffer in which they are coalesced
+        std::vector<std::pair<ReceiveContext*, DWORD>> m_echoBatch{};
+        std::vector<char> m_echoBuffer{};
+
+        // Only updated by the thread of the shard
+        long long m_echoedDatagrams = 0;
+        long long m_echoedBytes = 0;
+        long long m_sendCalls = 0;
+        long long m_failedReceives = 0;
+        long long m_dequeueCalls = 0;
+        long long m_maxBatchSize = 0;
+        // Time a datagram waited in a dequeued batch before being echoed, i.e. the time spent echoing the
+        // datagrams dequeued before it
+        LatenessHistogram m_queueingDelay{};
+    };
+#endif
+
     void InitiateReceive(ReceiveContext& receiveContext);
 
-    void CompleteReceive(ReceiveContext& receiveContext, OVERLAPPED* ov) noexcept;
+    void CompleteReceive(ReceiveContext& receiveContext, SocketIoRequest* request) noexcept;
+
+    // Returns the number of bytes received, 0 if the receive failed
+    uint32_t GetReceiveResult(ReceiveContext& receiveContext, SocketIoRequest* request) noexcept;
 
-    ctl::ctSockaddr m_listenAddress;
+    // Returns false if the datagram is dropped, as its header is invalid or it is a stream request refused
+    // - a STAMP packet is turned into the reflected packet, with the time it was received
+    // - a datagram asking for a header echo is turned into its header and echo report
+    bool AcceptDatagram(ReceiveContext& receiveContext, uint32_t bytesReceived) noexcept;
 
-    wil::unique_socket m_socket;
-    std::unique_ptr<ctl::ctThreadIocp> m_threadpoolIo;
+    // Starts or renews the downlink stream of a request carrying the cookie of its sender, and turns the request into
+    // its header echo followed by the cookie. Returns false if it is refused: it is then not echoed.
+    bool AcceptStreamRequest(
+        ReceiveContext& receiveContext, const DatagramHeader& header, uint32_t bytesReceived, long long receiveTimestamp) noexcept;
+
+    // Sets the echo timestamp of an accepted datagram, at the last moment before it is sent
+    static void StampEcho(ReceiveContext& receiveContext) noexcept;
+
+    // Returns false if the datagram is dropped
+    bool EchoDatagram(ReceiveContext& receiveContext, uint32_t bytesReceived) noexcept;
+
+#ifdef _WIN32
+    // Echoes the datagrams of m_echoBatch, coalescing the consecutive ones with the same destination and size
+    void EchoBatch(Shard& shard) noexcept;
+
+    // Sends size bytes to the sender of the given datagram, split in datagrams of segmentSize bytes
+    void SendEcho(Shard& shard, ReceiveContext& destination, char* buffer, DWORD size, DWORD segmentSize) noexcept;
+
+    void RunShard(Shard& shard) noexcept;
+#endif
+
+    SocketAddress m_listenAddress;
+
+    UniqueSocket m_socket;
+    // The threadpool, or the completion thread off Windows
+    std::unique_ptr<SocketIo> m_socketIo;
+#ifdef _WIN32
+    // Used instead of the threadpool when the server is sharded
+    wil::unique_handle m_completionPort;
+#endif
 
     std::vector<ReceiveContext> m_receiveContexts;
+#ifdef _WIN32
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::unique_ptr<DownlinkStreamer> m_streamer;
+    // Whether the OS supports UDP send offload, to echo a batch in a single send
+    bool m_echoOffloadEnabled = false;
+#endif
+    unsigned long m_echoBatchSize = 1;
+    DatagramProtocol m_protocol = DatagramProtocol::Native;
+
+    std::atomic<bool> m_stopping{false};
+    std::atomic<long long> m_pendingReceives{0};
+    // The datagrams dropped, and the ones echoed in the unversioned format of the previous releases
+    std::atomic<long long> m_invalidDatagrams{0};
+    std::atomic<long long> m_legacyDatagrams{0};
+    // The datagrams whose payload does not match its CRC, corrupted on the way from the client. They are echoed as is,
+    // for the client to account them.
+    std::atomic<long long> m_corruptPayloads{0};
+    // The STAMP packets reflected, and the datagrams echoed as their header only
+    std::atomic<long long> m_stampPackets{0};
+    std::atomic<long long> m_headerEchoes{0};
+    // The stream requests dropped, as downlink streams are disabled or the request is refused
+    std::atomic<long long> m_refusedStreamRequests{0};
+    long long m_startTime = 0;
 };
-} // namespace multipath
\ No newline at end of file
+} // namespace multipath
@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Parses every pair of options in both orders: an option must never claim the value of another option
+// whose name it prefixes (-echo and -echobatch, -catchup and -catchuplimit)
+
+#include "arguments.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace multipath;
+
+namespace {
+int g_failures = 0;
+
+void Check(bool condition, const std::wstring_view first, const std::wstring_view second, const char* what)
+{
+    if (!condition)
+    {
+        std::fwprintf(stderr, L"FAILED: %ls %ls: %hs\n", first.data(), second.data(), what);
+        ++g_failures;
+    }
+}
+
+void ParsePair(const std::wstring_view first, const std::wstring_view second, bool parseFirstOptionFirst)
+{
+    const std::wstring firstArgument = std::wstring(first) + L":1";
+    const std::wstring secondArgument = std::wstring(second) + L":2";
+    std::vector<const wchar_t*> args{firstArgument.c_str(), secondArgument.c_str()};
+
+    std::optional<std::wstring_view> firstValue;
+    std::optional<std::wstring_view> secondValue;
+    if (parseFirstOptionFirst)
+    {
+        firstValue = ParseArgument(first, args);
+        secondValue = ParseArgument(second, args);
+    }
+    else
+    {
+        secondValue = ParseArgument(second, args);
+        firstValue = ParseArgument(first, args);
+    }
+
+    Check(firstValue == L"1", first, second, "wrong value for the first option");
+    Check(secondValue == L"2", first, second, "wrong value for the second option");
+    Check(args.empty(), first, second, "arguments left over");
+}
+} // namespace
+
+int main()
+{
+    for (const auto first : c_argumentNames)
+    {
+        for (const auto second : c_argumentNames)
+        {
+            if (first != second)
+            {
+                ParsePair(first, second, true);
+                ParsePair(first, second, false);
+            }
+        }
+    }
+
+    // the client parses -catchup before -catchuplimit, whose name it prefixes
+    {
+        std::vector<const wchar_t*> args{L"-catchuplimit:5", L"-catchup:burst"};
+        const auto catchup = ParseArgument(L"-catchup", args);
+        const auto catchupLimit = ParseArgument(L"-catchuplimit", args);
+        Check(catchup == L"burst" && catchupLimit == L"5", L"-catchup", L"-catchuplimit", "wrong values");
+    }
+
+    // the name alone is the option without a value, not a prefix match
+    std::vector<const wchar_t*> args{L"-echobatch"};
+    Check(!ParseArgument(L"-echo", args) && args.size() == 1, L"-echo", L"-echobatch", "prefix matched");
+    try
+    {
+        ParseArgument(L"-echobatch", args);
+        Check(false, L"-echobatch", L"", "missing value accepted");
+    }
+    catch (const std::invalid_argument&)
+    {
+    }
+
+    if (g_failures == 0)
+    {
+        std::printf("%zu options parsed in every pair\n", c_argumentNames.size());
+    }
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Estimates a server clock with a known offset and skew over a run long enough for the windows to be merged:
+// the number of windows stays bounded, the fit finds the clock, and merging the estimates of the parts of the run
+// gives the same model as a single estimate
+
+#include "clock_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace multipath;
+
+namespace {
+int g_failures = 0;
+
+void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        ++g_failures;
+    }
+}
+
+constexpr long long c_duration = 4LL * 3600 * 1'000'000'000; // 4 hours
+constexpr long long c_interval = 10'000'000; // 10 ms
+constexpr double c_offset = 5'000'000.; // 5 ms
+constexpr double c_skew = 20e-6; // 20 ppm
+constexpr long long c_minimumDelay = 200'000; // 200 us each way
+
+struct RoundTrip
+{
+    long long m_send;
+    long long m_echo;
+    long long m_receive;
+};
+
+std::vector<RoundTrip> GenerateRun()
+{
+    // Each way is delayed by queuing, a few datagrams in each window go through without
+    std::mt19937_64 random{42};
+    std::exponential_distribution<double> queuing{1. / 300'000.};
+    std::bernoulli_distribution unqueued{0.05};
+    auto delay = [&] { return c_minimumDelay + (unqueued(random) ? 0 : std::llround(queuing(random))); };
+
+    std::vector<RoundTrip> run;
+    for (long long send = 0; send < c_duration; send += c_interval)
+    {
+        const auto arrival = send + delay();
+        const auto echo = arrival + std::llround(c_offset + c_skew * static_cast<double>(arrival));
+        run.push_back({send, echo, arrival + delay()});
+    }
+    return run;
+}
+} // namespace
+
+int main()
+{
+    const auto run = GenerateRun();
+
+    ClockEstimator whole;
+    size_t largestWindowCount = 0;
+    for (const auto& roundTrip : run)
+    {
+        whole.AddSample(roundTrip.m_send, roundTrip.m_echo, roundTrip.m_receive);
+        largestWindowCount = (std::max)(largestWindowCount, whole.WindowCount());
+    }
+    Check(largestWindowCount <= ClockEstimator::c_maxWindows, "too many windows");
+    Check(whole.WindowCount() > ClockEstimator::c_maxWindows / 2, "windows merged too early");
+
+    const auto model = whole.Estimate();
+    Check(model.has_value(), "no estimate");
+    if (!model)
+    {
+        return 1;
+    }
+    // The offset at the reference, in the middle of the first round trip
+    const auto expectedOffset = c_offset + c_skew * static_cast<double>(model->m_reference);
+    Check(std::abs(model->m_offset - expectedOffset) < 10'000., "offset further than 10 us");
+    Check(std::abs(model->m_skew - c_skew) < 0.1e-6, "skew further than 0.1 ppm");
+
+    // The parts of the run are estimated separately, then merged out of order
+    constexpr size_t c_partCount = 7;
+    std::vector<ClockEstimator> parts(c_partCount);
+    for (size_t i = 0; i < run.size(); ++i)
+    {
+        const auto& roundTrip = run[i];
+        parts[i * c_partCount / run.size()].AddSample(roundTrip.m_send, roundTrip.m_echo, roundTrip.m_receive);
+    }
+    ClockEstimator merged;
+    for (size_t i = c_partCount; i > 0; --i)
+    {
+        merged.Merge(parts[i - 1]);
+    }
+    const auto mergedModel = merged.Estimate();
+    Check(merged.WindowCount() == whole.WindowCount(), "merged windows differ");
+    Check(mergedModel && std::abs(mergedModel->ToClientTime(c_duration) - model->ToClientTime(c_duration)) < 1'000,
+        "merged model differs by more than 1 us");
+
+    if (g_failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", g_failures);
+        return 1;
+    }
+    std::printf(
+        "%zu round trips in %zu windows: offset %.1f us, skew %.3f ppm\n",
+        run.size(),
+        whole.WindowCount(),
+        model->m_offset / 1'000.,
+        model->m_skew * 1e6);
+    return 0;
+}
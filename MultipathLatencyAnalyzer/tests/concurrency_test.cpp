@@ -0,0 +1,224 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Runs the structures shared by the completions and the timer under concurrent load, meant to be built with
+// -fsanitize=thread:
+// - LatencyStore: the completions update the timestamps while the timer extends the window and finalizes the datagrams,
+//   each datagram must be finalized once, with every timestamp set by an update which found it in the window
+// - SpscQueue: the arrivals of a receive handed over to the timer, in order and without loss
+// - SocketUsers: the sends and completions use the socket while it is canceled, none may use it once Cancel returns
+
+#include "latency_store.h"
+#include "socket_users.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace multipath;
+
+namespace {
+std::atomic<int> g_failures{0};
+
+void Check(bool condition, const char* what, long long sequenceNumber)
+{
+    if (!condition)
+    {
+        // Only the first failures are printed
+        if (g_failures.fetch_add(1) < 10)
+        {
+            std::fprintf(stderr, "FAILED: %s, sequence number: %lld\n", what, sequenceNumber);
+        }
+    }
+}
+
+constexpr long long c_datagramCount = 50'000;
+constexpr size_t c_pathCount = 4;
+// Small, so that the finalization keeps racing with the updates
+constexpr size_t c_windowSize = 64;
+
+long long SendTimestamp(long long sequenceNumber) noexcept
+{
+    return sequenceNumber * 10;
+}
+
+long long ReceiveTimestamp(long long sequenceNumber, size_t path) noexcept
+{
+    return sequenceNumber * 10 + static_cast<long long>(path) + 1;
+}
+
+void TestLatencyStore()
+{
+    // Set by the update callbacks, read by the finalization once the writers left the slot
+    std::vector<std::atomic<bool>> updated(c_datagramCount * c_pathCount);
+    std::vector<int> finalized(c_datagramCount, 0);
+    long long nextFinalized = 0;
+
+    LatencyStore store(c_windowSize, c_pathCount, [&](long long sequenceNumber, const LatencyMeasure& measure) {
+        Check(sequenceNumber == nextFinalized, "finalized out of order", sequenceNumber);
+        nextFinalized = sequenceNumber + 1;
+        finalized[static_cast<size_t>(sequenceNumber)] += 1;
+
+        for (size_t path = 0; path < c_pathCount; ++path)
+        {
+            const auto& timestamps = measure.m_paths[path];
+            const auto wasUpdated = updated[static_cast<size_t>(sequenceNumber) * c_pathCount + path].load(std::memory_order_relaxed);
+            Check(!wasUpdated || timestamps.m_receive >= 0, "update lost by the finalization", sequenceNumber);
+            Check(timestamps.m_receive < 0 || timestamps.m_receive == ReceiveTimestamp(sequenceNumber, path),
+                "wrong receive timestamp", sequenceNumber);
+            Check(timestamps.m_send < 0 || timestamps.m_send == SendTimestamp(sequenceNumber), "wrong send timestamp", sequenceNumber);
+        }
+    });
+
+    // The timer sends the datagrams, the completions of each path update them as they are sent. The timer waits for the
+    // completions to be within a window of the datagrams sent, so that they keep updating the oldest datagrams.
+    std::atomic<long long> sent{0};
+    std::vector<std::atomic<long long>> progress(c_pathCount);
+    std::vector<std::thread> completions;
+    for (size_t path = 0; path < c_pathCount; ++path)
+    {
+        completions.emplace_back([&, path] {
+            long long next = 0;
+            while (next < c_datagramCount)
+            {
+                const auto end = sent.load(std::memory_order_acquire);
+                for (; next < end; ++next)
+                {
+                    store.Update(next, [&](LatencyStore::Entry& entry) {
+                        // A completion can be preempted in the middle of its update
+                        updated[static_cast<size_t>(next) * c_pathCount + path].store(true, std::memory_order_relaxed);
+                        entry.SetFirst(path, TimestampKind::Send, SendTimestamp(next));
+                        std::this_thread::yield();
+                        entry.SetFirst(path, TimestampKind::Receive, ReceiveTimestamp(next, path));
+                    });
+                    progress[path].store(next + 1, std::memory_order_relaxed);
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    for (long long sequenceNumber = 0; sequenceNumber < c_datagramCount; ++sequenceNumber)
+    {
+        for (auto& completed : progress)
+        {
+            while (completed.load(std::memory_order_relaxed) < sequenceNumber - static_cast<long long>(c_windowSize))
+            {
+                std::this_thread::yield();
+            }
+        }
+        store.Advance(sequenceNumber + 1);
+        sent.store(sequenceNumber + 1, std::memory_order_release);
+    }
+    for (auto& completion : completions)
+    {
+        completion.join();
+    }
+    store.FinalizeAll();
+
+    for (long long sequenceNumber = 0; sequenceNumber < c_datagramCount; ++sequenceNumber)
+    {
+        Check(finalized[static_cast<size_t>(sequenceNumber)] == 1, "not finalized once", sequenceNumber);
+    }
+}
+
+void TestSpscQueue()
+{
+    constexpr long long c_itemCount = 200'000;
+    SpscQueue<long long> queue(256);
+
+    std::thread producer([&] {
+        for (long long item = 0; item < c_itemCount;)
+        {
+            if (queue.TryPush(item))
+            {
+                ++item;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    long long expected = 0;
+    while (expected < c_itemCount)
+    {
+        queue.Drain([&](long long item) {
+            Check(item == expected, "item out of order", item);
+            expected = item + 1;
+        });
+    }
+    producer.join();
+    Check(queue.Drain([](long long) {}) == 0, "item left in the queue", c_itemCount);
+}
+
+void TestSocketUsers()
+{
+    constexpr long long c_roundCount = 500;
+    constexpr size_t c_userCount = 4;
+
+    for (long long round = 0; round < c_roundCount; ++round)
+    {
+        SocketUsers users;
+        // Stands for the socket: used by the users while they hold it, destroyed once Cancel returns, which the
+        // sanitizer reports if a user still holds it
+        auto socket = std::make_unique<std::atomic<long long>>(0);
+        users.Open();
+
+        std::atomic<bool> canceling{false};
+        std::atomic<bool> canceled{false};
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < c_userCount; ++i)
+        {
+            threads.emplace_back([&] {
+                // Until the socket is canceled, as the sends and the completions which repost a receive
+                while (users.Acquire())
+                {
+                    Check(!canceled.load(), "socket acquired once canceled", round);
+                    socket->fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                    socket->fetch_add(1, std::memory_order_relaxed);
+                    users.Release();
+                }
+                Check(canceling.load(), "socket refused before it was canceled", round);
+            });
+        }
+
+        // Canceled after a varying number of uses, while the users are acquiring and releasing it
+        while (socket->load(std::memory_order_relaxed) < (round % 16) * 8)
+        {
+            std::this_thread::yield();
+        }
+        canceling = true;
+        users.Cancel();
+        socket.reset();
+        canceled = true;
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+}
+} // namespace
+
+int main()
+{
+    TestLatencyStore();
+    TestSpscQueue();
+    TestSocketUsers();
+
+    if (g_failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", g_failures.load());
+        return 1;
+    }
+    std::printf(
+        "%lld datagrams finalized once under concurrent updates, queue handed over in order, socket canceled under use\n",
+        c_datagramCount);
+    return 0;
+}
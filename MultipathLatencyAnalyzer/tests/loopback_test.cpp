@@ -0,0 +1,288 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Measures a million datagrams on two paths through the echo server over loopback, with the portable I/O backend:
+// the send and receive completions update the latency store from the completion threads of the paths while the
+// sending thread extends its window and finalizes the datagrams. Each datagram must be finalized once, in order, with
+// the timestamps of each path set together and in the order of the round trip.
+
+#include "latency_store.h"
+#include "posix_io.h"
+#include "posix_socket_utils.h"
+#include "stream_server.h"
+#include "time_utils.h"
+
+#include <arpa/inet.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace multipath;
+
+namespace {
+std::atomic<int> g_failures{0};
+
+void Check(bool condition, const char* what, long long sequenceNumber)
+{
+    if (!condition)
+    {
+        // Only the first failures are printed
+        if (g_failures.fetch_add(1) < 10)
+        {
+            std::fprintf(stderr, "FAILED: %s, sequence number: %lld\n", what, sequenceNumber);
+        }
+    }
+}
+
+constexpr long long c_datagramCount = 1'000'000;
+constexpr size_t c_pathCount = 2;
+constexpr size_t c_datagramSize = c_datagramHeaderLength + 16;
+// The datagrams are sent in bursts, each one once the previous one is echoed: well within the socket receive buffers,
+// the loopback does not drop them
+constexpr long long c_burstSize = 64;
+// Smaller than a burst: the oldest datagrams of a burst are finalized while their echoes are received
+constexpr size_t c_windowSize = 32;
+constexpr size_t c_receiveCount = 16;
+
+// The socket of a path, connected to the server, like a MeasuredSocket
+class Path
+{
+public:
+    Path(size_t index, const sockaddr_in& serverAddress, LatencyStore& store) :
+        m_index(index), m_store(store), m_socket(CreateDatagramSocket()), m_receiveContexts(c_receiveCount), m_sendSlots(c_burstSize)
+    {
+        if (connect(m_socket.get(), reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)) != 0)
+        {
+            ThrowLastError("connect failed");
+        }
+        m_io = std::make_unique<ctl::ctPosixIo>(m_socket.get(), c_burstSize + c_receiveCount);
+        for (auto& receiveContext : m_receiveContexts)
+        {
+            InitiateReceive(receiveContext);
+        }
+    }
+
+    ~Path() noexcept
+    {
+        m_io->stop();
+    }
+
+    void Send(long long sequenceNumber)
+    {
+        auto& slot = m_sendSlots[static_cast<size_t>(sequenceNumber % c_burstSize)];
+        while (slot.m_inFlight.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        slot.m_inFlight.store(true, std::memory_order_relaxed);
+
+        DatagramHeader header;
+        header.m_pathId = static_cast<uint16_t>(m_index);
+        header.m_payloadLength = static_cast<uint32_t>(c_datagramSize - c_datagramHeaderLength);
+        header.m_sequenceNumber = sequenceNumber;
+        header.m_echoTimestamp = -1;
+        WriteDatagramHeader(slot.m_buffer.data(), header);
+
+        auto* request = m_io->new_request([this, &slot, sequenceNumber](ctl::ctPosixIoRequest* completed) noexcept {
+            if (completed->result > 0)
+            {
+                m_store.Update(sequenceNumber, [&](LatencyStore::Entry& entry) {
+                    entry.SetFirst(m_index, TimestampKind::Send, slot.m_sendTimestamp);
+                });
+            }
+            slot.m_inFlight.store(false, std::memory_order_release);
+        });
+        slot.m_iov = {slot.m_buffer.data(), slot.m_buffer.size()};
+        request->message.msg_iov = &slot.m_iov;
+        request->message.msg_iovlen = 1;
+        slot.m_sendTimestamp = SnapTimestampInNanoSec();
+        StampDatagramSend(slot.m_buffer.data(), slot.m_sendTimestamp);
+        if (m_io->start_send(request) != 0)
+        {
+            m_io->cancel_request(request);
+            slot.m_inFlight.store(false, std::memory_order_release);
+            Check(false, "send failed", sequenceNumber);
+        }
+    }
+
+    // Waits a second at most for the echoes of the datagrams before count, as one may be lost
+    void WaitForEchoes(long long count) const
+    {
+        const auto deadline = SnapTimestampInNanoSec() + 1'000'000'000;
+        while (m_received.load(std::memory_order_acquire) < count && SnapTimestampInNanoSec() < deadline)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    [[nodiscard]] long long LateEchoes() const noexcept
+    {
+        return m_lateEchoes.load();
+    }
+
+private:
+    struct SendSlot
+    {
+        std::array<char, c_datagramSize> m_buffer{};
+        iovec m_iov{};
+        long long m_sendTimestamp = 0;
+        std::atomic<bool> m_inFlight{false};
+    };
+
+    struct ReceiveContext
+    {
+        std::array<char, c_datagramSize> m_buffer{};
+        iovec m_iov{};
+    };
+
+    void InitiateReceive(ReceiveContext& receiveContext)
+    {
+        auto* request = m_io->new_request([this, &receiveContext](ctl::ctPosixIoRequest* completed) noexcept {
+            const auto receiveTimestamp = SnapTimestampInNanoSec();
+            if (completed->result == -ECANCELED)
+            {
+                return;
+            }
+            DatagramHeader header;
+            if (completed->result > 0 &&
+                ParseDatagramHeader(receiveContext.m_buffer.data(), static_cast<size_t>(completed->result), header))
+            {
+                // The echo and receive timestamps are set by the same update: the finalization sees both or none
+                const auto result = m_store.Update(header.m_sequenceNumber, [&](LatencyStore::Entry& entry) {
+                    entry.SetFirst(m_index, TimestampKind::Echo, header.m_echoTimestamp);
+                    std::this_thread::yield();
+                    entry.SetFirst(m_index, TimestampKind::Receive, receiveTimestamp);
+                });
+                Check(result != LatencyStore::UpdateResult::NotSent, "echo of a datagram not sent", header.m_sequenceNumber);
+                m_lateEchoes += result == LatencyStore::UpdateResult::AlreadyFinalized ? 1 : 0;
+                m_received.store(header.m_sequenceNumber + 1, std::memory_order_release);
+            }
+            InitiateReceive(receiveContext);
+        });
+        receiveContext.m_iov = {receiveContext.m_buffer.data(), receiveContext.m_buffer.size()};
+        request->message.msg_iov = &receiveContext.m_iov;
+        request->message.msg_iovlen = 1;
+        if (const auto error = m_io->start_receive(request))
+        {
+            m_io->cancel_request(request);
+            Check(error == ECANCELED, "failed to start a receive", -1);
+        }
+    }
+
+    const size_t m_index;
+    LatencyStore& m_store;
+    UniqueFd m_socket;
+    std::unique_ptr<ctl::ctPosixIo> m_io;
+    std::vector<ReceiveContext> m_receiveContexts;
+    std::vector<SendSlot> m_sendSlots;
+    // The sequence number after the last one echoed, the loopback keeps them in order
+    std::atomic<long long> m_received{0};
+    std::atomic<long long> m_lateEchoes{0};
+};
+
+// A free loopback port for the server, which is not told to bind to an ephemeral one
+sockaddr_in ReserveLoopbackAddress()
+{
+    const UniqueFd socket{CreateDatagramSocket()};
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(socket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        getsockname(socket.get(), reinterpret_cast<sockaddr*>(&address), &length) != 0)
+    {
+        ThrowLastError("failed to reserve a loopback port");
+    }
+    return address;
+}
+} // namespace
+
+int main()
+try
+{
+    std::vector<int> finalized(c_datagramCount, 0);
+    long long nextFinalized = 0;
+    long long echoed = 0;
+
+    LatencyStore store(c_windowSize, c_pathCount, [&](long long sequenceNumber, const LatencyMeasure& measure) {
+        Check(sequenceNumber == nextFinalized, "finalized out of order", sequenceNumber);
+        nextFinalized = sequenceNumber + 1;
+        finalized[static_cast<size_t>(sequenceNumber)] += 1;
+
+        for (size_t path = 0; path < c_pathCount; ++path)
+        {
+            const auto& timestamps = measure.m_paths[path];
+            Check((timestamps.m_echo >= 0) == (timestamps.m_receive >= 0), "update torn by the finalization", sequenceNumber);
+            Check(timestamps.m_send < 0 || timestamps.m_echo < 0 || timestamps.m_send <= timestamps.m_echo,
+                "echoed before sent", sequenceNumber);
+            Check(timestamps.m_echo <= timestamps.m_receive, "received before echoed", sequenceNumber);
+            echoed += timestamps.m_receive >= 0 ? 1 : 0;
+        }
+    });
+
+    const auto serverAddress = ReserveLoopbackAddress();
+    StreamServer server{SocketAddress{reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)}};
+    server.Start(c_receiveCount);
+
+    std::vector<std::unique_ptr<Path>> paths;
+    for (size_t path = 0; path < c_pathCount; ++path)
+    {
+        paths.push_back(std::make_unique<Path>(path, serverAddress, store));
+    }
+
+    // Like the sending thread of the client: the window is extended before the datagram is sent
+    for (long long sequenceNumber = 0; sequenceNumber < c_datagramCount; ++sequenceNumber)
+    {
+        if (sequenceNumber % c_burstSize == 0)
+        {
+            for (auto& path : paths)
+            {
+                path->WaitForEchoes(sequenceNumber);
+            }
+        }
+        store.Advance(sequenceNumber + 1);
+        for (auto& path : paths)
+        {
+            path->Send(sequenceNumber);
+        }
+    }
+    long long lateEchoes = 0;
+    for (auto& path : paths)
+    {
+        path->WaitForEchoes(c_datagramCount);
+        lateEchoes += path->LateEchoes();
+    }
+    paths.clear();
+    server.Stop();
+    store.FinalizeAll();
+
+    for (long long sequenceNumber = 0; sequenceNumber < c_datagramCount; ++sequenceNumber)
+    {
+        Check(finalized[static_cast<size_t>(sequenceNumber)] == 1, "not finalized once", sequenceNumber);
+    }
+    // Over loopback, with few datagrams in flight, an echo is only missing if an update was lost
+    const auto expected = c_datagramCount * static_cast<long long>(c_pathCount);
+    Check(echoed + lateEchoes == expected, "echo lost", expected - echoed - lateEchoes);
+
+    if (g_failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", g_failures.load());
+        return 1;
+    }
+    std::printf(
+        "%lld datagrams on %zu paths finalized once, %lld echoes measured, %lld too late\n",
+        c_datagramCount,
+        c_pathCount,
+        echoed,
+        lateEchoes);
+    return 0;
+}
+catch (const std::exception& ex)
+{
+    std::fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+}
@@ -6,8 +6,12 @@
 #pragma once
 
 // cpp headers
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
-#include <functional>
 // os headers
 #include <excpt.h>
 #include <Windows.h>
@@ -20,27 +24,79 @@ namespace ctl {
 // not using an unnamed namespace as debugging this is unnecessarily difficult with Windows debuggers
 //
 //
-// typedef used for the std::function to be given to ctThreadIocpCallbackInfo
-// - constructed by ctThreadIocp
+// type-erased callback invoked with the completed OVERLAPPED*
+// - the callable is stored inline: constructing or invoking a callback never allocates
+// - callables larger than c_inline_size fail to compile, capture pointers or references to bigger state instead
 //
-typedef std::function<void(OVERLAPPED*)> ctThreadIocpCallback_t;
+class ctThreadIocpCallback
+{
+public:
+    static constexpr size_t c_inline_size = 64;
+
+    ctThreadIocpCallback() noexcept = default;
+    ~ctThreadIocpCallback() noexcept
+    {
+        reset();
+    }
+    // non-copyable
+    ctThreadIocpCallback(const ctThreadIocpCallback&) = delete;
+    ctThreadIocpCallback& operator=(const ctThreadIocpCallback&) = delete;
+    ctThreadIocpCallback(ctThreadIocpCallback&&) = delete;
+    ctThreadIocpCallback& operator=(ctThreadIocpCallback&&) = delete;
+
+    template <typename Callback>
+    void assign(Callback&& _callback) noexcept
+    {
+        using callback_t = std::decay_t<Callback>;
+        static_assert(sizeof(callback_t) <= c_inline_size, "the callback state must fit in ctThreadIocpCallback");
+        static_assert(alignof(callback_t) <= alignof(std::max_align_t), "the callback state is over-aligned");
+        static_assert(std::is_nothrow_move_constructible_v<callback_t> || std::is_nothrow_copy_constructible_v<callback_t>);
+
+        reset();
+        new (storage) callback_t(std::forward<Callback>(_callback));
+        invoke_function = [](void* _storage, OVERLAPPED* _overlapped) { (*static_cast<callback_t*>(_storage))(_overlapped); };
+        destroy_function = [](void* _storage) noexcept { static_cast<callback_t*>(_storage)->~callback_t(); };
+    }
+
+    void operator()(OVERLAPPED* _overlapped)
+    {
+        invoke_function(storage, _overlapped);
+    }
+
+    void reset() noexcept
+    {
+        if (destroy_function)
+        {
+            destroy_function(storage);
+            invoke_function = nullptr;
+            destroy_function = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char storage[c_inline_size]{};
+    void (*invoke_function)(void*, OVERLAPPED*) = nullptr;
+    void (*destroy_function)(void*) noexcept = nullptr;
+};
+
+// the request pool structures are padded for their interlocked list entries
+#pragma warning(push)
+#pragma warning(disable : 4324) // structure was padded due to alignment specifier
 
 //
 // structure passed to the ctThreadIocp IO completion function
 // - to allow the callback function to find the callback
 //   associated with that completed OVERLAPPED*
+// - instances are recycled through the request pool of their ctThreadIocp
 //
-struct ctThreadIocpCallbackInfo
+struct alignas(MEMORY_ALLOCATION_ALIGNMENT) ctThreadIocpCallbackInfo
 {
     OVERLAPPED ov{};
-    PVOID padding{}; // required padding before the std::function for the below static_assert alignment/sizing to be correct
-    ctThreadIocpCallback_t callback;
+    SLIST_ENTRY pool_entry{};
+    bool pooled = false; // false when allocated on the heap because the pool was exhausted
+    ctThreadIocpCallback callback;
 
-    // ReSharper disable once CppPossiblyUninitializedMember
-    explicit ctThreadIocpCallbackInfo(ctThreadIocpCallback_t&& _callback) noexcept : callback(std::move(_callback))
-    {
-        ::ZeroMemory(&ov, sizeof ov);
-    }
+    ctThreadIocpCallbackInfo() noexcept = default;
     ~ctThreadIocpCallbackInfo() noexcept = default;
     // non-copyable
     ctThreadIocpCallbackInfo(const ctThreadIocpCallbackInfo&) = delete;
@@ -50,7 +106,106 @@ struct ctThreadIocpCallbackInfo
 };
 
 // asserting at compile time, as we assume this when we reinterpret_cast in the callback
-static_assert(sizeof(ctThreadIocpCallbackInfo) == sizeof(OVERLAPPED) + sizeof(PVOID) + sizeof(ctThreadIocpCallback_t));
+static_assert(std::is_standard_layout_v<ctThreadIocpCallbackInfo>);
+
+//
+// counters exposed by ctThreadIocp to size its request pool
+//
+struct ctThreadIocpStatistics
+{
+    long long capacity = 0;        // number of requests preallocated in the pool
+    long long in_use = 0;          // number of requests currently in-flight
+    long long peak_in_use = 0;     // maximum number of requests simultaneously in-flight
+    long long exhausted_count = 0; // number of requests allocated on the heap because the pool was empty
+    long long total_requests = 0;  // number of requests issued
+};
+
+//
+// fixed-capacity pool of ctThreadIocpCallbackInfo, shared between the threads issuing IO and completing IO
+// - backed by an interlocked singly linked list, taking or returning a request never blocks nor allocates
+//
+class ctThreadIocpRequestPool
+{
+public:
+    explicit ctThreadIocpRequestPool(size_t _capacity) :
+        requests(std::make_unique<ctThreadIocpCallbackInfo[]>(_capacity)), capacity(_capacity)
+    {
+        ::InitializeSListHead(&free_list);
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            requests[i].pooled = true;
+            ::InterlockedPushEntrySList(&free_list, &requests[i].pool_entry);
+        }
+    }
+    ~ctThreadIocpRequestPool() noexcept = default;
+    // non-copyable
+    ctThreadIocpRequestPool(const ctThreadIocpRequestPool&) = delete;
+    ctThreadIocpRequestPool& operator=(const ctThreadIocpRequestPool&) = delete;
+    ctThreadIocpRequestPool(ctThreadIocpRequestPool&&) = delete;
+    ctThreadIocpRequestPool& operator=(ctThreadIocpRequestPool&&) = delete;
+
+    // can fail by throwing std::bad_alloc, only when the pool is exhausted
+    ctThreadIocpCallbackInfo* acquire()
+    {
+        ctThreadIocpCallbackInfo* request = nullptr;
+        if (auto* entry = ::InterlockedPopEntrySList(&free_list))
+        {
+            request = CONTAINING_RECORD(entry, ctThreadIocpCallbackInfo, pool_entry);
+        }
+        else
+        {
+            // ReSharper disable CppNonReclaimedResourceAcquisition
+            request = new ctThreadIocpCallbackInfo();
+            // ReSharper restore CppNonReclaimedResourceAcquisition
+            exhausted_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        total_requests.fetch_add(1, std::memory_order_relaxed);
+        const auto current = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto peak = peak_in_use.load(std::memory_order_relaxed);
+        while (current > peak && !peak_in_use.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        {
+        }
+        return request;
+    }
+
+    void release(ctThreadIocpCallbackInfo* _request) noexcept
+    {
+        _request->callback.reset();
+        in_use.fetch_sub(1, std::memory_order_relaxed);
+        if (_request->pooled)
+        {
+            ::InterlockedPushEntrySList(&free_list, &_request->pool_entry);
+        }
+        else
+        {
+            delete _request;
+        }
+    }
+
+    [[nodiscard]] ctThreadIocpStatistics statistics() const noexcept
+    {
+        ctThreadIocpStatistics stats;
+        stats.capacity = static_cast<long long>(capacity);
+        stats.in_use = in_use.load(std::memory_order_relaxed);
+        stats.peak_in_use = peak_in_use.load(std::memory_order_relaxed);
+        stats.exhausted_count = exhausted_count.load(std::memory_order_relaxed);
+        stats.total_requests = total_requests.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    SLIST_HEADER free_list{};
+    std::unique_ptr<ctThreadIocpCallbackInfo[]> requests;
+    size_t capacity = 0;
+
+    std::atomic<long long> in_use{0};
+    std::atomic<long long> peak_in_use{0};
+    std::atomic<long long> exhausted_count{0};
+    std::atomic<long long> total_requests{0};
+};
+
+#pragma warning(pop)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///
@@ -65,6 +220,9 @@ static_assert(sizeof(ctThreadIocpCallbackInfo) == sizeof(OVERLAPPED) + sizeof(PV
 /// - construct a ctThreadIocp object by passing in the HANDLE/SOCKET on which overlapped IO calls will be made
 /// - call new_request to get an OVERLAPPED* for an asynchronous Win32 API call the associated HANDLE/SOCKET
 ///   - additionally pass a function to be invoked on IO completion
+///   - the OVERLAPPED* and the function are stored in a request taken from a fixed-capacity pool:
+///     in steady state, issuing and completing IO does not allocate
+///   - if more requests are in-flight than the pool capacity, new requests are allocated on the heap
 /// - if the Win32 API succeeds or returns ERROR_IO_PENDING:
 ///    - the user's callback function will be called on completion [if succeeds or fails]
 ///    - from the callback function, the user then calls GetOverlappedResult/WSAGetOverlappedResult
@@ -89,18 +247,24 @@ public:
     // These c'tors can fail under low resources
     // - wil::ResultException (from the ThreadPool APIs)
     //
-    explicit ctThreadIocp(HANDLE _handle, _In_opt_ PTP_CALLBACK_ENVIRON _ptp_env = nullptr)
+    static constexpr size_t c_default_pool_capacity = 256;
+
+    explicit ctThreadIocp(HANDLE _handle, _In_opt_ PTP_CALLBACK_ENVIRON _ptp_env = nullptr, size_t _pool_capacity = c_default_pool_capacity) :
+        request_pool(std::make_unique<ctThreadIocpRequestPool>(_pool_capacity))
     {
-        ptp_io = CreateThreadpoolIo(_handle, IoCompletionCallback, nullptr, _ptp_env);
+        // the request pool is passed as the callback context
+        ptp_io = CreateThreadpoolIo(_handle, IoCompletionCallback, request_pool.get(), _ptp_env);
         if (!ptp_io)
         {
             THROW_WIN32_MSG(GetLastError(), "CreateThreadpoolIo");
         }
     }
 
-    explicit ctThreadIocp(SOCKET _socket, _In_opt_ PTP_CALLBACK_ENVIRON _ptp_env = nullptr)
+    explicit ctThreadIocp(SOCKET _socket, _In_opt_ PTP_CALLBACK_ENVIRON _ptp_env = nullptr, size_t _pool_capacity = c_default_pool_capacity) :
+        request_pool(std::make_unique<ctThreadIocpRequestPool>(_pool_capacity))
     {
-        ptp_io = CreateThreadpoolIo(reinterpret_cast<HANDLE>(_socket), IoCompletionCallback, nullptr, _ptp_env);
+        // the request pool is passed as the callback context
+        ptp_io = CreateThreadpoolIo(reinterpret_cast<HANDLE>(_socket), IoCompletionCallback, request_pool.get(), _ptp_env);
         if (!ptp_io)
         {
             THROW_WIN32_MSG(GetLastError(), "CreateThreadpoolIo");
@@ -118,7 +282,7 @@ public:
         }
     }
 
-    ctThreadIocp(ctThreadIocp&& rhs) noexcept : ptp_io(rhs.ptp_io)
+    ctThreadIocp(ctThreadIocp&& rhs) noexcept : ptp_io(rhs.ptp_io), request_pool(std::move(rhs.request_pool))
     {
         // null out the moved-from object's TP ptr since this object now has ownership
         rhs.ptp_io = nullptr;
@@ -126,6 +290,7 @@ public:
     ctThreadIocp& operator=(ctThreadIocp&& rhs) noexcept
     {
         ptp_io = rhs.ptp_io;
+        request_pool = std::move(rhs.request_pool);
         // null out the moved-from object's TP ptr since this object now has ownership
         rhs.ptp_io = nullptr;
         return *this;
@@ -133,8 +298,9 @@ public:
 
     //
     // new_request is expected to be called before each call to a Win32 function taking an OVLERAPPED*
-    // - which the caller expects to have their std::function invoked with the following signature:
+    // - which the caller expects to have their callable invoked with the following signature:
     //     void callback_function(OVERLAPPED* _overlapped)
+    // - the callable is stored inline in the request: it must fit in ctThreadIocpCallback::c_inline_size bytes
     //
     // The OVERLAPPED* returned is always owned by the object - never by the caller
     // - the caller is expected to pass it directly to a Win32 API
@@ -151,12 +317,12 @@ public:
     // - each call will return a unique OVERLAPPED*
     // - the callback will be given the OVERLAPPED* matching the IO that completed
     //
-    OVERLAPPED* new_request(std::function<void(OVERLAPPED*)> _callback) const
+    template <typename Callback>
+    OVERLAPPED* new_request(Callback&& _callback) const
     {
-        // this can fail by throwing std::bad_alloc
-        // ReSharper disable CppNonReclaimedResourceAcquisition
-        auto* new_callback = new ctThreadIocpCallbackInfo(std::move(_callback));
-        // ReSharper restore CppNonReclaimedResourceAcquisition
+        // this can fail by throwing std::bad_alloc, only if the pool is exhausted
+        auto* new_callback = request_pool->acquire();
+        new_callback->callback.assign(std::forward<Callback>(_callback));
 
         // once creating a new request succeeds, start the IO
         // - all below calls are no-fail calls
@@ -176,8 +342,16 @@ public:
     void cancel_request(OVERLAPPED* pOverlapped) const noexcept
     {
         CancelThreadpoolIo(ptp_io);
-        const auto* const old_request = reinterpret_cast<ctThreadIocpCallbackInfo*>(pOverlapped);
-        delete old_request;
+        auto* const old_request = reinterpret_cast<ctThreadIocpCallbackInfo*>(pOverlapped);
+        request_pool->release(old_request);
+    }
+
+    //
+    // Counters over the request pool, to size its capacity
+    //
+    [[nodiscard]] ctThreadIocpStatistics statistics() const noexcept
+    {
+        return request_pool->statistics();
     }
 
     //
@@ -190,9 +364,10 @@ public:
 
 private:
     PTP_IO ptp_io = nullptr;
+    std::unique_ptr<ctThreadIocpRequestPool> request_pool;
 
     static void CALLBACK IoCompletionCallback(
-        PTP_CALLBACK_INSTANCE /*_instance*/, PVOID /*_context*/, PVOID _overlapped, ULONG /*_ioresult*/, ULONG_PTR /*_numberofbytestransferred*/, PTP_IO /*_io*/)
+        PTP_CALLBACK_INSTANCE /*_instance*/, PVOID _context, PVOID _overlapped, ULONG /*_ioresult*/, ULONG_PTR /*_numberofbytestransferred*/, PTP_IO /*_io*/)
     {
         // this code may look really odd
         // the Win32 TP APIs eat stack overflow exceptions and reuses the thread for the next TP request
@@ -204,7 +379,7 @@ private:
         {
             auto* _request = static_cast<ctThreadIocpCallbackInfo*>(_overlapped);
             _request->callback(static_cast<OVERLAPPED*>(_overlapped));
-            delete _request;
+            static_cast<ctThreadIocpRequestPool*>(_context)->release(_request);
         }
         // ReSharper disable once CppAssignedValueIsNeverUsed (exr is used in the except handler)
         __except (exr = GetExceptionInformation(), EXCEPTION_EXECUTE_HANDLER)
@@ -4,16 +4,74 @@
 #pragma once
 
 #include <Windows.h>
+#include <algorithm>
+#include <atomic>
 #include <functional>
 
 #include <wil/result.h>
 
+#include "lateness_histogram.h"
 #include "time_utils.h"
 
 namespace multipath {
 
 using ThreadpoolTimerCallback = std::function<void()>;
 
+// What the timer does with the periods whose deadline passed before the previous callback returned
+enum class TimerCatchUpPolicy : uint32_t
+{
+    // Invoke the callback back-to-back for the missed periods, up to the limit, and skip the others
+    Burst = 0,
+    // Skip the missed periods, the next callback runs on the next deadline still ahead
+    Skip = 1,
+    // Skip the missed deadlines, and invoke the callback for the missed periods over the next periods (the limit)
+    Spread = 2,
+};
+
+// The name of the policy on the command line, e.g. "spread"
+inline const char* TimerCatchUpPolicyName(TimerCatchUpPolicy policy) noexcept
+{
+    switch (policy)
+    {
+    case TimerCatchUpPolicy::Burst:
+        return "burst";
+    case TimerCatchUpPolicy::Skip:
+        return "skip";
+    case TimerCatchUpPolicy::Spread:
+        return "spread";
+    }
+    return "unknown";
+}
+
+struct TimerCatchUpSettings
+{
+    static constexpr long long c_defaultLimit = 16;
+
+    TimerCatchUpPolicy m_policy = TimerCatchUpPolicy::Burst;
+    // Burst: the maximum number of callbacks invoked back-to-back
+    // Spread: the number of periods over which the missed periods are caught up
+    long long m_limit = c_defaultLimit;
+};
+
+// What the timer measured of its own schedule, to check that the callbacks ran at the requested rate
+struct TimerStatistics
+{
+    // The number of times the callback was invoked
+    long long m_callbacks = 0;
+    // The number of deadlines which passed before the previous callback returned
+    long long m_missedPeriods = 0;
+    // The number of missed periods for which the callback was never invoked
+    long long m_skippedPeriods = 0;
+    // The maximum number of callbacks invoked back-to-back
+    long long m_maxBurst = 0;
+    // The lateness of each timer expiration against its deadline
+    LatenessHistogram m_lateness{};
+};
+
+// Invokes a callback periodically from the system threadpool
+// - the deadlines are absolute (start + N * period), the callbacks run sequentially
+// - when a callback returns after the next deadline, the missed periods are handled by the catch-up policy:
+//   they are caught up in a loop on the same threadpool callback, never by recursion
 class ThreadpoolTimer
 {
 public:
@@ -37,47 +95,120 @@ public:
     ThreadpoolTimer(ThreadpoolTimer&&) = delete;
     ThreadpoolTimer& operator=(ThreadpoolTimer&&) = delete;
 
-    void Schedule(unsigned long periodInHundredNanosec) noexcept
+    void Schedule(unsigned long periodInHundredNanosec, TimerCatchUpSettings catchUp = {}) noexcept
     {
         m_exiting = false;
         m_period = periodInHundredNanosec;
+        m_catchUp = catchUp;
+        m_catchUp.m_limit = (std::max)(m_catchUp.m_limit, 1LL);
+        m_backlog = 0;
+        m_backlogPerPeriod = 0;
+        m_statistics = {};
         m_timerExpiration = SnapSystemTimeInHundredNs();
 
         FILETIME expiration{};
         SetThreadpoolTimer(m_ptpTimer, &expiration, 0, 0);
     }
 
+    // Can be called from the callback, otherwise waits for the callback running to return
     void Stop() noexcept
     {
         m_exiting = true;
         if (m_ptpTimer)
         {
             SetThreadpoolTimer(m_ptpTimer, nullptr, 0, 0);
+            if (m_callbackThread.load() != GetCurrentThreadId())
+            {
+                WaitForThreadpoolTimerCallbacks(m_ptpTimer, TRUE);
+            }
         }
     }
 
-private:
+    // Only valid once the timer is stopped
+    [[nodiscard]] const TimerStatistics& GetStatistics() const noexcept
+    {
+        return m_statistics;
+    }
 
-    void ScheduleNextPeriod() noexcept
+private:
+    // Invokes the callback for the current deadline and the periods to catch up, then arms the timer for the next one
+    void RunPeriods() noexcept
     {
-        // Don't schedule a next period if the callback (or someone else) called stop
-        if (m_exiting)
+        long long burst = 0;
+        long long periodsToRun = 1;
+
+        // The backlog of the spread policy is caught up along the regular periods
+        const auto caughtUp = (std::min)(m_backlog, m_backlogPerPeriod);
+        m_backlog -= caughtUp;
+        periodsToRun += caughtUp;
+
+        m_statistics.m_lateness.Add((SnapSystemTimeInHundredNs() - m_timerExpiration) / 10);
+
+        while (!m_exiting)
         {
+            for (; periodsToRun > 0 && !m_exiting; --periodsToRun)
+            {
+                InvokeCallback();
+                burst += 1;
+            }
+            m_statistics.m_maxBurst = (std::max)(m_statistics.m_maxBurst, burst);
+
+            // Don't schedule a next period if the callback (or someone else) called stop
+            if (m_exiting)
+            {
+                return;
+            }
+
+            m_timerExpiration += m_period;
+            const long long remainingTime = m_timerExpiration - SnapSystemTimeInHundredNs();
+            if (remainingTime > 0)
+            {
+                FILETIME expiration = ConvertHundredNsToRelativeFiletime(remainingTime);
+                SetThreadpoolTimer(m_ptpTimer, &expiration, 0, 0);
+                return;
+            }
+
+            // We are late! The deadlines up to now are missed
+            if (m_catchUp.m_policy == TimerCatchUpPolicy::Burst && burst < m_catchUp.m_limit)
+            {
+                // Run the next period immediately, the following missed deadlines are counted as they are reached
+                m_statistics.m_missedPeriods += 1;
+                m_statistics.m_lateness.Add(-remainingTime / 10);
+                periodsToRun = 1;
+                continue;
+            }
+
+            // Move to the first deadline still ahead
+            const long long missed = 1 + -remainingTime / m_period;
+            m_statistics.m_missedPeriods += missed;
+            m_timerExpiration += missed * m_period;
+            if (m_catchUp.m_policy == TimerCatchUpPolicy::Spread)
+            {
+                m_backlog += missed;
+                m_backlogPerPeriod = (m_backlog + m_catchUp.m_limit - 1) / m_catchUp.m_limit;
+            }
+            else
+            {
+                m_statistics.m_skippedPeriods += missed;
+            }
+
+            FILETIME expiration = ConvertHundredNsToRelativeFiletime(m_timerExpiration - SnapSystemTimeInHundredNs());
+            SetThreadpoolTimer(m_ptpTimer, &expiration, 0, 0);
             return;
         }
+    }
 
-        m_timerExpiration += m_period;
-        const long long remainingTime = max(0, m_timerExpiration - SnapSystemTimeInHundredNs());
-
-        // We are late! Call the next callback immediately
-        if (remainingTime <= 0)
+    void InvokeCallback() noexcept
+    {
+        try
         {
-            TimerCallback(nullptr, this, nullptr);
+            m_callback();
+            m_statistics.m_callbacks += 1;
         }
-        else
+        catch (...)
         {
-            FILETIME expiration = ConvertHundredNsToRelativeFiletime(remainingTime);
-            SetThreadpoolTimer(m_ptpTimer, &expiration, 0, 0);
+            // immediately break if we catch an exception
+            FAIL_FAST_MSG("exception raised in timer callback routine");
         }
     }
 
@@ -90,24 +221,27 @@ private:
             return;
         }
 
-        try
-        {
-            self->m_callback();
-        }
-        catch (...)
-        {
-            // immediately break if we catch an exception
-            FAIL_FAST_MSG("exception raised in timer callback routine");
-        }
+        // The next period is scheduled manually to ensure the callbacks run sequentially
+        const auto thread = GetCurrentThreadId();
+        self->m_callbackThread = thread;
+        self->RunPeriods();
 
-        // Schedule the next period manually to ensure the callbacks run sequentially
-        self->ScheduleNextPeriod();
+        // The next period may already run on another thread
+        auto running = thread;
+        self->m_callbackThread.compare_exchange_strong(running, 0);
     }
 
     std::atomic_bool m_exiting = false;
+    // The thread running the callback, 0 between the callbacks
+    std::atomic<DWORD> m_callbackThread = 0;
     PTP_TIMER m_ptpTimer = nullptr;
     long long m_timerExpiration{};
     unsigned long m_period = 0;
+    TimerCatchUpSettings m_catchUp{};
+    // The missed periods still to be caught up by the spread policy, and how many are caught up each period
+    long long m_backlog = 0;
+    long long m_backlogPerPeriod = 0;
+    TimerStatistics m_statistics{};
     ThreadpoolTimerCallback m_callback{};
 };
 
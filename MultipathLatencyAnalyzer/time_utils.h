@@ -3,31 +3,242 @@
 
 #pragma once
 
+#include "stamp_packet.h"
+
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <time.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
 
 namespace multipath {
 
+// Off Windows, CLOCK_MONOTONIC stands in for QPC, in nanoseconds
 inline long long SnapQpc() noexcept
 {
+#ifdef _WIN32
     LARGE_INTEGER qpc{};
     QueryPerformanceCounter(&qpc);
 
     return qpc.QuadPart;
+#else
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1'000'000'000LL + now.tv_nsec;
+#endif
 }
 
-inline long long SnapQpcInMicroSec() noexcept
+inline long long GetQpcFrequency() noexcept
 {
+#ifdef _WIN32
     // snap the frequency on first call; C++11 guarantees this is thread-safe
     static const long long c_qpf = []() {
         LARGE_INTEGER qpf;
         QueryPerformanceFrequency(&qpf);
         return qpf.QuadPart;
     }();
+    return c_qpf;
+#else
+    return 1'000'000'000;
+#endif
+}
+
+// Converts the ticks of a counter to nanoseconds with a multiplication and a shift precomputed from its frequency
+// - no 64-bit division per conversion, and no overflow of ticks * 10^9 on long uptimes or high frequency counters
+// - the product is computed by parts, without 128-bit intrinsics, and rounded down
+// - the 32.32 multiplier 10^9 / frequency is truncated: the result is exact only when 10^9 / frequency is (10 MHz,
+//   1 GHz), otherwise it is early by up to ticks * 2^-32 ns, e.g. about 7 ms after a year of a 3 GHz counter
+class TickScale
+{
+public:
+    static constexpr int c_shift = 32;
+
+    TickScale() noexcept = default;
+    explicit TickScale(long long frequency) noexcept :
+        m_multiplier((1'000'000'000ULL << c_shift) / static_cast<unsigned long long>(frequency))
+    {
+    }
+
+    [[nodiscard]] long long ToNanoSec(long long ticks) const noexcept
+    {
+        if (ticks < 0)
+        {
+            return -ToNanoSec(-ticks);
+        }
+
+        // (ticks * multiplier) >> 32, with ticks = high:low and multiplier = multiplierHigh:multiplierLow
+        constexpr unsigned long long lowMask = 0xffff'ffff;
+        const auto value = static_cast<unsigned long long>(ticks);
+        const auto high = value >> c_shift;
+        const auto low = value & lowMask;
+        const auto multiplierHigh = m_multiplier >> c_shift;
+        const auto multiplierLow = m_multiplier & lowMask;
+        return static_cast<long long>(high * m_multiplier + low * multiplierHigh + ((low * multiplierLow) >> c_shift));
+    }
+
+private:
+    // 10^9 / frequency, in 32.32 fixed point
+    unsigned long long m_multiplier = 0;
+};
+
+inline const TickScale& GetQpcScale() noexcept
+{
+    static const TickScale c_scale{GetQpcFrequency()};
+    return c_scale;
+}
+
+inline long long ConvertQpcToNanoSec(long long qpc) noexcept
+{
+    return GetQpcScale().ToNanoSec(qpc);
+}
+
+inline long long ConvertQpcToMicroSec(long long qpc) noexcept
+{
+    // The division by a constant compiles to a multiplication
+    return ConvertQpcToNanoSec(qpc) / 1'000;
+}
+
+inline long long SnapQpcInMicroSec() noexcept
+{
+    return ConvertQpcToMicroSec(SnapQpc());
+}
+
+enum class ClockSource
+{
+    // QueryPerformanceCounter, usually 10 MHz (100 ns resolution)
+    Qpc,
+    // The invariant time stamp counter of x86 processors, calibrated against QPC (sub-nanosecond resolution)
+    Tsc
+};
+
+inline const char* ClockSourceName(ClockSource source) noexcept
+{
+    switch (source)
+    {
+    case ClockSource::Qpc:
+        return "qpc";
+    case ClockSource::Tsc:
+        return "tsc";
+    }
+    return "unknown";
+}
+
+// The monotonic clock of the datagram timestamps, in nanoseconds
+// - on the QPC time base whatever the source: the timestamps taken by the network stack (QPC) can be compared with it
+// - the source must be selected once, before the first timestamp is taken
+class TimestampClock
+{
+public:
+    // Returns false, and keeps QPC, if the processor has no invariant TSC
+    static bool Select(ClockSource source) noexcept
+    {
+        s_useTsc = false;
+        if (source == ClockSource::Tsc)
+        {
+#if defined(_M_X64) || defined(_M_IX86)
+            s_useTsc = CalibrateTsc();
+#endif
+        }
+        return source == ClockSource::Qpc || s_useTsc;
+    }
 
-    // (qpc / qpf) is in seconds
-    return static_cast<long long>(SnapQpc() * 1'000'000LL / c_qpf);
+    [[nodiscard]] static ClockSource Source() noexcept
+    {
+        return s_useTsc ? ClockSource::Tsc : ClockSource::Qpc;
+    }
+
+    // The frequency of the source, in ticks per second
+    [[nodiscard]] static long long Frequency() noexcept
+    {
+        return s_useTsc ? s_tscFrequency : GetQpcFrequency();
+    }
+
+    [[nodiscard]] static long long Now() noexcept
+    {
+#if defined(_M_X64) || defined(_M_IX86)
+        if (s_useTsc)
+        {
+            return s_tscOrigin + s_tscScale.ToNanoSec(static_cast<long long>(__rdtsc()) - s_tscOriginTicks);
+        }
+#endif
+        return ConvertQpcToNanoSec(SnapQpc());
+    }
+
+private:
+#if defined(_M_X64) || defined(_M_IX86)
+    static bool CalibrateTsc() noexcept
+    {
+        // CPUID 0x80000007, EDX bit 8: the TSC runs at a constant rate in all the power states
+        int registers[4]{};
+        __cpuid(registers, 0x80000000);
+        if (static_cast<unsigned int>(registers[0]) < 0x80000007)
+        {
+            return false;
+        }
+        __cpuid(registers, 0x80000007);
+        if ((registers[3] & (1 << 8)) == 0)
+        {
+            return false;
+        }
+
+        // The TSC at a QPC instant: the TSC read the closest before and after QPC, out of a few attempts
+        auto snapPair = [](long long& qpc, long long& tsc) {
+            unsigned long long shortest = ~0ULL;
+            for (int i = 0; i < 8; ++i)
+            {
+                const auto before = __rdtsc();
+                const auto counter = SnapQpc();
+                const auto after = __rdtsc();
+                if (after - before < shortest)
+                {
+                    shortest = after - before;
+                    qpc = counter;
+                    tsc = static_cast<long long>(before + (after - before) / 2);
+                }
+            }
+        };
+
+        long long startQpc = 0;
+        long long startTsc = 0;
+        snapPair(startQpc, startTsc);
+        Sleep(c_calibrationInMs);
+        long long endQpc = 0;
+        long long endTsc = 0;
+        snapPair(endQpc, endTsc);
+        if (endQpc <= startQpc || endTsc <= startTsc)
+        {
+            return false;
+        }
+
+        s_tscFrequency = static_cast<long long>(
+            static_cast<double>(endTsc - startTsc) * static_cast<double>(GetQpcFrequency()) / static_cast<double>(endQpc - startQpc));
+        s_tscScale = TickScale{s_tscFrequency};
+        s_tscOriginTicks = endTsc;
+        s_tscOrigin = ConvertQpcToNanoSec(endQpc);
+        return true;
+    }
+#endif
+
+    // The calibration error is about the QPC resolution over this duration, 1 ppm
+    static constexpr unsigned long c_calibrationInMs = 100;
+
+    static inline bool s_useTsc = false;
+    static inline long long s_tscFrequency = 0;
+    static inline TickScale s_tscScale{};
+    // The TSC value at the QPC instant s_tscOrigin, in nanoseconds
+    static inline long long s_tscOriginTicks = 0;
+    static inline long long s_tscOrigin = 0;
+};
+
+inline long long SnapTimestampInNanoSec() noexcept
+{
+    return TimestampClock::Now();
 }
 
+#ifdef _WIN32
 // Create a negative FILETIME, which for some timer APIs indicate a 'relative' time
 // - e.g. SetThreadpoolTimer, where a negative value indicates the amount of time to wait relative to the current time
 inline FILETIME ConvertHundredNsToRelativeFiletime(long long hundredNanoseconds) noexcept
@@ -56,5 +267,73 @@ inline long long SnapSystemTimeInHundredNs() noexcept
     GetSystemTimeAsFileTime(&filetime);
     return ConvertFiletimeToHundredNs(filetime);
 }
+#endif
+
+// The difference between the wall clock, in nanoseconds since the Unix epoch, and the datagram timestamps
+// - taken once, at the first call, after the clock is selected: the timestamps converted to the wall clock stay
+//   monotonic, and drift from it like the monotonic clock does
+inline long long GetWallClockOffsetInNanoSec() noexcept
+{
+    static const long long c_offset = []() {
+#ifdef _WIN32
+        // FILETIME counts hundreds of nanoseconds since 1601, 11644473600 seconds before the Unix epoch
+        constexpr long long unixEpochInHundredNs = 116'444'736'000'000'000;
+        FILETIME filetime;
+        GetSystemTimePreciseAsFileTime(&filetime);
+        const auto timestamp = SnapTimestampInNanoSec();
+        return (ConvertFiletimeToHundredNs(filetime) - unixEpochInHundredNs) * 100 - timestamp;
+#else
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        const auto timestamp = SnapTimestampInNanoSec();
+        return now.tv_sec * 1'000'000'000LL + now.tv_nsec - timestamp;
+#endif
+    }();
+    return c_offset;
+}
+
+inline long long ConvertTimestampToUnixNanoSec(long long timestampInNanoSec) noexcept
+{
+    return timestampInNanoSec + GetWallClockOffsetInNanoSec();
+}
+
+inline long long ConvertUnixNanoSecToTimestamp(long long unixNanoSec) noexcept
+{
+    return unixNanoSec - GetWallClockOffsetInNanoSec();
+}
+
+// The NTP timestamps of the STAMP packets, from and to the clock of the datagram timestamps
+inline uint64_t ConvertTimestampToNtp(long long timestampInNanoSec) noexcept
+{
+    return ConvertUnixNanoSecToNtp(ConvertTimestampToUnixNanoSec(timestampInNanoSec));
+}
+
+inline long long ConvertNtpToTimestamp(uint64_t ntpTimestamp) noexcept
+{
+    return ConvertUnixNanoSecToTimestamp(ConvertNtpToUnixNanoSec(ntpTimestamp));
+}
+
+// CPU time (user + kernel) consumed by the process so far
+inline long long SnapProcessCpuTimeInHundredNs() noexcept
+{
+#ifdef _WIN32
+    FILETIME creationTime{};
+    FILETIME exitTime{};
+    FILETIME kernelTime{};
+    FILETIME userTime{};
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        return 0;
+    }
+    return ConvertFiletimeToHundredNs(kernelTime) + ConvertFiletimeToHundredNs(userTime);
+#else
+    timespec cpuTime{};
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuTime) != 0)
+    {
+        return 0;
+    }
+    return cpuTime.tv_sec * 10'000'000LL + cpuTime.tv_nsec / 100;
+#endif
+}
 
 } // namespace multipath
\ No newline at end of file
@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "input_file.h"
+
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace multipath::report {
+namespace {
+    // The number of values on the first line, e.g. the column header
+    size_t CountFields(const char* begin, const char* end) noexcept
+    {
+        size_t count = 1;
+        for (auto* current = begin; current < end && *current != '\n'; ++current)
+        {
+            count += *current == ',' ? 1 : 0;
+        }
+        return count;
+    }
+
+    bool IsBinaryDump(std::span<const std::byte> data) noexcept
+    {
+        return data.size() >= 4 && data[0] == std::byte{'M'} && data[1] == std::byte{'L'} && data[2] == std::byte{'A'} &&
+               data[3] == std::byte{'D'};
+    }
+
+    const char* SkipSeparators(const char* current, const char* end) noexcept
+    {
+        while (current < end && (*current == ' ' || *current == ','))
+        {
+            ++current;
+        }
+        return current;
+    }
+} // namespace
+
+InputFile::InputFile(std::filesystem::path path) : m_path(std::move(path)), m_file(m_path)
+{
+    const auto data = m_file.Data();
+    if (IsBinaryDump(data))
+    {
+        m_format = LatencyDumpFormat::Binary;
+        m_binaryReader.emplace(data);
+        m_pathCount = m_binaryReader->Header().m_pathCount;
+        return;
+    }
+
+    m_format = LatencyDumpFormat::Csv;
+    const auto* begin = reinterpret_cast<const char*>(data.data());
+    const auto size = data.size();
+
+    // The columns are deduced from the header: 3 per path, 2 more with the kernel timestamps, 1 more with the
+    // reflector timestamps. Without header, the legacy files have 6 or 10 columns for 2 paths.
+    const auto hasHeader = size > 0 && (begin[0] < '0' || begin[0] > '9');
+    const auto columnCount = size > 0 ? CountFields(begin, begin + size) - 1 : 6;
+    auto kernelTimestamps = columnCount == 10;
+    auto reflectorTimestamps = false;
+    if (hasHeader)
+    {
+        const auto text = std::string_view{begin, size};
+        const auto header = text.substr(0, text.find('\n'));
+        kernelTimestamps = header.find("Kernel") != std::string_view::npos;
+        reflectorTimestamps = header.find("Reflector") != std::string_view::npos;
+        m_csvTimestampScale = header.find("(nanosec)") != std::string_view::npos ? 1 : 1'000;
+    }
+    m_pathCount = columnCount / (3 + (kernelTimestamps ? 2 : 0) + (reflectorTimestamps ? 1 : 0));
+    m_csvLayout = LatencyDumpColumns(m_pathCount, kernelTimestamps, reflectorTimestamps);
+    if (m_pathCount < 1 || m_pathCount > c_maxPathCount || m_csvLayout.size() != columnCount)
+    {
+        throw std::runtime_error("Unexpected columns in " + m_path.string());
+    }
+
+    // Skip the column header
+    size_t offset = 0;
+    if (hasHeader)
+    {
+        while (offset < size && begin[offset] != '\n')
+        {
+            ++offset;
+        }
+        offset += offset < size ? 1 : 0;
+    }
+
+    while (offset < size)
+    {
+        auto end = offset + c_csvChunkSize < size ? offset + c_csvChunkSize : size;
+        while (end < size && begin[end - 1] != '\n')
+        {
+            ++end;
+        }
+        m_csvChunks.emplace_back(offset, end);
+        offset = end;
+    }
+}
+
+void InputFile::DecodeChunk(size_t index, std::vector<LatencyRecord>& records) const
+{
+    if (m_binaryReader)
+    {
+        std::vector<LatencyMeasure> measures;
+        const auto firstSequenceNumber = m_binaryReader->DecodeBlock(index, measures);
+
+        records.resize(measures.size());
+        for (size_t i = 0; i < measures.size(); ++i)
+        {
+            records[i] = {firstSequenceNumber + static_cast<long long>(i), measures[i]};
+        }
+    }
+    else
+    {
+        DecodeCsvChunk(index, records);
+    }
+}
+
+void InputFile::DecodeCsvChunk(size_t index, std::vector<LatencyRecord>& records) const
+{
+    const auto [first, last] = m_csvChunks.at(index);
+    const auto* current = reinterpret_cast<const char*>(m_file.Data().data()) + first;
+    const auto* end = reinterpret_cast<const char*>(m_file.Data().data()) + last;
+
+    records.clear();
+    while (current < end)
+    {
+        // Tolerate empty lines and Windows line endings
+        if (*current == '\n' || *current == '\r')
+        {
+            ++current;
+            continue;
+        }
+
+        LatencyRecord record{};
+        auto result = std::from_chars(current, end, record.m_sequenceNumber);
+        for (const auto& column : m_csvLayout)
+        {
+            if (result.ec != std::errc{})
+            {
+                break;
+            }
+            auto& timestamp = record.m_measure.m_paths[column.m_path].*TimestampMember(column.m_kind);
+            result = std::from_chars(SkipSeparators(result.ptr, end), end, timestamp);
+            timestamp = timestamp < 0 ? timestamp : timestamp * m_csvTimestampScale;
+        }
+        if (result.ec != std::errc{})
+        {
+            throw std::runtime_error(
+                "Invalid line in " + m_path.string() + " at offset " +
+                std::to_string(current - reinterpret_cast<const char*>(m_file.Data().data())));
+        }
+
+        records.push_back(record);
+
+        current = result.ptr;
+        while (current < end && *current != '\n')
+        {
+            ++current;
+        }
+    }
+}
+
+} // namespace multipath::report
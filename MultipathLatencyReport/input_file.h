@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "latencyStatistics.h"
+#include "latency_dump.h"
+
+namespace multipath::report {
+
+struct LatencyRecord
+{
+    long long m_sequenceNumber;
+    LatencyMeasure m_measure;
+};
+
+// A latency dump written by MultipathLatencyAnalyzer, in csv or binary format
+// - the file is memory-mapped and split in chunks, which can be decoded independently and in parallel
+// - the chunks are ordered by sequence number
+class InputFile
+{
+public:
+    // Target size of the csv chunks, they are cut at the end of a line
+    static constexpr size_t c_csvChunkSize = 8 * 1024 * 1024;
+
+    explicit InputFile(std::filesystem::path path);
+
+    [[nodiscard]] const std::filesystem::path& Path() const noexcept
+    {
+        return m_path;
+    }
+
+    [[nodiscard]] LatencyDumpFormat Format() const noexcept
+    {
+        return m_format;
+    }
+
+    // Only binary dumps contain the configuration of the run
+    [[nodiscard]] const LatencyDumpHeader* Header() const noexcept
+    {
+        return m_binaryReader ? &m_binaryReader->Header() : nullptr;
+    }
+
+    [[nodiscard]] size_t PathCount() const noexcept
+    {
+        return m_pathCount;
+    }
+
+    [[nodiscard]] size_t ChunkCount() const noexcept
+    {
+        return m_binaryReader ? m_binaryReader->BlockCount() : m_csvChunks.size();
+    }
+
+    void DecodeChunk(size_t index, std::vector<LatencyRecord>& records) const;
+
+    // Not copyable or movable
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+    InputFile(InputFile&&) = delete;
+    InputFile& operator=(InputFile&&) = delete;
+
+    ~InputFile() = default;
+
+private:
+    void DecodeCsvChunk(size_t index, std::vector<LatencyRecord>& records) const;
+
+    std::filesystem::path m_path;
+    MappedFile m_file;
+    LatencyDumpFormat m_format = LatencyDumpFormat::Csv;
+    std::optional<LatencyBinaryReader> m_binaryReader{};
+    size_t m_pathCount = 2;
+    // The columns of the csv files, after the sequence number
+    std::vector<LatencyDumpColumn> m_csvLayout{};
+    // Converts the csv timestamps to nanoseconds: the files written before the nanosecond clock hold microseconds
+    long long m_csvTimestampScale = 1'000;
+    // Byte ranges [first, second) of the csv chunks
+    std::vector<std::pair<size_t, size_t>> m_csvChunks{};
+};
+
+} // namespace multipath::report
@@ -0,0 +1,364 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "clock_estimator.h"
+#include "input_file.h"
+#include "report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace multipath;
+using namespace multipath::report;
+
+namespace {
+struct Configuration
+{
+    std::vector<std::filesystem::path> m_inputs{};
+    // The output files are written next to the inputs when empty
+    std::filesystem::path m_outputDirectory{};
+    long long m_intervalInNanoSec = 1'000'000'000;
+    int m_histogramDigits = LatencyHistogram::c_defaultSignificantDigits;
+    unsigned int m_threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+void PrintUsage()
+{
+    std::cout << "MultipathLatencyReport analyzes the latency data files written by MultipathLatencyAnalyzer\n"
+                 "\n"
+                 "MultipathLatencyReport.exe [-interval:<Ns,Nms>] [-outdir:<path>] [-histogramdigits:#] [-threads:#] "
+                 "<file> [<file> ...]\n"
+                 "\n"
+                 "For each file, in csv or binary format, the tool prints the same statistics as the client at the end "
+                 "of a run and writes:\n"
+                 "\t- <file>.series.csv: the statistics of each interval of the run, keyed by send time\n"
+                 "\t- <file>.cdf.csv: the latency distribution of each interface\n"
+                 "When several files are given, a comparison of the runs is printed at the end.\n"
+                 "\n"
+                 "-interval:<Ns,Nms>\n"
+                 "\t- the length of the intervals of the time series (default: 1s)\n"
+                 "-outdir:<path>\n"
+                 "\t- the directory where the output files are written (default: next to each input file)\n"
+                 "-histogramdigits:<1-5>\n"
+                 "\t- the number of significant digits of the reported latencies (default: 3)\n"
+                 "-threads:#\n"
+                 "\t- the number of worker threads (default: the number of processors)\n"
+                 "-help\n"
+                 "\t- prints this usage information\n";
+}
+
+long long ParseInteger(std::string_view value, std::string_view option)
+{
+    long long result = 0;
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc{} || ptr != value.data() + value.size())
+    {
+        throw std::invalid_argument("invalid value for " + std::string(option));
+    }
+    return result;
+}
+
+std::optional<std::string_view> ParseArgument(std::string_view arg, std::string_view option)
+{
+    if (arg.size() > option.size() && arg.starts_with(option) && arg[option.size()] == ':')
+    {
+        return arg.substr(option.size() + 1);
+    }
+    return std::nullopt;
+}
+
+Configuration ParseArguments(int argc, char** argv)
+{
+    Configuration config;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (auto value = ParseArgument(arg, "-interval"))
+        {
+            long long multiplier = 1'000'000'000;
+            if (value->ends_with("ms"))
+            {
+                multiplier = 1'000'000;
+                value->remove_suffix(2);
+            }
+            else if (value->ends_with("s"))
+            {
+                value->remove_suffix(1);
+            }
+            config.m_intervalInNanoSec = ParseInteger(*value, "-interval") * multiplier;
+            if (config.m_intervalInNanoSec <= 0)
+            {
+                throw std::invalid_argument("-interval must be positive");
+            }
+        }
+        else if (auto outputDirectory = ParseArgument(arg, "-outdir"))
+        {
+            config.m_outputDirectory = *outputDirectory;
+        }
+        else if (auto digits = ParseArgument(arg, "-histogramdigits"))
+        {
+            config.m_histogramDigits = static_cast<int>(ParseInteger(*digits, "-histogramdigits"));
+            if (config.m_histogramDigits < 1 || config.m_histogramDigits > 5)
+            {
+                throw std::invalid_argument("-histogramdigits must be between 1 and 5");
+            }
+        }
+        else if (auto threads = ParseArgument(arg, "-threads"))
+        {
+            const auto count = ParseInteger(*threads, "-threads");
+            if (count < 1 || count > 1024)
+            {
+                throw std::invalid_argument("-threads must be between 1 and 1024");
+            }
+            config.m_threads = static_cast<unsigned int>(count);
+        }
+        else if (arg.starts_with('-'))
+        {
+            throw std::invalid_argument("unknown option " + std::string(arg));
+        }
+        else
+        {
+            config.m_inputs.emplace_back(arg);
+        }
+    }
+
+    if (config.m_inputs.empty())
+    {
+        throw std::invalid_argument("no input file");
+    }
+    return config;
+}
+
+std::filesystem::path OutputPath(const Configuration& config, const std::filesystem::path& input, std::string_view suffix)
+{
+    auto name = input.filename();
+    name += suffix;
+    return config.m_outputDirectory.empty() ? input.parent_path() / name : config.m_outputDirectory / name;
+}
+
+// The state of the analysis of one input file, shared by the workers
+struct Run
+{
+    Run(std::filesystem::path path, int significantDigits) : m_result(std::move(path), significantDigits)
+    {
+    }
+
+    std::unique_ptr<InputFile> m_input{};
+    std::mutex m_lock{};
+    // The server clock is estimated from the whole file before the one-way delays are accumulated
+    ClockEstimator m_clock{};
+    RunResult m_result;
+};
+
+// A unit of work: the time series of a whole file, which must be built sequentially,
+// or the clock samples or the totals of one chunk of a file, which are merged in the result of the file
+struct Task
+{
+    Run* m_run = nullptr;
+    // The time series task when empty
+    std::optional<size_t> m_chunk{};
+    bool m_clockEstimation = false;
+};
+
+void RecordError(Run& run, const std::exception& ex)
+{
+    const std::scoped_lock lock(run.m_lock);
+    if (run.m_result.m_error.empty())
+    {
+        run.m_result.m_error = ex.what();
+    }
+}
+
+void RunTask(const Configuration& config, const Task& task, std::vector<LatencyRecord>& records)
+{
+    auto& run = *task.m_run;
+    try
+    {
+        if (task.m_clockEstimation)
+        {
+            ClockEstimator clock;
+            run.m_input->DecodeChunk(*task.m_chunk, records);
+            for (const auto& record : records)
+            {
+                clock.AddSamples(record.m_measure, run.m_input->PathCount());
+            }
+
+            const std::scoped_lock lock(run.m_lock);
+            run.m_clock.Merge(clock);
+        }
+        else if (task.m_chunk)
+        {
+            // The clock model is set once all the clock samples are merged
+            LatencyData data(run.m_input->PathCount(), config.m_histogramDigits);
+            data.m_clock = run.m_result.m_data.m_clock;
+            run.m_input->DecodeChunk(*task.m_chunk, records);
+            for (const auto& record : records)
+            {
+                data.Add(record.m_measure);
+            }
+
+            const std::scoped_lock lock(run.m_lock);
+            run.m_result.m_data.Merge(data);
+        }
+        else
+        {
+            IntervalSeriesWriter series(
+                OutputPath(config, run.m_result.m_path, ".series.csv"),
+                config.m_intervalInNanoSec,
+                config.m_histogramDigits,
+                run.m_input->PathCount());
+            for (size_t chunk = 0; chunk < run.m_input->ChunkCount(); ++chunk)
+            {
+                run.m_input->DecodeChunk(chunk, records);
+                for (const auto& record : records)
+                {
+                    series.Add(record.m_measure);
+                }
+            }
+            series.Flush();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        RecordError(run, ex);
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "-help" || arg == "-?")
+        {
+            PrintUsage();
+            return 0;
+        }
+    }
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    const auto config = ParseArguments(argc, argv);
+    if (!config.m_outputDirectory.empty())
+    {
+        std::filesystem::create_directories(config.m_outputDirectory);
+    }
+
+    // Open all the files first, to split them in tasks
+    std::vector<std::unique_ptr<Run>> runs;
+    std::vector<Task> clockTasks;
+    std::vector<Task> tasks;
+    for (const auto& input : config.m_inputs)
+    {
+        auto& run = *runs.emplace_back(std::make_unique<Run>(input, config.m_histogramDigits));
+        try
+        {
+            run.m_input = std::make_unique<InputFile>(input);
+        }
+        catch (const std::exception& ex)
+        {
+            run.m_result.m_error = ex.what();
+            continue;
+        }
+
+        run.m_result.m_data = LatencyData(run.m_input->PathCount(), config.m_histogramDigits);
+        if (const auto* header = run.m_input->Header())
+        {
+            run.m_result.m_hasHeader = true;
+            run.m_result.m_header = *header;
+            run.m_result.m_data.m_datagramSize = header->m_datagramSize;
+        }
+
+        // The sequential time series first, as it is the longest task of each file
+        tasks.push_back({&run, std::nullopt});
+        for (size_t chunk = 0; chunk < run.m_input->ChunkCount(); ++chunk)
+        {
+            clockTasks.push_back({&run, chunk, true});
+            tasks.push_back({&run, chunk});
+        }
+    }
+
+    const auto runTasks = [&](const std::vector<Task>& taskList) {
+        std::atomic<size_t> nextTask{0};
+        const auto worker = [&] {
+            std::vector<LatencyRecord> records;
+            for (auto index = nextTask++; index < taskList.size(); index = nextTask++)
+            {
+                RunTask(config, taskList[index], records);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        const auto workerCount = std::min<size_t>(config.m_threads, std::max<size_t>(1, taskList.size()));
+        for (size_t i = 1; i < workerCount; ++i)
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers)
+        {
+            thread.join();
+        }
+    };
+
+    // The one-way delays need the clock model of the whole file, the files are read a second time to accumulate them
+    runTasks(clockTasks);
+    for (auto& run : runs)
+    {
+        run->m_result.m_data.m_clock = run->m_clock.Estimate();
+    }
+    runTasks(tasks);
+
+    // The distributions are only complete once all the chunks are merged
+    std::vector<const RunResult*> succeeded;
+    int failed = 0;
+    for (auto& run : runs)
+    {
+        auto& result = run->m_result;
+        if (result.m_error.empty())
+        {
+            try
+            {
+                WriteCdf(OutputPath(config, result.m_path, ".cdf.csv"), result.m_data);
+            }
+            catch (const std::exception& ex)
+            {
+                result.m_error = ex.what();
+            }
+        }
+
+        PrintRun(result);
+        if (result.m_error.empty())
+        {
+            succeeded.push_back(&result);
+        }
+        else
+        {
+            failed += 1;
+        }
+    }
+
+    PrintComparison(succeeded);
+    return failed == 0 ? 0 : 1;
+}
+catch (const std::exception& ex)
+{
+    std::cerr << "Error: " << ex.what() << "\n\n";
+    PrintUsage();
+    return 1;
+}
@@ -0,0 +1,273 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "report.h"
+#include "path_scheduler.h"
+
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace multipath::report {
+namespace {
+    // The percentiles written in the CDF files
+    constexpr double c_cdfPercentiles[] = {0.,   1.,   5.,   10.,  20.,   25.,    30.,     40.,  50.,
+                                           60.,  70.,  75.,  80.,  90.,   95.,    99.,     99.5, 99.9,
+                                           99.95, 99.99, 99.995, 99.999, 100.};
+
+    // e.g. "Secondary"
+    std::string ColumnName(std::string name)
+    {
+        if (!name.empty() && name[0] >= 'a' && name[0] <= 'z')
+        {
+            name[0] = static_cast<char>(name[0] - 'a' + 'A');
+        }
+        return name;
+    }
+
+    // The latencies are written in microseconds, with the nanoseconds as decimals
+    double ConvertNanosToMicros(long long nanos) noexcept
+    {
+        return static_cast<double>(nanos) / 1'000.;
+    }
+
+    void WriteAggregate(std::ostream& out, const LatencyAggregate& aggregate)
+    {
+        out << ',' << aggregate.Sent() << ',' << aggregate.Received() << ',' << aggregate.Lost();
+        if (aggregate.Received() > 0)
+        {
+            out << ',' << ConvertNanosToMicros(aggregate.Percentile(50.)) << ','
+                << ConvertNanosToMicros(aggregate.Percentile(99.)) << ',' << ConvertNanosToMicros(aggregate.Max());
+        }
+        else
+        {
+            out << ",,,";
+        }
+    }
+
+    double LossRate(const LatencyAggregate& aggregate) noexcept
+    {
+        return aggregate.Sent() > 0 ? 100. * static_cast<double>(aggregate.Lost()) / static_cast<double>(aggregate.Sent()) : 0.;
+    }
+} // namespace
+
+IntervalSeriesWriter::IntervalSeriesWriter(
+    const std::filesystem::path& path, long long intervalInNanoSec, int significantDigits, size_t pathCount) :
+    m_file(path, std::ios::out | std::ios::trunc),
+    m_intervalInNanoSec(intervalInNanoSec),
+    m_significantDigits(significantDigits),
+    m_pathCount(pathCount),
+    m_current(pathCount, significantDigits)
+{
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to create " + path.string());
+    }
+
+    m_file << "Interval start (sec)";
+    std::vector<std::string> names;
+    for (const auto& data : m_current.m_paths)
+    {
+        names.push_back(ColumnName(data.m_name));
+    }
+    names.emplace_back("Effective");
+    for (const auto& name : names)
+    {
+        m_file << ", " << name << " sent, " << name << " received, " << name << " lost, " << name
+               << " p50 (microsec), " << name << " p99 (microsec), " << name << " max (microsec)";
+    }
+    // The primary path is the reference
+    for (size_t i = 1; i < m_pathCount; ++i)
+    {
+        m_file << ", Received first on " << m_current.m_paths[i].m_name;
+    }
+    m_file << '\n';
+}
+
+void IntervalSeriesWriter::Add(const LatencyMeasure& measure)
+{
+    const auto sendTimestamp = measure.FirstSend(AllPaths(m_pathCount));
+    if (sendTimestamp < 0)
+    {
+        return;
+    }
+    if (m_origin < 0)
+    {
+        m_origin = sendTimestamp;
+    }
+
+    // Datagrams sent slightly out of order (e.g. on the other path) are kept in the current interval
+    const auto index = (sendTimestamp - m_origin) / m_intervalInNanoSec;
+    while (m_currentIndex < index)
+    {
+        WriteRow();
+        m_currentIndex += 1;
+    }
+
+    m_current.Add(measure);
+}
+
+void IntervalSeriesWriter::Flush()
+{
+    if (m_origin >= 0)
+    {
+        WriteRow();
+    }
+    m_file.flush();
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to write the interval series");
+    }
+}
+
+void IntervalSeriesWriter::WriteRow()
+{
+    m_file << std::fixed << std::setprecision(3)
+           << static_cast<double>(m_currentIndex * m_intervalInNanoSec) / 1'000'000'000.;
+    for (const auto& data : m_current.m_paths)
+    {
+        WriteAggregate(m_file, data.m_latency);
+    }
+    WriteAggregate(m_file, m_current.Effective());
+    for (size_t i = 1; i < m_pathCount; ++i)
+    {
+        m_file << ',' << m_current.m_combinations.front().m_receivedFirst[i];
+    }
+    m_file << '\n';
+
+    // Intervals without any datagram are written as empty rows, to keep a regular time axis
+    if (m_current.Effective().Sent() > 0)
+    {
+        m_current = LatencyData(m_pathCount, m_significantDigits);
+    }
+}
+
+void WriteCdf(const std::filesystem::path& path, const LatencyData& data)
+{
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to create " + path.string());
+    }
+
+    std::vector<const LatencyAggregate*> aggregates;
+    file << "Percentile";
+    for (const auto& path : data.m_paths)
+    {
+        file << ", " << ColumnName(path.m_name) << " (microsec)";
+        aggregates.push_back(&path.m_latency);
+    }
+    file << ", Effective (microsec)\n";
+    aggregates.push_back(&data.Effective());
+
+    file << std::fixed << std::setprecision(3);
+    for (const auto percentile : c_cdfPercentiles)
+    {
+        file << percentile;
+        for (const auto* aggregate : aggregates)
+        {
+            file << ',';
+            if (aggregate->Received() > 0)
+            {
+                file << ConvertNanosToMicros(aggregate->Percentile(percentile));
+            }
+        }
+        file << '\n';
+    }
+
+    file.flush();
+    if (!file)
+    {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+}
+
+void PrintRun(const RunResult& run)
+{
+    std::cout << "\n=== " << run.m_path.string() << " ===\n";
+    if (!run.m_error.empty())
+    {
+        std::cout << "Error: " << run.m_error << '\n';
+        return;
+    }
+
+    if (run.m_hasHeader)
+    {
+        const auto& header = run.m_header;
+        std::cout << "Bitrate: " << header.m_bitrate << " bps, Datagram size: " << header.m_datagramSize
+                  << " bytes, Grouping: " << header.m_grouping << '\n';
+        std::cout << "Duration: ";
+        if (header.m_duration > 0)
+        {
+            std::cout << header.m_duration << " sec";
+        }
+        else
+        {
+            std::cout << "until stopped";
+        }
+        std::cout << ", Loss timeout: " << header.m_lossTimeout << " ms\n";
+        std::cout << "Secondary interface: "
+                  << ((header.m_flags & LatencyDumpHeader::c_flagSecondaryInterface) ? "yes" : "no")
+                  << ", Batch send: " << ((header.m_flags & LatencyDumpHeader::c_flagBatchSend) ? "yes" : "no")
+                  << ", Pacing: " << ((header.m_flags & LatencyDumpHeader::c_flagPrecisePacing) ? "precise" : "timer")
+                  << ", Paths: " << header.m_pathCount
+                  << ", Scheduler: " << SchedulingPolicyName(static_cast<SchedulingPolicy>(header.m_scheduler))
+                  << ", Direction: " << ((header.m_flags & LatencyDumpHeader::c_flagDownlink) ? "downlink" : "round trip") << '\n';
+        if (header.m_startTime > 0)
+        {
+            std::cout << "Started at: " << header.m_startTime
+                      << " (Unix time)\n";
+        }
+    }
+
+    PrintLatencyStatistics(run.m_data);
+}
+
+void PrintComparison(const std::vector<const RunResult*>& runs)
+{
+    if (runs.size() < 2)
+    {
+        return;
+    }
+
+    std::cout << '\n';
+    std::cout << "-----------------------------------------------------------------------\n";
+    std::cout << "                            COMPARISON                                 \n";
+    std::cout << "-----------------------------------------------------------------------\n";
+    std::cout << "Effective latencies in ms, differences relative to the first run\n";
+    std::cout << "Copies: the datagrams sent on all the paths for each datagram, the cost of the scheduling policy\n\n";
+
+    const auto& reference = runs.front()->m_data.Effective();
+    std::cout << std::left << std::setw(40) << "Run" << std::right << std::setw(12) << "Sent" << std::setw(10)
+              << "Copies" << std::setw(10) << "Lost %" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+              << std::setw(12) << "d p50" << std::setw(12) << "d p99" << '\n';
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto* run : runs)
+    {
+        const auto& effective = run->m_data.Effective();
+        long long copies = 0;
+        for (const auto& path : run->m_data.m_paths)
+        {
+            copies += path.m_latency.Sent();
+        }
+        auto name = run->m_path.filename().string();
+        if (name.size() > 39)
+        {
+            name = name.substr(0, 36) + "...";
+        }
+
+        std::cout << std::left << std::setw(40) << name << std::right << std::setw(12) << effective.Sent()
+                  << std::setw(10) << (effective.Sent() > 0 ? static_cast<double>(copies) / effective.Sent() : 0.)
+                  << std::setw(10) << LossRate(effective) << std::setw(10) << effective.Percentile(50.) / 1'000'000.
+                  << std::setw(10) << effective.Percentile(99.) / 1'000'000. << std::setw(10)
+                  << effective.Percentile(99.9) / 1'000'000. << std::setw(12)
+                  << static_cast<double>(effective.Percentile(50.) - reference.Percentile(50.)) / 1'000'000.
+                  << std::setw(12)
+                  << static_cast<double>(effective.Percentile(99.) - reference.Percentile(99.)) / 1'000'000. << '\n';
+    }
+}
+
+} // namespace multipath::report
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "input_file.h"
+#include "latencyStatistics.h"
+
+namespace multipath::report {
+
+// Splits a run in consecutive intervals, keyed by the time at which each datagram was first sent
+// - the records must be added in sequence number order, i.e. approximately in send order
+// - only the current interval is kept in memory, the completed ones are written immediately
+class IntervalSeriesWriter
+{
+public:
+    IntervalSeriesWriter(
+        const std::filesystem::path& path, long long intervalInNanoSec, int significantDigits, size_t pathCount);
+
+    void Add(const LatencyMeasure& measure);
+    void Flush();
+
+    IntervalSeriesWriter(const IntervalSeriesWriter&) = delete;
+    IntervalSeriesWriter& operator=(const IntervalSeriesWriter&) = delete;
+    IntervalSeriesWriter(IntervalSeriesWriter&&) = delete;
+    IntervalSeriesWriter& operator=(IntervalSeriesWriter&&) = delete;
+    ~IntervalSeriesWriter() = default;
+
+private:
+    void WriteRow();
+
+    std::ofstream m_file;
+    long long m_intervalInNanoSec;
+    int m_significantDigits;
+    size_t m_pathCount;
+    long long m_origin = -1;
+    long long m_currentIndex = 0;
+    LatencyData m_current;
+};
+
+// Writes the latency distribution of each path, as a percentile grid
+void WriteCdf(const std::filesystem::path& path, const LatencyData& data);
+
+// The result of the analysis of one run
+struct RunResult
+{
+    explicit RunResult(std::filesystem::path path, int significantDigits) :
+        m_path(std::move(path)), m_data(2, significantDigits)
+    {
+    }
+
+    std::filesystem::path m_path;
+    LatencyData m_data;
+    bool m_hasHeader = false;
+    LatencyDumpHeader m_header{};
+    // Empty if the analysis succeeded
+    std::string m_error{};
+};
+
+// Prints the configuration and the statistics of a run, in the same format as MultipathLatencyAnalyzer
+void PrintRun(const RunResult& run);
+
+// Prints a summary of each run side by side, with the difference from the first one
+void PrintComparison(const std::vector<const RunResult*>& runs);
+
+} // namespace multipath::report